@@ -85,11 +85,20 @@ static void usage()
   printf("  --refresh n: The refresh period, in ms. Forcing the refresh period is not recommended.\n");
   printf("  --btstack: use btstack for the bluetooth connection.\n");
   printf("    Btstack is the only available connection method on Windows, and an alternative connection method on Linux.\n");
+  printf("  --btstack-socket path: use btstack, and connect to its daemon through a unix socket instead of TCP (Linux only, ex: /tmp/BTstack).\n");
   printf("  --log filename: write messages into a log file instead of the standard output.\n");
   printf("    filename: The name of the log file, in the ~/.gimx/log directory (make sure this folder exists).\n");
   printf("  --skip_leds: Filter out set led commands from FFB command stream (performance tweak for G27/G29 wheels on small targets).\n");
   printf("  --ff_conv: Force OS translation for FFB commands on Windows.\n");
   printf("  --timeout value: Exit if controllers are inactive during a given number of minutes.\n");
+  printf("  --haptic-period n: The minimum period between two output reports sent to a gamepad, in ms (ex: 8 for the DS4).\n");
+  printf("  --usb-queue-depth n: The number of interrupt IN transfers in flight for pass-through devices (1 to %d, default: 1).\n", MAX_USB_QUEUE_DEPTH);
+  printf("  --serial-frames: Send a single frame per refresh period to the GIMX adapter, if the firmware supports it.\n");
+  printf("  --hci-user: Take exclusive control of the Bluetooth dongles through HCI user channels, and bypass the kernel l2cap layer (Linux only, the bluetooth service has to be stopped).\n");
+  printf("  --bt-link-tuning: Set a flush timeout, disable sniff mode and request a minimum poll interval on Bluetooth interrupt channels (Linux only).\n");
+  printf("    The configured values are logged, not the resulting latency. The main loop blocks while each channel is tuned, up to 1.2s if the dongle does not answer.\n");
+  printf("  --bt-report-rate n: The rate of the reports sent to the PS4 over Bluetooth, in Hz (ex: 250, 500 or 1000, default: the refresh rate).\n");
+  printf("  --gpp-keepalive n: The period at which unchanged outputs are sent to a GPP/Cronus/Titan device, in ms (0 to %d, 0 to always send, default: %d).\n", MAX_GPP_KEEPALIVE / 1000, DEFAULT_GPP_KEEPALIVE / 1000);
 
   printf("  --show-debug-flags: Show all available debug flags.\n");
 
@@ -193,6 +202,9 @@ int args_read(int argc, char *argv[], s_gimx_params* params)
     {"ff_conv",          no_argument, &params->ff_conv,           1},
     {"auto-grab",        no_argument, &params->autograb,          1},
     {"proxy",            no_argument, &proxy,                     1},
+    {"serial-frames",    no_argument, &params->serial_frames,     1},
+    {"bt-link-tuning",   no_argument, &params->bt_link_tuning,    1},
+    {"hci-user",         no_argument, &params->hci_user,          1},
     /* These options don't set a flag. We distinguish them by their indices. */
     {"bdaddr",  required_argument, 0, 'b'},
     {"config",  required_argument, 0, 'c'},
@@ -204,6 +216,11 @@ int args_read(int argc, char *argv[], s_gimx_params* params)
     {"log",     required_argument, 0, 'l'},
     {"port",    required_argument, 0, 'p'},
     {"timeout", required_argument, 0, 'q'},
+    {"haptic-period", required_argument, 0, 'f'},
+    {"usb-queue-depth", required_argument, 0, 'u'},
+    {"gpp-keepalive", required_argument, 0, 'g'},
+    {"bt-report-rate", required_argument, 0, 'w'},
+    {"btstack-socket", required_argument, 0, 'o'},
     {"refresh", required_argument, 0, 'r'},
     {"src",     required_argument, 0, 's'},
     {"type",    required_argument, 0, 't'},
@@ -400,6 +417,68 @@ int args_read(int argc, char *argv[], s_gimx_params* params)
         printf(_("global option -q with value `%s'\n"), optarg);
         break;
 
+      case 'f':
+        params->haptic_period = atof(optarg) * 1000;
+        if(params->haptic_period)
+        {
+          printf(_("global option --haptic-period with value `%s'\n"), optarg);
+        }
+        else
+        {
+          gerror("Bad haptic period: %s\n", optarg);
+          ret = -1;
+        }
+        break;
+
+      case 'u':
+        params->usb_queue_depth = atoi(optarg);
+        if(params->usb_queue_depth >= 1 && params->usb_queue_depth <= MAX_USB_QUEUE_DEPTH)
+        {
+          printf(_("global option --usb-queue-depth with value `%s'\n"), optarg);
+        }
+        else
+        {
+          gerror("Bad USB queue depth: %s\n", optarg);
+          ret = -1;
+        }
+        break;
+
+      case 'g':
+      {
+        char * end;
+        double keepalive = strtod(optarg, &end);
+        if(end != optarg && *end == '\0' && keepalive >= 0 && keepalive <= MAX_GPP_KEEPALIVE / 1000)
+        {
+          params->gpp_keepalive = keepalive * 1000;
+          printf(_("global option --gpp-keepalive with value `%s'\n"), optarg);
+        }
+        else
+        {
+          gerror("Bad GPP keepalive: %s\n", optarg);
+          ret = -1;
+        }
+        break;
+      }
+
+      case 'w':
+        params->bt_report_rate = atoi(optarg);
+        if(params->bt_report_rate > 0 && params->bt_report_rate <= 1000)
+        {
+          printf(_("global option --bt-report-rate with value `%s'\n"), optarg);
+        }
+        else
+        {
+          gerror("Bad Bluetooth report rate: %s\n", optarg);
+          ret = -1;
+        }
+        break;
+
+      case 'o':
+        params->btstack_socket = optarg;
+        params->btstack = 1;
+        printf(_("global option --btstack-socket with value `%s'\n"), optarg);
+        break;
+
       case 'r':
         params->refresh_period = atof(optarg) * 1000;
         if(params->refresh_period)
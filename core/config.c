@@ -319,7 +319,13 @@ int cfg_add_binding(s_config_entry* entry)
   return ret;
 }
 
-#define JOYSTICK_RUMBLE_REFRESH_PERIOD 20000
+/*
+ * Rumble updates are forwarded at most once per period, for each joystick.
+ * ginput_joystick_set_haptic() only queues the output transfer, so its duration can't tell
+ * how fast a joystick takes the updates: the period is fixed, and matches the default
+ * period of the DS4 haptic sink (--haptic-period).
+ */
+#define JOYSTICK_RUMBLE_PERIOD 8000 // us
 
 static struct
 {
@@ -327,44 +333,89 @@ static struct
   unsigned short strong;
   unsigned char updated; //an update has been received
   unsigned char active; //the rumble is active
-  int elapsed; //the time elapsed since the last GE_JoystickSetRumble() call
+  gtime deadline; //the earliest time for the next ginput_joystick_set_haptic() call
 } joystick_rumble[MAX_DEVICES] = {};
 
+/*
+ * The joysticks having a pending update, sorted by deadline.
+ */
+static struct
+{
+  unsigned char ids[MAX_DEVICES];
+  unsigned int nb;
+} rumble_queue = {};
+
+static void rumble_queue_insert(int id)
+{
+  unsigned int i = rumble_queue.nb;
+  while (i > 0 && joystick_rumble[rumble_queue.ids[i - 1]].deadline > joystick_rumble[id].deadline)
+  {
+    rumble_queue.ids[i] = rumble_queue.ids[i - 1];
+    --i;
+  }
+  rumble_queue.ids[i] = id;
+  ++rumble_queue.nb;
+}
+
 void cfg_process_rumble_event(GE_Event* event)
 {
-  joystick_rumble[event->jrumble.which].weak = event->jrumble.weak;
-  joystick_rumble[event->jrumble.which].strong = event->jrumble.strong;
-  joystick_rumble[event->jrumble.which].updated = 1;
+  int id = event->jrumble.which;
+
+  if (id < 0 || id >= MAX_DEVICES)
+  {
+    return;
+  }
+
+  joystick_rumble[id].weak = event->jrumble.weak;
+  joystick_rumble[id].strong = event->jrumble.strong;
+
+  if (!joystick_rumble[id].updated)
+  {
+    joystick_rumble[id].updated = 1;
+    rumble_queue_insert(id);
+  }
 }
 
 void cfg_process_rumble()
 {
-  int i;
-  for (i = 0; i < MAX_DEVICES; ++i)
+  if (rumble_queue.nb == 0)
   {
-    joystick_rumble[i].elapsed += gimx_params.refresh_period;
+    return;
+  }
 
-    if(joystick_rumble[i].updated && joystick_rumble[i].elapsed >= JOYSTICK_RUMBLE_REFRESH_PERIOD)
-    {
-      unsigned short weak = joystick_rumble[i].weak;
-      unsigned short strong = joystick_rumble[i].strong;
+  gtime now = gtime_gettime();
+
+  unsigned int i;
+  for (i = 0; i < rumble_queue.nb; ++i)
+  {
+    int id = rumble_queue.ids[i];
 
-      unsigned char active = weak || strong;
+    if (joystick_rumble[id].deadline > now)
+    {
+      break; // next deadlines are later
+    }
 
-      if(joystick_rumble[i].active || active)
-      {
-        GE_Event haptic = { .jrumble = { .type = GE_JOYRUMBLE, .which = i, .weak = weak, .strong = strong } };
-        ginput_joystick_set_haptic(&haptic);
-      }
+    unsigned short weak = joystick_rumble[id].weak;
+    unsigned short strong = joystick_rumble[id].strong;
 
-      joystick_rumble[i].active = active;
+    unsigned char active = weak || strong;
 
-      joystick_rumble[i].weak = 0;
-      joystick_rumble[i].strong = 0;
-      joystick_rumble[i].updated = 0;
-      joystick_rumble[i].elapsed = 0;
+    if(joystick_rumble[id].active || active)
+    {
+      GE_Event haptic = { .jrumble = { .type = GE_JOYRUMBLE, .which = id, .weak = weak, .strong = strong } };
+      ginput_joystick_set_haptic(&haptic);
     }
+
+    joystick_rumble[id].active = active;
+
+    joystick_rumble[id].weak = 0;
+    joystick_rumble[id].strong = 0;
+    joystick_rumble[id].updated = 0;
+    joystick_rumble[id].deadline = now + JOYSTICK_RUMBLE_PERIOD * 1000ULL;
   }
+
+  rumble_queue.nb -= i;
+  memmove(rumble_queue.ids, rumble_queue.ids + i, rumble_queue.nb * sizeof(*rumble_queue.ids));
 }
 
 int cfg_is_joystick_used(int id)
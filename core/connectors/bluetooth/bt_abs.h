@@ -11,6 +11,7 @@ typedef enum
   E_BT_ABS_BTSTACK,
 #ifndef WIN32
   E_BT_ABS_BLUEZ,
+  E_BT_ABS_HCIUSER,
 #endif
   E_BT_ABS_MAX,
 } e_bt_abs;
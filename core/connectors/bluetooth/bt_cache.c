@@ -0,0 +1,150 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <connectors/bluetooth/bt_cache.h>
+#include <gimx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include "../../../directories.h"
+
+#define BT_CACHE_FILE "peers"
+#define BT_CACHE_MAX_ENTRIES 16
+
+static void bt_cache_path(const char * local, char * path, size_t size)
+{
+  snprintf(path, size, "%s%s%s%s/%s", gimx_params.homedir, GIMX_DIR, BT_DIR, local, BT_CACHE_FILE);
+}
+
+/*
+ * Read all the entries of a dongle.
+ * Returns the number of entries (0 if there is no cache file).
+ */
+static unsigned int bt_cache_read(const char * local, s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES])
+{
+  char path[PATH_MAX];
+  bt_cache_path(local, path, sizeof(path));
+
+  FILE * file = gfile_fopen(path, "r");
+  if (file == NULL)
+  {
+    return 0;
+  }
+
+  unsigned int nb = 0;
+  char line[LINE_MAX];
+  while (nb < BT_CACHE_MAX_ENTRIES && fgets(line, sizeof(line), file))
+  {
+    s_bt_cache_entry * entry = entries + nb;
+    if (sscanf(line, "%17s %8x", entry->peer, &entry->sdp_crc) == 2)
+    {
+      ++nb;
+    }
+  }
+
+  fclose(file);
+
+  return nb;
+}
+
+static int bt_cache_write(const char * local, const s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES], unsigned int nb)
+{
+  char path[PATH_MAX];
+  bt_cache_path(local, path, sizeof(path));
+
+  FILE * file = gfile_fopen(path, "w");
+  if (file == NULL)
+  {
+    gwarn(_("can't write the bluetooth cache file '%s'\n"), path);
+    return -1;
+  }
+
+  unsigned int i;
+  for (i = 0; i < nb; ++i)
+  {
+    fprintf(file, "%s %08x\n", entries[i].peer, entries[i].sdp_crc);
+  }
+
+  fclose(file);
+
+  return 0;
+}
+
+static int bt_cache_find(const s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES], unsigned int nb, const char * peer)
+{
+  unsigned int i;
+  for (i = 0; i < nb; ++i)
+  {
+    if (!strcasecmp(entries[i].peer, peer))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Look for the entry of a peer.
+ * Returns 0 if found, -1 otherwise.
+ */
+int bt_cache_load(const char * local, const char * peer, s_bt_cache_entry * entry)
+{
+  s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES];
+  unsigned int nb = bt_cache_read(local, entries);
+
+  int index = bt_cache_find(entries, nb, peer);
+  if (index < 0)
+  {
+    return -1;
+  }
+
+  *entry = entries[index];
+
+  return 0;
+}
+
+/*
+ * Add or update the entry of a peer.
+ * The oldest entry is dropped if the cache is full.
+ */
+int bt_cache_store(const char * local, const s_bt_cache_entry * entry)
+{
+  s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES];
+  unsigned int nb = bt_cache_read(local, entries);
+
+  int index = bt_cache_find(entries, nb, entry->peer);
+  if (index < 0)
+  {
+    if (nb == BT_CACHE_MAX_ENTRIES)
+    {
+      memmove(entries, entries + 1, (nb - 1) * sizeof(*entries));
+      --nb;
+    }
+    index = nb++;
+  }
+
+  entries[index] = *entry;
+
+  return bt_cache_write(local, entries, nb);
+}
+
+int bt_cache_invalidate(const char * local, const char * peer)
+{
+  s_bt_cache_entry entries[BT_CACHE_MAX_ENTRIES];
+  unsigned int nb = bt_cache_read(local, entries);
+
+  int index = bt_cache_find(entries, nb, peer);
+  if (index < 0)
+  {
+    return 0;
+  }
+
+  memmove(entries + index, entries + index + 1, (nb - index - 1) * sizeof(*entries));
+  --nb;
+
+  return bt_cache_write(local, entries, nb);
+}
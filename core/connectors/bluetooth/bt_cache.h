@@ -0,0 +1,29 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef BT_CACHE_H_
+#define BT_CACHE_H_
+
+#include <stdint.h>
+
+/*
+ * A small on-disk cache of the peers a Bluetooth dongle successfully connected to,
+ * stored in ~/.gimx/bluetooth/<dongle bdaddr>/peers, next to the link keys.
+ *
+ * Each entry holds a checksum of the SDP requests received from the peer,
+ * so that the entry can be invalidated if the peer behaves differently.
+ */
+
+typedef struct
+{
+  char peer[18];
+  uint32_t sdp_crc;
+} s_bt_cache_entry;
+
+int bt_cache_load(const char * local, const char * peer, s_bt_cache_entry * entry);
+int bt_cache_store(const char * local, const s_bt_cache_entry * entry);
+int bt_cache_invalidate(const char * local, const char * peer);
+
+#endif /* BT_CACHE_H_ */
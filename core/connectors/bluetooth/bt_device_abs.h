@@ -14,11 +14,22 @@
 
 #include <connectors/bluetooth/bt_abs.h>
 
+/*
+ * Called with status 0 once the device layer is ready, or with status -1 if it failed to initialize.
+ */
+typedef void (* BT_DEVICE_INIT_CALLBACK)(void * user, int status);
+
+/*
+ * Called with status 0 and the sampled values, or with status -1 if the link could not be sampled.
+ */
+typedef void (* BT_LINK_QUALITY_CALLBACK)(void * user, int status, int8_t rssi, uint8_t link_quality);
+
 typedef struct
 {
-  int (* init)();
+  int (* init)(BT_DEVICE_INIT_CALLBACK callback, void * user); // the callback may be called before init returns
   int (* get_bdaddr)(int device_number, bdaddr_t * bdaddr);
   int (* write_device_class)(int device_number, uint32_t devclass);
+  int (* read_link_quality)(int device_number, const bdaddr_t * peer, BT_LINK_QUALITY_CALLBACK callback, void * user); // optional, must not block
 } s_bt_device_abs;
 
 void bt_device_abs_register(e_bt_abs index, s_bt_device_abs * value);
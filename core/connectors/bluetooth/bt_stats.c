@@ -0,0 +1,192 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <connectors/bluetooth/bt_stats.h>
+#include <connectors/bluetooth/bt_device_abs.h>
+#include <connectors/bluetooth/l2cap_abs.h>
+#include <gimxtimer/include/gtimer.h>
+#include <gimx.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIDP_INPUT_REPORT 0xa1
+
+#define BT_STATS_SAMPLE_TIMEOUT (3 * BT_STATS_PERIOD) // microseconds, a request without reply is sent again after this delay
+
+/*
+ * The entries are allocated separately, as the l2cap backends keep pointers to them.
+ */
+static struct
+{
+  unsigned int nb;
+  s_bt_stats ** peers;
+  struct gtimer * timer;
+  gtime window_start;
+} stats = { 0 };
+
+static void bt_stats_link_quality_cb(void * user, int status, int8_t rssi, uint8_t link_quality)
+{
+  s_bt_stats * peer = (s_bt_stats *) user;
+
+  peer->sampling = 0;
+  peer->sampled = (status == 0);
+  if (status == 0)
+  {
+    peer->rssi = rssi;
+    peer->link_quality = link_quality;
+  }
+}
+
+static int bt_stats_timer_read(void * user __attribute__((unused)))
+{
+  gtime now = gtime_gettime();
+  gtime elapsed = now - stats.window_start;
+  stats.window_start = now;
+
+  unsigned int i;
+  for (i = 0; i < stats.nb; ++i)
+  {
+    s_bt_stats * peer = stats.peers[i];
+
+    if (elapsed > 0)
+    {
+      peer->rate = (peer->window_reports * 1000000000ULL + elapsed / 2) / elapsed;
+    }
+    peer->window_reports = 0;
+
+    if (bt_device_abs_get()->read_link_quality != NULL
+        && (peer->sampling == 0 || GTIME_USEC(now - peer->sampling) >= BT_STATS_SAMPLE_TIMEOUT))
+    {
+      if (bt_device_abs_get()->read_link_quality(peer->device_number, &peer->ba, bt_stats_link_quality_cb, peer) == 0)
+      {
+        peer->sampling = now;
+      }
+      else
+      {
+        peer->sampling = 0;
+        peer->sampled = 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int bt_stats_timer_close(void * user __attribute__((unused)))
+{
+  stats.timer = NULL;
+  return 1;
+}
+
+static void bt_stats_start_timer()
+{
+  GTIMER_CALLBACKS callbacks = {
+          .fp_read = bt_stats_timer_read,
+          .fp_close = bt_stats_timer_close,
+          .fp_register = REGISTER_FUNCTION,
+          .fp_remove = REMOVE_FUNCTION,
+  };
+  stats.timer = gtimer_start(NULL, BT_STATS_PERIOD, &callbacks);
+  if (stats.timer == NULL)
+  {
+    gwarn("failed to start the bluetooth stats timer\n");
+  }
+  stats.window_start = gtime_gettime();
+}
+
+/*
+ * Get the stats of a peer, creating them if needed.
+ * Returns NULL if the allocation failed.
+ */
+s_bt_stats * bt_stats_get(int device_number, const bdaddr_t * peer)
+{
+  unsigned int i;
+  for (i = 0; i < stats.nb; ++i)
+  {
+    if (!bacmp(&stats.peers[i]->ba, peer))
+    {
+      return stats.peers[i];
+    }
+  }
+
+  s_bt_stats ** peers = realloc(stats.peers, (stats.nb + 1) * sizeof(*peers));
+  if (peers == NULL)
+  {
+    PRINT_ERROR_ALLOC_FAILED("realloc");
+    return NULL;
+  }
+  stats.peers = peers;
+
+  s_bt_stats * entry = calloc(1, sizeof(*entry));
+  if (entry == NULL)
+  {
+    PRINT_ERROR_ALLOC_FAILED("calloc");
+    return NULL;
+  }
+  stats.peers[stats.nb] = entry;
+  bacpy(&entry->ba, peer);
+  ba2str(peer, entry->bdaddr);
+  entry->device_number = device_number;
+  ++stats.nb;
+
+  if (stats.timer == NULL)
+  {
+    bt_stats_start_timer();
+  }
+
+  return entry;
+}
+
+void bt_stats_sent(s_bt_stats * peer, unsigned short psm, const unsigned char * buf, int len)
+{
+  if (len < 0)
+  {
+    ++peer->send_errors;
+    return;
+  }
+
+  ++peer->sent;
+
+  if (psm == PSM_HID_INTERRUPT && len > 0 && buf[0] == HIDP_INPUT_REPORT)
+  {
+    ++peer->reports;
+    ++peer->window_reports;
+  }
+}
+
+unsigned int bt_stats_count()
+{
+  return stats.nb;
+}
+
+const s_bt_stats * bt_stats_peer(unsigned int index)
+{
+  return (index < stats.nb) ? stats.peers[index] : NULL;
+}
+
+/*
+ * Stop sampling, and print the stats of each peer.
+ */
+void bt_stats_clean()
+{
+  if (stats.timer != NULL)
+  {
+    gtimer_close(stats.timer);
+    stats.timer = NULL;
+  }
+
+  unsigned int i;
+  for (i = 0; i < stats.nb; ++i)
+  {
+    const s_bt_stats * peer = stats.peers[i];
+    ginfo(_("Bluetooth peer %s: %u packets sent, %u send errors, %u through the ACL bypass (%u continuation fragments), %u input reports"),
+        peer->bdaddr, peer->sent, peer->send_errors, peer->bypassed, peer->segments, peer->reports);
+    if (peer->sampled)
+    {
+      ginfo(_(", last RSSI: %d dB, link quality: %u/255"), peer->rssi, peer->link_quality);
+    }
+    ginfo("\n");
+  }
+}
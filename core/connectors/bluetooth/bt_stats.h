@@ -0,0 +1,49 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef BT_STATS_H_
+#define BT_STATS_H_
+
+#ifndef WIN32
+#include <bluetooth/bluetooth.h>
+#else
+#include <connectors/bluetooth/windows/bt_bdaddr.h>
+#endif
+
+#include <gimxtime/include/gtime.h>
+
+#define BT_STATS_PERIOD 1000000 // microseconds
+
+/*
+ * Link statistics of a Bluetooth peer.
+ *
+ * The link quality is sampled through the HCI every BT_STATS_PERIOD,
+ * if the Bluetooth backend supports it. The replies are received by the poll loop.
+ */
+typedef struct
+{
+  char bdaddr[18];
+  bdaddr_t ba;
+  int device_number;
+  int sampled; // rssi and link_quality are valid
+  gtime sampling; // when the pending link quality request was sent, 0 if none
+  int8_t rssi; // dB, relative to the golden receive power range
+  uint8_t link_quality; // 0 to 255
+  unsigned int sent;
+  unsigned int send_errors;
+  unsigned int bypassed; // packets sent through the ACL bypass
+  unsigned int segments; // ACL continuation fragments
+  unsigned int reports; // interrupt input reports
+  unsigned int window_reports; // interrupt input reports in the current period
+  unsigned int rate; // interrupt input reports per second, over the last period
+} s_bt_stats;
+
+s_bt_stats * bt_stats_get(int device_number, const bdaddr_t * peer);
+void bt_stats_sent(s_bt_stats * stats, unsigned short psm, const unsigned char * buf, int len);
+unsigned int bt_stats_count();
+const s_bt_stats * bt_stats_peer(unsigned int index);
+void bt_stats_clean();
+
+#endif /* BT_STATS_H_ */
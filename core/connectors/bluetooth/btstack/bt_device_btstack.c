@@ -21,9 +21,9 @@
 
 static recv_data_t recv_data = { {}, 0, 0 };
 
-int bt_device_btstack_device_init()
+int bt_device_btstack_device_init(BT_DEVICE_INIT_CALLBACK callback, void * user)
 {
-  return btstack_common_init();
+  return btstack_common_init(callback, user);
 }
 
 /*
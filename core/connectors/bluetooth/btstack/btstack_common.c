@@ -4,8 +4,12 @@
 */
 
 #include "btstack_common.h"
+#include "btstack_transport.h"
 #include <connectors/tcp_con.h>
+#include <gimx.h>
+#include <gimxpoll/include/gpoll.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #define BTSTACK_TIMEOUT   1 // 1 second
 
@@ -13,6 +17,8 @@
 #define BTSTACK_PORT 13333
 
 static int btstack_fd = -1;
+static int btstack_unix = 0; // connected through a unix socket
+static int btstack_seqpacket = 0; // each packet is a single message
 
 static recv_data_t recv_data = { {}, 0, 0 };
 
@@ -23,17 +29,25 @@ int btstack_common_getfd()
   return btstack_fd;
 }
 
-int btstack_common_init()
+static void btstack_common_close()
 {
-  int ret = 0;
-
-  btstack_fd = tcp_connect(inet_addr(BTSTACK_ADDR), BTSTACK_PORT);
-  if(btstack_fd < 0)
+  if(btstack_unix)
   {
-    return -1;
+    close(btstack_fd);
   }
+  else
+  {
+    tcp_close(btstack_fd);
+  }
+  btstack_fd = -1;
+}
 
-  ret = btstack_common_send_cmd(&btstack_set_power_mode, HCI_POWER_ON );
+/*
+ * Power the controller on, and wait until it is working.
+ */
+static int btstack_common_power_on()
+{
+  int ret = btstack_common_send_cmd(&btstack_set_power_mode, HCI_POWER_ON );
 
   while(ret >= 0)
   {
@@ -57,52 +71,83 @@ int btstack_common_init()
 
   if(ret < 0)
   {
-    tcp_close(btstack_fd);
-    btstack_fd = -1;
+    btstack_common_close();
   }
 
-  return ret;
+  return ret < 0 ? -1 : 0;
 }
 
-int btstack_common_recv(recv_data_t* recv_data)
+static struct
 {
-  int status = 0;
+  BT_DEVICE_INIT_CALLBACK callback;
+  void * user;
+} init_callback = { NULL, NULL };
 
-  if(btstack_fd < 0)
+/*
+ * The daemon accepted the connection, or all attempts failed: resume the initialization.
+ */
+static int btstack_connect_cb(void * user __attribute__((unused)), int fd)
+{
+  int status = -1;
+
+  if(fd >= 0)
   {
-    fprintf(stderr, "No connection to btstack.\n");
-    return -1;
+    btstack_fd = fd;
+    status = btstack_common_power_on();
   }
 
-  int ret;
+  init_callback.callback(init_callback.user, status);
 
-  if(recv_data->read < sizeof(packet_header_t))
-  {
-    recv_data->remaining = sizeof(packet_header_t) - recv_data->read;
-  }
+  return 0;
+}
 
-  ret = tcp_recv(btstack_fd, recv_data->buffer+recv_data->read, recv_data->remaining);
-  if(ret > 0)
-  {
-    recv_data->read += ret;
-    recv_data->remaining -= ret;
-  }
-  else if( ret < 0)
-  {
-    status = -1;
-  }
+/*
+ * Connect to the btstack daemon, and power the controller on.
+ * Through TCP, the connection does not block, so that the daemon gets some time to start listening,
+ * and the initialization resumes from the connect callback.
+ */
+int btstack_common_init(BT_DEVICE_INIT_CALLBACK callback, void * user)
+{
+  init_callback.callback = callback;
+  init_callback.user = user;
 
-  if(recv_data->read == sizeof(packet_header_t))
+#ifndef WIN32
+  if(gimx_params.btstack_socket != NULL)
   {
-    recv_data->remaining = READ_BT_16( recv_data->buffer, 4);
+    btstack_fd = btstack_transport_connect_unix(gimx_params.btstack_socket, &btstack_seqpacket);
+    if(btstack_fd < 0)
+    {
+      return -1;
+    }
+    btstack_unix = 1;
+    ginfo("connected to btstack through %s (%s)\n", gimx_params.btstack_socket, btstack_seqpacket ? "seqpacket" : "stream");
+    if(btstack_common_power_on() < 0)
+    {
+      return -1;
+    }
+    callback(user, 0);
+    return 0;
   }
-  else if(!recv_data->remaining)
+#endif
+
+  TCP_CALLBACKS callbacks = {
+          .fp_connect = btstack_connect_cb,
+          .fp_register = REGISTER_FUNCTION,
+          .fp_remove = REMOVE_FUNCTION,
+  };
+  return tcp_connect_async(inet_addr(BTSTACK_ADDR), BTSTACK_PORT, NULL, &callbacks);
+}
+
+int btstack_common_recv(recv_data_t* recv_data)
+{
+  if(btstack_fd < 0)
   {
-    status = 1;
-    recv_data->read = 0;
+    fprintf(stderr, "No connection to btstack.\n");
+    return -1;
   }
 
-  return status;
+  return btstack_transport_recv(btstack_fd, btstack_seqpacket, recv_data->buffer, sizeof(recv_data->buffer),
+      &recv_data->read, &recv_data->remaining);
 }
 
 int btstack_common_recv_packet(recv_data_t* data)
@@ -150,22 +195,7 @@ int btstack_common_recv_packet(recv_data_t* data)
 
 int btstack_common_send_packet(uint16_t type, uint16_t cid, const unsigned char * buf, uint32_t len)
 {
-  uint8_t header[sizeof(packet_header_t)];
-  bt_store_16(header, 0, type);
-  bt_store_16(header, 2, cid);
-  bt_store_16(header, 4, len);
-
-  // Linux, MinGW and Cygwin
-  if(tcp_send(btstack_fd, (const void*)header, 6) < 0)
-  {
-    return -1;
-  }
-  if(tcp_send(btstack_fd, (const void*)buf, len) < 0)
-  {
-    return -1;
-  }
-
-  return len;
+  return btstack_transport_send(btstack_fd, type, cid, buf, len);
 }
 
 // send hci cmd packet
@@ -183,16 +213,7 @@ int btstack_common_send_cmd(const hci_cmd_t *cmd, ...)
   uint16_t len = hci_create_cmd_internal(hci_cmd_buffer, cmd, argptr);
   va_end(argptr);
 
-  uint8_t header[sizeof(packet_header_t)];
-  bt_store_16(header, 0, HCI_COMMAND_DATA_PACKET);
-  bt_store_16(header, 2, 0);
-  bt_store_16(header, 4, len);
-  if(tcp_send(btstack_fd, header, 6) < 0)
-  {
-    fprintf(stderr, "Failed to send hci command.\n");
-    return -1;
-  }
-  if(tcp_send(btstack_fd, hci_cmd_buffer, len) < 0)
+  if(btstack_transport_send(btstack_fd, HCI_COMMAND_DATA_PACKET, 0, hci_cmd_buffer, len) < 0)
   {
     fprintf(stderr, "Failed to send hci command.\n");
     return -1;
@@ -221,7 +242,7 @@ int btstack_common_disconnect(uint16_t handle)
     }
   }
 
-  ret = tcp_close(btstack_fd);
+  btstack_common_close();
 
-  return ret;
+  return 1;
 }
@@ -7,6 +7,7 @@
 #define BTSTACK_COMMON_H_
 
 #include <hci.h>
+#include <connectors/bluetooth/bt_device_abs.h>
 
 #define ACL_MTU 1024
 #define L2CAP_MTU 1024
@@ -23,7 +24,7 @@ typedef struct {
   uint16_t remaining;
 } recv_data_t;
 
-int btstack_common_init();
+int btstack_common_init(BT_DEVICE_INIT_CALLBACK callback, void * user);
 int btstack_common_getfd();
 int btstack_common_recv(recv_data_t* recv_data);
 int btstack_common_recv_packet(recv_data_t* recv_data);
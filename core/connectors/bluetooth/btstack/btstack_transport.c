@@ -0,0 +1,204 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include "btstack_transport.h"
+#ifdef WIN32
+#include <connectors/windows/sockets.h>
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#define psockerror(msg) perror(msg)
+#endif
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BTSTACK_MAX_PAYLOAD 0xFFFF
+
+#ifndef WIN32
+static int btstack_transport_connect_type(const char * path, int type)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "unix socket path is too long: %s\n", path);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, type, 0);
+  if(fd < 0)
+  {
+    return -1;
+  }
+
+  if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+  {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Connect to a unix socket, preferably in seqpacket mode, else in stream mode.
+ * Retry a few times, to give the daemon some time to start listening.
+ */
+int btstack_transport_connect_unix(const char * path, int * seqpacket)
+{
+  unsigned int backoff = BTSTACK_UNIX_BACKOFF;
+  unsigned int attempt;
+  for(attempt = 0; attempt < BTSTACK_UNIX_RETRIES; ++attempt)
+  {
+    if(attempt)
+    {
+      usleep(backoff);
+      backoff *= 2;
+    }
+
+    int fd = btstack_transport_connect_type(path, SOCK_SEQPACKET);
+    if(fd >= 0)
+    {
+      *seqpacket = 1;
+      return fd;
+    }
+
+    if(errno == EPROTOTYPE)
+    {
+      // the daemon listens in stream mode
+      fd = btstack_transport_connect_type(path, SOCK_STREAM);
+      if(fd >= 0)
+      {
+        *seqpacket = 0;
+        return fd;
+      }
+    }
+
+    if(errno != ENOENT && errno != ECONNREFUSED)
+    {
+      break;
+    }
+  }
+
+  psockerror("connect");
+  fprintf(stderr, "can't connect to %s\n", path);
+
+  return -1;
+}
+#endif
+
+/*
+ * Send the header and the payload in a single call.
+ * This avoids a second system call and, with TCP, a second segment.
+ */
+int btstack_transport_send(int fd, uint16_t type, uint16_t channel, const unsigned char * buf, uint16_t len)
+{
+  static unsigned char packet[BTSTACK_HEADER_SIZE + BTSTACK_MAX_PAYLOAD];
+
+  packet[0] = type & 0xFF;
+  packet[1] = type >> 8;
+  packet[2] = channel & 0xFF;
+  packet[3] = channel >> 8;
+  packet[4] = len & 0xFF;
+  packet[5] = len >> 8;
+  memcpy(packet + BTSTACK_HEADER_SIZE, buf, len);
+
+  int ret = send(fd, (const void *) packet, BTSTACK_HEADER_SIZE + len, MSG_NOSIGNAL);
+  if(ret < 0)
+  {
+    psockerror("send");
+    return -1;
+  }
+  if(ret != BTSTACK_HEADER_SIZE + len)
+  {
+    fprintf(stderr, "short write to btstack: %d/%d\n", ret, BTSTACK_HEADER_SIZE + len);
+    return -1;
+  }
+
+  return len;
+}
+
+/*
+ * Receive a part of a packet.
+ *
+ * Returns 1 if a complete packet is in the buffer, 0 if more data is needed, -1 in case of error.
+ */
+int btstack_transport_recv(int fd, int seqpacket, unsigned char * buffer, unsigned int size, uint16_t * read,
+    uint16_t * remaining)
+{
+  int ret;
+
+  if(seqpacket)
+  {
+    // a message is a complete packet
+    ret = recv(fd, (void *) buffer, size, 0);
+    if(ret < 0)
+    {
+      psockerror("recv");
+      return -1;
+    }
+    if(ret == 0)
+    {
+      fprintf(stderr, "connection closed by btstack\n");
+      return -1;
+    }
+    if(ret < BTSTACK_HEADER_SIZE || ret != BTSTACK_HEADER_SIZE + (buffer[4] | buffer[5] << 8))
+    {
+      fprintf(stderr, "bad packet from btstack (%d bytes)\n", ret);
+      return -1;
+    }
+    *read = 0;
+    *remaining = 0;
+    return 1;
+  }
+
+  int status = 0;
+
+  if(*read < BTSTACK_HEADER_SIZE)
+  {
+    *remaining = BTSTACK_HEADER_SIZE - *read;
+  }
+
+  if(*read + *remaining > size)
+  {
+    fprintf(stderr, "packet from btstack is too large\n");
+    return -1;
+  }
+
+  ret = recv(fd, (void *) (buffer + *read), *remaining, 0);
+  if(ret > 0)
+  {
+    *read += ret;
+    *remaining -= ret;
+  }
+  else if(ret < 0)
+  {
+    psockerror("recv");
+    status = -1;
+  }
+  else
+  {
+    fprintf(stderr, "connection closed by btstack\n");
+    status = -1;
+  }
+
+  if(*read == BTSTACK_HEADER_SIZE)
+  {
+    *remaining = buffer[4] | buffer[5] << 8;
+  }
+  if(status == 0 && *read >= BTSTACK_HEADER_SIZE && !*remaining)
+  {
+    status = 1;
+    *read = 0;
+  }
+
+  return status;
+}
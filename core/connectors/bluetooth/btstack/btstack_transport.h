@@ -0,0 +1,31 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef BTSTACK_TRANSPORT_H_
+#define BTSTACK_TRANSPORT_H_
+
+#include <stdint.h>
+
+/*
+ * Framing of the packets exchanged with the btstack daemon:
+ * a 6-byte header (type, channel, length, little endian) followed by the payload.
+ *
+ * The same framing is used over TCP, unix stream sockets and unix seqpacket sockets.
+ * With seqpacket sockets, each packet is a single message.
+ */
+
+#define BTSTACK_HEADER_SIZE 6
+
+#define BTSTACK_UNIX_RETRIES 5
+#define BTSTACK_UNIX_BACKOFF 100000 //microseconds, doubled after each failed attempt
+
+#ifndef WIN32
+int btstack_transport_connect_unix(const char * path, int * seqpacket);
+#endif
+int btstack_transport_send(int fd, uint16_t type, uint16_t channel, const unsigned char * buf, uint16_t len);
+int btstack_transport_recv(int fd, int seqpacket, unsigned char * buffer, unsigned int size, uint16_t * read,
+    uint16_t * remaining);
+
+#endif /* BTSTACK_TRANSPORT_H_ */
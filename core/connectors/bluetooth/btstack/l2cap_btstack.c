@@ -14,6 +14,7 @@
 #include <connectors/tcp_con.h>
 #include "btstack_common.h"
 #include "connectors/bluetooth/l2cap_abs.h"
+#include "connectors/bluetooth/bt_stats.h"
 #ifdef WIN32
 #include "connectors/bluetooth/windows/bt_bdaddr.h"
 #endif
@@ -31,6 +32,7 @@ typedef struct
   unsigned short cid;
   unsigned short omtu;
   uint16_t handle;
+  s_bt_stats * stats; // NULL if there are too many peers
   L2CAP_ABS_CONNECT_CALLBACK connect_callback;
   L2CAP_ABS_READ_CALLBACK read_callback;
   L2CAP_ABS_PACKET_CALLBACK packet_callback;
@@ -72,6 +74,7 @@ static int l2cap_btstack_connect_channel(bdaddr_t event_addr, uint16_t psm, uint
         {
           channels.entries[channel].cid = cid;
           channels.entries[channel].handle = handle;
+          channels.entries[channel].stats = bt_stats_get(0, &event_addr);
         }
       }
       else
@@ -206,7 +209,14 @@ static int l2cap_btstack_send(int channel, const unsigned char* buf, int len, in
     return -1;
   }
 
-  return btstack_common_send_packet(L2CAP_DATA_PACKET, channels.entries[channel].cid, buf, len);
+  int ret = btstack_common_send_packet(L2CAP_DATA_PACKET, channels.entries[channel].cid, buf, len);
+
+  if(channels.entries[channel].stats != NULL)
+  {
+    bt_stats_sent(channels.entries[channel].stats, channels.entries[channel].psm, buf, ret);
+  }
+
+  return ret;
 }
 
 static int l2cap_btstack_listen(void * user __attribute__((unused)), const char *bdaddr_adapter __attribute__((unused)), unsigned short psm __attribute__((unused)), int options __attribute__((unused)),
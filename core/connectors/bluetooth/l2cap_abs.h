@@ -14,6 +14,10 @@
 
 #include <connectors/bluetooth/bt_abs.h>
 
+/*
+ * Limits of the fixed-size tables (btstack backend, listening channels).
+ * The bluez backend allocates its connected channels dynamically.
+ */
 #define L2CAP_ABS_MAX_PEERS     7 // = MAX_CONTROLLERS
 #define L2CAP_ABS_MAX_CHANNELS  3 // = PSM_SDP + PSM_HID_CONTROL + PSM_HID_INTERRUPT
 
@@ -4,19 +4,24 @@
 */
 
 #include <connectors/bluetooth/bt_device_abs.h>
+#include <gimx.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
+#include <gimxpoll/include/gpoll.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define HCI_REQ_TIMEOUT   1000
 
-static int bt_device_bluez_device_init()
+static int bt_device_bluez_device_init(BT_DEVICE_INIT_CALLBACK callback, void * user)
 {
   //TODO MLA: move bt_mgmt_adapter_init here
+  callback(user, 0);
   return 0;
 }
 
@@ -82,11 +87,330 @@ static int bt_device_bluez_write_device_class(int device_number, uint32_t devcla
   return ret;
 }
 
+/*
+ * The link quality is sampled without blocking: the commands are sent through an HCI socket
+ * registered in the poll loop, and their Command Complete events are matched by opcode and handle.
+ */
+
+#define PENDING_RSSI         0x01
+#define PENDING_LINK_QUALITY 0x02
+
+typedef struct
+{
+  void * user;
+  BT_LINK_QUALITY_CALLBACK callback;
+  int device_number;
+  int has_handle;
+  uint16_t handle;
+  unsigned char pending; // the replies that are still expected
+  int status;
+  int8_t rssi;
+  uint8_t link_quality;
+} s_link_quality_request;
+
+static struct
+{
+  struct
+  {
+    int opened;
+    int fd;
+  } devices[HCI_MAX_DEV];
+  s_link_quality_request * requests;
+  unsigned int nb;
+} link_quality = { 0 };
+
+static void bt_device_bluez_close_hci(int device_number)
+{
+  if(link_quality.devices[device_number].opened)
+  {
+    REMOVE_FUNCTION(link_quality.devices[device_number].fd);
+    hci_close_dev(link_quality.devices[device_number].fd);
+    link_quality.devices[device_number].opened = 0;
+  }
+}
+
+static void bt_device_bluez_complete_request(s_link_quality_request * request, unsigned char reply, const unsigned char * rp)
+{
+  request->pending &= ~reply;
+
+  if(rp[0])
+  {
+    request->status = -1;
+    // the handle may not be valid anymore
+    request->has_handle = 0;
+  }
+  else if(reply == PENDING_RSSI)
+  {
+    request->rssi = (int8_t) rp[3];
+  }
+  else
+  {
+    request->link_quality = rp[3];
+  }
+
+  if(!request->pending)
+  {
+    request->callback(request->user, request->status, request->rssi, request->link_quality);
+  }
+}
+
+static int bt_device_bluez_hci_read(void * user)
+{
+  int device_number = (intptr_t) user;
+
+  unsigned char buf[HCI_MAX_EVENT_SIZE + 1];
+
+  ssize_t len = read(link_quality.devices[device_number].fd, buf, sizeof(buf));
+  if(len < 0)
+  {
+    if(errno != EAGAIN && errno != EINTR)
+    {
+      perror("read");
+      bt_device_bluez_close_hci(device_number);
+    }
+    return 0;
+  }
+
+  // packet type, event, length, credits, opcode, status, handle, value
+  if(len < 1 + HCI_EVENT_HDR_SIZE + 3 + 4 || buf[0] != HCI_EVENT_PKT || buf[1] != EVT_CMD_COMPLETE)
+  {
+    return 0;
+  }
+
+  uint16_t opcode = bt_get_le16(buf + 4);
+  const unsigned char * rp = buf + 6;
+  uint16_t handle = bt_get_le16(rp + 1);
+
+  unsigned char reply;
+  if(opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI))
+  {
+    reply = PENDING_RSSI;
+  }
+  else if(opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_LINK_QUALITY))
+  {
+    reply = PENDING_LINK_QUALITY;
+  }
+  else
+  {
+    return 0;
+  }
+
+  unsigned int i;
+  for(i = 0; i < link_quality.nb; ++i)
+  {
+    s_link_quality_request * request = link_quality.requests + i;
+    if(request->device_number == device_number && request->has_handle && request->handle == handle
+        && (request->pending & reply))
+    {
+      bt_device_bluez_complete_request(request, reply, rp);
+      break;
+    }
+  }
+
+  return 0;
+}
+
+static int bt_device_bluez_hci_close(void * user)
+{
+  bt_device_bluez_close_hci((intptr_t) user);
+  return 0;
+}
+
+/*
+ * Open the HCI socket of a device, if not done yet.
+ * Only the Command Complete events are received.
+ */
+static int bt_device_bluez_open_hci(int device_number)
+{
+  if(device_number < 0 || device_number >= HCI_MAX_DEV)
+  {
+    return -1;
+  }
+
+  if(link_quality.devices[device_number].opened)
+  {
+    return link_quality.devices[device_number].fd;
+  }
+
+  int dd = hci_open_dev(device_number);
+  if(dd < 0)
+  {
+    perror("hci_open_dev");
+    return -1;
+  }
+
+  struct hci_filter flt;
+  hci_filter_clear(&flt);
+  hci_filter_set_ptype(HCI_EVENT_PKT, &flt);
+  hci_filter_set_event(EVT_CMD_COMPLETE, &flt);
+  if(setsockopt(dd, SOL_HCI, HCI_FILTER, &flt, sizeof(flt)) < 0)
+  {
+    perror("setsockopt HCI_FILTER");
+    hci_close_dev(dd);
+    return -1;
+  }
+
+  if(fcntl(dd, F_SETFL, fcntl(dd, F_GETFL) | O_NONBLOCK) < 0)
+  {
+    perror("fcntl O_NONBLOCK");
+    hci_close_dev(dd);
+    return -1;
+  }
+
+  GPOLL_CALLBACKS callbacks = {
+          .fp_read = bt_device_bluez_hci_read,
+          .fp_write = NULL,
+          .fp_close = bt_device_bluez_hci_close,
+  };
+  if(REGISTER_FUNCTION(dd, (void *)(intptr_t) device_number, &callbacks) < 0)
+  {
+    hci_close_dev(dd);
+    return -1;
+  }
+
+  link_quality.devices[device_number].opened = 1;
+  link_quality.devices[device_number].fd = dd;
+
+  return dd;
+}
+
+static s_link_quality_request * bt_device_bluez_get_request(void * user)
+{
+  unsigned int i;
+  for(i = 0; i < link_quality.nb; ++i)
+  {
+    if(link_quality.requests[i].user == user)
+    {
+      return link_quality.requests + i;
+    }
+  }
+
+  s_link_quality_request * requests = realloc(link_quality.requests, (link_quality.nb + 1) * sizeof(*requests));
+  if(requests == NULL)
+  {
+    PRINT_ERROR_ALLOC_FAILED("realloc");
+    return NULL;
+  }
+  link_quality.requests = requests;
+
+  s_link_quality_request * request = link_quality.requests + link_quality.nb;
+  memset(request, 0x00, sizeof(*request));
+  request->user = user;
+  ++link_quality.nb;
+
+  return request;
+}
+
+/*
+ * Get the handle of the connection with a peer, from the kernel.
+ */
+static int bt_device_bluez_get_handle(int dd, const bdaddr_t * peer, uint16_t * handle)
+{
+  struct hci_conn_info_req * cr = malloc(sizeof(*cr) + sizeof(struct hci_conn_info));
+  if(cr == NULL)
+  {
+    PRINT_ERROR_ALLOC_FAILED("malloc");
+    return -1;
+  }
+
+  bacpy(&cr->bdaddr, peer);
+  cr->type = ACL_LINK;
+
+  // the peer may not be connected anymore
+  int ret = ioctl(dd, HCIGETCONNINFO, (unsigned long) cr);
+  if(ret == 0)
+  {
+    *handle = cr->conn_info->handle;
+  }
+
+  free(cr);
+
+  return ret;
+}
+
+/*
+ * \brief This function requests the RSSI and the link quality of the connection with a peer.
+ *        It does not wait for the replies: the callback is called from the poll loop.
+ *
+ * \param device_number  the device number
+ * \param peer           the peer address
+ * \param callback       the function to call with the values
+ * \param user           the user data for the callback
+ *
+ * \return 0 if the request was sent, -1 otherwise
+ */
+static int bt_device_bluez_read_link_quality(int device_number, const bdaddr_t * peer, BT_LINK_QUALITY_CALLBACK callback,
+    void * user)
+{
+  int dd = bt_device_bluez_open_hci(device_number);
+  if(dd < 0)
+  {
+    return -1;
+  }
+
+  s_link_quality_request * request = bt_device_bluez_get_request(user);
+  if(request == NULL)
+  {
+    return -1;
+  }
+
+  if(request->device_number != device_number)
+  {
+    request->device_number = device_number;
+    request->has_handle = 0;
+  }
+
+  // the handle lookup does not involve the controller, and is only needed after a connection
+  if(!request->has_handle)
+  {
+    if(bt_device_bluez_get_handle(dd, peer, &request->handle) < 0)
+    {
+      return -1;
+    }
+    request->has_handle = 1;
+  }
+
+  request->callback = callback;
+  request->status = 0;
+  request->pending = PENDING_RSSI | PENDING_LINK_QUALITY;
+
+  uint16_t cp = htobs(request->handle);
+
+  if(hci_send_cmd(dd, OGF_STATUS_PARAM, OCF_READ_RSSI, sizeof(cp), &cp) < 0
+      || hci_send_cmd(dd, OGF_STATUS_PARAM, OCF_READ_LINK_QUALITY, sizeof(cp), &cp) < 0)
+  {
+    perror("hci_send_cmd");
+    request->pending = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void bt_device_bluez_clean(void) __attribute__((destructor));
+void bt_device_bluez_clean(void)
+{
+  int i;
+  for(i = 0; i < HCI_MAX_DEV; ++i)
+  {
+    // the poll loop is not used anymore
+    if(link_quality.devices[i].opened)
+    {
+      hci_close_dev(link_quality.devices[i].fd);
+      link_quality.devices[i].opened = 0;
+    }
+  }
+  free(link_quality.requests);
+  link_quality.requests = NULL;
+  link_quality.nb = 0;
+}
+
 static s_bt_device_abs bt_device_bluez =
 {
     .init = bt_device_bluez_device_init,
     .get_bdaddr = bt_device_bluez_get_device_bdaddr,
     .write_device_class = bt_device_bluez_write_device_class,
+    .read_link_quality = bt_device_bluez_read_link_quality,
 };
 
 void bt_device_bluez_init(void) __attribute__((constructor));
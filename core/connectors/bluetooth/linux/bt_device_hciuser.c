@@ -0,0 +1,220 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+   License: GPLv3
+*/
+
+#include <connectors/bluetooth/bt_device_abs.h>
+#include <connectors/bluetooth/linux/hci_user.h>
+#include <bluetooth/hci.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int bt_device_hciuser_device_init(BT_DEVICE_INIT_CALLBACK callback, void * user)
+{
+  // devices are opened on first use
+  callback(user, 0);
+  return 0;
+}
+
+/*
+ * \brief This function gets the bluetooth device address for a given device number.
+ *        The device is taken from the kernel if this was not done yet.
+ *
+ * \param device_number  the device number
+ * \param bdaddr         the buffer to store the bluetooth device address
+ *
+ * \return 0 if successful, -1 otherwise
+ */
+static int bt_device_hciuser_get_device_bdaddr(int device_number, bdaddr_t* ba)
+{
+  if(hci_user_open(device_number, NULL) < 0)
+  {
+    return -1;
+  }
+
+  return hci_user_get_bdaddr(device_number, ba);
+}
+
+/*
+ * \brief This function writes the device class for a given device number.
+ *
+ * \param device_number  the device number
+ * \param devclass       the device class to write
+ *
+ * \return 0 if successful, -1 otherwise
+ */
+static int bt_device_hciuser_write_device_class(int device_number, uint32_t devclass)
+{
+  if(hci_user_open(device_number, NULL) < 0)
+  {
+    return -1;
+  }
+
+  uint8_t cp[3] = { devclass & 0xff, (devclass >> 8) & 0xff, (devclass >> 16) & 0xff };
+
+  return hci_user_command(device_number, cmd_opcode_pack(OGF_HOST_CTL, OCF_WRITE_CLASS_OF_DEV), cp, sizeof(cp), NULL, 0);
+}
+
+#define PENDING_RSSI         0x01
+#define PENDING_LINK_QUALITY 0x02
+
+typedef struct
+{
+  void * user;
+  BT_LINK_QUALITY_CALLBACK callback;
+  unsigned char pending; // the replies that are still expected
+  int status;
+  int8_t rssi;
+  uint8_t link_quality;
+} s_link_quality_request;
+
+static struct
+{
+  s_link_quality_request * requests;
+  unsigned int nb;
+} link_quality = { 0 };
+
+static void bt_device_hciuser_complete_request(intptr_t index, unsigned char reply, const unsigned char * rparam, int rlen)
+{
+  s_link_quality_request * request = link_quality.requests + index;
+
+  if(!(request->pending & reply))
+  {
+    // the request was sent again
+    return;
+  }
+
+  request->pending &= ~reply;
+
+  // status, handle, value
+  if(rlen < 4 || rparam[0])
+  {
+    request->status = -1;
+  }
+  else if(reply == PENDING_RSSI)
+  {
+    request->rssi = (int8_t) rparam[3];
+  }
+  else
+  {
+    request->link_quality = rparam[3];
+  }
+
+  if(!request->pending)
+  {
+    request->callback(request->user, request->status, request->rssi, request->link_quality);
+  }
+}
+
+static void bt_device_hciuser_rssi_cb(void * user, const unsigned char * rparam, int rlen)
+{
+  bt_device_hciuser_complete_request((intptr_t) user, PENDING_RSSI, rparam, rlen);
+}
+
+static void bt_device_hciuser_link_quality_cb(void * user, const unsigned char * rparam, int rlen)
+{
+  bt_device_hciuser_complete_request((intptr_t) user, PENDING_LINK_QUALITY, rparam, rlen);
+}
+
+static int bt_device_hciuser_get_request(void * user)
+{
+  unsigned int i;
+  for(i = 0; i < link_quality.nb; ++i)
+  {
+    if(link_quality.requests[i].user == user)
+    {
+      return i;
+    }
+  }
+
+  s_link_quality_request * requests = realloc(link_quality.requests, (link_quality.nb + 1) * sizeof(*requests));
+  if(requests == NULL)
+  {
+    fprintf(stderr, "%s:%d %s: realloc failed\n", __FILE__, __LINE__, __func__);
+    return -1;
+  }
+  link_quality.requests = requests;
+
+  memset(link_quality.requests + link_quality.nb, 0x00, sizeof(*requests));
+  link_quality.requests[link_quality.nb].user = user;
+
+  return link_quality.nb++;
+}
+
+/*
+ * \brief This function requests the RSSI and the link quality of the connection with a peer.
+ *        It does not wait for the replies: the callback is called when the device is read.
+ *
+ * \param device_number  the device number
+ * \param peer           the peer address
+ * \param callback       the function to call with the values
+ * \param user           the user data for the callback
+ *
+ * \return 0 if the request was sent, -1 otherwise
+ */
+static int bt_device_hciuser_read_link_quality(int device_number, const bdaddr_t * peer, BT_LINK_QUALITY_CALLBACK callback,
+    void * user)
+{
+  uint16_t handle;
+
+  // the peer may not be connected anymore
+  if(hci_user_get_handle(device_number, peer, &handle) < 0)
+  {
+    return -1;
+  }
+
+  int index = bt_device_hciuser_get_request(user);
+  if(index < 0)
+  {
+    return -1;
+  }
+
+  s_link_quality_request * request = link_quality.requests + index;
+  request->callback = callback;
+  request->status = 0;
+  request->pending = PENDING_RSSI | PENDING_LINK_QUALITY;
+
+  uint8_t cp[2] = { handle & 0xff, handle >> 8 };
+
+  if(hci_user_command_cb(device_number, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI), cp, sizeof(cp),
+          bt_device_hciuser_rssi_cb, (void *)(intptr_t) index) < 0)
+  {
+    request->pending = 0;
+    return -1;
+  }
+
+  if(hci_user_command_cb(device_number, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_LINK_QUALITY), cp, sizeof(cp),
+          bt_device_hciuser_link_quality_cb, (void *)(intptr_t) index) < 0)
+  {
+    // the RSSI reply must not be taken for the one of the next request
+    hci_user_command_cancel(device_number, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI), (void *)(intptr_t) index);
+    request->pending = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void bt_device_hciuser_clean(void) __attribute__((destructor));
+void bt_device_hciuser_clean(void)
+{
+  free(link_quality.requests);
+  link_quality.requests = NULL;
+  link_quality.nb = 0;
+}
+
+static s_bt_device_abs bt_device_hciuser =
+{
+    .init = bt_device_hciuser_device_init,
+    .get_bdaddr = bt_device_hciuser_get_device_bdaddr,
+    .write_device_class = bt_device_hciuser_write_device_class,
+    .read_link_quality = bt_device_hciuser_read_link_quality,
+};
+
+void bt_device_hciuser_init(void) __attribute__((constructor));
+void bt_device_hciuser_init(void)
+{
+  bt_device_abs_register(E_BT_ABS_HCIUSER, &bt_device_hciuser);
+}
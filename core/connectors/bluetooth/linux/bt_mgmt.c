@@ -315,7 +315,7 @@ static int str2buf(const char *str, uint8_t *buf, size_t blen)
   return 0;
 }
 
-static int read_link_keys(uint16_t index, uint16_t nb_keys, bdaddr_t bdaddrs[nb_keys], unsigned char keys[nb_keys][16])
+int bt_mgmt_read_link_keys(uint16_t index, uint16_t nb_keys, bdaddr_t bdaddrs[nb_keys], unsigned char keys[nb_keys][16])
 {
   char file_path[PATH_MAX];
 
@@ -417,7 +417,7 @@ int bt_mgmt_adapter_init(uint16_t index)
   bdaddr_t bdaddrs[2];
   unsigned char keys[2][16];
 
-  if(read_link_keys(index, 2, bdaddrs, keys) < 0)
+  if(bt_mgmt_read_link_keys(index, 2, bdaddrs, keys) < 0)
   {
     fprintf(stderr, "read_link_keys failed\n");
     close(sk);
@@ -7,7 +7,9 @@
 #define BT_MGMT_H
  
 #include <stdint.h>
+#include <bluetooth/bluetooth.h>
 
 int bt_mgmt_adapter_init(uint16_t index);
+int bt_mgmt_read_link_keys(uint16_t index, uint16_t nb_keys, bdaddr_t bdaddrs[nb_keys], unsigned char keys[nb_keys][16]);
 
 #endif
@@ -0,0 +1,928 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <connectors/bluetooth/linux/hci_user.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/l2cap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define HCI_USER_MAX_DEVICES 16 // = HCI_MAX_DEV
+#define HCI_USER_MAX_LINKS 7 // the maximum number of active slaves in a piconet
+
+#define HCI_USER_CMD_TIMEOUT 1000 // ms
+#define HCI_USER_CMD_QUEUE_SIZE 8
+
+#define HCI_USER_MAX_PACKET 2048
+
+#define HCI_USER_SEND_FAILED 0x1f // unspecified error, the status of the commands that could not be sent
+
+typedef struct
+{
+  int used;
+  uint16_t handle;
+  bdaddr_t ba;
+  unsigned int pending; // ACL packets sent but not completed yet
+  unsigned short len; // length of the frame being reassembled
+  unsigned char frame[L2CAP_HDR_SIZE + HCI_USER_L2CAP_MTU];
+} s_link;
+
+typedef struct
+{
+  unsigned short len;
+  unsigned char buf[HCI_COMMAND_HDR_SIZE + 255];
+} s_command;
+
+typedef struct
+{
+  int fd;
+  bdaddr_t ba;
+  s_hci_user_callbacks callbacks;
+  uint16_t acl_mtu; // the largest ACL payload the controller accepts
+  uint16_t acl_max; // the number of ACL buffers of the controller
+  uint16_t acl_free; // the number of ACL buffers that can be used
+  uint8_t cmd_credits; // the number of commands the controller accepts
+  struct
+  {
+    s_command commands[HCI_USER_CMD_QUEUE_SIZE];
+    unsigned int first;
+    unsigned int count;
+  } queue; // commands waiting for credits
+  struct
+  {
+    uint16_t opcode; // 0 means no command is waited for
+    int done;
+    uint8_t status;
+    unsigned char * rparam;
+    uint8_t rlen;
+  } pending; // the synchronous command
+  struct
+  {
+    uint16_t opcode; // 0 means the slot is free
+    unsigned int sequence;
+    HCI_USER_COMPLETE_CALLBACK callback; // NULL if the command was cancelled
+    void * user;
+  } completions[HCI_USER_CMD_QUEUE_SIZE]; // the asynchronous commands waiting for their completion
+  unsigned int sequence;
+  s_link links[HCI_USER_MAX_LINKS];
+} s_device;
+
+static s_device * devices[HCI_USER_MAX_DEVICES] = {};
+
+static s_device * get_device(int device)
+{
+  if(device < 0 || device >= HCI_USER_MAX_DEVICES || devices[device] == NULL)
+  {
+    fprintf(stderr, "hci%d is not opened\n", device);
+    return NULL;
+  }
+  return devices[device];
+}
+
+static s_link * get_link(s_device * dev, uint16_t handle)
+{
+  unsigned int i;
+  for(i = 0; i < sizeof(dev->links) / sizeof(*dev->links); ++i)
+  {
+    if(dev->links[i].used && dev->links[i].handle == handle)
+    {
+      return dev->links + i;
+    }
+  }
+  return NULL;
+}
+
+static int write_packet(int fd, struct iovec * iv, int ivn, int retry)
+{
+  while(writev(fd, iv, ivn) < 0)
+  {
+    if(errno == EINTR || (errno == EAGAIN && retry))
+    {
+      continue;
+    }
+    if(errno != EAGAIN)
+    {
+      perror("writev");
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static int send_command(s_device * dev, const s_command * command)
+{
+  uint8_t type = HCI_COMMAND_PKT;
+
+  struct iovec iv[2] =
+  {
+    { .iov_base = &type, .iov_len = 1 },
+    { .iov_base = (void *) command->buf, .iov_len = command->len },
+  };
+
+  if(write_packet(dev->fd, iv, 2, 1) < 0)
+  {
+    return -1;
+  }
+
+  --dev->cmd_credits;
+
+  return 0;
+}
+
+static void complete_command(s_device * dev, uint16_t opcode, uint8_t status, const unsigned char * rparam, int rlen);
+
+static void flush_commands(s_device * dev)
+{
+  while(dev->cmd_credits && dev->queue.count)
+  {
+    s_command command = dev->queue.commands[dev->queue.first];
+    dev->queue.first = (dev->queue.first + 1) % HCI_USER_CMD_QUEUE_SIZE;
+    --dev->queue.count;
+    if(send_command(dev, &command) < 0)
+    {
+      // the controller will never complete the command: fail it now
+      uint8_t status = HCI_USER_SEND_FAILED;
+      complete_command(dev, bt_get_le16(command.buf), status, &status, sizeof(status));
+    }
+  }
+}
+
+/*
+ * Send a command, or queue it until the controller accepts commands.
+ */
+int hci_user_command_async(int device, uint16_t opcode, const void * cparam, uint8_t clen)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  if(dev->queue.count == HCI_USER_CMD_QUEUE_SIZE)
+  {
+    fprintf(stderr, "hci%d: command queue is full\n", device);
+    return -1;
+  }
+
+  s_command * command = dev->queue.commands + (dev->queue.first + dev->queue.count) % HCI_USER_CMD_QUEUE_SIZE;
+  bt_put_le16(opcode, command->buf);
+  command->buf[2] = clen;
+  if(clen)
+  {
+    memcpy(command->buf + HCI_COMMAND_HDR_SIZE, cparam, clen);
+  }
+  command->len = HCI_COMMAND_HDR_SIZE + clen;
+  ++dev->queue.count;
+
+  flush_commands(dev);
+
+  return 0;
+}
+
+/*
+ * Send a command without waiting for its completion.
+ * The callback is called from hci_user_read when the command completes or fails.
+ */
+int hci_user_command_cb(int device, uint16_t opcode, const void * cparam, uint8_t clen, HCI_USER_COMPLETE_CALLBACK callback,
+    void * user)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  unsigned int i;
+  for(i = 0; i < HCI_USER_CMD_QUEUE_SIZE && dev->completions[i].opcode; ++i) ;
+
+  if(i == HCI_USER_CMD_QUEUE_SIZE)
+  {
+    fprintf(stderr, "hci%d: too many pending commands\n", device);
+    return -1;
+  }
+
+  // the command may fail before hci_user_command_async returns
+  dev->completions[i].opcode = opcode;
+  dev->completions[i].sequence = dev->sequence++;
+  dev->completions[i].callback = callback;
+  dev->completions[i].user = user;
+
+  if(hci_user_command_async(device, opcode, cparam, clen) < 0)
+  {
+    dev->completions[i].opcode = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Forget the callback of the newest command sent with hci_user_command_cb for the given opcode and user data.
+ * The command keeps its slot until it completes, so that the next completions are not mismatched.
+ */
+void hci_user_command_cancel(int device, uint16_t opcode, void * user)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return;
+  }
+
+  int newest = -1;
+  unsigned int i;
+  for(i = 0; i < HCI_USER_CMD_QUEUE_SIZE; ++i)
+  {
+    if(dev->completions[i].opcode == opcode && dev->completions[i].callback != NULL && dev->completions[i].user == user
+        && (newest < 0 || (int)(dev->completions[i].sequence - dev->completions[newest].sequence) > 0))
+    {
+      newest = i;
+    }
+  }
+  if(newest >= 0)
+  {
+    dev->completions[newest].callback = NULL;
+  }
+}
+
+static int elapsed_ms(const struct timespec * start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Send a command and wait for its completion.
+ * The packets received in the meantime are processed as usual.
+ * The return parameters (starting with the status) are copied into rparam.
+ *
+ * \return 0 if the command succeeded, -1 otherwise
+ */
+int hci_user_command(int device, uint16_t opcode, const void * cparam, uint8_t clen, void * rparam, uint8_t rlen)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  if(dev->pending.opcode)
+  {
+    fprintf(stderr, "hci%d: command 0x%04x is still pending\n", device, dev->pending.opcode);
+    return -1;
+  }
+
+  dev->pending.opcode = opcode;
+  dev->pending.done = 0;
+  dev->pending.status = 0;
+  dev->pending.rparam = rparam;
+  dev->pending.rlen = rlen;
+
+  int ret = hci_user_command_async(device, opcode, cparam, clen);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while(ret == 0 && !dev->pending.done)
+  {
+    int remaining = HCI_USER_CMD_TIMEOUT - elapsed_ms(&start);
+    struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+    int res = remaining > 0 ? poll(&pfd, 1, remaining) : 0;
+    if(res < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if(res <= 0)
+    {
+      fprintf(stderr, "hci%d: command 0x%04x timed out\n", device, opcode);
+      ret = -1;
+    }
+    else
+    {
+      ret = hci_user_read(device);
+    }
+  }
+
+  if(ret == 0 && dev->pending.status)
+  {
+    fprintf(stderr, "hci%d: command 0x%04x failed with status 0x%02x\n", device, opcode, dev->pending.status);
+    ret = -1;
+  }
+
+  dev->pending.opcode = 0;
+
+  return ret;
+}
+
+static void complete_command(s_device * dev, uint16_t opcode, uint8_t status, const unsigned char * rparam, int rlen)
+{
+  if(dev->pending.opcode != opcode || dev->pending.done)
+  {
+    // the controller completes the commands with the same opcode in order
+    int oldest = -1;
+    unsigned int i;
+    for(i = 0; i < HCI_USER_CMD_QUEUE_SIZE; ++i)
+    {
+      if(dev->completions[i].opcode == opcode
+          && (oldest < 0 || (int)(dev->completions[i].sequence - dev->completions[oldest].sequence) < 0))
+      {
+        oldest = i;
+      }
+    }
+    if(oldest >= 0)
+    {
+      dev->completions[oldest].opcode = 0;
+      if(dev->completions[oldest].callback != NULL)
+      {
+        dev->completions[oldest].callback(dev->completions[oldest].user, rparam, rlen);
+      }
+    }
+    return;
+  }
+
+  if(dev->pending.rparam != NULL)
+  {
+    int len = rlen < dev->pending.rlen ? rlen : dev->pending.rlen;
+    memcpy(dev->pending.rparam, rparam, len);
+  }
+  dev->pending.status = status;
+  dev->pending.done = 1;
+}
+
+/*
+ * The controller released the buffers of the packets it sent, or flushed.
+ */
+static void release_buffers(s_device * dev, s_link * link, unsigned int count)
+{
+  if(count > link->pending)
+  {
+    count = link->pending;
+  }
+  link->pending -= count;
+  dev->acl_free += count;
+  if(dev->acl_free > dev->acl_max)
+  {
+    dev->acl_free = dev->acl_max;
+  }
+}
+
+static void process_event(int device, s_device * dev, const unsigned char * buf, int len)
+{
+  if(len < HCI_EVENT_HDR_SIZE || len < HCI_EVENT_HDR_SIZE + buf[1])
+  {
+    return;
+  }
+
+  const unsigned char * params = buf + HCI_EVENT_HDR_SIZE;
+  int plen = buf[1];
+  int ready = 0;
+
+  switch(buf[0])
+  {
+    case EVT_CMD_COMPLETE:
+      if(plen >= 4)
+      {
+        dev->cmd_credits = params[0];
+        complete_command(dev, bt_get_le16(params + 1), params[3], params + 3, plen - 3);
+        flush_commands(dev);
+      }
+      break;
+    case EVT_CMD_STATUS:
+      if(plen >= 4)
+      {
+        dev->cmd_credits = params[1];
+        // a successful status only completes the commands that don't have a completion event
+        if(params[0])
+        {
+          complete_command(dev, bt_get_le16(params + 2), params[0], params, 1);
+        }
+        flush_commands(dev);
+      }
+      break;
+    case EVT_NUM_COMP_PKTS:
+      if(plen >= 1 && plen >= 1 + params[0] * 4)
+      {
+        int i;
+        for(i = 0; i < params[0]; ++i)
+        {
+          s_link * link = get_link(dev, acl_handle(bt_get_le16(params + 1 + i * 4)));
+          if(link != NULL)
+          {
+            release_buffers(dev, link, bt_get_le16(params + 3 + i * 4));
+          }
+        }
+        if(dev->callbacks.acl_ready != NULL)
+        {
+          dev->callbacks.acl_ready(device);
+        }
+      }
+      return;
+    case EVT_CONN_COMPLETE:
+      // status, handle, bdaddr, link type, encryption
+      if(plen >= 11 && params[0] == 0x00 && params[9] == ACL_LINK)
+      {
+        unsigned int i;
+        for(i = 0; i < sizeof(dev->links) / sizeof(*dev->links); ++i)
+        {
+          if(!dev->links[i].used)
+          {
+            dev->links[i].used = 1;
+            dev->links[i].handle = acl_handle(bt_get_le16(params + 1));
+            memcpy(&dev->links[i].ba, params + 3, sizeof(dev->links[i].ba));
+            dev->links[i].pending = 0;
+            dev->links[i].len = 0;
+            break;
+          }
+        }
+        if(i == sizeof(dev->links) / sizeof(*dev->links))
+        {
+          fprintf(stderr, "hci%d: too many links\n", device);
+        }
+      }
+      break;
+    case EVT_DISCONN_COMPLETE:
+      // status, handle, reason
+      if(plen >= 4 && params[0] == 0x00)
+      {
+        s_link * link = get_link(dev, acl_handle(bt_get_le16(params + 1)));
+        if(link != NULL)
+        {
+          // the controller drops the pending packets without completing them
+          ready = (link->pending > 0);
+          release_buffers(dev, link, link->pending);
+          link->used = 0;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  if(dev->callbacks.event != NULL)
+  {
+    dev->callbacks.event(device, buf, HCI_EVENT_HDR_SIZE + plen);
+  }
+
+  if(ready && dev->callbacks.acl_ready != NULL)
+  {
+    dev->callbacks.acl_ready(device);
+  }
+}
+
+/*
+ * Reassemble l2cap frames, and pass them to the acl callback.
+ */
+static void process_acl(int device, s_device * dev, const unsigned char * buf, int len)
+{
+  if(len < HCI_ACL_HDR_SIZE)
+  {
+    return;
+  }
+
+  uint16_t handle = acl_handle(bt_get_le16(buf));
+  uint8_t flags = acl_flags(bt_get_le16(buf)) & 0x03;
+  uint16_t dlen = bt_get_le16(buf + 2);
+
+  if(dlen > len - HCI_ACL_HDR_SIZE)
+  {
+    return;
+  }
+
+  s_link * link = get_link(dev, handle);
+  if(link == NULL)
+  {
+    return;
+  }
+
+  if(flags != ACL_CONT)
+  {
+    link->len = 0;
+  }
+  else if(link->len == 0)
+  {
+    // continuation of a dropped frame
+    return;
+  }
+
+  if(link->len + dlen > sizeof(link->frame))
+  {
+    fprintf(stderr, "hci%d: l2cap frame is too large\n", device);
+    link->len = 0;
+    return;
+  }
+
+  memcpy(link->frame + link->len, buf + HCI_ACL_HDR_SIZE, dlen);
+  link->len += dlen;
+
+  if(link->len < L2CAP_HDR_SIZE)
+  {
+    return;
+  }
+
+  unsigned int expected = L2CAP_HDR_SIZE + bt_get_le16(link->frame);
+
+  if(link->len > expected)
+  {
+    fprintf(stderr, "hci%d: bad l2cap frame length\n", device);
+    link->len = 0;
+  }
+  else if(link->len == expected)
+  {
+    link->len = 0;
+    if(dev->callbacks.acl != NULL)
+    {
+      dev->callbacks.acl(device, handle, link->frame, expected);
+    }
+  }
+}
+
+/*
+ * Read and process one packet.
+ *
+ * \return 0 if successful, -1 if the device failed
+ */
+int hci_user_read(int device)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  unsigned char buf[HCI_USER_MAX_PACKET];
+
+  ssize_t len = read(dev->fd, buf, sizeof(buf));
+  if(len < 0)
+  {
+    if(errno == EAGAIN || errno == EINTR)
+    {
+      return 0;
+    }
+    perror("read");
+    return -1;
+  }
+  if(len == 0)
+  {
+    fprintf(stderr, "hci%d: device was removed\n", device);
+    return -1;
+  }
+
+  switch(buf[0])
+  {
+    case HCI_EVENT_PKT:
+      process_event(device, dev, buf + 1, len - 1);
+      break;
+    case HCI_ACLDATA_PKT:
+      process_acl(device, dev, buf + 1, len - 1);
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/*
+ * Send an l2cap frame, in as many ACL packets as needed.
+ * Nothing is sent if the controller does not have enough free buffers for the whole frame.
+ *
+ * \return len if successful, -1 otherwise (errno is EAGAIN if the frame could not be sent yet)
+ */
+int hci_user_acl_send(int device, uint16_t handle, uint16_t cid, const unsigned char * buf, int len)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  s_link * link = get_link(dev, handle);
+  if(link == NULL)
+  {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  unsigned int total = L2CAP_HDR_SIZE + len;
+  unsigned int fragments = (total + dev->acl_mtu - 1) / dev->acl_mtu;
+
+  if(fragments > dev->acl_free)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  uint8_t type = HCI_ACLDATA_PKT;
+  hci_acl_hdr acl_hdr;
+  l2cap_hdr l2_hdr = { .len = htobs(len), .cid = htobs(cid) };
+
+  unsigned int data_len = dev->acl_mtu - L2CAP_HDR_SIZE;
+  if((unsigned int) len < data_len)
+  {
+    data_len = len;
+  }
+
+  acl_hdr.handle = htobs(acl_handle_pack(handle, ACL_START));
+  acl_hdr.dlen = htobs(L2CAP_HDR_SIZE + data_len);
+
+  struct iovec iv[4] =
+  {
+    { .iov_base = &type, .iov_len = 1 },
+    { .iov_base = &acl_hdr, .iov_len = HCI_ACL_HDR_SIZE },
+    { .iov_base = &l2_hdr, .iov_len = L2CAP_HDR_SIZE },
+    { .iov_base = (void *) buf, .iov_len = data_len },
+  };
+
+  if(write_packet(dev->fd, iv, data_len ? 4 : 3, 0) < 0)
+  {
+    // nothing was sent
+    return -1;
+  }
+
+  unsigned int sent = 1;
+  unsigned int offset = data_len;
+
+  while(offset < (unsigned int) len)
+  {
+    data_len = len - offset;
+    if(data_len > dev->acl_mtu)
+    {
+      data_len = dev->acl_mtu;
+    }
+
+    acl_hdr.handle = htobs(acl_handle_pack(handle, ACL_CONT));
+    acl_hdr.dlen = htobs(data_len);
+
+    iv[2].iov_base = (void *) (buf + offset);
+    iv[2].iov_len = data_len;
+
+    // the frame was partially sent: complete it
+    if(write_packet(dev->fd, iv, 3, 1) < 0)
+    {
+      break;
+    }
+
+    ++sent;
+    offset += data_len;
+  }
+
+  dev->acl_free -= sent;
+  link->pending += sent;
+
+  return offset < (unsigned int) len ? -1 : len;
+}
+
+int hci_user_get_fd(int device)
+{
+  s_device * dev = get_device(device);
+
+  return dev != NULL ? dev->fd : -1;
+}
+
+int hci_user_get_bdaddr(int device, bdaddr_t * ba)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  bacpy(ba, &dev->ba);
+
+  return 0;
+}
+
+/*
+ * Get the handle of the link with a peer.
+ */
+int hci_user_get_handle(int device, const bdaddr_t * peer, uint16_t * handle)
+{
+  s_device * dev = get_device(device);
+  if(dev == NULL)
+  {
+    return -1;
+  }
+
+  unsigned int i;
+  for(i = 0; i < sizeof(dev->links) / sizeof(*dev->links); ++i)
+  {
+    if(dev->links[i].used && !bacmp(&dev->links[i].ba, peer))
+    {
+      *handle = dev->links[i].handle;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Get the index of an opened device, from its address.
+ */
+int hci_user_find(const bdaddr_t * ba)
+{
+  int i;
+  for(i = 0; i < HCI_USER_MAX_DEVICES; ++i)
+  {
+    if(devices[i] != NULL && !bacmp(&devices[i]->ba, ba))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int init_device(int device, s_device * dev)
+{
+  if(hci_user_command(device, cmd_opcode_pack(OGF_HOST_CTL, OCF_RESET), NULL, 0, NULL, 0) < 0)
+  {
+    return -1;
+  }
+
+  unsigned char rp[7];
+
+  if(hci_user_command(device, cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BD_ADDR), NULL, 0, rp, sizeof(rp)) < 0)
+  {
+    return -1;
+  }
+  memcpy(&dev->ba, rp + 1, sizeof(dev->ba));
+
+  // status, ACL MTU, SCO MTU, ACL buffers, SCO buffers
+  if(hci_user_command(device, cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BUFFER_SIZE), NULL, 0, rp, sizeof(rp)) < 0)
+  {
+    return -1;
+  }
+  dev->acl_mtu = bt_get_le16(rp + 1);
+  dev->acl_max = bt_get_le16(rp + 4);
+  if(dev->acl_mtu <= L2CAP_HDR_SIZE || dev->acl_max == 0)
+  {
+    fprintf(stderr, "hci%d: bad buffer size (mtu: %u, buffers: %u)\n", device, dev->acl_mtu, dev->acl_max);
+    return -1;
+  }
+  dev->acl_free = dev->acl_max;
+
+  return 0;
+}
+
+static void set_callbacks(s_device * dev, const s_hci_user_callbacks * callbacks)
+{
+  if(callbacks == NULL)
+  {
+    return;
+  }
+  if(callbacks->event != NULL)
+  {
+    dev->callbacks.event = callbacks->event;
+  }
+  if(callbacks->acl != NULL)
+  {
+    dev->callbacks.acl = callbacks->acl;
+  }
+  if(callbacks->acl_ready != NULL)
+  {
+    dev->callbacks.acl_ready = callbacks->acl_ready;
+  }
+}
+
+/*
+ * Initialize a device on top of an opened transport. The transport is closed on failure.
+ */
+static int attach_device(int device, int fd, const s_hci_user_callbacks * callbacks)
+{
+  s_device * dev = calloc(1, sizeof(*dev));
+  if(dev == NULL)
+  {
+    fprintf(stderr, "%s:%d %s: calloc failed\n", __FILE__, __LINE__, __func__);
+    close(fd);
+    return -1;
+  }
+
+  dev->fd = fd;
+  dev->cmd_credits = 1;
+  devices[device] = dev;
+
+  // the callbacks may be needed during the initialization
+  set_callbacks(dev, callbacks);
+
+  if(init_device(device, dev) < 0)
+  {
+    fprintf(stderr, "failed to initialize hci%d\n", device);
+    hci_user_close(device);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Take exclusive ownership of a device.
+ * The device is brought down first, as the kernel only gives up idle devices.
+ * If the device is already opened, only the non-NULL callbacks are set.
+ *
+ * \return 0 if successful, -1 otherwise
+ */
+int hci_user_open(int device, const s_hci_user_callbacks * callbacks)
+{
+  if(device < 0 || device >= HCI_USER_MAX_DEVICES)
+  {
+    fprintf(stderr, "bad device index: %d\n", device);
+    return -1;
+  }
+
+  if(devices[device] != NULL)
+  {
+    set_callbacks(devices[device], callbacks);
+    return 0;
+  }
+
+  int ctl = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
+  if(ctl < 0)
+  {
+    perror("socket");
+    return -1;
+  }
+  if(ioctl(ctl, HCIDEVDOWN, device) < 0 && errno != EALREADY)
+  {
+    perror("HCIDEVDOWN");
+  }
+  close(ctl);
+
+  int fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI);
+  if(fd < 0)
+  {
+    perror("socket");
+    return -1;
+  }
+
+  struct sockaddr_hci addr = { .hci_family = AF_BLUETOOTH, .hci_dev = device, .hci_channel = HCI_CHANNEL_USER };
+
+  if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+  {
+    if(errno == EBUSY)
+    {
+      fprintf(stderr, "hci%d is in use, please stop the bluetooth service\n", device);
+    }
+    else
+    {
+      perror("bind");
+    }
+    close(fd);
+    return -1;
+  }
+
+  return attach_device(device, fd, callbacks);
+}
+
+/*
+ * Use an opened transport instead of the user channel of a device, e.g. to run against an emulated controller.
+ * The transport has to preserve the packet boundaries, and each packet starts with its H4 packet type,
+ * as for the user channel.
+ * The transport is owned by the device from now on.
+ *
+ * \return 0 if successful, -1 otherwise
+ */
+int hci_user_open_fd(int device, int fd, const s_hci_user_callbacks * callbacks)
+{
+  if(device < 0 || device >= HCI_USER_MAX_DEVICES || devices[device] != NULL)
+  {
+    fprintf(stderr, "bad or busy device index: %d\n", device);
+    close(fd);
+    return -1;
+  }
+
+  int flags = fcntl(fd, F_GETFL);
+  if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+  {
+    perror("fcntl O_NONBLOCK");
+    close(fd);
+    return -1;
+  }
+
+  return attach_device(device, fd, callbacks);
+}
+
+/*
+ * Give the device back to the kernel.
+ */
+void hci_user_close(int device)
+{
+  if(device < 0 || device >= HCI_USER_MAX_DEVICES || devices[device] == NULL)
+  {
+    return;
+  }
+
+  close(devices[device]->fd);
+  free(devices[device]);
+  devices[device] = NULL;
+}
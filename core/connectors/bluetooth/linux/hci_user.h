@@ -0,0 +1,48 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef HCI_USER_H_
+#define HCI_USER_H_
+
+#include <stdint.h>
+#include <bluetooth/bluetooth.h>
+
+/*
+ * An HCI device opened through an HCI_CHANNEL_USER socket.
+ * The kernel does not process any traffic of such a device: the host stack is ours.
+ * All the packets of all the peers are exchanged through a single socket.
+ */
+
+#define HCI_USER_L2CAP_MTU 1024 // the largest l2cap frame that can be received
+
+typedef struct
+{
+  // an HCI event, except the flow control ones (can be NULL)
+  void (* event)(int device, const unsigned char * buf, int len);
+  // a reassembled l2cap frame, including the l2cap header
+  void (* acl)(int device, uint16_t handle, const unsigned char * buf, int len);
+  // ACL buffers were released by the controller (can be NULL)
+  void (* acl_ready)(int device);
+} s_hci_user_callbacks;
+
+// the return parameters of a command, starting with the status
+typedef void (* HCI_USER_COMPLETE_CALLBACK)(void * user, const unsigned char * rparam, int rlen);
+
+int hci_user_open(int device, const s_hci_user_callbacks * callbacks);
+int hci_user_open_fd(int device, int fd, const s_hci_user_callbacks * callbacks);
+void hci_user_close(int device);
+int hci_user_find(const bdaddr_t * ba);
+int hci_user_get_fd(int device);
+int hci_user_get_bdaddr(int device, bdaddr_t * ba);
+int hci_user_get_handle(int device, const bdaddr_t * peer, uint16_t * handle);
+int hci_user_command(int device, uint16_t opcode, const void * cparam, uint8_t clen, void * rparam, uint8_t rlen);
+int hci_user_command_async(int device, uint16_t opcode, const void * cparam, uint8_t clen);
+int hci_user_command_cb(int device, uint16_t opcode, const void * cparam, uint8_t clen, HCI_USER_COMPLETE_CALLBACK callback,
+    void * user);
+void hci_user_command_cancel(int device, uint16_t opcode, void * user);
+int hci_user_acl_send(int device, uint16_t handle, uint16_t cid, const unsigned char * buf, int len);
+int hci_user_read(int device);
+
+#endif /* HCI_USER_H_ */
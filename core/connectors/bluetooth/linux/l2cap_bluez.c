@@ -4,6 +4,7 @@
  */
 
 #include <connectors/bluetooth/l2cap_abs.h>
+#include <connectors/bluetooth/bt_stats.h>
 #include <gimx.h>
 #include <gimxpoll/include/gpoll.h>
 
@@ -18,6 +19,12 @@
 
 #define BT_SLOT 625 //microseconds
 
+#ifndef BT_FLUSHABLE
+#define BT_FLUSHABLE 8
+#define BT_FLUSHABLE_OFF 0
+#define BT_FLUSHABLE_ON 1
+#endif
+
 #ifndef BT_POWER
 #define BT_POWER 9
 #define BT_POWER_FORCE_ACTIVE_OFF 0
@@ -32,6 +39,16 @@ struct bt_power {
 
 #define HCI_REQ_TIMEOUT   1000
 
+#define L2CAP_BLUEZ_QUEUE_SIZE 4 // packets
+
+#define HIDP_INPUT_REPORT 0xa1 // DATA transaction, input report
+
+typedef struct
+{
+  unsigned short len;
+  unsigned char buf[L2CAP_MTU];
+} s_queued_packet;
+
 typedef struct
 {
   void * user;
@@ -42,15 +59,36 @@ typedef struct
   uint16_t omtu;
   uint16_t handle;
   int fd;
+  int registered; // fd is registered with read or write callbacks
+  int acl_dd; // raw HCI socket for the l2cap MTU bypass, -1 if not opened
+  int next_free; // next free entry, -1 if none
+  s_bt_stats * stats; // NULL if the allocation failed
   L2CAP_ABS_CONNECT_CALLBACK connect_callback;
   L2CAP_ABS_CLOSE_CALLBACK close_callback;
+  L2CAP_ABS_READ_CALLBACK read_callback;
+  L2CAP_ABS_CLOSE_CALLBACK source_close_callback;
+  struct
+  {
+    s_queued_packet packets[L2CAP_BLUEZ_QUEUE_SIZE];
+    unsigned int count;
+    int wait_fd; // fd waiting for POLLOUT (fd or acl_dd), -1 if none
+    unsigned int replaced; // pending input reports replaced by newer ones
+    unsigned int dropped; // pending input reports dropped because the queue was full
+  } queue;
 } s_channel;
 
+#define L2CAP_BLUEZ_CHANNELS_GROWTH 8
+
+/*
+ * The channel table grows as needed, and the entries of closed channels are reused.
+ * The entries are allocated separately, so that pointers to them remain valid when the table grows.
+ */
 static struct
 {
   unsigned int nb;
-  s_channel channels[L2CAP_ABS_MAX_PEERS*L2CAP_ABS_MAX_CHANNELS];
-} channels = { 0, { } };
+  s_channel ** channels;
+  int free; // first free entry, -1 if none
+} channels = { 0, NULL, -1 };
 
 typedef struct
 {
@@ -65,51 +103,277 @@ static struct
   s_listen_channel channels[L2CAP_ABS_MAX_CHANNELS];
 } listen_channels = { 0, { } };
 
-#if 0
-static int l2cap_bluez_set_flush_timeout(int channel, int timeout_ms)
+/*
+ * Get a free channel entry, growing the table if needed.
+ * Returns the channel index, or -1 if the allocation failed.
+ */
+static int l2cap_bluez_alloc_channel()
 {
-    int result = 0, dd;
-    struct hci_request rq = { 0 };
-
-    write_link_supervision_timeout_cp cmd_param;
+  if(channels.free < 0)
+  {
+    unsigned int size = channels.nb + L2CAP_BLUEZ_CHANNELS_GROWTH;
+    s_channel ** entries = realloc(channels.channels, size * sizeof(*entries));
+    if(entries == NULL)
+    {
+      PRINT_ERROR_ALLOC_FAILED("realloc");
+      return -1;
+    }
+    channels.channels = entries;
 
-    write_link_supervision_timeout_rp cmd_response;
+    unsigned int i;
+    for(i = channels.nb; i < size; ++i)
+    {
+      entries[i] = calloc(1, sizeof(**entries));
+      if(entries[i] == NULL)
+      {
+        PRINT_ERROR_ALLOC_FAILED("calloc");
+        break;
+      }
+      entries[i]->fd = -1;
+      entries[i]->next_free = channels.free;
+      channels.free = i;
+    }
+    channels.nb = i;
 
-    if ((dd = hci_open_dev(channels.channels[channel].devid)) < 0)
+    if(channels.free < 0)
     {
-      perror("hci_open_dev");
       return -1;
     }
+  }
+
+  int channel = channels.free;
+  s_channel * ch = channels.channels[channel];
+  channels.free = ch->next_free;
+
+  memset(ch, 0x00, sizeof(*ch));
+  ch->fd = -1;
+  ch->acl_dd = -1;
+  ch->queue.wait_fd = -1;
+  ch->next_free = -1;
+
+  return channel;
+}
+
+/*
+ * Check that a channel index refers to an open channel.
+ */
+static inline int l2cap_bluez_is_open(int channel)
+{
+  return channel >= 0 && (unsigned int) channel < channels.nb && channels.channels[channel]->fd >= 0;
+}
+
+static void l2cap_bluez_free_channel(int channel)
+{
+  channels.channels[channel]->next_free = channels.free;
+  channels.free = channel;
+}
+
+void l2cap_bluez_clean(void) __attribute__((destructor));
+void l2cap_bluez_clean(void)
+{
+  unsigned int i;
+  for(i = 0; i < channels.nb; ++i)
+  {
+    free(channels.channels[i]);
+  }
+  free(channels.channels);
+  channels.channels = NULL;
+  channels.nb = 0;
+  channels.free = -1;
+}
+
+#define L2CAP_BLUEZ_FLUSH_TIMEOUT 10 // ms, stale interrupt reports are dropped after this delay
+#define L2CAP_BLUEZ_POLL_INTERVAL 1250 // microseconds, the minimum poll interval requested for interrupt channels
+#define L2CAP_BLUEZ_TUNING_TIMEOUT 200 // ms, for each of the (up to 6) tuning commands
+
+#define QOS_SERVICE_TYPE_GUARANTEED 0x02
+#define QOS_NOT_SPECIFIED 0x00000000
+#define QOS_DONT_CARE 0xFFFFFFFF
+
+static int l2cap_bluez_read_flush_timeout(int dd, uint16_t handle, uint16_t * timeout)
+{
+  struct hci_request rq = { 0 };
+  uint16_t cmd_param = htobs(handle);
+  read_automatic_flush_timeout_rp cmd_response;
+
+  rq.ogf = OGF_HOST_CTL;
+  rq.ocf = OCF_READ_AUTOMATIC_FLUSH_TIMEOUT;
+  rq.cparam = &cmd_param;
+  rq.clen = sizeof(cmd_param);
+  rq.rparam = &cmd_response;
+  rq.rlen = sizeof(cmd_response);
+  rq.event = EVT_CMD_COMPLETE;
+
+  if (hci_send_req(dd, &rq, L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
+  {
+    perror("hci_send_req");
+    return -1;
+  }
+  if (cmd_response.status)
+  {
+    errno = bt_error(cmd_response.status);
+    perror("failed to read flush timeout");
+    return -1;
+  }
+
+  *timeout = btohs(cmd_response.timeout);
+
+  return 0;
+}
+
+static int l2cap_bluez_write_flush_timeout(int dd, uint16_t handle, uint16_t timeout)
+{
+  struct hci_request rq = { 0 };
+  write_automatic_flush_timeout_cp cmd_param;
+  write_automatic_flush_timeout_rp cmd_response;
+
+  cmd_param.handle = htobs(handle);
+  cmd_param.timeout = htobs(timeout);
+  rq.ogf = OGF_HOST_CTL;
+  rq.ocf = OCF_WRITE_AUTOMATIC_FLUSH_TIMEOUT;
+  rq.cparam = &cmd_param;
+  rq.clen = sizeof(cmd_param);
+  rq.rparam = &cmd_response;
+  rq.rlen = sizeof(cmd_response);
+  rq.event = EVT_CMD_COMPLETE;
+
+  if (hci_send_req(dd, &rq, L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
+  {
+    perror("hci_send_req");
+    return -1;
+  }
+  if (cmd_response.status)
+  {
+    errno = bt_error(cmd_response.status);
+    perror("failed to set flush timeout");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Request a guaranteed service with a given latency, which the master uses as poll interval.
+ * The granted latency may differ from the requested one.
+ */
+static int l2cap_bluez_qos_setup(int dd, uint16_t handle, uint32_t latency, uint32_t * granted)
+{
+  struct hci_request rq = { 0 };
+  qos_setup_cp cmd_param = { 0 };
+  evt_qos_setup_complete cmd_response;
+
+  cmd_param.handle = htobs(handle);
+  cmd_param.qos.service_type = QOS_SERVICE_TYPE_GUARANTEED;
+  cmd_param.qos.token_rate = htobl(QOS_NOT_SPECIFIED);
+  cmd_param.qos.peak_bandwidth = htobl(QOS_NOT_SPECIFIED);
+  cmd_param.qos.latency = htobl(latency);
+  cmd_param.qos.delay_variation = htobl(QOS_DONT_CARE);
+  rq.ogf = OGF_LINK_POLICY;
+  rq.ocf = OCF_QOS_SETUP;
+  rq.cparam = &cmd_param;
+  rq.clen = QOS_SETUP_CP_SIZE;
+  rq.rparam = &cmd_response;
+  rq.rlen = sizeof(cmd_response);
+  rq.event = EVT_QOS_SETUP_COMPLETE;
+
+  if (hci_send_req(dd, &rq, L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
+  {
+    perror("hci_send_req");
+    return -1;
+  }
+  if (cmd_response.status)
+  {
+    errno = bt_error(cmd_response.status);
+    perror("failed to setup qos");
+    return -1;
+  }
+
+  *granted = btohl(cmd_response.qos.latency);
+
+  return 0;
+}
+
+/*
+ * Tune the link of an interrupt channel for latency (see --bt-link-tuning):
+ * - mark the outgoing packets as flushable, and set an automatic flush timeout,
+ *   so that the controller drops stale reports instead of delivering them late,
+ * - disable sniff mode,
+ * - request a minimum poll interval.
+ * Failures are not fatal, the link is just left as is.
+ * The commands are synchronous, and run from the poll loop: if the dongle does not answer,
+ * each of them blocks for up to L2CAP_BLUEZ_TUNING_TIMEOUT.
+ */
+static void l2cap_bluez_tune_link(int channel)
+{
+  s_channel * ch = channels.channels[channel];
+
+  if (!gimx_params.bt_link_tuning || ch->psm != PSM_HID_INTERRUPT)
+  {
+    return;
+  }
 
-    // build a command packet to send to the bluetooth microcontroller
-    cmd_param.handle = channels.channels[channel].handle;
-    cmd_param.timeout = htobs(timeout_ms/BT_SLOT);
-    rq.ogf = OGF_HOST_CTL;
-    rq.ocf = OCF_WRITE_AUTOMATIC_FLUSH_TIMEOUT;
-    rq.cparam = &cmd_param;
-    rq.clen = sizeof(cmd_param);
-    rq.rparam = &cmd_response;
-    rq.rlen = sizeof(cmd_response);
-    rq.event = EVT_CMD_COMPLETE;
-
-    // send the command and wait for the response
-    if( hci_send_req( dd, &rq, 0 ) < 0)
+  char dst[18];
+  ba2str(&ch->ba_dst, dst);
+
+  int flushable = BT_FLUSHABLE_ON;
+  if (setsockopt(ch->fd, SOL_BLUETOOTH, BT_FLUSHABLE, &flushable, sizeof(flushable)) < 0)
+  {
+    perror("setsockopt BT_FLUSHABLE");
+  }
+
+  int dd;
+  if ((dd = hci_open_dev(ch->devid)) < 0)
+  {
+    perror("hci_open_dev");
+    return;
+  }
+
+  uint16_t flush_before = 0;
+  uint16_t flush_after = 0;
+  uint16_t policy_before = 0;
+  uint16_t policy_after = 0;
+  uint32_t poll_interval = 0;
+
+  if (l2cap_bluez_read_flush_timeout(dd, ch->handle, &flush_before) == 0
+      && l2cap_bluez_write_flush_timeout(dd, ch->handle, L2CAP_BLUEZ_FLUSH_TIMEOUT * 1000 / BT_SLOT) == 0)
+  {
+    l2cap_bluez_read_flush_timeout(dd, ch->handle, &flush_after);
+  }
+
+  // the libbluetooth link policy functions pass the handle and the policy as is
+  uint16_t policy;
+  if (hci_read_link_policy(dd, htobs(ch->handle), &policy, L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
+  {
+    perror("hci_read_link_policy");
+  }
+  else
+  {
+    policy_before = btohs(policy);
+    if (hci_write_link_policy(dd, htobs(ch->handle), htobs(policy_before & ~(HCI_LP_SNIFF | HCI_LP_PARK)),
+        L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
     {
-      perror("hci_send_req");
-      result = -1;
+      perror("hci_write_link_policy");
     }
-    else if( cmd_response.status )
+    else if (hci_read_link_policy(dd, htobs(ch->handle), &policy, L2CAP_BLUEZ_TUNING_TIMEOUT) < 0)
     {
-      errno = bt_error(cmd_response.status);
-      perror("failed to set flush timeout");
-      result = -1;
+      perror("hci_read_link_policy");
     }
+    else
+    {
+      policy_after = btohs(policy);
+    }
+  }
 
-    hci_close_dev(dd);
+  l2cap_bluez_qos_setup(dd, ch->handle, L2CAP_BLUEZ_POLL_INTERVAL, &poll_interval);
 
-    return result;
+  hci_close_dev(dd);
+
+  // a flush timeout of 0 means no automatic flush
+  ginfo(_("%s: link tuning: flush timeout: %uus -> %uus, sniff mode: %s -> %s, poll interval: %uus (requested: %uus)\n"),
+      dst, flush_before * BT_SLOT, flush_after * BT_SLOT,
+      (policy_before & HCI_LP_SNIFF) ? "on" : "off", (policy_after & HCI_LP_SNIFF) ? "on" : "off",
+      poll_interval, L2CAP_BLUEZ_POLL_INTERVAL);
 }
-#endif
 
 #define ACL_MTU 1024
 
@@ -117,7 +381,7 @@ static int l2cap_bluez_set_flush_timeout(int channel, int timeout_ms)
  * This function can be used to bypass the l2cap outgoing MTU check of the Linux kernel.
  * If plen is higher than ACL_MTU, it sends a segmented packet.
  */
-static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned short plen)
+static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned short plen, int blocking)
 {
   int ret = -1, dd = -1;
   uint8_t type = HCI_ACLDATA_PKT;
@@ -127,11 +391,22 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
   int ivn;
   unsigned short data_len;
 
-  if ((dd = hci_open_dev(channels.channels[channel].devid)) < 0)
+  if (channels.channels[channel]->acl_dd < 0)
   {
-    perror("hci_open_dev");
-    return -1;
+    if ((dd = hci_open_dev(channels.channels[channel]->devid)) < 0)
+    {
+      perror("hci_open_dev");
+      return -1;
+    }
+    if (fcntl(dd, F_SETFL, fcntl(dd, F_GETFL) | O_NONBLOCK) < 0)
+    {
+      perror("fcntl O_NONBLOCK");
+      hci_close_dev(dd);
+      return -1;
+    }
+    channels.channels[channel]->acl_dd = dd;
   }
+  dd = channels.channels[channel]->acl_dd;
 
   data_len = ACL_MTU-1-HCI_ACL_HDR_SIZE-L2CAP_HDR_SIZE;
   if(plen < data_len)
@@ -142,13 +417,13 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
   iv[0].iov_base = &type;
   iv[0].iov_len = 1;
 
-  acl_hdr.handle = htobs(acl_handle_pack(channels.channels[channel].handle, ACL_START));
+  acl_hdr.handle = htobs(acl_handle_pack(channels.channels[channel]->handle, ACL_START));
   acl_hdr.dlen = htobs(data_len+L2CAP_HDR_SIZE);
   
   iv[1].iov_base = &acl_hdr;
   iv[1].iov_len = HCI_ACL_HDR_SIZE;
 
-  l2_hdr.cid = htobs(channels.channels[channel].cid);
+  l2_hdr.cid = htobs(channels.channels[channel]->cid);
   l2_hdr.len = htobs(plen);
 
   iv[2].iov_base = &l2_hdr;
@@ -165,12 +440,16 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
   
   while ((ret = writev(dd, iv, ivn)) < 0)
   {
-    if (errno == EAGAIN || errno == EINTR)
+    if (errno == EINTR || (errno == EAGAIN && blocking))
     {
       continue;
     }
-    perror("writev");
-    break;
+    if (errno != EAGAIN)
+    {
+      perror("writev");
+    }
+    // nothing was sent
+    return -1;
   }
   
   if(ret != -1)
@@ -189,7 +468,7 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
       iv[0].iov_base = &type;
       iv[0].iov_len = 1;
 
-      acl_hdr.handle = htobs(acl_handle_pack(channels.channels[channel].handle, ACL_CONT));
+      acl_hdr.handle = htobs(acl_handle_pack(channels.channels[channel]->handle, ACL_CONT));
       acl_hdr.dlen = htobs(plen);
 
       iv[1].iov_base = &acl_hdr;
@@ -199,6 +478,7 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
       iv[2].iov_len = htobs(data_len);
       ivn = 3;
 
+      // the packet was partially sent: complete it
       while ((ret = writev(dd, iv, ivn)) < 0)
       {
         if (errno == EAGAIN || errno == EINTR)
@@ -215,10 +495,13 @@ static int l2cap_bluez_acl_send_data (int channel, unsigned char *data, unsigned
       }
 
       plen -= data_len;
+
+      if(channels.channels[channel]->stats != NULL)
+      {
+        ++channels.channels[channel]->stats->segments;
+      }
     }
   }
-  
-  hci_close_dev(dd);
 
   return ret;
 }
@@ -383,38 +666,44 @@ static int l2cap_bluez_connect_channel(void * user)
 
   int result = 0;
 
-  int fd = channels.channels[channel].fd;
+  int fd = channels.channels[channel]->fd;
 
   if(l2cap_bluez_is_connected(fd))
   {
     gpoll_remove_fd(fd);
 
-    if(channels.channels[channel].connect_callback(channels.channels[channel].user))
+    if(channels.channels[channel]->connect_callback(channels.channels[channel]->user))
     {
       result = -1;
     }
     else
     {
-      if(l2cap_bluez_get_outgoing_mtu(fd, &channels.channels[channel].omtu))
+      if(l2cap_bluez_get_outgoing_mtu(fd, &channels.channels[channel]->omtu))
       {
         result = -1;
       }
       else
       {
-        if(l2cap_bluez_get_handle(fd, &channels.channels[channel].handle))
+        if(l2cap_bluez_get_handle(fd, &channels.channels[channel]->handle))
         {
           result = -1;
         }
         else
         {
-          if(l2cap_bluez_get_cid(fd, &channels.channels[channel].cid))
+          if(l2cap_bluez_get_cid(fd, &channels.channels[channel]->cid))
           {
             result = -1;
           }
           else
           {
-            result = l2cap_bluez_get_devid(&channels.channels[channel].ba_dst,
-                &channels.channels[channel].devid);
+            result = l2cap_bluez_get_devid(&channels.channels[channel]->ba_dst,
+                &channels.channels[channel]->devid);
+            if(result == 0)
+            {
+              channels.channels[channel]->stats = bt_stats_get(channels.channels[channel]->devid,
+                  &channels.channels[channel]->ba_dst);
+              l2cap_bluez_tune_link(channel);
+            }
           }
         }
       }
@@ -422,12 +711,12 @@ static int l2cap_bluez_connect_channel(void * user)
   }
   else
   {
-    fprintf(stderr, "can't connect to psm 0x%04x\n", channels.channels[channel].psm);
+    fprintf(stderr, "can't connect to psm 0x%04x\n", channels.channels[channel]->psm);
     result = -1;
   }
   if(result)
   {
-    channels.channels[channel].close_callback(channels.channels[channel].user);
+    channels.channels[channel]->close_callback(channels.channels[channel]->user);
   }
   return result;
 }
@@ -438,12 +727,6 @@ static int l2cap_bluez_connect(const char * bdaddr_src, const char * bdaddr_dest
     int fd;
     struct sockaddr_l2 addr;
 
-    if(channels.nb == sizeof(channels.channels) / sizeof(*channels.channels))
-    {
-      fprintf(stderr, "no space left for the l2cap connection (out)\n");
-      return -1;
-    }
-
     if ((fd = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK, BTPROTO_L2CAP)) == -1)
     {
       perror("socket");
@@ -476,15 +759,21 @@ static int l2cap_bluez_connect(const char * bdaddr_src, const char * bdaddr_dest
       }
     }
 
-    int channel = channels.nb;
+    int channel = l2cap_bluez_alloc_channel();
+    if(channel < 0)
+    {
+      fprintf(stderr, "no space left for the l2cap connection (out)\n");
+      close(fd);
+      return -1;
+    }
 
-    channels.channels[channel].fd = fd;
+    channels.channels[channel]->fd = fd;
 
-    bacpy(&channels.channels[channel].ba_dst, &addr.l2_bdaddr);
-    channels.channels[channel].psm = psm;
-    channels.channels[channel].user = user;
-    channels.channels[channel].connect_callback = connect_callback;
-    channels.channels[channel].close_callback = close_callback;
+    bacpy(&channels.channels[channel]->ba_dst, &addr.l2_bdaddr);
+    channels.channels[channel]->psm = psm;
+    channels.channels[channel]->user = user;
+    channels.channels[channel]->connect_callback = connect_callback;
+    channels.channels[channel]->close_callback = close_callback;
 
     GPOLL_CALLBACKS callbacks = {
             .fp_read = NULL,
@@ -493,51 +782,339 @@ static int l2cap_bluez_connect(const char * bdaddr_src, const char * bdaddr_dest
     };
     gpoll_register_fd(fd, (void *)(intptr_t) channel, &callbacks);
 
-    ++channels.nb;
-
     return channel;
 }
 
-static int l2cap_bluez_close(int channel)
+static int l2cap_bluez_read_cb(void * user)
 {
-  gpoll_remove_fd(channels.channels[channel].fd);
-  close(channels.channels[channel].fd);
-  channels.channels[channel].fd = -1;
+  s_channel * ch = channels.channels[(intptr_t) user];
 
-  return 1;
+  return ch->read_callback(ch->user);
 }
 
-static int l2cap_bluez_send(int channel, const unsigned char* buf, int len, int blocking)
+static int l2cap_bluez_close_cb(void * user)
 {
-  if(!channels.channels[channel].cid)
+  int channel = (intptr_t) user;
+  s_channel * ch = channels.channels[channel];
+
+  if (ch->source_close_callback != NULL)
   {
-    fprintf(stderr, "connection is still pending\n");
-    return -1;
+    return ch->source_close_callback(ch->user);
+  }
+
+  // no source yet: stop polling, and drop the pending packets
+  gpoll_remove_fd(ch->fd);
+  ch->registered = 0;
+  ch->queue.count = 0;
+  ch->queue.wait_fd = -1;
+
+  return 0;
+}
+
+static int l2cap_bluez_flush_queue(int channel);
+
+static int l2cap_bluez_write_cb(void * user)
+{
+  return l2cap_bluez_flush_queue((intptr_t) user);
+}
+
+/*
+ * (Re)register the l2cap socket, with a read callback once a source is added,
+ * and with a write callback while packets are waiting for the socket to be writable.
+ */
+static void l2cap_bluez_register(int channel)
+{
+  s_channel * ch = channels.channels[channel];
+
+  if (ch->registered)
+  {
+    gpoll_remove_fd(ch->fd);
+    ch->registered = 0;
+  }
+
+  int wait = (ch->queue.wait_fd >= 0 && ch->queue.wait_fd == ch->fd);
+
+  if (ch->read_callback == NULL && !wait)
+  {
+    return;
+  }
+
+  GPOLL_CALLBACKS callbacks = {
+          .fp_read = ch->read_callback ? l2cap_bluez_read_cb : NULL,
+          .fp_write = wait ? l2cap_bluez_write_cb : NULL,
+          .fp_close = l2cap_bluez_close_cb,
+  };
+  if (gpoll_register_fd(ch->fd, (void *)(intptr_t) channel, &callbacks) == 0)
+  {
+    ch->registered = 1;
+  }
+}
+
+/*
+ * Wait for fd to be writable (the l2cap socket, or the raw HCI socket), or stop waiting if fd is -1.
+ */
+static void l2cap_bluez_wait(int channel, int fd)
+{
+  s_channel * ch = channels.channels[channel];
+
+  int previous = ch->queue.wait_fd;
+
+  if (previous == fd)
+  {
+    return;
+  }
+
+  ch->queue.wait_fd = fd;
+
+  if (previous >= 0 && previous == ch->acl_dd)
+  {
+    gpoll_remove_fd(previous);
   }
 
-  if(len > channels.channels[channel].omtu)
+  if (fd >= 0 && fd == ch->acl_dd)
+  {
+    GPOLL_CALLBACKS callbacks = {
+            .fp_read = NULL,
+            .fp_write = l2cap_bluez_write_cb,
+            .fp_close = l2cap_bluez_write_cb,
+    };
+    gpoll_register_fd(fd, (void *)(intptr_t) channel, &callbacks);
+  }
+
+  if (previous == ch->fd || fd == ch->fd)
+  {
+    l2cap_bluez_register(channel);
+  }
+}
+
+/*
+ * Send a packet without waiting.
+ * Returns len on success, or -1 on failure (errno is EAGAIN if the packet could not be sent yet).
+ */
+static int l2cap_bluez_send_now(int channel, const unsigned char* buf, int len, int blocking)
+{
+  s_channel * ch = channels.channels[channel];
+
+  if(len > ch->omtu)
   {
     //bypass the kernel omtu check (usefull for the DS4)
-    if(l2cap_bluez_acl_send_data(channel, (unsigned char*)buf, len) < 0)
+    if(l2cap_bluez_acl_send_data(channel, (unsigned char*)buf, len, blocking) < 0)
     {
-      fprintf(stderr, "acl_send_data failed\n");
+      if(errno != EAGAIN)
+      {
+        fprintf(stderr, "acl_send_data failed\n");
+        if(ch->stats != NULL)
+        {
+          bt_stats_sent(ch->stats, ch->psm, buf, -1);
+        }
+      }
       return -1;
     }
+    if(ch->stats != NULL)
+    {
+      ++ch->stats->bypassed;
+    }
   }
   else
   {
-    if(send(channels.channels[channel].fd, buf, len, blocking ? 0 : MSG_DONTWAIT) != len)
+    if(send(ch->fd, buf, len, blocking ? 0 : MSG_DONTWAIT) != len)
     {
-      perror("send");
+      if(errno != EAGAIN)
+      {
+        perror("send");
+        if(ch->stats != NULL)
+        {
+          bt_stats_sent(ch->stats, ch->psm, buf, -1);
+        }
+      }
       return -1;
     }
   }
+  if(ch->stats != NULL)
+  {
+    bt_stats_sent(ch->stats, ch->psm, buf, len);
+  }
+  return len;
+}
+
+/*
+ * On the control channel, the same header is used for the GET_REPORT replies,
+ * which must never be replaced or dropped.
+ */
+static inline int l2cap_bluez_is_input_report(int channel, const unsigned char* buf, int len)
+{
+  return channels.channels[channel]->psm == PSM_HID_INTERRUPT && len >= 2 && buf[0] == HIDP_INPUT_REPORT;
+}
+
+/*
+ * Queue a packet until the link can take it.
+ * On the interrupt channel, a newer input report replaces a pending one with the same report id,
+ * and the oldest pending input report is dropped if the queue is full,
+ * so that a congested link drops stale state rather than fresh state.
+ */
+static int l2cap_bluez_enqueue(int channel, const unsigned char* buf, int len)
+{
+  s_channel * ch = channels.channels[channel];
+
+  if((unsigned int) len > sizeof(ch->queue.packets->buf))
+  {
+    fprintf(stderr, "packet is too large for the send queue\n");
+    return -1;
+  }
+
+  unsigned int i;
+
+  if(l2cap_bluez_is_input_report(channel, buf, len))
+  {
+    for(i = 0; i < ch->queue.count; ++i)
+    {
+      s_queued_packet * packet = ch->queue.packets + i;
+      if(l2cap_bluez_is_input_report(channel, packet->buf, packet->len) && packet->buf[1] == buf[1])
+      {
+        memcpy(packet->buf, buf, len);
+        packet->len = len;
+        ++ch->queue.replaced;
+        return len;
+      }
+    }
+  }
+
+  if(ch->queue.count == L2CAP_BLUEZ_QUEUE_SIZE)
+  {
+    for(i = 0; i < ch->queue.count; ++i)
+    {
+      if(l2cap_bluez_is_input_report(channel, ch->queue.packets[i].buf, ch->queue.packets[i].len))
+      {
+        break;
+      }
+    }
+    if(i == ch->queue.count)
+    {
+      fprintf(stderr, "send queue is full (psm 0x%04x)\n", ch->psm);
+      return -1;
+    }
+    memmove(ch->queue.packets + i, ch->queue.packets + i + 1, (ch->queue.count - i - 1) * sizeof(*ch->queue.packets));
+    --ch->queue.count;
+    ++ch->queue.dropped;
+  }
+
+  s_queued_packet * packet = ch->queue.packets + ch->queue.count;
+  memcpy(packet->buf, buf, len);
+  packet->len = len;
+  ++ch->queue.count;
+
   return len;
 }
 
+/*
+ * Send the queued packets, until the queue is empty or the link is congested.
+ */
+static int l2cap_bluez_flush_queue(int channel)
+{
+  s_channel * ch = channels.channels[channel];
+
+  while(ch->queue.count)
+  {
+    s_queued_packet * packet = ch->queue.packets;
+    if(l2cap_bluez_send_now(channel, packet->buf, packet->len, 0) < 0 && errno == EAGAIN)
+    {
+      l2cap_bluez_wait(channel, (packet->len > ch->omtu) ? ch->acl_dd : ch->fd);
+      return 0;
+    }
+    // the packet was sent, or can't be sent
+    --ch->queue.count;
+    memmove(ch->queue.packets, ch->queue.packets + 1, ch->queue.count * sizeof(*ch->queue.packets));
+  }
+
+  l2cap_bluez_wait(channel, -1);
+
+  return 0;
+}
+
+static int l2cap_bluez_close(int channel)
+{
+  if(!l2cap_bluez_is_open(channel))
+  {
+    // already closed
+    return 1;
+  }
+
+  s_channel * ch = channels.channels[channel];
+
+  l2cap_bluez_wait(channel, -1);
+  ch->queue.count = 0;
+
+  if(ch->queue.replaced || ch->queue.dropped)
+  {
+    ginfo("psm 0x%04x: %u pending input reports replaced, %u dropped\n", ch->psm, ch->queue.replaced,
+        ch->queue.dropped);
+  }
+
+  gpoll_remove_fd(ch->fd);
+  ch->registered = 0;
+  close(ch->fd);
+  ch->fd = -1;
+
+  if(ch->acl_dd >= 0)
+  {
+    hci_close_dev(ch->acl_dd);
+    ch->acl_dd = -1;
+  }
+
+  l2cap_bluez_free_channel(channel);
+
+  return 1;
+}
+
+static int l2cap_bluez_send(int channel, const unsigned char* buf, int len, int blocking)
+{
+  if(!l2cap_bluez_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return -1;
+  }
+
+  s_channel * ch = channels.channels[channel];
+
+  if(!ch->cid)
+  {
+    fprintf(stderr, "connection is still pending\n");
+    return -1;
+  }
+
+  if(blocking)
+  {
+    return l2cap_bluez_send_now(channel, buf, len, 1);
+  }
+
+  // keep the packets in order
+  if(ch->queue.count)
+  {
+    return l2cap_bluez_enqueue(channel, buf, len);
+  }
+
+  int ret = l2cap_bluez_send_now(channel, buf, len, 0);
+  if(ret < 0 && errno == EAGAIN)
+  {
+    ret = l2cap_bluez_enqueue(channel, buf, len);
+    if(ret > 0)
+    {
+      l2cap_bluez_wait(channel, (len > ch->omtu) ? ch->acl_dd : ch->fd);
+    }
+  }
+
+  return ret;
+}
+
 static int l2cap_bluez_recv(int channel, unsigned char* buf, int len)
 {
-    return recv(channels.channels[channel].fd, buf, len, MSG_DONTWAIT);
+  if(!l2cap_bluez_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return -1;
+  }
+
+  return recv(channels.channels[channel]->fd, buf, len, MSG_DONTWAIT);
 }
 
 static int l2cap_bluez_connect_accept(void * user)
@@ -568,12 +1145,6 @@ static int l2cap_bluez_connect_accept(void * user)
   psm = btohs(rem_addr.l2_psm);
   cid = btohs(rem_addr.l2_cid);
 
-  if(channels.nb == sizeof(channels.channels) / sizeof(*channels.channels))
-  {
-    fprintf(stderr, "no space left for the l2cap connection (in)\n");
-    return -1;
-  }
-
   uint16_t omtu = 0;
 
   if(l2cap_bluez_get_outgoing_mtu(fd, &omtu) < 0)
@@ -601,17 +1172,26 @@ static int l2cap_bluez_connect_accept(void * user)
     return -1;
   }
 
-  int channel = channels.nb;
+  int channel = l2cap_bluez_alloc_channel();
+  if(channel < 0)
+  {
+    fprintf(stderr, "no space left for the l2cap connection (in)\n");
+    close(fd);
+    return -1;
+  }
 
   //it's required to do this before the callback
   //as the callback may reenter
-  channels.channels[channel].fd = fd;
-  channels.channels[channel].devid = devid;
-  channels.channels[channel].omtu = omtu;
-  channels.channels[channel].handle = handle;
-  channels.channels[channel].psm = psm;
-  channels.channels[channel].cid = cid;
-  ++channels.nb;
+  channels.channels[channel]->fd = fd;
+  channels.channels[channel]->devid = devid;
+  channels.channels[channel]->omtu = omtu;
+  channels.channels[channel]->handle = handle;
+  channels.channels[channel]->psm = psm;
+  channels.channels[channel]->cid = cid;
+  bacpy(&channels.channels[channel]->ba_dst, &src);
+  channels.channels[channel]->stats = bt_stats_get(devid, &src);
+
+  l2cap_bluez_tune_link(channel);
 
   if(listen_channels.channels[listen_channel].accept_callback(channel, &src))
   {
@@ -691,13 +1271,16 @@ static int l2cap_bluez_listen(void * user __attribute__((unused)), const char *
 
 static void l2cap_bluez_add_source(int channel, void * user, L2CAP_ABS_READ_CALLBACK read_callback, L2CAP_ABS_PACKET_CALLBACK packet_callback __attribute__((unused)), L2CAP_ABS_CLOSE_CALLBACK close_callback)
 {
-  channels.channels[channel].user = user;
-  GPOLL_CALLBACKS callbacks = {
-          .fp_read = read_callback,
-          .fp_write = NULL,
-          .fp_close = close_callback
-  };
-  gpoll_register_fd(channels.channels[channel].fd, channels.channels[channel].user, &callbacks);
+  if(!l2cap_bluez_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return;
+  }
+
+  channels.channels[channel]->user = user;
+  channels.channels[channel]->read_callback = read_callback;
+  channels.channels[channel]->source_close_callback = close_callback;
+  l2cap_bluez_register(channel);
 }
 
 static int l2cap_bluez_disconnect(int channel)
@@ -705,13 +1288,18 @@ static int l2cap_bluez_disconnect(int channel)
   int result = 0;
   int dd;
 
-  if ((dd = hci_open_dev(channels.channels[channel].devid)) < 0)
+  if(!l2cap_bluez_is_open(channel))
+  {
+    return -1;
+  }
+
+  if ((dd = hci_open_dev(channels.channels[channel]->devid)) < 0)
   {
     perror("hci_open_dev");
     return -1;
   }
 
-  if(hci_disconnect(dd, channels.channels[channel].handle, HCI_OE_USER_ENDED_CONNECTION, 5*HCI_REQ_TIMEOUT) < 0)
+  if(hci_disconnect(dd, channels.channels[channel]->handle, HCI_OE_USER_ENDED_CONNECTION, 5*HCI_REQ_TIMEOUT) < 0)
   {
     perror("hci_disconnect");
     result = -1;
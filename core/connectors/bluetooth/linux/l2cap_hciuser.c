@@ -0,0 +1,1460 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <connectors/bluetooth/l2cap_abs.h>
+#include <connectors/bluetooth/bt_stats.h>
+#include <connectors/bluetooth/linux/hci_user.h>
+#include <connectors/bluetooth/linux/bt_mgmt.h>
+#include <gimx.h>
+#include <gimxpoll/include/gpoll.h>
+
+#include <bluetooth/hci.h>
+#include <bluetooth/l2cap.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An l2cap implementation on top of HCI user channels (see hci_user.c).
+ * Connections, security and l2cap signaling are handled here, instead of in the kernel.
+ * Only the basic l2cap mode is supported.
+ */
+
+#define L2CAP_MTU 1024
+
+#define L2CAP_HCIUSER_MAX_DEVICES 16 // = HCI_MAX_DEV
+#define L2CAP_HCIUSER_QUEUE_SIZE 8 // frames waiting for controller buffers, per link
+#define L2CAP_HCIUSER_RX_QUEUE_SIZE 4 // frames waiting to be read, per channel
+#define L2CAP_HCIUSER_SEND_TIMEOUT 1000 // ms, for blocking sends
+
+#define HIDP_INPUT_REPORT 0xa1 // DATA transaction, input report
+
+#define SIGNALING_CID 0x0001
+#define FIRST_DYNAMIC_CID 0x0040
+
+#define L2CAP_REJ_NOT_UNDERSTOOD 0x0000
+#define L2CAP_IT_FEAT_MASK 0x0002
+#define L2CAP_IT_FIXED_CHAN 0x0003
+
+#define LINK_KEYS 2 // as many as loaded by bt_mgmt_adapter_init
+
+typedef struct
+{
+  int channel; // -1 for signaling frames
+  uint16_t cid;
+  unsigned short len;
+  unsigned char buf[L2CAP_MTU];
+} s_frame;
+
+typedef enum
+{
+  LINK_FREE,
+  LINK_CONNECTING,
+  LINK_SECURING, // authentication and encryption of outgoing links
+  LINK_CONNECTED,
+} e_link_state;
+
+typedef struct
+{
+  e_link_state state;
+  int device;
+  bdaddr_t ba;
+  uint16_t handle;
+  int outgoing;
+  int options; // L2CAP_ABS_LM_* flags of the outgoing channels
+  uint8_t ident; // last signaling identifier
+  s_bt_stats * stats; // NULL if the allocation failed
+  struct
+  {
+    s_frame frames[L2CAP_HCIUSER_QUEUE_SIZE];
+    unsigned int first;
+    unsigned int count;
+    unsigned int replaced; // pending input reports replaced by newer ones
+    unsigned int dropped; // input reports dropped because the queue was full
+  } queue;
+} s_link;
+
+typedef enum
+{
+  CHANNEL_FREE,
+  CHANNEL_WAIT_LINK, // outgoing channel, the link is not ready yet
+  CHANNEL_WAIT_CONNECT, // outgoing channel, waiting for the connection response
+  CHANNEL_CONFIG,
+  CHANNEL_OPEN,
+  CHANNEL_CLOSED, // closed by the peer, waiting for l2cap_hciuser_close
+} e_channel_state;
+
+#define CONF_IN  0x01 // the configuration of the peer was accepted
+#define CONF_OUT 0x02 // our configuration was accepted
+
+typedef struct
+{
+  e_channel_state state;
+  int link;
+  int listen; // index of the listening channel, -1 for outgoing channels
+  void * user;
+  uint16_t psm;
+  uint16_t lcid;
+  uint16_t rcid;
+  uint16_t omtu;
+  int conf;
+  L2CAP_ABS_CONNECT_CALLBACK connect_callback;
+  L2CAP_ABS_CLOSE_CALLBACK close_callback;
+  L2CAP_ABS_READ_CALLBACK read_callback;
+  L2CAP_ABS_CLOSE_CALLBACK source_close_callback;
+  struct
+  {
+    unsigned short len[L2CAP_HCIUSER_RX_QUEUE_SIZE];
+    unsigned char buf[L2CAP_HCIUSER_RX_QUEUE_SIZE][L2CAP_MTU];
+    unsigned int first;
+    unsigned int count;
+  } rx;
+} s_channel;
+
+typedef struct
+{
+  int used;
+  int device;
+  unsigned short psm;
+  int options;
+  L2CAP_ABS_LISTEN_ACCEPT_CALLBACK accept_callback;
+  L2CAP_ABS_CLOSE_CALLBACK close_callback;
+} s_listen_channel;
+
+static s_link links[L2CAP_ABS_MAX_PEERS] = {};
+
+static s_channel channels[L2CAP_ABS_MAX_PEERS * L2CAP_ABS_MAX_CHANNELS] = {};
+
+static s_listen_channel listen_channels[L2CAP_ABS_MAX_CHANNELS] = {};
+
+static struct
+{
+  int polled;
+  int scanning;
+} devices[L2CAP_HCIUSER_MAX_DEVICES] = {};
+
+#define NB_LINKS (sizeof(links) / sizeof(*links))
+#define NB_CHANNELS (sizeof(channels) / sizeof(*channels))
+#define NB_LISTEN_CHANNELS (sizeof(listen_channels) / sizeof(*listen_channels))
+
+static inline int l2cap_hciuser_is_open(int channel)
+{
+  return channel >= 0 && (unsigned int) channel < NB_CHANNELS && channels[channel].state != CHANNEL_FREE;
+}
+
+static int l2cap_hciuser_find_link(int device, const bdaddr_t * ba)
+{
+  unsigned int i;
+  for(i = 0; i < NB_LINKS; ++i)
+  {
+    if(links[i].state != LINK_FREE && links[i].device == device && !bacmp(&links[i].ba, ba))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int l2cap_hciuser_find_handle(int device, uint16_t handle)
+{
+  unsigned int i;
+  for(i = 0; i < NB_LINKS; ++i)
+  {
+    if(links[i].state >= LINK_SECURING && links[i].device == device && links[i].handle == handle)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int l2cap_hciuser_alloc_link(int device, const bdaddr_t * ba, int outgoing)
+{
+  unsigned int i;
+  for(i = 0; i < NB_LINKS; ++i)
+  {
+    if(links[i].state == LINK_FREE)
+    {
+      memset(links + i, 0x00, sizeof(*links));
+      links[i].state = LINK_CONNECTING;
+      links[i].device = device;
+      bacpy(&links[i].ba, ba);
+      links[i].outgoing = outgoing;
+      return i;
+    }
+  }
+  fprintf(stderr, "no space left for the link\n");
+  return -1;
+}
+
+static int l2cap_hciuser_alloc_channel(int link)
+{
+  unsigned int i;
+  for(i = 0; i < NB_CHANNELS; ++i)
+  {
+    if(channels[i].state == CHANNEL_FREE)
+    {
+      memset(channels + i, 0x00, sizeof(*channels));
+      channels[i].link = link;
+      channels[i].listen = -1;
+      channels[i].lcid = FIRST_DYNAMIC_CID + i;
+      channels[i].omtu = L2CAP_DEFAULT_MTU;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Get the channel a local cid was given to.
+ */
+static int l2cap_hciuser_get_channel(int link, uint16_t lcid)
+{
+  if(lcid < FIRST_DYNAMIC_CID || lcid - FIRST_DYNAMIC_CID >= (int) NB_CHANNELS)
+  {
+    return -1;
+  }
+
+  int channel = lcid - FIRST_DYNAMIC_CID;
+
+  if(channels[channel].state == CHANNEL_FREE || channels[channel].link != link)
+  {
+    return -1;
+  }
+
+  return channel;
+}
+
+/*
+ * Send queued frames until the controller runs out of buffers.
+ */
+static void l2cap_hciuser_flush_queue(int link)
+{
+  s_link * l = links + link;
+
+  while(l->queue.count)
+  {
+    s_frame * frame = l->queue.frames + l->queue.first;
+
+    int ret = hci_user_acl_send(l->device, l->handle, frame->cid, frame->buf, frame->len);
+    if(ret < 0 && errno == EAGAIN)
+    {
+      break;
+    }
+
+    if(ret > 0 && frame->channel >= 0 && l->stats != NULL)
+    {
+      bt_stats_sent(l->stats, channels[frame->channel].psm, frame->buf, ret);
+    }
+
+    l->queue.first = (l->queue.first + 1) % L2CAP_HCIUSER_QUEUE_SIZE;
+    --l->queue.count;
+  }
+}
+
+static inline int l2cap_hciuser_is_input_report(int channel, const unsigned char* buf, int len)
+{
+  return channel >= 0 && channels[channel].psm == PSM_HID_INTERRUPT && len > 0 && buf[0] == HIDP_INPUT_REPORT;
+}
+
+/*
+ * Queue a frame until the controller has free buffers.
+ * Only the newest input report of a channel is kept.
+ */
+static int l2cap_hciuser_enqueue(int link, int channel, uint16_t cid, const unsigned char* buf, int len)
+{
+  s_link * l = links + link;
+
+  if(l2cap_hciuser_is_input_report(channel, buf, len))
+  {
+    unsigned int i;
+    for(i = 0; i < l->queue.count; ++i)
+    {
+      s_frame * frame = l->queue.frames + (l->queue.first + i) % L2CAP_HCIUSER_QUEUE_SIZE;
+      if(frame->channel == channel && l2cap_hciuser_is_input_report(channel, frame->buf, frame->len))
+      {
+        memcpy(frame->buf, buf, len);
+        frame->len = len;
+        ++l->queue.replaced;
+        return len;
+      }
+    }
+  }
+
+  if(l->queue.count == L2CAP_HCIUSER_QUEUE_SIZE)
+  {
+    if(l2cap_hciuser_is_input_report(channel, buf, len))
+    {
+      ++l->queue.dropped;
+      return len;
+    }
+    fprintf(stderr, "no space left in the queue of the link\n");
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  s_frame * frame = l->queue.frames + (l->queue.first + l->queue.count) % L2CAP_HCIUSER_QUEUE_SIZE;
+  frame->channel = channel;
+  frame->cid = cid;
+  memcpy(frame->buf, buf, len);
+  frame->len = len;
+  ++l->queue.count;
+
+  return len;
+}
+
+/*
+ * Send a frame to a channel, or to the signaling channel if channel is -1.
+ */
+static int l2cap_hciuser_send_frame(int link, int channel, uint16_t cid, const unsigned char* buf, int len)
+{
+  s_link * l = links + link;
+
+  if(len > L2CAP_MTU)
+  {
+    fprintf(stderr, "frame is too large: %d\n", len);
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  // keep the frames in order
+  if(l->queue.count == 0)
+  {
+    int ret = hci_user_acl_send(l->device, l->handle, cid, buf, len);
+    if(ret >= 0 || errno != EAGAIN)
+    {
+      if(ret > 0 && channel >= 0 && l->stats != NULL)
+      {
+        bt_stats_sent(l->stats, channels[channel].psm, buf, ret);
+      }
+      return ret;
+    }
+  }
+
+  return l2cap_hciuser_enqueue(link, channel, cid, buf, len);
+}
+
+static int l2cap_hciuser_send_signal(int link, uint8_t code, uint8_t ident, const unsigned char * data, uint16_t len)
+{
+  unsigned char buf[L2CAP_CMD_HDR_SIZE + 16];
+
+  if(len > sizeof(buf) - L2CAP_CMD_HDR_SIZE)
+  {
+    return -1;
+  }
+
+  buf[0] = code;
+  buf[1] = ident;
+  bt_put_le16(len, buf + 2);
+  if(len)
+  {
+    memcpy(buf + L2CAP_CMD_HDR_SIZE, data, len);
+  }
+
+  return l2cap_hciuser_send_frame(link, -1, SIGNALING_CID, buf, L2CAP_CMD_HDR_SIZE + len);
+}
+
+static uint8_t l2cap_hciuser_next_ident(int link)
+{
+  // 0 is not a valid identifier
+  if(++links[link].ident == 0)
+  {
+    links[link].ident = 1;
+  }
+  return links[link].ident;
+}
+
+static void l2cap_hciuser_send_connect_request(int channel)
+{
+  s_channel * ch = channels + channel;
+
+  unsigned char data[4];
+  bt_put_le16(ch->psm, data);
+  bt_put_le16(ch->lcid, data + 2);
+
+  ch->state = CHANNEL_WAIT_CONNECT;
+
+  l2cap_hciuser_send_signal(ch->link, L2CAP_CONN_REQ, l2cap_hciuser_next_ident(ch->link), data, sizeof(data));
+}
+
+static void l2cap_hciuser_send_config_request(int channel)
+{
+  s_channel * ch = channels + channel;
+
+  // dcid, flags, mtu option
+  unsigned char data[8];
+  bt_put_le16(ch->rcid, data);
+  bt_put_le16(0x0000, data + 2);
+  data[4] = L2CAP_CONF_MTU;
+  data[5] = 2;
+  bt_put_le16(L2CAP_MTU, data + 6);
+
+  ch->state = CHANNEL_CONFIG;
+
+  l2cap_hciuser_send_signal(ch->link, L2CAP_CONF_REQ, l2cap_hciuser_next_ident(ch->link), data, sizeof(data));
+}
+
+static void l2cap_hciuser_send_disconnect_request(int channel)
+{
+  s_channel * ch = channels + channel;
+
+  unsigned char data[4];
+  bt_put_le16(ch->rcid, data);
+  bt_put_le16(ch->lcid, data + 2);
+
+  l2cap_hciuser_send_signal(ch->link, L2CAP_DISCONN_REQ, l2cap_hciuser_next_ident(ch->link), data, sizeof(data));
+}
+
+/*
+ * The channel was closed by the peer, or its link was lost.
+ */
+static void l2cap_hciuser_terminate(int channel)
+{
+  s_channel * ch = channels + channel;
+
+  e_channel_state state = ch->state;
+
+  ch->state = CHANNEL_CLOSED;
+
+  if(ch->source_close_callback != NULL)
+  {
+    ch->source_close_callback(ch->user);
+  }
+  else if(state != CHANNEL_OPEN)
+  {
+    if(ch->listen < 0)
+    {
+      // the outgoing channel could not be connected
+      ch->close_callback(ch->user);
+    }
+    else
+    {
+      // the incoming channel was never accepted
+      ch->state = CHANNEL_FREE;
+    }
+  }
+}
+
+static void l2cap_hciuser_check_open(int channel)
+{
+  s_channel * ch = channels + channel;
+
+  if(ch->state != CHANNEL_CONFIG || ch->conf != (CONF_IN | CONF_OUT))
+  {
+    return;
+  }
+
+  ch->state = CHANNEL_OPEN;
+
+  char bdaddr[18];
+  ba2str(&links[ch->link].ba, bdaddr);
+
+  if(ch->listen >= 0)
+  {
+    ginfo("accepted connection from %s (psm: 0x%04x)\n", bdaddr, ch->psm);
+
+    bdaddr_t src;
+    bacpy(&src, &links[ch->link].ba);
+    listen_channels[ch->listen].accept_callback(channel, &src);
+  }
+  else if(ch->connect_callback(ch->user))
+  {
+    ch->state = CHANNEL_CLOSED;
+    ch->close_callback(ch->user);
+  }
+}
+
+static void l2cap_hciuser_link_ready(int link)
+{
+  links[link].state = LINK_CONNECTED;
+
+  unsigned int i;
+  for(i = 0; i < NB_CHANNELS; ++i)
+  {
+    if(channels[i].state == CHANNEL_WAIT_LINK && channels[i].link == link)
+    {
+      l2cap_hciuser_send_connect_request(i);
+    }
+  }
+}
+
+static void l2cap_hciuser_link_closed(int link)
+{
+  s_link * l = links + link;
+
+  if(l->queue.replaced || l->queue.dropped)
+  {
+    ginfo("link 0x%04x: %u pending input reports replaced, %u dropped\n", l->handle, l->queue.replaced, l->queue.dropped);
+  }
+
+  l->state = LINK_FREE;
+
+  unsigned int i;
+  for(i = 0; i < NB_CHANNELS; ++i)
+  {
+    if(channels[i].state != CHANNEL_FREE && channels[i].state != CHANNEL_CLOSED && channels[i].link == link)
+    {
+      l2cap_hciuser_terminate(i);
+    }
+  }
+}
+
+static int l2cap_hciuser_disconnect_link(int link)
+{
+  unsigned char cp[3];
+  bt_put_le16(links[link].handle, cp);
+  cp[2] = HCI_OE_USER_ENDED_CONNECTION;
+
+  return hci_user_command_async(links[link].device, cmd_opcode_pack(OGF_LINK_CTL, OCF_DISCONNECT), cp, sizeof(cp));
+}
+
+/*
+ * A command the link depends on could not be sent.
+ * The link is disconnected, or forgotten if even the disconnection can't be requested.
+ */
+static void l2cap_hciuser_abort_link(int link)
+{
+  char bdaddr[18];
+  ba2str(&links[link].ba, bdaddr);
+  fprintf(stderr, "aborting the link with %s\n", bdaddr);
+
+  if(links[link].state >= LINK_SECURING && l2cap_hciuser_disconnect_link(link) == 0)
+  {
+    // the channels are terminated when the disconnection completes
+    return;
+  }
+
+  l2cap_hciuser_link_closed(link);
+}
+
+/*
+ * Send a reply to a pairing request, the parameters start with the address of the peer.
+ */
+static void l2cap_hciuser_pairing_reply(int device, uint16_t ocf, const void * cp, uint8_t clen)
+{
+  if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, ocf), cp, clen) < 0)
+  {
+    // the pairing would only fail after a timeout
+    int link = l2cap_hciuser_find_link(device, (const bdaddr_t *) cp);
+    if(link >= 0)
+    {
+      l2cap_hciuser_abort_link(link);
+    }
+  }
+}
+
+static void l2cap_hciuser_link_key_request(int device, const bdaddr_t * ba)
+{
+  bdaddr_t bdaddrs[LINK_KEYS] = {};
+  unsigned char keys[LINK_KEYS][16] = {};
+
+  unsigned char cp[sizeof(*ba) + 16];
+  memcpy(cp, ba, sizeof(*ba));
+
+  if(bt_mgmt_read_link_keys(device, LINK_KEYS, bdaddrs, keys) == 0)
+  {
+    unsigned int i;
+    for(i = 0; i < LINK_KEYS; ++i)
+    {
+      if(!bacmp(bdaddrs + i, ba))
+      {
+        memcpy(cp + sizeof(*ba), keys[i], 16);
+        l2cap_hciuser_pairing_reply(device, OCF_LINK_KEY_REPLY, cp, sizeof(cp));
+        return;
+      }
+    }
+  }
+
+  char bdaddr[18];
+  ba2str(ba, bdaddr);
+  fprintf(stderr, "no link key for %s\n", bdaddr);
+
+  l2cap_hciuser_pairing_reply(device, OCF_LINK_KEY_NEG_REPLY, cp, sizeof(*ba));
+}
+
+static void l2cap_hciuser_connection_request(int device, const unsigned char * params)
+{
+  bdaddr_t ba;
+  memcpy(&ba, params, sizeof(ba));
+
+  // bdaddr, role or reason
+  unsigned char cp[sizeof(ba) + 1];
+  memcpy(cp, &ba, sizeof(ba));
+
+  int listen_channel = -1;
+  unsigned int i;
+  for(i = 0; i < NB_LISTEN_CHANNELS; ++i)
+  {
+    if(listen_channels[i].used && listen_channels[i].device == device)
+    {
+      listen_channel = i;
+      break;
+    }
+  }
+
+  int link = l2cap_hciuser_find_link(device, &ba);
+
+  if(link < 0 && listen_channel >= 0)
+  {
+    link = l2cap_hciuser_alloc_link(device, &ba, 0);
+  }
+
+  if(link < 0)
+  {
+    cp[sizeof(ba)] = HCI_REJECTED_LIMITED_RESOURCES;
+    if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_REJECT_CONN_REQ), cp, sizeof(cp)) < 0)
+    {
+      // there is no link to terminate, the controller rejects the connection after its accept timeout
+      fprintf(stderr, "failed to reject the connection\n");
+    }
+    return;
+  }
+
+  int options = listen_channel >= 0 ? listen_channels[listen_channel].options : links[link].options;
+
+  // 0x00: become the master, 0x01: remain the slave
+  cp[sizeof(ba)] = (options & L2CAP_ABS_LM_MASTER) ? 0x00 : 0x01;
+  if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_ACCEPT_CONN_REQ), cp, sizeof(cp)) < 0)
+  {
+    l2cap_hciuser_abort_link(link);
+  }
+}
+
+static void l2cap_hciuser_connection_complete(int device, const unsigned char * params)
+{
+  bdaddr_t ba;
+  memcpy(&ba, params + 3, sizeof(ba));
+
+  int link = l2cap_hciuser_find_link(device, &ba);
+  if(link < 0 || links[link].state != LINK_CONNECTING)
+  {
+    return;
+  }
+
+  char bdaddr[18];
+  ba2str(&ba, bdaddr);
+
+  if(params[0])
+  {
+    fprintf(stderr, "connection with %s failed: 0x%02x\n", bdaddr, params[0]);
+    l2cap_hciuser_link_closed(link);
+    return;
+  }
+
+  s_link * l = links + link;
+
+  l->handle = acl_handle(bt_get_le16(params + 1));
+  l->stats = bt_stats_get(device, &ba);
+
+  ginfo("connected to %s (handle: 0x%04x)\n", bdaddr, l->handle);
+
+  if(l->outgoing && (l->options & (L2CAP_ABS_LM_AUTH | L2CAP_ABS_LM_ENCRYPT)))
+  {
+    l->state = LINK_SECURING;
+
+    unsigned char cp[2];
+    bt_put_le16(l->handle, cp);
+    if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_AUTH_REQUESTED), cp, sizeof(cp)) < 0)
+    {
+      l2cap_hciuser_abort_link(link);
+    }
+  }
+  else
+  {
+    l2cap_hciuser_link_ready(link);
+  }
+}
+
+static void l2cap_hciuser_process_event(int device, const unsigned char * buf, int len __attribute__((unused)))
+{
+  const unsigned char * params = buf + HCI_EVENT_HDR_SIZE;
+  int plen = buf[1];
+  int link;
+
+  switch(buf[0])
+  {
+    case EVT_CONN_REQUEST:
+      // bdaddr, class, link type
+      if(plen >= 10 && params[9] == ACL_LINK)
+      {
+        l2cap_hciuser_connection_request(device, params);
+      }
+      break;
+    case EVT_CONN_COMPLETE:
+      if(plen >= 11)
+      {
+        l2cap_hciuser_connection_complete(device, params);
+      }
+      break;
+    case EVT_CMD_STATUS:
+      // status, credits, opcode
+      if(plen >= 4 && params[0] && bt_get_le16(params + 2) == cmd_opcode_pack(OGF_LINK_CTL, OCF_CREATE_CONN))
+      {
+        unsigned int i;
+        for(i = 0; i < NB_LINKS; ++i)
+        {
+          if(links[i].state == LINK_CONNECTING && links[i].device == device && links[i].outgoing)
+          {
+            fprintf(stderr, "failed to create the connection: 0x%02x\n", params[0]);
+            l2cap_hciuser_link_closed(i);
+            break;
+          }
+        }
+      }
+      break;
+    case EVT_AUTH_COMPLETE:
+    case EVT_ENCRYPT_CHANGE:
+      // status, handle, (encryption)
+      if(plen >= 3 && (link = l2cap_hciuser_find_handle(device, acl_handle(bt_get_le16(params + 1)))) >= 0
+          && links[link].state == LINK_SECURING)
+      {
+        if(params[0] || (buf[0] == EVT_ENCRYPT_CHANGE && (plen < 4 || !params[3])))
+        {
+          fprintf(stderr, "failed to secure the link: 0x%02x\n", params[0]);
+          l2cap_hciuser_abort_link(link);
+        }
+        else if(buf[0] == EVT_AUTH_COMPLETE && (links[link].options & L2CAP_ABS_LM_ENCRYPT))
+        {
+          unsigned char cp[3];
+          bt_put_le16(links[link].handle, cp);
+          cp[2] = 0x01;
+          if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_SET_CONN_ENCRYPT), cp, sizeof(cp)) < 0)
+          {
+            l2cap_hciuser_abort_link(link);
+          }
+        }
+        else
+        {
+          l2cap_hciuser_link_ready(link);
+        }
+      }
+      break;
+    case EVT_DISCONN_COMPLETE:
+      // status, handle, reason
+      if(plen >= 4 && !params[0] && (link = l2cap_hciuser_find_handle(device, acl_handle(bt_get_le16(params + 1)))) >= 0)
+      {
+        ginfo("link 0x%04x was disconnected: 0x%02x\n", links[link].handle, params[3]);
+        l2cap_hciuser_link_closed(link);
+      }
+      break;
+    case EVT_LINK_KEY_REQ:
+      if(plen >= 6)
+      {
+        l2cap_hciuser_link_key_request(device, (const bdaddr_t *) params);
+      }
+      break;
+    case EVT_PIN_CODE_REQ:
+      // legacy pairing is not supported
+      if(plen >= 6)
+      {
+        l2cap_hciuser_pairing_reply(device, OCF_PIN_CODE_NEG_REPLY, params, 6);
+      }
+      break;
+    case EVT_IO_CAPABILITY_REQUEST:
+      // secure simple pairing is not supported
+      if(plen >= 6)
+      {
+        unsigned char cp[7];
+        memcpy(cp, params, 6);
+        cp[6] = 0x18; // pairing not allowed
+        l2cap_hciuser_pairing_reply(device, OCF_IO_CAPABILITY_NEG_REPLY, cp, sizeof(cp));
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void l2cap_hciuser_connect_request(int link, uint8_t ident, const unsigned char * data, uint16_t len)
+{
+  if(len < 4)
+  {
+    return;
+  }
+
+  uint16_t psm = bt_get_le16(data);
+  uint16_t scid = bt_get_le16(data + 2);
+
+  // dcid, scid, result, status
+  unsigned char rsp[8] = {};
+  bt_put_le16(scid, rsp + 2);
+
+  int listen_channel = -1;
+  unsigned int i;
+  for(i = 0; i < NB_LISTEN_CHANNELS; ++i)
+  {
+    if(listen_channels[i].used && listen_channels[i].device == links[link].device && listen_channels[i].psm == psm)
+    {
+      listen_channel = i;
+      break;
+    }
+  }
+
+  if(listen_channel < 0)
+  {
+    bt_put_le16(L2CAP_CR_BAD_PSM, rsp + 4);
+    l2cap_hciuser_send_signal(link, L2CAP_CONN_RSP, ident, rsp, sizeof(rsp));
+    return;
+  }
+
+  int channel = l2cap_hciuser_alloc_channel(link);
+  if(channel < 0)
+  {
+    fprintf(stderr, "no space left for the l2cap connection (in)\n");
+    bt_put_le16(L2CAP_CR_NO_MEM, rsp + 4);
+    l2cap_hciuser_send_signal(link, L2CAP_CONN_RSP, ident, rsp, sizeof(rsp));
+    return;
+  }
+
+  s_channel * ch = channels + channel;
+  ch->listen = listen_channel;
+  ch->psm = psm;
+  ch->rcid = scid;
+
+  bt_put_le16(ch->lcid, rsp);
+  bt_put_le16(L2CAP_CR_SUCCESS, rsp + 4);
+  l2cap_hciuser_send_signal(link, L2CAP_CONN_RSP, ident, rsp, sizeof(rsp));
+
+  l2cap_hciuser_send_config_request(channel);
+}
+
+static void l2cap_hciuser_connect_response(int link, const unsigned char * data, uint16_t len)
+{
+  if(len < 8)
+  {
+    return;
+  }
+
+  uint16_t dcid = bt_get_le16(data);
+  uint16_t scid = bt_get_le16(data + 2);
+  uint16_t result = bt_get_le16(data + 4);
+
+  int channel = l2cap_hciuser_get_channel(link, scid);
+
+  if(channel < 0 || channels[channel].state != CHANNEL_WAIT_CONNECT)
+  {
+    if(result == L2CAP_CR_SUCCESS)
+    {
+      // the channel was closed in the meantime
+      unsigned char req[4];
+      bt_put_le16(dcid, req);
+      bt_put_le16(scid, req + 2);
+      l2cap_hciuser_send_signal(link, L2CAP_DISCONN_REQ, l2cap_hciuser_next_ident(link), req, sizeof(req));
+    }
+    return;
+  }
+
+  if(result == L2CAP_CR_PEND)
+  {
+    return;
+  }
+
+  if(result != L2CAP_CR_SUCCESS)
+  {
+    fprintf(stderr, "can't connect to psm 0x%04x: 0x%04x\n", channels[channel].psm, result);
+    l2cap_hciuser_terminate(channel);
+    return;
+  }
+
+  channels[channel].rcid = dcid;
+
+  l2cap_hciuser_send_config_request(channel);
+}
+
+static void l2cap_hciuser_config_request(int link, uint8_t ident, const unsigned char * data, uint16_t len)
+{
+  if(len < 4)
+  {
+    return;
+  }
+
+  int channel = l2cap_hciuser_get_channel(link, bt_get_le16(data));
+  if(channel < 0)
+  {
+    unsigned char rej[6];
+    bt_put_le16(0x0002, rej); // invalid cid
+    memcpy(rej + 2, data, 2);
+    bt_put_le16(0x0000, rej + 4);
+    l2cap_hciuser_send_signal(link, L2CAP_COMMAND_REJ, ident, rej, sizeof(rej));
+    return;
+  }
+
+  s_channel * ch = channels + channel;
+
+  // only the mtu is taken into account, other options are accepted as is
+  uint16_t offset = 4;
+  while(offset + 2 <= len && offset + 2 + data[offset + 1] <= len)
+  {
+    if((data[offset] & 0x7f) == L2CAP_CONF_MTU && data[offset + 1] == 2)
+    {
+      ch->omtu = bt_get_le16(data + offset + 2);
+    }
+    offset += 2 + data[offset + 1];
+  }
+
+  // scid, flags, result
+  unsigned char rsp[6];
+  bt_put_le16(ch->rcid, rsp);
+  memcpy(rsp + 2, data + 2, 2);
+  bt_put_le16(L2CAP_CONF_SUCCESS, rsp + 4);
+  l2cap_hciuser_send_signal(link, L2CAP_CONF_RSP, ident, rsp, sizeof(rsp));
+
+  // the configuration may continue in another request
+  if(!(bt_get_le16(data + 2) & 0x0001))
+  {
+    ch->conf |= CONF_IN;
+    l2cap_hciuser_check_open(channel);
+  }
+}
+
+static void l2cap_hciuser_config_response(int link, const unsigned char * data, uint16_t len)
+{
+  if(len < 6)
+  {
+    return;
+  }
+
+  int channel = l2cap_hciuser_get_channel(link, bt_get_le16(data));
+  if(channel < 0 || channels[channel].state != CHANNEL_CONFIG)
+  {
+    return;
+  }
+
+  uint16_t result = bt_get_le16(data + 4);
+  if(result != L2CAP_CONF_SUCCESS)
+  {
+    fprintf(stderr, "configuration of psm 0x%04x was rejected: 0x%04x\n", channels[channel].psm, result);
+    l2cap_hciuser_send_disconnect_request(channel);
+    l2cap_hciuser_terminate(channel);
+    return;
+  }
+
+  channels[channel].conf |= CONF_OUT;
+  l2cap_hciuser_check_open(channel);
+}
+
+static void l2cap_hciuser_disconnect_request(int link, uint8_t ident, const unsigned char * data, uint16_t len)
+{
+  if(len < 4)
+  {
+    return;
+  }
+
+  // the response echoes the request
+  l2cap_hciuser_send_signal(link, L2CAP_DISCONN_RSP, ident, data, 4);
+
+  int channel = l2cap_hciuser_get_channel(link, bt_get_le16(data));
+  if(channel >= 0 && channels[channel].state != CHANNEL_CLOSED)
+  {
+    l2cap_hciuser_terminate(channel);
+  }
+}
+
+static void l2cap_hciuser_info_request(int link, uint8_t ident, const unsigned char * data, uint16_t len)
+{
+  if(len < 2)
+  {
+    return;
+  }
+
+  // type, result, data
+  unsigned char rsp[12] = {};
+  uint16_t type = bt_get_le16(data);
+  uint16_t rlen = 4;
+
+  bt_put_le16(type, rsp);
+
+  switch(type)
+  {
+    case L2CAP_IT_FEAT_MASK:
+      // no extended feature
+      rlen += 4;
+      break;
+    case L2CAP_IT_FIXED_CHAN:
+      // the signaling channel only
+      rsp[4] = 1 << SIGNALING_CID;
+      rlen += 8;
+      break;
+    default:
+      bt_put_le16(L2CAP_IR_NOTSUPP, rsp + 2);
+      break;
+  }
+
+  l2cap_hciuser_send_signal(link, L2CAP_INFO_RSP, ident, rsp, rlen);
+}
+
+static void l2cap_hciuser_process_signaling(int link, const unsigned char * buf, int len)
+{
+  // a signaling frame may contain several commands
+  while(len >= L2CAP_CMD_HDR_SIZE)
+  {
+    uint8_t code = buf[0];
+    uint8_t ident = buf[1];
+    uint16_t clen = bt_get_le16(buf + 2);
+    const unsigned char * data = buf + L2CAP_CMD_HDR_SIZE;
+
+    if(L2CAP_CMD_HDR_SIZE + clen > len)
+    {
+      break;
+    }
+
+    switch(code)
+    {
+      case L2CAP_CONN_REQ:
+        l2cap_hciuser_connect_request(link, ident, data, clen);
+        break;
+      case L2CAP_CONN_RSP:
+        l2cap_hciuser_connect_response(link, data, clen);
+        break;
+      case L2CAP_CONF_REQ:
+        l2cap_hciuser_config_request(link, ident, data, clen);
+        break;
+      case L2CAP_CONF_RSP:
+        l2cap_hciuser_config_response(link, data, clen);
+        break;
+      case L2CAP_DISCONN_REQ:
+        l2cap_hciuser_disconnect_request(link, ident, data, clen);
+        break;
+      case L2CAP_ECHO_REQ:
+        l2cap_hciuser_send_signal(link, L2CAP_ECHO_RSP, ident, data, clen > 16 ? 16 : clen);
+        break;
+      case L2CAP_INFO_REQ:
+        l2cap_hciuser_info_request(link, ident, data, clen);
+        break;
+      case L2CAP_DISCONN_RSP:
+      case L2CAP_ECHO_RSP:
+      case L2CAP_INFO_RSP:
+        break;
+      case L2CAP_COMMAND_REJ:
+        fprintf(stderr, "signaling command %u was rejected\n", ident);
+        break;
+      default:
+        {
+          unsigned char rej[2];
+          bt_put_le16(L2CAP_REJ_NOT_UNDERSTOOD, rej);
+          l2cap_hciuser_send_signal(link, L2CAP_COMMAND_REJ, ident, rej, sizeof(rej));
+        }
+        break;
+    }
+
+    buf += L2CAP_CMD_HDR_SIZE + clen;
+    len -= L2CAP_CMD_HDR_SIZE + clen;
+  }
+}
+
+static void l2cap_hciuser_process_acl(int device, uint16_t handle, const unsigned char * buf, int len)
+{
+  int link = l2cap_hciuser_find_handle(device, handle);
+  if(link < 0)
+  {
+    return;
+  }
+
+  uint16_t cid = bt_get_le16(buf + 2);
+  buf += L2CAP_HDR_SIZE;
+  len -= L2CAP_HDR_SIZE;
+
+  if(cid == SIGNALING_CID)
+  {
+    l2cap_hciuser_process_signaling(link, buf, len);
+    return;
+  }
+
+  int channel = l2cap_hciuser_get_channel(link, cid);
+  if(channel < 0 || channels[channel].state != CHANNEL_OPEN)
+  {
+    return;
+  }
+
+  s_channel * ch = channels + channel;
+
+  if(ch->rx.count == L2CAP_HCIUSER_RX_QUEUE_SIZE || len > L2CAP_MTU)
+  {
+    fprintf(stderr, "psm 0x%04x: frame dropped\n", ch->psm);
+    return;
+  }
+
+  unsigned int index = (ch->rx.first + ch->rx.count) % L2CAP_HCIUSER_RX_QUEUE_SIZE;
+  memcpy(ch->rx.buf[index], buf, len);
+  ch->rx.len[index] = len;
+  ++ch->rx.count;
+
+  if(ch->read_callback != NULL)
+  {
+    ch->read_callback(ch->user);
+  }
+}
+
+static void l2cap_hciuser_acl_ready(int device)
+{
+  unsigned int i;
+  for(i = 0; i < NB_LINKS; ++i)
+  {
+    if(links[i].state >= LINK_SECURING && links[i].device == device)
+    {
+      l2cap_hciuser_flush_queue(i);
+    }
+  }
+}
+
+static s_hci_user_callbacks hci_callbacks =
+{
+  .event = l2cap_hciuser_process_event,
+  .acl = l2cap_hciuser_process_acl,
+  .acl_ready = l2cap_hciuser_acl_ready,
+};
+
+static int l2cap_hciuser_read_cb(void * user)
+{
+  int device = (intptr_t) user;
+
+  if(hci_user_read(device) < 0)
+  {
+    gerror("lost hci%d\n", device);
+
+    gpoll_remove_fd(hci_user_get_fd(device));
+    devices[device].polled = 0;
+    devices[device].scanning = 0;
+
+    unsigned int i;
+    for(i = 0; i < NB_LINKS; ++i)
+    {
+      if(links[i].state != LINK_FREE && links[i].device == device)
+      {
+        l2cap_hciuser_link_closed(i);
+      }
+    }
+
+    hci_user_close(device);
+  }
+
+  return 0;
+}
+
+/*
+ * Start processing the packets of a device.
+ */
+static int l2cap_hciuser_poll_device(const char * bdaddr)
+{
+  bdaddr_t ba;
+  str2ba(bdaddr, &ba);
+
+  int device = hci_user_find(&ba);
+  if(device < 0 || device >= L2CAP_HCIUSER_MAX_DEVICES)
+  {
+    fprintf(stderr, "%s is not opened\n", bdaddr);
+    return -1;
+  }
+
+  if(!devices[device].polled)
+  {
+    if(hci_user_open(device, &hci_callbacks) < 0)
+    {
+      return -1;
+    }
+
+    GPOLL_CALLBACKS callbacks = {
+            .fp_read = l2cap_hciuser_read_cb,
+            .fp_write = NULL,
+            .fp_close = l2cap_hciuser_read_cb,
+    };
+    if(gpoll_register_fd(hci_user_get_fd(device), (void *)(intptr_t) device, &callbacks) < 0)
+    {
+      return -1;
+    }
+
+    devices[device].polled = 1;
+  }
+
+  return device;
+}
+
+static int l2cap_hciuser_connect(const char * bdaddr_src, const char * bdaddr_dest, unsigned short psm, int options,
+    void * user, L2CAP_ABS_CONNECT_CALLBACK connect_callback, L2CAP_ABS_CLOSE_CALLBACK close_callback)
+{
+  int device = l2cap_hciuser_poll_device(bdaddr_src);
+  if(device < 0)
+  {
+    return -1;
+  }
+
+  bdaddr_t dst;
+  str2ba(bdaddr_dest, &dst);
+
+  int link = l2cap_hciuser_find_link(device, &dst);
+  if(link < 0)
+  {
+    if((link = l2cap_hciuser_alloc_link(device, &dst, 1)) < 0)
+    {
+      return -1;
+    }
+
+    // bdaddr, packet types (DM1 DH1 DM3 DH3 DM5 DH5), page scan repetition mode (R1), reserved, clock offset, role switch
+    unsigned char cp[13] = {};
+    memcpy(cp, &dst, sizeof(dst));
+    bt_put_le16(0xcc18, cp + 6);
+    cp[8] = 0x01;
+    cp[12] = (options & L2CAP_ABS_LM_MASTER) ? 0x00 : 0x01;
+
+    if(hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_CREATE_CONN), cp, sizeof(cp)) < 0)
+    {
+      links[link].state = LINK_FREE;
+      return -1;
+    }
+  }
+
+  links[link].options |= options;
+
+  int channel = l2cap_hciuser_alloc_channel(link);
+  if(channel < 0)
+  {
+    fprintf(stderr, "no space left for the l2cap connection (out)\n");
+    return -1;
+  }
+
+  s_channel * ch = channels + channel;
+  ch->state = CHANNEL_WAIT_LINK;
+  ch->psm = psm;
+  ch->user = user;
+  ch->connect_callback = connect_callback;
+  ch->close_callback = close_callback;
+
+  if(links[link].state == LINK_CONNECTED)
+  {
+    l2cap_hciuser_send_connect_request(channel);
+  }
+
+  return channel;
+}
+
+static int l2cap_hciuser_listen(void * user __attribute__((unused)), const char * bdaddr_adapter, unsigned short psm, int options,
+    L2CAP_ABS_LISTEN_ACCEPT_CALLBACK read_callback, L2CAP_ABS_CLOSE_CALLBACK close_callback)
+{
+  int device = l2cap_hciuser_poll_device(bdaddr_adapter);
+  if(device < 0)
+  {
+    return -1;
+  }
+
+  unsigned int channel;
+  for(channel = 0; channel < NB_LISTEN_CHANNELS; ++channel)
+  {
+    if(!listen_channels[channel].used)
+    {
+      break;
+    }
+  }
+
+  if(channel == NB_LISTEN_CHANNELS)
+  {
+    fprintf(stderr, "no space left for listening psm 0x%04x\n", psm);
+    return -1;
+  }
+
+  if(!devices[device].scanning)
+  {
+    // the same name as the one set by bt_mgmt_adapter_init
+    unsigned char name[248] = "Wireless Controller";
+    if(hci_user_command(device, cmd_opcode_pack(OGF_HOST_CTL, OCF_CHANGE_LOCAL_NAME), name, sizeof(name), NULL, 0) < 0)
+    {
+      return -1;
+    }
+
+    // connectable
+    uint8_t scan = SCAN_PAGE;
+    if(hci_user_command(device, cmd_opcode_pack(OGF_HOST_CTL, OCF_WRITE_SCAN_ENABLE), &scan, sizeof(scan), NULL, 0) < 0)
+    {
+      return -1;
+    }
+
+    devices[device].scanning = 1;
+  }
+
+  listen_channels[channel].used = 1;
+  listen_channels[channel].device = device;
+  listen_channels[channel].psm = psm;
+  listen_channels[channel].options = options;
+  listen_channels[channel].accept_callback = read_callback;
+  listen_channels[channel].close_callback = close_callback;
+
+  ginfo("listening on psm: 0x%04x\n", psm);
+
+  return channel;
+}
+
+static int l2cap_hciuser_send(int channel, const unsigned char* buf, int len, int blocking)
+{
+  if(!l2cap_hciuser_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return -1;
+  }
+
+  s_channel * ch = channels + channel;
+
+  if(ch->state != CHANNEL_OPEN)
+  {
+    fprintf(stderr, "connection is still pending\n");
+    return -1;
+  }
+
+  int link = ch->link;
+
+  int ret = l2cap_hciuser_send_frame(link, channel, ch->rcid, buf, len);
+
+  if(ret > 0 && blocking)
+  {
+    // wait for the queue to be sent
+    int fd = hci_user_get_fd(links[link].device);
+    while(links[link].state == LINK_CONNECTED && links[link].queue.count)
+    {
+      struct pollfd pfd = { .fd = fd, .events = POLLIN };
+      if(poll(&pfd, 1, L2CAP_HCIUSER_SEND_TIMEOUT) <= 0 || hci_user_read(links[link].device) < 0)
+      {
+        fprintf(stderr, "psm 0x%04x: blocking send failed\n", ch->psm);
+        return -1;
+      }
+    }
+  }
+
+  return ret;
+}
+
+static int l2cap_hciuser_recv(int channel, unsigned char* buf, int len)
+{
+  if(!l2cap_hciuser_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return -1;
+  }
+
+  s_channel * ch = channels + channel;
+
+  if(!ch->rx.count)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  int ret = ch->rx.len[ch->rx.first];
+  if(ret > len)
+  {
+    ret = len;
+  }
+  memcpy(buf, ch->rx.buf[ch->rx.first], ret);
+
+  ch->rx.first = (ch->rx.first + 1) % L2CAP_HCIUSER_RX_QUEUE_SIZE;
+  --ch->rx.count;
+
+  return ret;
+}
+
+static int l2cap_hciuser_close(int channel)
+{
+  if(!l2cap_hciuser_is_open(channel))
+  {
+    // already closed
+    return 1;
+  }
+
+  s_channel * ch = channels + channel;
+
+  if((ch->state == CHANNEL_CONFIG || ch->state == CHANNEL_OPEN) && links[ch->link].state == LINK_CONNECTED)
+  {
+    l2cap_hciuser_send_disconnect_request(channel);
+  }
+
+  // drop the pending frames of the channel
+  s_link * l = links + ch->link;
+  unsigned int i, count = 0;
+  for(i = 0; i < l->queue.count; ++i)
+  {
+    s_frame * frame = l->queue.frames + (l->queue.first + i) % L2CAP_HCIUSER_QUEUE_SIZE;
+    if(frame->channel != channel)
+    {
+      if(i != count)
+      {
+        *(l->queue.frames + (l->queue.first + count) % L2CAP_HCIUSER_QUEUE_SIZE) = *frame;
+      }
+      ++count;
+    }
+  }
+  l->queue.count = count;
+
+  ch->state = CHANNEL_FREE;
+
+  return 1;
+}
+
+static void l2cap_hciuser_add_source(int channel, void * user, L2CAP_ABS_READ_CALLBACK read_callback, L2CAP_ABS_PACKET_CALLBACK packet_callback __attribute__((unused)), L2CAP_ABS_CLOSE_CALLBACK close_callback)
+{
+  if(!l2cap_hciuser_is_open(channel))
+  {
+    fprintf(stderr, "invalid channel: %d\n", channel);
+    return;
+  }
+
+  s_channel * ch = channels + channel;
+
+  ch->user = user;
+  ch->read_callback = read_callback;
+  ch->source_close_callback = close_callback;
+
+  // deliver the frames received before the source was added
+  unsigned int pending = ch->rx.count;
+  while(pending-- && ch->state == CHANNEL_OPEN && ch->read_callback != NULL)
+  {
+    ch->read_callback(ch->user);
+  }
+}
+
+static int l2cap_hciuser_disconnect(int channel)
+{
+  if(!l2cap_hciuser_is_open(channel))
+  {
+    return -1;
+  }
+
+  int link = channels[channel].link;
+
+  if(links[link].state == LINK_FREE || links[link].state == LINK_CONNECTING)
+  {
+    return -1;
+  }
+
+  // the caller closes the channels
+  return l2cap_hciuser_disconnect_link(link);
+}
+
+static s_l2cap_abs l2cap_hciuser =
+{
+    .connect = l2cap_hciuser_connect,
+    .listen = l2cap_hciuser_listen,
+    .send = l2cap_hciuser_send,
+    .recv = l2cap_hciuser_recv,
+    .close = l2cap_hciuser_close,
+    .add_source = l2cap_hciuser_add_source,
+    .disconnect = l2cap_hciuser_disconnect,
+};
+
+void l2cap_hciuser_init(void) __attribute__((constructor));
+void l2cap_hciuser_init(void)
+{
+  l2cap_abs_register(E_BT_ABS_HCIUSER, &l2cap_hciuser);
+}
+
+/*
+ * Give the devices back to the kernel.
+ */
+void l2cap_hciuser_clean(void) __attribute__((destructor));
+void l2cap_hciuser_clean(void)
+{
+  unsigned int i;
+  for(i = 0; i < L2CAP_HCIUSER_MAX_DEVICES; ++i)
+  {
+    hci_user_close(i);
+  }
+}
@@ -5,6 +5,7 @@
 
 #include <controller.h>
 #include "gimx.h"
+#include "crc32.h"
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -13,7 +14,7 @@
 #include "connectors/btds4.h"
 #include "connectors/bluetooth/linux/bt_mgmt.h"
 #include "connectors/bluetooth/bt_device_abs.h"
-#include <mhash.h>
+#include "connectors/bluetooth/bt_cache.h"
 #include <poll.h>
 #include <arpa/inet.h> /* for htons */
 #else
@@ -37,6 +38,8 @@
 #define HID_TYPE_OUTPUT 2
 #define HID_TYPE_FEATURE 3
 
+#define REPORT_INTERVAL_DISABLED 0x3f // report interval field value of the ps4 output reports
+
 static unsigned char sdp_ps4[] =
 {
   0x07, 0x00, 0x01, 0x01, 0x53, 0x01, 0x50, 0x36, 0x01, 0x4d, 0x36, 0x00, 0x32, 0x09, 0x00, 0x00,
@@ -151,10 +154,27 @@ struct btds4_state {
     s_btds4_report bt_report;
     s_report_ds4 previous;
     int joystick_id;
-    unsigned short inactivity_counter;
+    unsigned int inactivity_counter;
     unsigned char active;
     s_channels ps4_channels;
     s_channels ds4_channels;
+    struct {
+      s_bt_cache_entry entry;
+      int known; // the ps4 is in the cache
+      uint32_t sdp_crc; // checksum of the sdp requests received from the ps4
+      unsigned int sdp_requests;
+      int skipped; // the reconnection work-around was skipped
+      int ready; // the ps4 sent its first interrupt packet
+      gtime start;
+    } cache;
+    struct {
+      unsigned int period; // us, configured report period, 0 means every refresh period
+      unsigned int requested; // report interval field of the last ps4 output report (see report_period)
+      gtime next; // deadline of the next report
+      gtime last; // time of the last report
+      gtime active; // time spent sending reports at the expected rate
+      unsigned int reports; // reports sent at the expected rate
+    } rate;
 };
 
 static struct
@@ -234,6 +254,20 @@ static int read_ps4_sdp(void * user)
   {
     //assume the ps4 requests the sdp descriptor
 
+    /*
+     * Hash the request, except the transaction id (bytes 1 and 2).
+     */
+    struct btds4_state* state = states + btds4_number;
+    if(len > 0)
+    {
+      state->cache.sdp_crc = crc32_update(state->cache.sdp_crc, buf, 1);
+    }
+    if(len > 3)
+    {
+      state->cache.sdp_crc = crc32_update(state->cache.sdp_crc, buf + 3, len - 3);
+    }
+    ++state->cache.sdp_requests;
+
     int ret = l2cap_abs_get()->send(states[btds4_number].ps4_channels.sdp.id, sdp_ds4, sizeof(sdp_ds4), 0);
 
     if(ret < 0)
@@ -267,6 +301,24 @@ static int close_ps4_sdp(void * user)
     return 1;
   }
 
+  if(state->cache.known)
+  {
+    if(state->cache.sdp_requests && crc32_final(state->cache.sdp_crc) == state->cache.entry.sdp_crc)
+    {
+      /*
+       * This ps4 already went through the work-around with this dongle, keep the current connection.
+       * The cache entry is invalidated if the ps4 closes the connection before sending anything.
+       */
+      ginfo("known ps4 %s, skipping the reconnection\n", state->ps4_bdaddr);
+      state->cache.skipped = 1;
+      return 1;
+    }
+
+    ginfo("ps4 %s sdp requests changed, invalidating the cache\n", state->ps4_bdaddr);
+    bt_cache_invalidate(state->dongle_bdaddr.str, state->ps4_bdaddr);
+    state->cache.known = 0;
+  }
+
   /*
    * Warning: this is really hackish...
    * There is an issue at the very first connection.
@@ -509,6 +561,30 @@ static int read_ps4_control(void * user)
   return 0;
 }
 
+/*
+ * Start a new session: the checksum only covers the sdp requests of this session,
+ * and the entry may have been stored or invalidated by the previous one.
+ */
+static void cache_reset(struct btds4_state* state)
+{
+  state->cache.sdp_crc = crc32_init();
+  state->cache.sdp_requests = 0;
+  state->cache.skipped = 0;
+  state->cache.ready = 0;
+  state->cache.known = (bt_cache_load(state->dongle_bdaddr.str, state->ps4_bdaddr, &state->cache.entry) == 0);
+}
+
+static void check_cache(struct btds4_state* state)
+{
+  if(state->cache.skipped && !state->cache.ready)
+  {
+    ginfo("ps4 %s closed the connection, invalidating the cache\n", state->ps4_bdaddr);
+    bt_cache_invalidate(state->dongle_bdaddr.str, state->ps4_bdaddr);
+    state->cache.known = 0;
+    state->cache.skipped = 0;
+  }
+}
+
 static int close_ps4_control(void * user)
 {
   int btds4_number = (intptr_t) user;
@@ -522,6 +598,8 @@ static int close_ps4_control(void * user)
     state->ps4_channels.control.pending = 0;
   }
 
+  check_cache(state);
+
   state->sys.shutdown = 1;
 
   return 1;
@@ -541,6 +619,9 @@ static int connect_ps4_control(void * user)
 
   state->ps4_channels.control.pending = 0;
 
+  ginfo("connected with hci%d = %s to %s psm 0x%04x after %lldms\n", state->dongle_index,
+      state->dongle_bdaddr.str, state->ps4_bdaddr, PSM_HID_CONTROL, GTIME_USEC(gtime_gettime() - state->cache.start) / 1000);
+
   if(state->ds4_channels.control.id >= 0)
   {
     l2cap_abs_get()->add_source(state->ps4_channels.control.id, user, read_ps4_control, process, close_ps4_control);
@@ -564,12 +645,45 @@ static int read_ps4_interrupt(void * user)
   }
   else
   {
+    struct btds4_state* state = states + btds4_number;
+    if(!state->cache.ready)
+    {
+      state->cache.ready = 1;
+      gtime elapsed = gtime_gettime() - state->cache.start;
+      ginfo("ps4 %s ready after %lu.%06lus (%s)\n", state->ps4_bdaddr, GTIME_SECPART(elapsed), GTIME_USECPART(elapsed),
+          state->cache.skipped ? "cached" : "full setup");
+      if(!state->cache.skipped && state->cache.sdp_requests)
+      {
+        strncpy(state->cache.entry.peer, state->ps4_bdaddr, sizeof(state->cache.entry.peer) - 1);
+        state->cache.entry.sdp_crc = crc32_final(state->cache.sdp_crc);
+        bt_cache_store(state->dongle_bdaddr.str, &state->cache.entry);
+      }
+    }
+
     switch(buf[1])
     {
       case 0x11:
       case 0x15:
       case 0x19:
         {
+          /*
+           * The first byte of the output report holds the HID and CRC flags,
+           * and the report interval the ps4 wants in its low bits.
+           */
+          unsigned int requested = buf[2] & 0x3f;
+          if(requested != state->rate.requested)
+          {
+            if(requested == REPORT_INTERVAL_DISABLED)
+            {
+              ginfo("ps4 %s disables the periodic reports\n", state->ps4_bdaddr);
+            }
+            else
+            {
+              ginfo("ps4 %s requests a report interval of %ums\n", state->ps4_bdaddr, requested ? requested : 1);
+            }
+            state->rate.requested = requested;
+          }
+
           int joystick = adapter_get_device(E_DEVICE_TYPE_JOYSTICK, btds4_number);
 
           if(joystick >= 0 && (ginput_joystick_get_haptic(joystick) & GE_HAPTIC_RUMBLE))
@@ -629,24 +743,8 @@ static int ds4_interrupt_rumble(const GE_Event * haptic)
       report.data[7] = haptic->jrumble.weak >> 8;
       report.data[8] = haptic->jrumble.strong >> 8;
 
-#ifndef WIN32
-      MHASH td = mhash_init(MHASH_CRC32B);
-
-      if (td == MHASH_FAILED)
-      {
-        perror("mhash_init");
-      }
-
-      mhash(td, report.data, sizeof(report.data));
-#else
-      //TODO MLA: windows port
-#endif
-
-      unsigned int digest = 0; // crc32 will be stored here
-
-#ifndef WIN32
-      mhash_deinit(td, &digest);
-#endif
+      // the HIDP header (data[0]) is constant
+      unsigned int digest = crc32_final(crc32_update(CRC32_SEED_HIDP_OUTPUT, report.data + 1, sizeof(report.data) - 1));
 
       report.crc32[3] = digest >> 24;
       report.crc32[2] = (digest >> 16) & 0xFF;
@@ -680,6 +778,8 @@ static int close_ps4_interrupt(void * user)
     state->ps4_channels.interrupt.pending = 0;
   }
 
+  check_cache(state);
+
   state->sys.shutdown = 1;
 
   return 1;
@@ -693,6 +793,9 @@ static int connect_ps4_interrupt(void * user)
 
   state->ps4_channels.interrupt.pending = 0;
 
+  ginfo("connected with hci%d = %s to %s psm 0x%04x after %lldms\n", state->dongle_index,
+      state->dongle_bdaddr.str, state->ps4_bdaddr, PSM_HID_INTERRUPT, GTIME_USEC(gtime_gettime() - state->cache.start) / 1000);
+
   if(state->ds4_channels.interrupt.id >= 0)
   {
     l2cap_abs_get()->add_source(state->ps4_channels.interrupt.id, user, read_ps4_interrupt, process, close_ps4_interrupt);
@@ -732,6 +835,8 @@ static int listen_accept_sdp(int channel, bdaddr_t * src)
       if(strchr(states[i].ps4_bdaddr, ':') && !strchr(states[i].ds4_bdaddr, ':'))
       {
         ba2str(src, states[i].ds4_bdaddr);
+        cache_reset(states + i);
+        states[i].cache.start = gtime_gettime();
         states[i].ds4_channels.sdp.id = channel;
         l2cap_abs_get()->add_source(channel, (void *)(intptr_t) i, read_ds4_sdp, process, close_ds4_sdp);
 
@@ -905,7 +1010,8 @@ int btds4_listen(int btds4_number)
   struct btds4_state * state = states + btds4_number;
 
 #ifndef WIN32
-  if(bt_mgmt_adapter_init(state->dongle_index) < 0)
+  // the kernel has no access to devices opened through HCI user channels
+  if(bt_abs_value != E_BT_ABS_HCIUSER && bt_mgmt_adapter_init(state->dongle_index) < 0)
   {
     fprintf(stderr, "failed to initialize bluetooth device\n");
     return -1;
@@ -922,6 +1028,17 @@ int btds4_listen(int btds4_number)
   ba2str(&state->dongle_bdaddr.ba, state->dongle_bdaddr.str);
   state->btds4_number = btds4_number;
 
+  if(gimx_params.bt_report_rate)
+  {
+    state->rate.period = 1000000 / gimx_params.bt_report_rate;
+    if(state->rate.period < (unsigned int) gimx_params.refresh_period)
+    {
+      gwarn("btds4 %d: report rate is limited to the refresh rate (%d Hz)\n", btds4_number, 1000000 / gimx_params.refresh_period);
+    }
+  }
+
+  cache_reset(state);
+
   if (bt_device_abs_get()->write_device_class(state->dongle_index, DS4_DEVICE_CLASS) < 0)
   {
     fprintf(stderr, "failed to set device class\n");
@@ -954,7 +1071,56 @@ int btds4_listen(int btds4_number)
   return 0;
 }
 
-#define INACTIVITY_THRESHOLD 6000 //6000x10ms=60s
+#define INACTIVITY_TIMEOUT 60000000 //60s
+
+/*
+ * The report period is the slowest of the configured one and the one requested by the ps4.
+ * It is 0 if reports can be sent at each refresh period.
+ *
+ * The report interval field is in ms, with 0 meaning 1ms.
+ * When the ps4 disables the periodic reports, only the configured period applies,
+ * as reports are still needed to forward the input changes.
+ */
+static unsigned int report_period(struct btds4_state * state)
+{
+  unsigned int period = state->rate.period;
+
+  if(state->rate.requested != REPORT_INTERVAL_DISABLED)
+  {
+    unsigned int requested = (state->rate.requested ? state->rate.requested : 1) * 1000;
+    if(requested > period)
+    {
+      period = requested;
+    }
+  }
+
+  if(period <= (unsigned int) gimx_params.refresh_period)
+  {
+    period = 0;
+  }
+
+  return period;
+}
+
+/*
+ * Only count reports sent within two report periods, so that inactivity is not measured.
+ */
+static void update_rate(struct btds4_state * state, gtime now)
+{
+  unsigned int period = report_period(state);
+  if(!period)
+  {
+    period = gimx_params.refresh_period;
+  }
+
+  if(state->rate.last && now - state->rate.last < 2000LL * period)
+  {
+    state->rate.active += now - state->rate.last;
+    ++state->rate.reports;
+  }
+
+  state->rate.last = now;
+}
 
 int btds4_send_interrupt(int btds4_number, s_report_ds4* report, int active)
 {
@@ -980,7 +1146,7 @@ int btds4_send_interrupt(int btds4_number, s_report_ds4* report, int active)
   }
   else
   {
-    if(!state->active && state->inactivity_counter == INACTIVITY_THRESHOLD)
+    if(!state->active && state->inactivity_counter == (unsigned int) (INACTIVITY_TIMEOUT / gimx_params.refresh_period))
     {
       return 0;
     }
@@ -988,26 +1154,35 @@ int btds4_send_interrupt(int btds4_number, s_report_ds4* report, int active)
     ++state->inactivity_counter;
   }
 
-  state->bt_report.report = *report;
-
-#ifndef WIN32
-  MHASH td = mhash_init(MHASH_CRC32B);
+  gtime now = gtime_gettime();
 
-  if (td == MHASH_FAILED)
+  unsigned int period = report_period(state);
+  if(period)
   {
-    perror("mhash_init");
+    /*
+     * Skip this refresh period if the next report is not due before the middle of the next one.
+     * The deadline is kept on a fixed grid so that the average rate matches the report period.
+     */
+    gtime interval = 1000LL * period;
+    if(state->rate.next && now + 500LL * gimx_params.refresh_period < state->rate.next)
+    {
+      return 0;
+    }
+    if(state->rate.next && now < state->rate.next + interval)
+    {
+      state->rate.next += interval;
+    }
+    else
+    {
+      state->rate.next = now + interval;
+    }
   }
 
-  mhash(td, &state->bt_report, sizeof(state->bt_report)-4);
-#else
-  //TODO MLA: windows port
-#endif
-
-  unsigned int digest = 0; // crc32 will be stored here
+  state->bt_report.report = *report;
 
-#ifndef WIN32
-  mhash_deinit(td, &digest);
-#endif
+  // the HIDP header is constant
+  unsigned int digest = crc32_final(crc32_update(CRC32_SEED_HIDP_INPUT, &state->bt_report.code,
+      sizeof(state->bt_report) - sizeof(state->bt_report.header) - sizeof(state->bt_report.crc32)));
 
   state->bt_report.crc32[3] = digest >> 24;
   state->bt_report.crc32[2] = (digest >> 16) & 0xFF;
@@ -1023,6 +1198,10 @@ int btds4_send_interrupt(int btds4_number, s_report_ds4* report, int active)
       ret = 0;
     }
   }
+  else
+  {
+    update_rate(state, now);
+  }
 
   return ret;
 }
@@ -1033,6 +1212,17 @@ void btds4_close(int btds4_number)
 
   state->sys.shutdown = 1;
 
+  if(state->rate.reports)
+  {
+    unsigned int period = report_period(state);
+    if(!period)
+    {
+      period = gimx_params.refresh_period;
+    }
+    ginfo("ps4 %s: report rate requested: %.01fHz, achieved: %.01fHz (%u reports)\n", state->ps4_bdaddr,
+        1000000.0 / period, state->rate.reports * 1000000.0 / GTIME_USEC(state->rate.active), state->rate.reports);
+  }
+
   if(state->ps4_channels.control.id >= 0)
   {
     l2cap_abs_get()->disconnect(state->ps4_channels.control.id);
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <gimxgpp/pcprog.h>
 #include <gimxcontroller/include/controller.h>
+#include <gimxtime/include/gtime.h>
 #include "config.h"
 #include "gimx.h"
 
@@ -47,6 +48,16 @@ int gpp_connect(int id, const char* device)
   return ret;
 }
 
+/*
+ * The last output sent to each device, to skip unchanged outputs.
+ */
+static struct
+{
+  int valid;
+  int8_t output[GCAPI_INPUT_TOTAL];
+  gtime time;
+} last[MAX_CONTROLLERS] = {};
+
 static inline int scale_axis(e_controller_type type, int index, int axis[AXIS_MAX])
 {
   return axis[index] * 100 / controller_get_max_signed(type, index);
@@ -121,6 +132,16 @@ int gpp_send(int id, e_controller_type type, int axis[AXIS_MAX])
     }
   }
 
+  gtime now = gtime_gettime();
+
+  // the GPP link is slow, only send changes, and a periodic keepalive
+  if (gimx_params.gpp_keepalive && !gimx_params.force_updates && last[id].valid
+      && !memcmp(last[id].output, output[id], sizeof(last[id].output))
+      && GTIME_USEC(now - last[id].time) < gimx_params.gpp_keepalive)
+  {
+    return 0;
+  }
+
   int res = gpppcprog_output(id, output[id]);
   if(res < 0)
   {
@@ -130,6 +151,12 @@ int gpp_send(int id, e_controller_type type, int axis[AXIS_MAX])
   {
     gwarn("device is busy\n");
   }
+  else
+  {
+    memcpy(last[id].output, output[id], sizeof(last[id].output));
+    last[id].time = now;
+    last[id].valid = 1;
+  }
 
   return ret;
 }
@@ -141,5 +168,12 @@ int8_t gpp_start_async(int id, const GHID_CALLBACKS * callbacks)
 
 void gpp_disconnect(int id)
 {
+  GCAPI_WRITE_STATS stats;
+  if (gpppcprog_get_write_stats(id, &stats) == 0 && stats.count > 0)
+  {
+    ginfo(_("GPP write completion time: average %u us, max %u us (%u writes).\n"), stats.average, stats.max, stats.count);
+  }
+  last[id].valid = 0;
+
   gppcprog_disconnect(id);
 }
@@ -38,6 +38,8 @@ typedef struct GIMX_PACKED
 #define BYTE_VERSION      0x77
 #define BYTE_BAUDRATE     0x88
 #define BYTE_DEBUG        0x99
+#define BYTE_CAPS         0xaa
+#define BYTE_FRAME        0xbb
 #define BYTE_OUT_REPORT   0xee
 #define BYTE_IN_REPORT    0xff
 
@@ -47,4 +49,15 @@ typedef struct GIMX_PACKED
 #define BYTE_LEN_0_BYTE 0x00
 #define BYTE_LEN_1_BYTE 0x01
 
+/*
+ * Capabilities, as answered by the adapter to a BYTE_CAPS packet.
+ * Firmwares that do not know BYTE_CAPS do not answer.
+ */
+#define BYTE_CAP_FRAME 0x01 // BYTE_FRAME packets are supported
+
+/*
+ * The value of a BYTE_FRAME packet is a sequence of packets (header and value),
+ * that are processed as if they were received one after the other.
+ */
+
 #endif /* PROTOCOL_H_ */
@@ -0,0 +1,206 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <connectors/remote_protocol.h>
+
+static inline void write16(unsigned char * buf, uint16_t value) {
+    buf[0] = value >> 8;
+    buf[1] = value;
+}
+
+static inline void write32(unsigned char * buf, uint32_t value) {
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+static inline uint16_t read16(const unsigned char * buf) {
+    return (buf[0] << 8) | buf[1];
+}
+
+static inline uint32_t read32(const unsigned char * buf) {
+    return ((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+/*
+ * Build the answer to a version request.
+ * Returns the answer size.
+ */
+int remote_version_build(unsigned char * buf, const uint16_t * ports, unsigned char count) {
+
+    if (count > MAX_CONTROLLERS) {
+        count = MAX_CONTROLLERS;
+    }
+
+    buf[0] = E_NETWORK_PACKET_VERSION;
+    buf[1] = REMOTE_PROTOCOL_VERSION;
+    buf[2] = count;
+
+    unsigned char i;
+    for (i = 0; i < count; ++i) {
+        write16(buf + 3 + 2 * i, ports[i]);
+    }
+
+    return 3 + 2 * count;
+}
+
+/*
+ * Parse the answer to a version request.
+ * Returns the protocol version, or -1 if the answer is invalid.
+ */
+int remote_version_parse(const unsigned char * buf, unsigned int size, uint16_t * ports, unsigned char * count) {
+
+    if (size < 3 || buf[0] != E_NETWORK_PACKET_VERSION || buf[2] > MAX_CONTROLLERS || size != 3u + 2 * buf[2]) {
+        return -1;
+    }
+
+    *count = buf[2];
+
+    unsigned char i;
+    for (i = 0; i < *count; ++i) {
+        ports[i] = read16(buf + 3 + 2 * i);
+    }
+
+    return buf[1];
+}
+
+void remote_batch_init(s_remote_batch * batch, uint32_t sequence, uint32_t timestamp) {
+
+    batch->buf[0] = E_NETWORK_PACKET_IN_REPORT_BATCH;
+    batch->buf[1] = REMOTE_PROTOCOL_VERSION;
+    batch->buf[2] = 0;
+    write32(batch->buf + 3, sequence);
+    write32(batch->buf + 7, timestamp);
+    batch->size = REMOTE_BATCH_HEADER_SIZE;
+    batch->count = 0;
+}
+
+/*
+ * Add the axes of a controller to a batch.
+ * Only the axes that differ from last_axes are added, unless all is set.
+ * Returns 0 on success, -1 if the batch is full.
+ */
+int remote_batch_add(s_remote_batch * batch, uint16_t port, const int axis[AXIS_MAX], const int last_axes[AXIS_MAX],
+        int all) {
+
+    if (batch->count == MAX_CONTROLLERS) {
+        return -1;
+    }
+
+    unsigned char * block = batch->buf + batch->size;
+    unsigned char nbAxes = 0;
+
+    write16(block, port);
+
+    unsigned char i;
+    for (i = 0; i < AXIS_MAX; ++i) {
+        if (all || last_axes[i] != axis[i]) {
+            unsigned char * entry = block + REMOTE_BATCH_BLOCK_SIZE(nbAxes);
+            entry[0] = (i >= abs_axis_0) ? (0x80 | (i - abs_axis_0)) : i;
+            write32(entry + 1, axis[i]);
+            ++nbAxes;
+        }
+    }
+
+    block[2] = nbAxes;
+
+    batch->size += REMOTE_BATCH_BLOCK_SIZE(nbAxes);
+    ++batch->count;
+    batch->buf[2] = batch->count;
+
+    return 0;
+}
+
+/*
+ * Parse a batched report, and call fp_block for each controller it contains.
+ * Returns 0 on success, -1 if the packet is invalid (in which case fp_block is not called).
+ */
+int remote_batch_parse(const unsigned char * buf, unsigned int size, uint32_t * sequence, uint32_t * timestamp,
+        REMOTE_BLOCK_CALLBACK fp_block, void * user) {
+
+    if (size < REMOTE_BATCH_HEADER_SIZE || buf[0] != E_NETWORK_PACKET_IN_REPORT_BATCH
+            || buf[1] != REMOTE_PROTOCOL_VERSION || buf[2] > MAX_CONTROLLERS) {
+        return -1;
+    }
+
+    // check the whole packet first, so that a truncated packet is not partially applied
+    unsigned int offset = REMOTE_BATCH_HEADER_SIZE;
+    unsigned char i;
+    for (i = 0; i < buf[2]; ++i) {
+        if (offset + REMOTE_BATCH_BLOCK_SIZE(0) > size) {
+            return -1;
+        }
+        offset += REMOTE_BATCH_BLOCK_SIZE(buf[offset + 2]);
+    }
+    if (offset != size) {
+        return -1;
+    }
+
+    *sequence = read32(buf + 3);
+    *timestamp = read32(buf + 7);
+
+    s_remote_axis axes[AXIS_MAX];
+
+    offset = REMOTE_BATCH_HEADER_SIZE;
+    for (i = 0; i < buf[2]; ++i) {
+        const unsigned char * block = buf + offset;
+        unsigned char nbAxes = 0;
+        unsigned char j;
+        for (j = 0; j < block[2]; ++j) {
+            const unsigned char * entry = block + REMOTE_BATCH_BLOCK_SIZE(j);
+            unsigned int axis = ((entry[0] & 0x80) ? abs_axis_0 : 0) + (entry[0] & 0x7f);
+            if (axis < AXIS_MAX) {
+                axes[nbAxes].axis = axis;
+                axes[nbAxes].value = (int32_t) read32(entry + 1);
+                ++nbAxes;
+            }
+        }
+        fp_block(user, read16(block), nbAxes, axes);
+        offset += REMOTE_BATCH_BLOCK_SIZE(block[2]);
+    }
+
+    return 0;
+}
+
+/*
+ * Update the statistics of a stream of batched reports.
+ * Sequence numbers that go backwards are counted as reordered packets, and the lost count is corrected,
+ * as they were previously counted as lost.
+ * Arrival and sending times are in microseconds, and do not need to share the same origin.
+ */
+void remote_stats_update(s_remote_stats * stats, uint32_t sequence, uint32_t timestamp, uint32_t arrival) {
+
+    ++stats->received;
+
+    int32_t transit = arrival - timestamp;
+
+    if (!stats->started) {
+        stats->started = 1;
+        stats->next = sequence + 1;
+        stats->transit = transit;
+        return;
+    }
+
+    int32_t gap = sequence - stats->next;
+
+    if (gap < 0) {
+        ++stats->reordered;
+        if (stats->lost > 0) {
+            --stats->lost;
+        }
+        return;
+    }
+
+    stats->lost += gap;
+    stats->next = sequence + 1;
+
+    int32_t delta = transit - stats->transit;
+    if (delta < 0) {
+        delta = -delta;
+    }
+    stats->transit = transit;
+    stats->jitter += ((int32_t) delta - (int32_t) stats->jitter) / 16;
+}
@@ -0,0 +1,77 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef REMOTE_PROTOCOL_H_
+#define REMOTE_PROTOCOL_H_
+
+#include <stdint.h>
+#include <gimxcontroller/include/defs.h>
+#include <gimx.h>
+
+/*
+ * Version 2 of the remote GIMX protocol.
+ *
+ * It extends the version 1 protocol (see gimx-network-protocol) with two packet types,
+ * that version 1 receivers silently ignore:
+ *
+ * - a version request, answered with the protocol version and the ports of all the controllers
+ *   served by the receiving process:
+ *     request: uint8 type
+ *     answer:  uint8 type, uint8 version, uint8 count, count * uint16 port
+ *
+ * - a batched report, carrying the axis changes of several controllers served by the same process,
+ *   along with a sequence number and a timestamp for loss, reordering and jitter statistics:
+ *     uint8 type, uint8 version, uint8 count, uint32 sequence, uint32 timestamp (us),
+ *     count * { uint16 port, uint8 nbAxes, nbAxes * { uint8 index, int32 value } }
+ *
+ * All fields are big endian. Axis indexes use the version 1 encoding (0x80 flags absolute axes).
+ */
+
+#define REMOTE_PROTOCOL_VERSION 2
+
+#define E_NETWORK_PACKET_VERSION 0xf0
+#define E_NETWORK_PACKET_IN_REPORT_BATCH 0xf1
+
+#define REMOTE_BATCH_HEADER_SIZE 11
+#define REMOTE_BATCH_BLOCK_SIZE(NB_AXES) (3 + (NB_AXES) * 5)
+#define REMOTE_BATCH_MAX_SIZE (REMOTE_BATCH_HEADER_SIZE + MAX_CONTROLLERS * REMOTE_BATCH_BLOCK_SIZE(AXIS_MAX))
+
+#define REMOTE_VERSION_MAX_SIZE (3 + MAX_CONTROLLERS * 2)
+
+typedef struct {
+    unsigned char buf[REMOTE_BATCH_MAX_SIZE];
+    unsigned int size;
+    unsigned char count;
+} s_remote_batch;
+
+typedef struct {
+    unsigned char axis; // offset in the axis table
+    int value;
+} s_remote_axis;
+
+typedef struct {
+    int started;
+    uint32_t next; // next expected sequence number
+    unsigned int received;
+    unsigned int lost;
+    unsigned int reordered;
+    int32_t transit; // last transit time (us), including the clock offset
+    uint32_t jitter; // interarrival jitter (us), as defined in RFC 3550
+} s_remote_stats;
+
+typedef void (* REMOTE_BLOCK_CALLBACK)(void * user, uint16_t port, unsigned char nbAxes, const s_remote_axis * axes);
+
+int remote_version_build(unsigned char * buf, const uint16_t * ports, unsigned char count);
+int remote_version_parse(const unsigned char * buf, unsigned int size, uint16_t * ports, unsigned char * count);
+
+void remote_batch_init(s_remote_batch * batch, uint32_t sequence, uint32_t timestamp);
+int remote_batch_add(s_remote_batch * batch, uint16_t port, const int axis[AXIS_MAX], const int last_axes[AXIS_MAX],
+        int all);
+int remote_batch_parse(const unsigned char * buf, unsigned int size, uint32_t * sequence, uint32_t * timestamp,
+        REMOTE_BLOCK_CALLBACK fp_block, void * user);
+
+void remote_stats_update(s_remote_stats * stats, uint32_t sequence, uint32_t timestamp, uint32_t arrival);
+
+#endif /* REMOTE_PROTOCOL_H_ */
@@ -34,15 +34,46 @@ static inline void trigger2event(int (*callback)(GE_Event*), GE_Event* event, un
   }
 }
 
-static inline void button2event(int (*callback)(GE_Event*), GE_Event* event, unsigned short buttons,
-    unsigned short pbuttons, unsigned short button_mask, uint8_t button_id)
+static const struct
 {
-  unsigned short value;
-  if((value = (buttons & button_mask)) ^ (pbuttons & button_mask))
+  unsigned short mask;
+  uint8_t id;
+} buttons[] =
+{
+  { X360_UP_MASK,    X360_UP_ID    },
+  { X360_DOWN_MASK,  X360_DOWN_ID  },
+  { X360_LEFT_MASK,  X360_LEFT_ID  },
+  { X360_RIGHT_MASK, X360_RIGHT_ID },
+  { X360_START_MASK, X360_START_ID },
+  { X360_BACK_MASK,  X360_BACK_ID  },
+  { X360_LS_MASK,    X360_LS_ID    },
+  { X360_RS_MASK,    X360_RS_ID    },
+  { X360_LB_MASK,    X360_LB_ID    },
+  { X360_RB_MASK,    X360_RB_ID    },
+  { X360_GUIDE_MASK, X360_GUIDE_ID },
+  { X360_A_MASK,     X360_A_ID     },
+  { X360_B_MASK,     X360_B_ID     },
+  { X360_X_MASK,     X360_X_ID     },
+  { X360_Y_MASK,     X360_Y_ID     },
+};
+
+/*
+ * Only walk the buttons whose bits changed.
+ */
+static inline void buttons2event(int (*callback)(GE_Event*), GE_Event* event, unsigned short value,
+    unsigned short pvalue)
+{
+  unsigned short changed = value ^ pvalue;
+  unsigned int i;
+  for (i = 0; changed && i < sizeof(buttons) / sizeof(*buttons); ++i)
   {
-    event->type = value ? GE_JOYBUTTONDOWN : GE_JOYBUTTONUP;
-    event->jbutton.button = button_id;
-    callback(event);
+    if (changed & buttons[i].mask)
+    {
+      changed &= ~buttons[i].mask;
+      event->type = (value & buttons[i].mask) ? GE_JOYBUTTONDOWN : GE_JOYBUTTONUP;
+      event->jbutton.button = buttons[i].id;
+      callback(event);
+    }
   }
 }
 
@@ -54,31 +85,18 @@ void _360Pad2event(int adapter_id __attribute__((unused)), s_report* current, s_
   s_report_x360* x360_current = &current->x360;
   s_report_x360* x360_previous = &previous->x360;
 
+  // skip the report if the buttons, triggers and sticks did not change
+  if (!memcmp(&x360_current->buttons, &x360_previous->buttons,
+      offsetof(s_report_x360, unused) - offsetof(s_report_x360, buttons)))
+  {
+    return;
+  }
+
   /*
    * Buttons
    */
 
-  unsigned short buttons = x360_current->buttons;
-  unsigned short prevButtons = x360_previous->buttons;
-
-  button2event(callback, &event, buttons, prevButtons, X360_UP_MASK, X360_UP_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_DOWN_MASK, X360_DOWN_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_LEFT_MASK, X360_LEFT_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_RIGHT_MASK, X360_RIGHT_ID);
-
-  button2event(callback, &event, buttons, prevButtons, X360_START_MASK, X360_START_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_BACK_MASK, X360_BACK_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_LS_MASK, X360_LS_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_RS_MASK, X360_RS_ID);
-
-  button2event(callback, &event, buttons, prevButtons, X360_LB_MASK, X360_LB_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_RB_MASK, X360_RB_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_GUIDE_MASK, X360_GUIDE_ID);
-
-  button2event(callback, &event, buttons, prevButtons, X360_A_MASK, X360_A_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_B_MASK, X360_B_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_X_MASK, X360_X_ID);
-  button2event(callback, &event, buttons, prevButtons, X360_Y_MASK, X360_Y_ID);
+  buttons2event(callback, &event, x360_current->buttons, x360_previous->buttons);
 
   /*
    * Axes
@@ -118,26 +118,75 @@ static inline void axis2event(int (*callback)(GE_Event*), GE_Event* event, unsig
   }
 }
 
-static inline void button2event(int (*callback)(GE_Event*), GE_Event* event, unsigned short buttons,
-    unsigned short pbuttons, unsigned short button_mask, uint8_t button_id)
+typedef struct
 {
-  unsigned short value;
-  if((value = (buttons & button_mask)) ^ (pbuttons & button_mask))
+  unsigned short mask;
+  uint8_t id;
+} s_button;
+
+static const s_button dir_buttons[] =
+{
+  { DS4_UP_MASK,    DS4_UP_ID    },
+  { DS4_RIGHT_MASK, DS4_RIGHT_ID },
+  { DS4_DOWN_MASK,  DS4_DOWN_ID  },
+  { DS4_LEFT_MASK,  DS4_LEFT_ID  },
+};
+
+static const s_button hat_buttons[] =
+{
+  { DS4_SQUARE_MASK,   DS4_SQUARE_ID   },
+  { DS4_CROSS_MASK,    DS4_CROSS_ID    },
+  { DS4_CIRCLE_MASK,   DS4_CIRCLE_ID   },
+  { DS4_TRIANGLE_MASK, DS4_TRIANGLE_ID },
+};
+
+static const s_button counter_buttons[] =
+{
+  { DS4_L1_MASK,       DS4_L1_ID       },
+  { DS4_R1_MASK,       DS4_R1_ID       },
+#ifndef WIN32
+  { DS4_L2_MASK,       DS4_L2_ID       },
+  { DS4_R2_MASK,       DS4_R2_ID       },
+#endif
+  { DS4_SHARE_MASK,    DS4_SHARE_ID    },
+  { DS4_OPTIONS_MASK,  DS4_OPTIONS_ID  },
+  { DS4_L3_MASK,       DS4_L3_ID       },
+  { DS4_R3_MASK,       DS4_R3_ID       },
+  { DS4_PS_MASK,       DS4_PS_ID       },
+  { DS4_TOUCHPAD_MASK, DS4_TOUCHPAD_ID },
+};
+
+// the upper bits of ButtonsAndCounter are a report counter
+#define DS4_BUTTONS_MASK ((DS4_TOUCHPAD_MASK << 1) - 1)
+
+#define BUTTONS2EVENT(CALLBACK, EVENT, VALUE, PVALUE, BUTTONS) \
+  buttons2event(CALLBACK, EVENT, VALUE, PVALUE, BUTTONS, sizeof(BUTTONS) / sizeof(*BUTTONS))
+
+/*
+ * Only walk the buttons whose bits changed.
+ */
+static inline void buttons2event(int (*callback)(GE_Event*), GE_Event* event, unsigned short value,
+    unsigned short pvalue, const s_button * buttons, unsigned int nb)
+{
+  unsigned short changed = value ^ pvalue;
+  unsigned int i;
+  for (i = 0; changed && i < nb; ++i)
   {
-    event->type = value ? GE_JOYBUTTONDOWN : GE_JOYBUTTONUP;
-    event->jbutton.button = button_id;
-    callback(event);
+    if (changed & buttons[i].mask)
+    {
+      changed &= ~buttons[i].mask;
+      event->type = (value & buttons[i].mask) ? GE_JOYBUTTONDOWN : GE_JOYBUTTONUP;
+      event->jbutton.button = buttons[i].id;
+      callback(event);
+    }
   }
 }
 
-void ds42event(int adapter_id, s_report* current, s_report* previous,
+static inline void joystick2event(s_report_ds4* ds4_current, s_report_ds4* ds4_previous,
     int joystick_id, int (*callback)(GE_Event*))
 {
   GE_Event event = { .jbutton = { .which = joystick_id } };
 
-  s_report_ds4* ds4_current = &current->ds4;
-  s_report_ds4* ds4_previous = &previous->ds4;
-
   /*
    * Buttons
    */
@@ -148,32 +197,18 @@ void ds42event(int adapter_id, s_report* current, s_report* previous,
   unsigned short buttonsAndCounter = ds4_current->ButtonsAndCounter;
   unsigned short prevButtonsAndCounter = ds4_previous->ButtonsAndCounter;
 
-  unsigned char dirButtons = hatToButtons(hatAndButtons & 0x0F);
-  unsigned char prevDirButtons = hatToButtons(prevHatAndButtons & 0x0F);
-
-  button2event(callback, &event, dirButtons, prevDirButtons, DS4_UP_MASK, DS4_UP_ID);
-  button2event(callback, &event, dirButtons, prevDirButtons, DS4_RIGHT_MASK, DS4_RIGHT_ID);
-  button2event(callback, &event, dirButtons, prevDirButtons, DS4_DOWN_MASK, DS4_DOWN_ID);
-  button2event(callback, &event, dirButtons, prevDirButtons, DS4_LEFT_MASK, DS4_LEFT_ID);
+  if((hatAndButtons ^ prevHatAndButtons) & 0x0F)
+  {
+    unsigned char dirButtons = hatToButtons(hatAndButtons & 0x0F);
+    unsigned char prevDirButtons = hatToButtons(prevHatAndButtons & 0x0F);
 
-  button2event(callback, &event, hatAndButtons, prevHatAndButtons, DS4_SQUARE_MASK, DS4_SQUARE_ID);
-  button2event(callback, &event, hatAndButtons, prevHatAndButtons, DS4_CROSS_MASK, DS4_CROSS_ID);
-  button2event(callback, &event, hatAndButtons, prevHatAndButtons, DS4_CIRCLE_MASK, DS4_CIRCLE_ID);
-  button2event(callback, &event, hatAndButtons, prevHatAndButtons, DS4_TRIANGLE_MASK, DS4_TRIANGLE_ID);
+    BUTTONS2EVENT(callback, &event, dirButtons, prevDirButtons, dir_buttons);
+  }
 
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_L1_MASK, DS4_L1_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_R1_MASK, DS4_R1_ID);
-#ifndef WIN32
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_L2_MASK, DS4_L2_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_R2_MASK, DS4_R2_ID);
-#endif
+  BUTTONS2EVENT(callback, &event, hatAndButtons & 0xF0, prevHatAndButtons & 0xF0, hat_buttons);
 
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_SHARE_MASK, DS4_SHARE_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_OPTIONS_MASK, DS4_OPTIONS_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_L3_MASK, DS4_L3_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_R3_MASK, DS4_R3_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_PS_MASK, DS4_PS_ID);
-  button2event(callback, &event, buttonsAndCounter, prevButtonsAndCounter, DS4_TOUCHPAD_MASK, DS4_TOUCHPAD_ID);
+  BUTTONS2EVENT(callback, &event, buttonsAndCounter & DS4_BUTTONS_MASK, prevButtonsAndCounter & DS4_BUTTONS_MASK,
+      counter_buttons);
 
   /*
    * Axes
@@ -188,6 +223,21 @@ void ds42event(int adapter_id, s_report* current, s_report* previous,
 
   trigger2event(callback, &event, ds4_current->Rx, ds4_previous->Rx, DS4_AXIS_L2_ID);
   trigger2event(callback, &event, ds4_current->Ry, ds4_previous->Ry, DS4_AXIS_R2_ID);
+}
+
+void ds42event(int adapter_id, s_report* current, s_report* previous,
+    int joystick_id, int (*callback)(GE_Event*))
+{
+  s_report_ds4* ds4_current = &current->ds4;
+  s_report_ds4* ds4_previous = &previous->ds4;
+
+  // skip the joystick events if the buttons, triggers and sticks did not change
+  if(memcmp(&ds4_current->X, &ds4_previous->X, offsetof(s_report_ds4, ButtonsAndCounter) - offsetof(s_report_ds4, X))
+      || ((ds4_current->ButtonsAndCounter ^ ds4_previous->ButtonsAndCounter) & DS4_BUTTONS_MASK)
+      || ds4_current->Rx != ds4_previous->Rx || ds4_current->Ry != ds4_previous->Ry)
+  {
+    joystick2event(ds4_current, ds4_previous, joystick_id, callback);
+  }
 
   //TODO MLA: refactor this
 
@@ -46,6 +46,48 @@ static inline void button2event(int (*callback)(GE_Event*), GE_Event* event, uns
   }
 }
 
+static const struct
+{
+  unsigned short mask;
+  uint8_t id;
+} buttons[] =
+{
+  { XONE_UP_MASK,    X360_UP_ID    },
+  { XONE_DOWN_MASK,  X360_DOWN_ID  },
+  { XONE_LEFT_MASK,  X360_LEFT_ID  },
+  { XONE_RIGHT_MASK, X360_RIGHT_ID },
+  { XONE_MENU_MASK,  X360_START_ID },
+  { XONE_VIEW_MASK,  X360_BACK_ID  },
+  { XONE_LS_MASK,    X360_LS_ID    },
+  { XONE_RS_MASK,    X360_RS_ID    },
+  { XONE_LB_MASK,    X360_LB_ID    },
+  { XONE_RB_MASK,    X360_RB_ID    },
+  { XONE_A_MASK,     X360_A_ID     },
+  { XONE_B_MASK,     X360_B_ID     },
+  { XONE_X_MASK,     X360_X_ID     },
+  { XONE_Y_MASK,     X360_Y_ID     },
+};
+
+/*
+ * Only walk the buttons whose bits changed.
+ */
+static inline void buttons2event(int (*callback)(GE_Event*), GE_Event* event, unsigned short value,
+    unsigned short pvalue)
+{
+  unsigned short changed = value ^ pvalue;
+  unsigned int i;
+  for (i = 0; changed && i < sizeof(buttons) / sizeof(*buttons); ++i)
+  {
+    if (changed & buttons[i].mask)
+    {
+      changed &= ~buttons[i].mask;
+      event->type = (value & buttons[i].mask) ? GE_JOYBUTTONDOWN : GE_JOYBUTTONUP;
+      event->jbutton.button = buttons[i].id;
+      callback(event);
+    }
+  }
+}
+
 void xOnePad2event(int adapter_id __attribute__((unused)), s_report* current, s_report* previous,
     int joystick_id, int (*callback)(GE_Event*))
 {
@@ -56,30 +98,18 @@ void xOnePad2event(int adapter_id __attribute__((unused)), s_report* current, s_
     s_report_xone* xone_current = &current->xone;
     s_report_xone* xone_previous = &previous->xone;
 
+    // skip the report if the buttons, triggers and sticks did not change
+    if (!memcmp(&xone_current->input.buttons, &xone_previous->input.buttons,
+        (unsigned char *)(&xone_current->input + 1) - (unsigned char *)&xone_current->input.buttons))
+    {
+      return;
+    }
+
     /*
      * Buttons
      */
 
-    unsigned short buttons = xone_current->input.buttons;
-    unsigned short prevButtons = xone_previous->input.buttons;
-
-    button2event(callback, &event, buttons, prevButtons, XONE_UP_MASK, X360_UP_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_DOWN_MASK, X360_DOWN_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_LEFT_MASK, X360_LEFT_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_RIGHT_MASK, X360_RIGHT_ID);
-
-    button2event(callback, &event, buttons, prevButtons, XONE_MENU_MASK, X360_START_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_VIEW_MASK, X360_BACK_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_LS_MASK, X360_LS_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_RS_MASK, X360_RS_ID);
-
-    button2event(callback, &event, buttons, prevButtons, XONE_LB_MASK, X360_LB_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_RB_MASK, X360_RB_ID);
-
-    button2event(callback, &event, buttons, prevButtons, XONE_A_MASK, X360_A_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_B_MASK, X360_B_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_X_MASK, X360_X_ID);
-    button2event(callback, &event, buttons, prevButtons, XONE_Y_MASK, X360_Y_ID);
+    buttons2event(callback, &event, xone_current->input.buttons, xone_previous->input.buttons);
 
     /*
      * Axes
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <gimxinput/include/ginput.h>
 #include <gimxtime/include/gtime.h>
+#include <gimxtimer/include/gtimer.h>
 #include <connectors/sixaxis.h>
 #include <connectors/bluetooth/bt_device_abs.h>
 #include <connectors/bluetooth/l2cap_abs.h>
@@ -22,6 +23,11 @@
 
 #define DS3_DEVICE_CLASS 0x508
 
+#define SIXAXIS_CONNECT_TIMEOUT 10000000 // microseconds
+
+#define SIXAXIS_REPORT_MAX 128 // HIDP header + report
+#define SIXAXIS_MAX_RESPONSES 8 // must not be lower than the number of assemble functions
+
 #define HID_HANDSHAKE 0x0
 #define HID_GET_REPORT 0x4
 #define HID_SET_REPORT 0x5
@@ -34,6 +40,11 @@
 
 enum led_state_t { LED_OFF = 0, LED_FLASH, LED_ON };
 
+enum connection_state_t { CONNECTION_IDLE = 0, CONNECTION_DEVICE, CONNECTION_CONTROL, CONNECTION_INTERRUPT, CONNECTION_DONE };
+
+static const char * connection_state_name[] =
+{ "idle", "device", "control", "interrupt", "done" };
+
 struct sixaxis_state_sys {
     /*** Values provided by the system (PS3): */
     int reporting_enabled;
@@ -69,6 +80,24 @@ struct sixaxis_state {
         int pending;
       } interrupt;
     } channels;
+    /*
+     * Feature reports only depend on the session (sixaxis number, bdaddr) and on values set by the PS3.
+     * They are assembled once, and again only when one of these values changes.
+     * Indexed like sixaxis_assemble, len is 0 if the response has to be (re)assembled.
+     */
+    struct
+    {
+      uint8_t buf[SIXAXIS_REPORT_MAX];
+      int len;
+    } responses[SIXAXIS_MAX_RESPONSES];
+    unsigned char recv_buf[1024];
+    struct
+    {
+      enum connection_state_t state;
+      struct gtimer * timer; // connection timeout
+      gtime start;
+      gtime control; // control channel connected
+    } connection;
 };
 
 struct sixaxis_assemble_t {
@@ -85,8 +114,6 @@ struct sixaxis_process_t {
 
 static struct sixaxis_state states[MAX_CONTROLLERS] = {};
 
-static unsigned char buf[1024];
-
 static const char *hid_report_name[] =
 { "reserved", "input", "output", "feature" };
 
@@ -97,6 +124,8 @@ static void sixaxis_init(int sixaxis_number)
   state->sys.reporting_enabled = 0;
   state->sys.feature_ef_byte_6 = 0xb0;
 
+  memset(state->responses, 0x00, sizeof(state->responses));
+
   state->channels.control.id = -1;
   state->channels.interrupt.id = -1;
 
@@ -281,12 +310,18 @@ static int process_output_01(const uint8_t *buf, int len, struct sixaxis_state *
 }
 
 /* Unknown */
+static void invalidate_response(struct sixaxis_state *state, uint8_t type, uint8_t report);
+
 static int process_feature_ef(const uint8_t *buf, int len, struct sixaxis_state *state)
 {
   if (len < 7)
     return -1;
   /* Need to remember byte 6 for assemble_feature_ef */
-  state->sys.feature_ef_byte_6 = buf[6];
+  if (state->sys.feature_ef_byte_6 != buf[6])
+  {
+    state->sys.feature_ef_byte_6 = buf[6];
+    invalidate_response(state, HID_TYPE_FEATURE, 0xef);
+  }
   return 0;
 }
 
@@ -323,29 +358,65 @@ static struct sixaxis_process_t sixaxis_process[] =
 { HID_TYPE_FEATURE, 0xf4, process_feature_f4 },
 { 0 } };
 
-static int send_report(int sixaxis_number, uint16_t psm, uint8_t type, uint8_t report, int blocking)
+/*
+ * Table indexes by type and report id, 0 means no entry, else the table index + 1.
+ */
+static uint8_t assemble_index[4][256];
+static uint8_t process_index[4][256];
+
+static void build_indexes()
 {
-  uint8_t buf[128];
-  int len = 0;
-  int i;
+  static int built = 0;
+  unsigned int i;
 
-  struct sixaxis_state* state = states + sixaxis_number;
+  if (built)
+  {
+    return;
+  }
 
-  /* Assemble report */
   for (i = 0; sixaxis_assemble[i].func; i++)
   {
-    if (sixaxis_assemble[i].type == type
-        && sixaxis_assemble[i].report == report)
+    if (i >= SIXAXIS_MAX_RESPONSES)
     {
-      len = sixaxis_assemble[i].func(&buf[2], sizeof(buf) - 2, state);
+      gerror("too many sixaxis assemble functions\n");
       break;
     }
+    assemble_index[sixaxis_assemble[i].type][sixaxis_assemble[i].report] = i + 1;
+  }
+  for (i = 0; sixaxis_process[i].func; i++)
+  {
+    process_index[sixaxis_process[i].type][sixaxis_process[i].report] = i + 1;
+  }
+
+  built = 1;
+}
+
+static void invalidate_response(struct sixaxis_state *state, uint8_t type, uint8_t report)
+{
+  int index = assemble_index[type][report];
+  if (index)
+  {
+    state->responses[index - 1].len = 0;
+  }
+}
+
+/*
+ * Assemble a report, including the HIDP header.
+ */
+static int assemble_report(uint8_t type, uint8_t report, uint8_t *buf, struct sixaxis_state *state)
+{
+  int len = -1;
+
+  int index = assemble_index[type][report];
+  if (index)
+  {
+    len = sixaxis_assemble[index - 1].func(&buf[2], SIXAXIS_REPORT_MAX - 2, state);
   }
 
-  if (!sixaxis_assemble[i].func || len < 0)
+  if (len < 0)
   {
     gwarn("%s %s report 0x%02x, sending empty response\n",
-        (len < 0) ? "Error assembling" : "Unknown", hid_report_name[type],
+        index ? "Error assembling" : "Unknown", hid_report_name[type],
         report);
     len = 0;
   }
@@ -355,6 +426,35 @@ static int send_report(int sixaxis_number, uint16_t psm, uint8_t type, uint8_t r
   buf[1] = report;
   len += 2;
 
+  return len;
+}
+
+static int send_report(int sixaxis_number, uint16_t psm, uint8_t type, uint8_t report, int blocking)
+{
+  uint8_t report_buf[SIXAXIS_REPORT_MAX];
+  uint8_t *buf;
+  int len;
+  int i;
+
+  struct sixaxis_state* state = states + sixaxis_number;
+
+  int index = assemble_index[type][report];
+  if (type == HID_TYPE_FEATURE && index)
+  {
+    /* Feature reports are answered from the precomputed responses */
+    buf = state->responses[index - 1].buf;
+    len = state->responses[index - 1].len;
+    if (!len)
+    {
+      len = state->responses[index - 1].len = assemble_report(type, report, buf, state);
+    }
+  }
+  else
+  {
+    buf = report_buf;
+    len = assemble_report(type, report, buf, state);
+  }
+
   /* Dump contents */
   if (gimx_params.debug.sixaxis)
   {
@@ -389,16 +489,13 @@ static int process_report(uint8_t type, uint8_t report, const uint8_t *buf, int
   }
 
   /* Process report */
-  for (i = 0; sixaxis_process[i].func; i++)
+  int index = process_index[type][report];
+  if (index)
   {
-    if (sixaxis_process[i].type == type && sixaxis_process[i].report == report)
-    {
-      ret = sixaxis_process[i].func(buf, len, state);
-      break;
-    }
+    ret = sixaxis_process[index - 1].func(buf, len, state);
   }
 
-  if (!sixaxis_process[i].func || ret < 0)
+  if (!index || ret < 0)
   {
     gwarn("%s %s report 0x%02x\n", (ret < 0) ? "Error processing" : "Unknown",
         hid_report_name[type], report);
@@ -521,6 +618,31 @@ static int process(void * user, int psm, const unsigned char *buf, int len)
   return ret;
 }
 
+static void connection_stop_timer(struct sixaxis_state* state)
+{
+  if(state->connection.timer != NULL)
+  {
+    gtimer_close(state->connection.timer);
+    state->connection.timer = NULL;
+  }
+}
+
+/*
+ * Log the failure of a pending connection.
+ */
+static void connection_failed(struct sixaxis_state* state)
+{
+  connection_stop_timer(state);
+
+  if(state->connection.state == CONNECTION_DEVICE || state->connection.state == CONNECTION_CONTROL
+      || state->connection.state == CONNECTION_INTERRUPT)
+  {
+    gerror("sixaxis %d: connection to %s failed after %lldms (%s)\n", state->sixaxis_number, state->bdaddr_dst,
+        GTIME_USEC(gtime_gettime() - state->connection.start) / 1000, connection_state_name[state->connection.state]);
+    state->connection.state = CONNECTION_IDLE;
+  }
+}
+
 static int read_control(void * user)
 {
   int sixaxis_number = (intptr_t) user;
@@ -529,11 +651,11 @@ static int read_control(void * user)
 
   struct sixaxis_state* state = states + sixaxis_number;
 
-  ssize_t len = l2cap_abs_get()->recv(state->channels.control.id, buf, sizeof(buf));
+  ssize_t len = l2cap_abs_get()->recv(state->channels.control.id, state->recv_buf, sizeof(state->recv_buf));
 
   if (len > 0)
   {
-    if (process(user, PSM_HID_CONTROL, buf, len) == -1)
+    if (process(user, PSM_HID_CONTROL, state->recv_buf, len) == -1)
     {
       gwarn("error processing ctrl\n");
     }
@@ -561,6 +683,8 @@ static int close_control(void * user)
     state->channels.control.pending = 0;
   }
 
+  connection_failed(state);
+
   state->sys.shutdown = 1;
   adapter_get(sixaxis_number)->send_command = 1;
 
@@ -575,11 +699,11 @@ static int read_interrupt(void * user)
 
   struct sixaxis_state* state = states + sixaxis_number;
 
-  ssize_t len = l2cap_abs_get()->recv(state->channels.interrupt.id, buf, sizeof(buf));
+  ssize_t len = l2cap_abs_get()->recv(state->channels.interrupt.id, state->recv_buf, sizeof(state->recv_buf));
 
   if (len > 0)
   {
-    if (process(user, PSM_HID_INTERRUPT, buf, len) == -1)
+    if (process(user, PSM_HID_INTERRUPT, state->recv_buf, len) == -1)
     {
       gwarn("error processing data\n");
     }
@@ -605,6 +729,8 @@ static int close_interrupt(void * user)
     state->channels.interrupt.pending = 0;
   }
 
+  connection_failed(state);
+
   state->sys.shutdown = 1;
   adapter_get(sixaxis_number)->send_command = 1;
 
@@ -640,6 +766,35 @@ void sixaxis_close(int sixaxis_number)
   close_control((void *)(intptr_t) sixaxis_number);
 }
 
+static int connection_timer_read(void * user)
+{
+  int sixaxis_number = (intptr_t) user;
+
+  struct sixaxis_state* state = states + sixaxis_number;
+
+  connection_stop_timer(state);
+
+  gerror("sixaxis %d: connection to %s timed out (%s)\n", sixaxis_number, state->bdaddr_dst,
+      connection_state_name[state->connection.state]);
+
+  state->connection.state = CONNECTION_IDLE;
+
+  // the channels are not fully set up, just close them
+  close_interrupt(user);
+  close_control(user);
+
+  return 0;
+}
+
+static int connection_timer_close(void * user)
+{
+  int sixaxis_number = (intptr_t) user;
+
+  connection_stop_timer(states + sixaxis_number);
+
+  return 1;
+}
+
 static int connect_interrupt(void * user)
 {
   int sixaxis_number = (intptr_t) user;
@@ -648,7 +803,14 @@ static int connect_interrupt(void * user)
 
   state->channels.interrupt.pending = 0;
 
-  ginfo("connected with hci%d = %s to %s\n", state->dongle_index, state->bdaddr_src.str, state->bdaddr_dst);
+  connection_stop_timer(state);
+  state->connection.state = CONNECTION_DONE;
+
+  gtime now = gtime_gettime();
+  ginfo("connected with hci%d = %s to %s in %lldms (control: %lldms, interrupt: %lldms)\n", state->dongle_index,
+      state->bdaddr_src.str, state->bdaddr_dst, GTIME_USEC(now - state->connection.start) / 1000,
+      GTIME_USEC(state->connection.control - state->connection.start) / 1000,
+      GTIME_USEC(now - state->connection.control) / 1000);
 
   l2cap_abs_get()->add_source(state->channels.interrupt.id, user, read_interrupt, process, close_interrupt);
 
@@ -663,6 +825,9 @@ static int connect_control(void * user)
 
   state->channels.control.pending = 0;
 
+  state->connection.control = gtime_gettime();
+  state->connection.state = CONNECTION_INTERRUPT;
+
   ginfo("connecting with hci%d = %s to %s psm 0x%04x\n", state->dongle_index,
     state->bdaddr_src.str, state->bdaddr_dst, PSM_HID_INTERRUPT);
 
@@ -681,52 +846,160 @@ static int connect_control(void * user)
   return 0;
 }
 
-int sixaxis_connect(int sixaxis_number, int dongle_index, const char * bdaddr_dst)
+/*
+ * Set up the dongle, and connect the control channel.
+ */
+static int connect_device(int sixaxis_number)
 {
   struct sixaxis_state* state = states + sixaxis_number;
 
-  if(gimx_params.btstack && sixaxis_number)
+  /*
+   * Peers sharing a dongle only need the dongle to be set up once.
+   */
+  int i;
+  for(i = 0; i < sixaxis_number; ++i)
   {
-    gerror("multiple instances are not supported when using btstack\n");
+    if(states[i].connection.state > CONNECTION_DEVICE && states[i].dongle_index == state->dongle_index)
+    {
+      state->bdaddr_src = states[i].bdaddr_src;
+      break;
+    }
+  }
+
+  if(i == sixaxis_number)
+  {
+    if (bt_device_abs_get()->get_bdaddr(state->dongle_index, &state->bdaddr_src.ba) < 0)
+    {
+      gerror("failed to get device address\n");
+      return -1;
+    }
+    ba2str(&state->bdaddr_src.ba, state->bdaddr_src.str);
+
+    if (bt_device_abs_get()->write_device_class(state->dongle_index, DS3_DEVICE_CLASS) < 0)
+    {
+      gerror("failed to get device address\n");
+      return -1;
+    }
+  }
+
+  ginfo("connecting with hci%d = %s to %s psm 0x%04x\n", state->dongle_index,
+    state->bdaddr_src.str, state->bdaddr_dst, PSM_HID_CONTROL);
+
+  if ((state->channels.control.id = l2cap_abs_get()->connect(state->bdaddr_src.str, state->bdaddr_dst,
+      PSM_HID_CONTROL, L2CAP_ABS_LM_MASTER, (void *)(intptr_t) sixaxis_number, connect_control, close_control)) < 0)
+  {
+    gerror("can't connect to control psm\n");
     return -1;
   }
 
-  state->dongle_index = dongle_index;
-  memcpy(state->bdaddr_dst, bdaddr_dst, sizeof(state->bdaddr_dst));
+  state->channels.control.pending = 1;
+  state->connection.state = CONNECTION_CONTROL;
 
-  sixaxis_init(sixaxis_number);
+  return 0;
+}
+
+static enum
+{
+  DEVICE_IDLE,
+  DEVICE_PENDING,
+  DEVICE_READY,
+} device_state = DEVICE_IDLE;
+
+/*
+ * The bluetooth device layer is ready, or failed to initialize: resume the pending connections.
+ */
+static void device_init_cb(void * user __attribute__((unused)), int status)
+{
+  device_state = (status < 0) ? DEVICE_IDLE : DEVICE_READY;
 
-  if(bt_device_abs_get()->init() < 0)
+  if(status < 0)
   {
     gerror("failed to initialize the bluetooth interface\n");
-    return -1;
   }
 
-  if (bt_device_abs_get()->get_bdaddr(state->dongle_index, &state->bdaddr_src.ba) < 0)
+  int i;
+  for(i = 0; i < MAX_CONTROLLERS; ++i)
   {
-    gerror("failed to get device address\n");
-    return -1;
+    struct sixaxis_state* state = states + i;
+    if(state->connection.state != CONNECTION_DEVICE)
+    {
+      continue;
+    }
+    if(status < 0 || connect_device(i) < 0)
+    {
+      connection_failed(state);
+      state->sys.shutdown = 1;
+      adapter_get(i)->send_command = 1;
+    }
   }
-  ba2str(&state->bdaddr_src.ba, state->bdaddr_src.str);
-  state->sixaxis_number = sixaxis_number;
+}
+
+int sixaxis_connect(int sixaxis_number, int dongle_index, const char * bdaddr_dst)
+{
+  struct sixaxis_state* state = states + sixaxis_number;
 
-  if (bt_device_abs_get()->write_device_class(state->dongle_index, DS3_DEVICE_CLASS) < 0)
+  if(gimx_params.btstack && sixaxis_number)
   {
-    gerror("failed to get device address\n");
+    gerror("multiple instances are not supported when using btstack\n");
     return -1;
   }
 
-  ginfo("connecting with hci%d = %s to %s psm 0x%04x\n", state->dongle_index,
-    state->bdaddr_src.str, state->bdaddr_dst, PSM_HID_CONTROL);
+  state->dongle_index = dongle_index;
+  memcpy(state->bdaddr_dst, bdaddr_dst, sizeof(state->bdaddr_dst));
 
-  if ((state->channels.control.id = l2cap_abs_get()->connect(state->bdaddr_src.str, state->bdaddr_dst,
-      PSM_HID_CONTROL, L2CAP_ABS_LM_MASTER, (void *)(intptr_t) sixaxis_number, connect_control, close_control)) < 0)
+  build_indexes();
+
+  sixaxis_init(sixaxis_number);
+
+  state->sixaxis_number = sixaxis_number;
+
+  state->connection.start = gtime_gettime();
+  state->connection.state = CONNECTION_DEVICE;
+
+  /*
+   * The connection to each peer progresses on its own, from the poll loop.
+   * Make sure a peer that does not answer can't stall forever.
+   */
+  GTIMER_CALLBACKS callbacks = {
+          .fp_read = connection_timer_read,
+          .fp_close = connection_timer_close,
+          .fp_register = REGISTER_FUNCTION,
+          .fp_remove = REMOVE_FUNCTION,
+  };
+  state->connection.timer = gtimer_start((void *)(intptr_t) sixaxis_number, SIXAXIS_CONNECT_TIMEOUT, &callbacks);
+  if(state->connection.timer == NULL)
   {
-    gerror("can't connect to control psm\n");
-    return -1;
+    gwarn("failed to start the connection timer\n");
   }
 
-  state->channels.control.pending = 1;
+  switch(device_state)
+  {
+    case DEVICE_IDLE:
+      // the device layer may still be starting (btstack), the connection resumes from the callback
+      device_state = DEVICE_PENDING;
+      if(bt_device_abs_get()->init(device_init_cb, NULL) < 0)
+      {
+        device_state = DEVICE_IDLE;
+        gerror("failed to initialize the bluetooth interface\n");
+        connection_failed(state);
+        return -1;
+      }
+      if(state->connection.state == CONNECTION_IDLE)
+      {
+        // the callback was called right away, and the connection failed
+        return -1;
+      }
+      break;
+    case DEVICE_PENDING:
+      break;
+    case DEVICE_READY:
+      if(connect_device(sixaxis_number) < 0)
+      {
+        connection_failed(state);
+        return -1;
+      }
+      break;
+  }
 
   return 0;
 }
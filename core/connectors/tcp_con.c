@@ -8,73 +8,315 @@
 #include <err.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <pwd.h>
 #else
 #include <connectors/windows/sockets.h>
+#include <ws2tcpip.h>
 #endif
 #include <connectors/tcp_con.h>
+#include <gimxtimer/include/gtimer.h>
 #include "gimx.h"
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /*
- * Open a TCP socket and connect to ip:port.
+ * Disable the Nagle algorithm, and keep the send buffer small, so that packets are sent right away.
  */
-int tcp_connect(unsigned int ip, unsigned short port)
+static void tcp_set_options(int fd)
 {
-  int fd;
-  int error = 0;
+  int nodelay = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const void *)&nodelay, sizeof(nodelay)) < 0)
+  {
+    psockerror("setsockopt TCP_NODELAY");
+  }
+  int size = TCP_SEND_BUFFER_SIZE;
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const void *)&size, sizeof(size)) < 0)
+  {
+    psockerror("setsockopt SO_SNDBUF");
+  }
+}
 
+static int tcp_set_nonblocking(int fd, int nonblocking)
+{
 #ifdef WIN32
-  if (wsa_init() < 0)
+  u_long iMode = nonblocking;
+  if(ioctlsocket(fd, FIONBIO, &iMode) == SOCKET_ERROR)
+  {
+    psockerror("ioctlsocket");
+    return -1;
+  }
+#else
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) < 0)
   {
+    psockerror("fcntl");
     return -1;
   }
 #endif
+  return 0;
+}
 
-  if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) != -1)
-  {
-    struct sockaddr_in sa =
-    { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = ip };
+struct tcp_connection
+{
+  struct sockaddr_in sa;
+  int fd;
+  unsigned int attempts;
+  unsigned int backoff; // microseconds
+  struct gtimer * timer; // the retry timer
+  struct gtimer * timeout; // the attempt timer
+  void * user;
+  TCP_CALLBACKS callbacks;
+};
 
-    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != -1)
-    {
-      ginfo(_("connected to %s:%d\n"), inet_ntoa(sa.sin_addr), port);
+static int tcp_connect_attempt(struct tcp_connection * connection);
 
+/*
+ * Returns the value returned by the connect callback.
+ */
+static int tcp_connect_done(struct tcp_connection * connection, int fd)
+{
 #ifdef WIN32
-      // Set the socket I/O mode; iMode = 0 for blocking; iMode != 0 for non-blocking
-      int iMode = 1;
-      if(ioctlsocket(fd, FIONBIO, (u_long FAR*) &iMode) == SOCKET_ERROR)
-      {
-        psockerror("ioctlsocket");
-        error = 1;
-      }
+  wsa_count(fd < 0);
+#endif
+
+  int ret = connection->callbacks.fp_connect(connection->user, fd);
+
+  free(connection);
+
+  return ret;
+}
+
+static int tcp_retry_timer_read(void * user)
+{
+  struct tcp_connection * connection = (struct tcp_connection *) user;
+
+  gtimer_close(connection->timer);
+  connection->timer = NULL;
+
+  return tcp_connect_attempt(connection);
+}
+
+static int tcp_retry_timer_close(void * user)
+{
+  struct tcp_connection * connection = (struct tcp_connection *) user;
+
+  // the timer is being closed
+  connection->timer = NULL;
+
+  tcp_connect_done(connection, -1);
+
+  return 1;
+}
+
+/*
+ * Retry later, or give up if all attempts failed.
+ */
+static int tcp_connect_failed(struct tcp_connection * connection)
+{
+  if (connection->fd >= 0)
+  {
+    close(connection->fd);
+    connection->fd = -1;
+  }
+
+  if (connection->attempts >= TCP_CONNECT_RETRIES)
+  {
+    gerror(_("failed to connect to %s:%d after %u attempts\n"), inet_ntoa(connection->sa.sin_addr),
+        ntohs(connection->sa.sin_port), connection->attempts);
+    return tcp_connect_done(connection, -1);
+  }
+
+  GTIMER_CALLBACKS callbacks = {
+          .fp_read = tcp_retry_timer_read,
+          .fp_close = tcp_retry_timer_close,
+          .fp_register = connection->callbacks.fp_register,
+          .fp_remove = connection->callbacks.fp_remove,
+  };
+  connection->timer = gtimer_start(connection, connection->backoff, &callbacks);
+  if (connection->timer == NULL)
+  {
+    return tcp_connect_done(connection, -1);
+  }
+
+  connection->backoff *= 2;
+  if (connection->backoff > TCP_CONNECT_BACKOFF_MAX)
+  {
+    connection->backoff = TCP_CONNECT_BACKOFF_MAX;
+  }
+
+  return 0;
+}
+
+static int tcp_connect_succeeded(struct tcp_connection * connection)
+{
+  int fd = connection->fd;
+
+#ifndef WIN32
+  // the connected socket is used in blocking mode, except on Windows
+  if (tcp_set_nonblocking(fd, 0) < 0)
+  {
+    return tcp_connect_failed(connection);
+  }
 #endif
-    }
-    else
-    {
-      psockerror("connect");
-      error = 1;
-    }
+
+  ginfo(_("connected to %s:%d\n"), inet_ntoa(connection->sa.sin_addr), ntohs(connection->sa.sin_port));
+
+  return tcp_connect_done(connection, fd);
+}
+
+static void tcp_stop_timeout(struct tcp_connection * connection)
+{
+  if (connection->timeout != NULL)
+  {
+    gtimer_close(connection->timeout);
+    connection->timeout = NULL;
+  }
+}
+
+/*
+ * The peer did not answer in time: give up this attempt.
+ */
+static int tcp_timeout_timer_read(void * user)
+{
+  struct tcp_connection * connection = (struct tcp_connection *) user;
+
+  connection->callbacks.fp_remove(connection->fd);
+  tcp_stop_timeout(connection);
+
+  return tcp_connect_failed(connection);
+}
+
+static int tcp_timeout_timer_close(void * user)
+{
+  struct tcp_connection * connection = (struct tcp_connection *) user;
+
+  // the timer is being closed, the attempt still ends with the kernel timeout
+  connection->timeout = NULL;
+
+  return 0;
+}
+
+/*
+ * The socket is writable (connected) or in error.
+ */
+static int tcp_connect_cb(void * user)
+{
+  struct tcp_connection * connection = (struct tcp_connection *) user;
+
+  connection->callbacks.fp_remove(connection->fd);
+  tcp_stop_timeout(connection);
+
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, (void *)&error, &len) < 0 || error != 0)
+  {
+    return tcp_connect_failed(connection);
   }
-  else
+
+  return tcp_connect_succeeded(connection);
+}
+
+static int tcp_connect_attempt(struct tcp_connection * connection)
+{
+  ++connection->attempts;
+
+  connection->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (connection->fd == -1)
   {
     psockerror("socket");
-    error = 1;
+    return tcp_connect_failed(connection);
   }
 
-  if(error && fd >= 0)
+  tcp_set_options(connection->fd);
+
+  if (tcp_set_nonblocking(connection->fd, 1) < 0)
   {
-    close(fd);
-    fd = -1;
+    return tcp_connect_failed(connection);
   }
 
+  if (connect(connection->fd, (struct sockaddr *)&connection->sa, sizeof(connection->sa)) != -1)
+  {
+    return tcp_connect_succeeded(connection);
+  }
+
+#ifdef WIN32
+  if (WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+  if (errno != EINPROGRESS)
+#endif
+  {
+    return tcp_connect_failed(connection);
+  }
+
+  GPOLL_CALLBACKS callbacks = {
+          .fp_read = NULL,
+          .fp_write = tcp_connect_cb,
+          .fp_close = tcp_connect_cb,
+  };
+  if (connection->callbacks.fp_register(connection->fd, connection, &callbacks) < 0)
+  {
+    return tcp_connect_failed(connection);
+  }
+
+  // don't wait for the kernel timeout if the peer does not answer
+  GTIMER_CALLBACKS timer_callbacks = {
+          .fp_read = tcp_timeout_timer_read,
+          .fp_close = tcp_timeout_timer_close,
+          .fp_register = connection->callbacks.fp_register,
+          .fp_remove = connection->callbacks.fp_remove,
+  };
+  connection->timeout = gtimer_start(connection, TCP_CONNECT_TIMEOUT, &timer_callbacks);
+  if (connection->timeout == NULL)
+  {
+    connection->callbacks.fp_remove(connection->fd);
+    return tcp_connect_failed(connection);
+  }
+
+  return 0;
+}
+
+/*
+ * Connect to ip:port without blocking.
+ * Each attempt times out after TCP_CONNECT_TIMEOUT.
+ * Failed attempts are retried with an exponential backoff, up to TCP_CONNECT_RETRIES attempts.
+ * The connect callback is called once, with the connected socket, or with -1 if all attempts failed.
+ * It may be called before this function returns, and its return value is returned to the poll loop.
+ */
+int tcp_connect_async(unsigned int ip, unsigned short port, void * user, const TCP_CALLBACKS * callbacks)
+{
+#ifdef WIN32
+  if (wsa_init() < 0)
+  {
+    return -1;
+  }
+#endif
+
+  struct tcp_connection * connection = calloc(1, sizeof(*connection));
+  if (connection == NULL)
+  {
+    PRINT_ERROR_ALLOC_FAILED("calloc");
 #ifdef WIN32
-  wsa_count(error);
+    wsa_count(1);
 #endif
+    return -1;
+  }
+
+  connection->sa.sin_family = AF_INET;
+  connection->sa.sin_port = htons(port);
+  connection->sa.sin_addr.s_addr = ip;
+  connection->fd = -1;
+  connection->backoff = TCP_CONNECT_BACKOFF;
+  connection->user = user;
+  connection->callbacks = *callbacks;
+
+  tcp_connect_attempt(connection);
 
-  return fd;
+  return 0;
 }
 
 /*
@@ -13,7 +13,27 @@
 #define psockerror(msg) perror(msg)
 #endif
 
-int tcp_connect(unsigned int ip, unsigned short port);
+#include <gimxpoll/include/gpoll.h>
+
+#define TCP_CONNECT_RETRIES 5
+#define TCP_CONNECT_BACKOFF 100000 //microseconds, doubled after each failed attempt
+#define TCP_CONNECT_BACKOFF_MAX 2000000 //microseconds
+#define TCP_CONNECT_TIMEOUT 1000000 //microseconds, for each attempt
+
+#define TCP_SEND_BUFFER_SIZE 8192 //bytes, small enough not to queue stale data
+
+/*
+ * Called when the connection is established (fd >= 0), or when all attempts failed (fd == -1).
+ */
+typedef int (* TCP_CONNECT_CALLBACK)(void * user, int fd);
+
+typedef struct {
+  TCP_CONNECT_CALLBACK fp_connect;
+  GPOLL_REGISTER_FD fp_register;
+  GPOLL_REMOVE_FD fp_remove;
+} TCP_CALLBACKS;
+
+int tcp_connect_async(unsigned int ip, unsigned short port, void * user, const TCP_CALLBACKS * callbacks);
 int tcp_close(int fd);
 int tcp_send(int fd, const unsigned char* buf, int length);
 int tcp_recv(int fd, unsigned char* buf, int len);
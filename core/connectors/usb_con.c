@@ -373,7 +373,7 @@ static struct usb_state {
   e_controller_type type;
   int index;
   struct gusb_device * usb_device;
-  unsigned char ack;
+  unsigned int pending; // number of interrupt IN transfers in flight
   int joystick_id;
   struct
   {
@@ -474,6 +474,23 @@ static void process_report(int usb_number, struct usb_state * state, unsigned ch
   }
 }
 
+/*
+ * Keep gimx_params.usb_queue_depth interrupt IN transfers in flight for each device,
+ * so that the next read of the real device does not wait for the processing of the previous one.
+ * Transfers on a given endpoint complete in submission order, so reports are processed in order.
+ */
+static int submit_interrupts(struct usb_state * state) {
+
+  while (state->pending < gimx_params.usb_queue_depth) {
+    if (gusb_poll(state->usb_device, controller[state->type][state->index].endpoints.in.address) < 0) {
+      return -1;
+    }
+    ++state->pending;
+  }
+
+  return 0;
+}
+
 int usb_poll_interrupts() {
 
   int status = 0;
@@ -486,11 +503,8 @@ int usb_poll_interrupts() {
       status = -1;
       continue;
     }
-    if (state->usb_device != NULL && state->ack) {
-      int ret = gusb_poll(state->usb_device, controller[state->type][state->index].endpoints.in.address);
-      if (ret != -1) {
-        state->ack = 0;
-      } else {
+    if (state->usb_device != NULL) {
+      if (submit_interrupts(state) < 0) {
         status = -1;
       }
     }
@@ -505,8 +519,8 @@ static int usb_read_callback(void * user, unsigned char endpoint, const void * b
 
   struct usb_state * state = usb_states + adapter;
 
-  if (endpoint != 0x00) {
-    state->ack = 1;
+  if (endpoint != 0x00 && state->pending > 0) {
+    --state->pending;
   }
 
   if (status == E_STATUS_TRANSFER_TIMED_OUT) {
@@ -602,7 +616,6 @@ int usb_init(int usb_number, e_controller_type type) {
   memset(state, 0x00, sizeof(*state));
   state->joystick_id = -1;
   state->type = type;
-  state->ack = 1;
 
   if(!controller[type][0].ids.vendor || !controller[type][0].ids.product) {
     ginfo(_("no pass-through device is needed\n"));
@@ -678,7 +691,7 @@ int usb_init(int usb_number, e_controller_type type) {
     return -1;
   }
 
-  ret = gusb_poll(state->usb_device, controller[state->type][state->index].endpoints.in.address);
+  ret = submit_interrupts(state);
   if (ret < 0) {
     usb_close(usb_number);
     return -1;
@@ -17,12 +17,14 @@
 #include <connectors/gpp_con.h>
 #include <connectors/usb_con.h>
 #include "connectors/sixaxis.h"
+#include "connectors/bluetooth/bt_stats.h"
 #ifndef WIN32
 #include "connectors/btds4.h"
 #endif
 #include <gimxcontroller/include/controller.h>
 #include <gimxpoll/include/gpoll.h>
 #include <gimxtime/include/gtime.h>
+#include <gimxtimer/include/gtimer.h>
 #include <gimxlog/include/glog.h>
 
 #include <haptic/haptic_core.h>
@@ -30,6 +32,10 @@
 #define DEFAULT_BAUDRATE 500000 //bps
 static const int baudrates[] = { 2000000, 1000000, DEFAULT_BAUDRATE }; //bps
 #define ADAPTER_TIMEOUT 1000 //millisecond
+/*
+ * Remote GIMX processes that only support the version 1 protocol do not answer version requests.
+ */
+#define REMOTE_VERSION_TIMEOUT 500 //millisecond
 /*
  * The adapter restarts about 15ms after receiving the reset command.
  * This time is doubled so as to include the reset command transfer duration.
@@ -39,10 +45,21 @@ static const int baudrates[] = { 2000000, 1000000, DEFAULT_BAUDRATE }; //bps
  * The number of times the adapter is queried for its type, before it is assumed as unreachable.
  */
 #define ADAPTER_INIT_RETRIES 10
+/*
+ * The period of the timer checking type query timeouts, when detecting adapters.
+ */
+#define ADAPTER_DETECT_TICK 10000 //microseconds
 /*
  * The number of times the adapter is queried for its baudrate before assuming baudrate is not supported.
  */
 #define ADAPTER_BAUDRATE_RETRIES 3
+/*
+ * The number of baudrate queries used to measure the link quality at a given baudrate,
+ * and the number of failed queries above which the baudrate is rejected.
+ */
+#define ADAPTER_PROBE_COUNT 20
+#define ADAPTER_PROBE_MAX_ERRORS 1
+#define ADAPTER_PROBE_DRAIN_TIMEOUT 20 //millisecond
 
 static s_adapter adapters[MAX_CONTROLLERS] = {};
 
@@ -105,6 +122,13 @@ static void dump(unsigned char * packet, unsigned char length)
     dump(DATA, LENGTH); \
   }
 
+/*
+ * A relay is a proxy that forwards to another proxy, i.e. a link in a chain of GIMX instances.
+ */
+static int is_proxy_relay(int adapter) {
+  return adapters[adapter].proxy.is_proxy && adapters[adapter].proxy.is_client;
+}
+
 static int is_gimx_adapter(int adapter) {
     return (adapters[adapter].atype == E_ADAPTER_TYPE_DIY_USB && adapters[adapter].serial.portname)
                 || (adapters[adapter].atype == E_ADAPTER_TYPE_PROXY && adapters[adapter].proxy.remote.ip);
@@ -184,6 +208,63 @@ static int adapter_write(int adapter, const void * buf, unsigned int count)
   return ret;
 }
 
+/*
+ * Send the packets queued for a framed adapter.
+ * A single packet is sent as is, several packets are sent in a BYTE_FRAME packet.
+ */
+static int adapter_flush(int adapter)
+{
+  s_packet * frame = &adapters[adapter].serial.frame;
+
+  int ret = 0;
+
+  if (adapters[adapter].serial.frame_count == 1)
+  {
+    ret = adapter_write(adapter, frame->value, frame->header.length);
+  }
+  else if (adapters[adapter].serial.frame_count > 1)
+  {
+    ret = adapter_write(adapter, frame, sizeof(frame->header) + frame->header.length);
+  }
+
+  frame->header.length = 0;
+  adapters[adapter].serial.frame_count = 0;
+
+  return ret;
+}
+
+/*
+ * Queue a packet (header and value) for a framed adapter, or send it right away otherwise.
+ */
+static int adapter_queue(int adapter, const void * buf, unsigned int count)
+{
+  if (!adapters[adapter].serial.framed)
+  {
+    return adapter_write(adapter, buf, count);
+  }
+
+  s_packet * frame = &adapters[adapter].serial.frame;
+
+  if (frame->header.length + count > sizeof(frame->value))
+  {
+    if (adapter_flush(adapter) < 0)
+    {
+      return -1;
+    }
+    if (count > sizeof(frame->value))
+    {
+      // too large for a frame, send it as is, after the queued packets
+      return adapter_write(adapter, buf, count);
+    }
+  }
+
+  memcpy(frame->value + frame->header.length, buf, count);
+  frame->header.length += count;
+  ++adapters[adapter].serial.frame_count;
+
+  return 0;
+}
+
 static int adapter_start_serialasync(int adapter);
 static e_gimx_status adapter_open(int i, unsigned int baudrate);
 
@@ -274,6 +355,70 @@ static int proxy_src_read_callback(void * user, const void * buf, int status, st
     return 0;
 }
 
+/*
+ * Forward a packet from the upstream GIMX to the downstream one.
+ * The packet is neither copied nor decoded, the downstream proxy checks it anyway.
+ */
+static int proxy_relay_src_read_callback(void * user, const void * buf, int status, struct gudp_address address)
+{
+    s_adapter * adapter = adapters + (intptr_t) user;
+
+    if (status <= 0)
+    {
+        gwarn("empty packet\n");
+        return 0;
+    }
+
+    if (adapter->proxy.peer.ip && adapter->proxy.peer.port)
+    {
+        if (adapter->proxy.peer.ip != address.ip || adapter->proxy.peer.port != address.port)
+        {
+            gwarn("reject packet from %s:%hu\n", gudp_ip_str(address.ip), address.port);
+            return 0;
+        }
+    }
+
+    if (((uint8_t *)buf)[0] != BYTE_RESET) {
+        adapter->proxy.peer = address;
+    } else {
+        adapter->proxy.peer.ip = 0;
+        adapter->proxy.peer.port = 0;
+    }
+
+    if (gudp_send(adapter->proxy.socket, buf, status, adapter->proxy.remote) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Forward a packet from the downstream GIMX to the upstream one, without copying nor decoding it.
+ */
+static int proxy_relay_dst_read_callback(void * user, const void * buf, int status, struct gudp_address address)
+{
+    s_adapter * adapter = adapters + (intptr_t) user;
+
+    if (adapter->proxy.remote.ip != address.ip || adapter->proxy.remote.port != address.port)
+    {
+        gwarn("reject packet from %s:%hu\n", gudp_ip_str(address.ip), address.port);
+        return 0;
+    }
+
+    if (status <= 0 || adapter->proxy.peer.ip == 0)
+    {
+        return 0;
+    }
+
+    if (gudp_send(adapter->proxy.relay_socket, buf, status, adapter->proxy.peer) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
 static int adapter_process_packet(int adapter, s_packet* packet);
 
 static int proxy_dst_read_callback(void * user, const void * buf, int status, struct gudp_address address) {
@@ -310,11 +455,42 @@ static int proxy_dst_read_callback(void * user, const void * buf, int status, st
     return adapter_process_packet(i, (s_packet*) buf);
 }
 
+/*
+ * Store the axes of a controller from a batched report.
+ * The controller is the one listening on the port given in the report,
+ * which is not necessarily the one that received the report.
+ */
+static void network_batch_block(void * user __attribute__((unused)), uint16_t port, unsigned char nbAxes,
+    const s_remote_axis * axes)
+{
+  int adapter;
+  for (adapter = 0; adapter < MAX_CONTROLLERS; ++adapter)
+  {
+    if (adapters[adapter].src_socket != NULL && adapters[adapter].src.port == port)
+    {
+      break;
+    }
+  }
+  if (adapter == MAX_CONTROLLERS)
+  {
+    gwarn("%s: no controller listening on port %hu\n", __func__, port);
+    return;
+  }
+  unsigned char i;
+  for (i = 0; i < nbAxes; ++i)
+  {
+    adapters[adapter].axis[axes[i].axis] = axes[i].value;
+  }
+  adapters[adapter].send_command = 1;
+}
+
 /*
  * Read a packet from a remote GIMX client.
  * The packet can be:
  * - a "get controller type" request
- * - a report to be sent.
+ * - a "get protocol version" request
+ * - a report to be sent
+ * - a batched report for one or more controllers.
  * Note that the socket operations should not block.
  */
 static int network_read_callback(void * user, const void * buf, int status, struct gudp_address address)
@@ -373,6 +549,40 @@ static int network_read_callback(void * user, const void * buf, int status, stru
       adapters[adapter].send_command = 1;
     }
     break;
+  case E_NETWORK_PACKET_VERSION:
+    {
+      // send the answer, with the ports of all the controllers this process serves
+      uint16_t ports[MAX_CONTROLLERS];
+      unsigned char count = 0;
+      int i;
+      for (i = 0; i < MAX_CONTROLLERS; ++i)
+      {
+        if (adapters[i].src_socket != NULL)
+        {
+          ports[count++] = adapters[i].src.port;
+        }
+      }
+      unsigned char answer[REMOTE_VERSION_MAX_SIZE];
+      int size = remote_version_build(answer, ports, count);
+      if (gudp_send(adapters[adapter].src_socket, answer, size, address) < 0)
+      {
+        gwarn("%s: can't send protocol version\n", __func__);
+        return 0;
+      }
+    }
+    break;
+  case E_NETWORK_PACKET_IN_REPORT_BATCH:
+    {
+      uint32_t sequence;
+      uint32_t timestamp;
+      if (remote_batch_parse(buf, status, &sequence, &timestamp, network_batch_block, NULL) < 0)
+      {
+        gwarn("%s: invalid batched report (size=%d)\n", __func__, status);
+        return 0;
+      }
+      remote_stats_update(&adapters[adapter].src_stats, sequence, timestamp, GTIME_USEC(gtime_gettime()));
+    }
+    break;
   }
   return (gimx_params.clock_source == CLOCK_INPUT);
 }
@@ -474,7 +684,8 @@ static int adapter_forward(int adapter, unsigned char type, unsigned char* data,
     }
   };
   memcpy(packet.value, data, length);
-  if(adapter_write(adapter, &packet, sizeof(packet.header)+packet.header.length) < 0)
+  // framed adapters get it with the next report
+  if(adapter_queue(adapter, &packet, sizeof(packet.header)+packet.header.length) < 0)
   {
     return -1;
   }
@@ -554,6 +765,47 @@ static int adapter_process_packet(int adapter, s_packet* packet)
       haptic_core_update(adapters[adapter].ff_core);
     }
   }
+  else if(type == BYTE_TYPE)
+  {
+    // reply to a type query sent while detecting adapters
+    if (adapters[adapter].serial.detect.pending && length == BYTE_LEN_1_BYTE)
+    {
+      adapters[adapter].serial.detect.type = data[0];
+      adapters[adapter].serial.detect.pending = 0;
+      adapters[adapter].serial.detect.end = gtime_gettime();
+      // exit the detection loop if all adapters answered
+      ret = 1;
+      int i;
+      for (i = 0; i < MAX_CONTROLLERS; ++i)
+      {
+        if (adapters[i].serial.detect.pending)
+        {
+          ret = 0;
+          break;
+        }
+      }
+    }
+  }
+  else if(type == BYTE_FRAME)
+  {
+    unsigned int offset = 0;
+    while (ret >= 0 && offset + sizeof(s_header) <= length)
+    {
+      s_packet * sub = (s_packet *)(data + offset);
+      if (offset + sizeof(s_header) + sub->header.length > length)
+      {
+        gwarn("invalid frame (length=%u)\n", length);
+        break;
+      }
+      if (sub->header.type == BYTE_FRAME)
+      {
+        gwarn("nested frame\n");
+        break;
+      }
+      ret = adapter_process_packet(adapter, sub);
+      offset += sizeof(s_header) + sub->header.length;
+    }
+  }
   else if(type == BYTE_DEBUG)
   {
     gtime now = gtime_gettime();
@@ -574,6 +826,12 @@ static int adapter_serial_read_cb(void * user, const void * buf, int status) {
   int adapter = (intptr_t) user;
 
   if (status < 0) {
+    if (adapters[adapter].serial.detect.pending)
+    {
+      // do not abort while detecting, the other adapters may still answer
+      adapters[adapter].serial.detect.pending = 0;
+      return 0;
+    }
     // reading with no timeout
     set_done();
     return -1;
@@ -797,6 +1055,30 @@ static int adapter_get_version(int adapter, int *major, int *minor)
   return 0;
 }
 
+/*
+ * Returns the capabilities of the adapter, 0 if it does not answer.
+ */
+static int adapter_get_caps(int adapter)
+{
+  s_packet packet = { .header = { .type = BYTE_CAPS, .length = 0 }, .value = {} };
+
+  int ret = adapter_write_timeout(adapter, &packet);
+  if (ret < 0 || (size_t)ret != sizeof(packet.header))
+  {
+    gerror("failed to send data to the GIMX adapter\n");
+    return 0;
+  }
+
+  ret = adapter_read_reply(adapter, &packet, 1);
+
+  if (ret == 0 && packet.header.length == BYTE_LEN_1_BYTE)
+  {
+    return packet.value[0];
+  }
+
+  return 0;
+}
+
 static int adapter_get_baudrate(int adapter)
 {
   s_packet packet = { .header = { .type = BYTE_BAUDRATE, .length = 0 }, .value = {} };
@@ -826,6 +1108,72 @@ static int adapter_get_baudrate_retry(int adapter, int retries)
   return baudrate;
 }
 
+typedef struct
+{
+  unsigned int queries;
+  unsigned int errors;
+  unsigned int rtt; // average round trip time (microseconds)
+} s_link_quality;
+
+/*
+ * Discard the pending input, so that a late reply is not taken for the reply to the next query.
+ */
+static void adapter_drain(int adapter)
+{
+  unsigned char byte;
+  while (get_done() == 0 && adapter_read_timeout(adapter, &byte, sizeof(byte), sizeof(byte), ADAPTER_PROBE_DRAIN_TIMEOUT) == 1)
+  {
+    ;
+  }
+}
+
+/*
+ * Measure the round trip time and the error rate of the link at the current baudrate.
+ * The baudrate query is used as an echo packet, as all firmwares supporting baudrate changes answer it.
+ * The measurement stops as soon as the baudrate is known to be rejected.
+ */
+static void adapter_probe_link(int adapter, int baudrate, s_link_quality * quality)
+{
+  unsigned int total = 0;
+  unsigned int count = 0;
+
+  quality->queries = 0;
+  quality->errors = 0;
+
+  int i;
+  for (i = 0; i < ADAPTER_PROBE_COUNT && get_done() == 0; ++i)
+  {
+    ++quality->queries;
+    gtime start = gtime_gettime();
+    int ret = adapter_get_baudrate(adapter);
+    gtime end = gtime_gettime();
+    if (ret != baudrate)
+    {
+      ++quality->errors;
+      if (quality->errors > ADAPTER_PROBE_MAX_ERRORS)
+      {
+        break;
+      }
+      adapter_drain(adapter);
+    }
+    else
+    {
+      total += GTIME_USEC(end - start);
+      ++count;
+    }
+  }
+
+  quality->rtt = count ? total / count : 0;
+}
+
+/*
+ * The report rate the link can sustain, assuming 10 bits per byte (8N1) and the largest report.
+ */
+static unsigned int adapter_get_max_report_rate(int baudrate)
+{
+  return baudrate / (10 * (HEADER_SIZE + sizeof(s_report)));
+}
+
 static int adapter_set_baudrate(int adapter, int baudrate)
 {
   s_packet packet = { .header = { .type = BYTE_BAUDRATE, .length = 1 }, .value = { baudrate / 100000 } };
@@ -916,6 +1264,196 @@ static void adapter_close(int i)
     {
       gudp_close(adapter->proxy.socket);
     }
+    if (adapter->proxy.relay_socket != NULL)
+    {
+      gudp_close(adapter->proxy.relay_socket);
+    }
+  }
+}
+
+static int adapter_send_type_query(int adapter)
+{
+  s_packet packet = { .header = { .type = BYTE_TYPE, .length = BYTE_LEN_0_BYTE } };
+
+  adapters[adapter].serial.detect.last = gtime_gettime();
+  ++adapters[adapter].serial.detect.queries;
+
+  return adapter_write(adapter, &packet, sizeof(packet.header));
+}
+
+static int adapter_detect_timer_read(void * user __attribute__((unused)))
+{
+  gtime now = gtime_gettime();
+  int pending = 0;
+
+  int i;
+  for (i = 0; i < MAX_CONTROLLERS; ++i)
+  {
+    if (!adapters[i].serial.detect.pending)
+    {
+      continue;
+    }
+    if (GTIME_USEC(now - adapters[i].serial.detect.last) >= ADAPTER_TIMEOUT * 1000)
+    {
+      if (adapters[i].serial.detect.queries >= ADAPTER_INIT_RETRIES || adapter_send_type_query(i) < 0)
+      {
+        adapters[i].serial.detect.pending = 0;
+        continue;
+      }
+    }
+    pending = 1;
+  }
+
+  return (pending && get_done() == 0) ? 0 : 1;
+}
+
+static int adapter_detect_timer_close(void * user __attribute__((unused)))
+{
+  set_done();
+  return 1;
+}
+
+/*
+ * Query the type of all serial adapters at once, so that an unreachable adapter
+ * does not delay the type detection of the other ones.
+ * The type of the adapters that do not answer after ADAPTER_INIT_RETRIES queries is left to -1.
+ * Only the type query is concurrent: the next steps (version, reset, baudrate probe, usb init)
+ * are still performed one adapter after the other in adapter_detect.
+ */
+static void adapter_detect_types()
+{
+  int pending = 0;
+  int i;
+
+  for (i = 0; i < MAX_CONTROLLERS; ++i)
+  {
+    s_adapter * adapter = adapters + i;
+    adapter->serial.detect.pending = 0;
+    adapter->serial.detect.type = -1;
+    adapter->serial.detect.queries = 0;
+    if (adapter->atype != E_ADAPTER_TYPE_DIY_USB || adapter->serial.portname == NULL)
+    {
+      continue;
+    }
+    adapter->serial.detect.start = gtime_gettime();
+    if (adapter_open(i, DEFAULT_BAUDRATE) != E_GIMX_STATUS_SUCCESS)
+    {
+      continue;
+    }
+    adapter->serial.bread = 0;
+    if (adapter_start_serialasync(i) < 0)
+    {
+      continue;
+    }
+    adapter->serial.detect.pending = 1;
+    if (adapter_send_type_query(i) < 0)
+    {
+      adapter->serial.detect.pending = 0;
+      continue;
+    }
+    pending = 1;
+  }
+
+  if (!pending)
+  {
+    return;
+  }
+
+  GTIMER_CALLBACKS callbacks = {
+          .fp_read = adapter_detect_timer_read,
+          .fp_close = adapter_detect_timer_close,
+          .fp_register = REGISTER_FUNCTION,
+          .fp_remove = REMOVE_FUNCTION,
+  };
+  struct gtimer * timer = gtimer_start(NULL, ADAPTER_DETECT_TICK, &callbacks);
+  if (timer == NULL)
+  {
+    return;
+  }
+
+  while (pending && get_done() == 0)
+  {
+    gpoll();
+    pending = 0;
+    for (i = 0; i < MAX_CONTROLLERS; ++i)
+    {
+      pending |= adapters[i].serial.detect.pending;
+    }
+  }
+
+  gtimer_close(timer);
+
+  for (i = 0; i < MAX_CONTROLLERS; ++i)
+  {
+    adapters[i].serial.detect.pending = 0;
+    if (adapters[i].serial.detect.type >= 0)
+    {
+      ginfo(_("GIMX adapter %d answered in %lu ms (%u queries).\n"), i,
+          (unsigned long) (GTIME_USEC(adapters[i].serial.detect.end - adapters[i].serial.detect.start) / 1000),
+          adapters[i].serial.detect.queries);
+    }
+  }
+}
+
+/*
+ * Check if the remote GIMX processes support the version 2 protocol, and get the ports they serve.
+ * The requests are sent at once, and the answers are awaited for REMOTE_VERSION_TIMEOUT in total.
+ */
+static void adapter_remote_get_versions()
+{
+  int pending[MAX_CONTROLLERS] = { 0 };
+  int i;
+
+  for(i=0; i<MAX_CONTROLLERS; ++i)
+  {
+    s_adapter * adapter = adapter_get(i);
+
+    if(adapter->atype != E_ADAPTER_TYPE_REMOTE_GIMX || adapter->remote.socket == NULL || adapter->ctype == C_TYPE_NONE)
+    {
+      continue;
+    }
+
+    adapter->remote.version = 1;
+
+    unsigned char request[] = { E_NETWORK_PACKET_VERSION };
+
+    if (gudp_send(adapter->remote.socket, request, sizeof(request), adapter->remote.address) != -1)
+    {
+      pending[i] = 1;
+    }
+  }
+
+  gtime deadline = gtime_gettime() + REMOTE_VERSION_TIMEOUT * 1000000ULL;
+
+  for(i=0; i<MAX_CONTROLLERS; ++i)
+  {
+    if (!pending[i])
+    {
+      continue;
+    }
+
+    s_adapter * adapter = adapter_get(i);
+
+    gtime now = gtime_gettime();
+    unsigned int timeout = (now < deadline) ? GTIME_USEC(deadline - now) / 1000 : 0;
+    if (timeout == 0)
+    {
+      timeout = 1; // only get the answers that already arrived
+    }
+
+    unsigned char answer[REMOTE_VERSION_MAX_SIZE];
+    struct gudp_address address = { 0, 0 };
+    int res = gudp_recv(adapter->remote.socket, answer, sizeof(answer), timeout, &address);
+    if (res > 0)
+    {
+      int version = remote_version_parse(answer, res, adapter->remote.ports, &adapter->remote.nb_ports);
+      if (version >= REMOTE_PROTOCOL_VERSION)
+      {
+        adapter->remote.version = REMOTE_PROTOCOL_VERSION;
+      }
+    }
+
+    ginfo(_("Remote GIMX %d protocol version: %d.\n"), i, adapter->remote.version);
   }
 }
 
@@ -925,6 +1463,11 @@ e_gimx_status adapter_detect()
   int i;
   s_adapter* adapter;
 
+  gtime start = gtime_gettime();
+
+  // the serial adapters are reopened below, which also stops the asynchronous reads
+  adapter_detect_types();
+
   for(i=0; i<MAX_CONTROLLERS; ++i)
   {
     adapter = adapter_get(i);
@@ -953,10 +1496,18 @@ e_gimx_status adapter_detect()
       if(ret == E_GIMX_STATUS_SUCCESS)
       {
         int rtype = -1;
-        int j;
-        for (j = 0; j < ADAPTER_INIT_RETRIES && rtype == -1 && get_done() == 0; ++j)
+        if (adapter->atype == E_ADAPTER_TYPE_DIY_USB)
+        {
+          // already queried by adapter_detect_types
+          rtype = adapter->serial.detect.type;
+        }
+        else
         {
-          rtype = adapter_send_short_command(i, BYTE_TYPE);
+          int j;
+          for (j = 0; j < ADAPTER_INIT_RETRIES && rtype == -1 && get_done() == 0; ++j)
+          {
+            rtype = adapter_send_short_command(i, BYTE_TYPE);
+          }
         }
 
         if(rtype >= 0 && rtype < C_TYPE_NONE)
@@ -1005,38 +1556,89 @@ e_gimx_status adapter_detect()
 
             if (baudrate > 0) {
 
+              /*
+               * Probe each supported baudrate, and keep the one with the lowest round trip time,
+               * among the ones with an acceptable error rate.
+               */
+              int best = -1;
+              s_link_quality best_quality = { 0, 0, 0 };
+
               unsigned int b;
-              for (b = 0; b < sizeof(baudrates) / sizeof(*baudrates); ++b)
+              for (b = 0; b < sizeof(baudrates) / sizeof(*baudrates) && get_done() == 0; ++b)
               {
-                if (baudrate == baudrates[b]) {
-                  break;
+                if (baudrate != baudrates[b])
+                {
+                  adapter_set_baudrate(i, baudrates[b]);
+
+                  ginfo(_("Trying baudrate: %d bps.\n"), baudrates[b]);
+
+                  if (adapter_open(i, baudrates[b]) != E_GIMX_STATUS_SUCCESS)
+                  {
+                    continue;
+                  }
+                  baudrate = adapter_get_baudrate_retry(i, ADAPTER_BAUDRATE_RETRIES);
+                  if (baudrate != baudrates[b]) {
+                    continue;
+                  }
                 }
-                adapter_set_baudrate(i, baudrates[b]);
 
-                ginfo(_("Trying baudrate: %d bps.\n"), baudrates[b]);
+                s_link_quality quality;
+                adapter_probe_link(i, baudrates[b], &quality);
 
-                ret = adapter_open(i, baudrates[b]);
-                if(ret != E_GIMX_STATUS_SUCCESS)
+                ginfo(_("Baudrate %d bps: round trip time %u us, %u/%u errors, max report rate %u Hz.\n"),
+                    baudrates[b], quality.rtt, quality.errors, quality.queries, adapter_get_max_report_rate(baudrates[b]));
+
+                if (quality.errors > ADAPTER_PROBE_MAX_ERRORS)
                 {
                   continue;
                 }
-                baudrate = adapter_get_baudrate_retry(i, ADAPTER_BAUDRATE_RETRIES);
-                if (baudrate == baudrates[b]) {
-                  break;
+
+                if (best == -1 || quality.rtt < best_quality.rtt)
+                {
+                  best = baudrates[b];
+                  best_quality = quality;
                 }
               }
 
-              if (b == sizeof(baudrates) / sizeof(*baudrates))
+              if (best == -1)
               {
                 ret = E_GIMX_STATUS_GENERIC_ERROR;
               }
+              else if (baudrate != best)
+              {
+                adapter_set_baudrate(i, best);
+                ret = adapter_open(i, best);
+                if (ret == E_GIMX_STATUS_SUCCESS)
+                {
+                  baudrate = adapter_get_baudrate_retry(i, ADAPTER_BAUDRATE_RETRIES);
+                  if (baudrate != best)
+                  {
+                    ret = E_GIMX_STATUS_GENERIC_ERROR;
+                  }
+                }
+              }
 
               if (ret == E_GIMX_STATUS_SUCCESS){
-                ginfo(_("Using baudrate: %d bps.\n"), baudrate);
+                ginfo(_("Using baudrate: %d bps (max report rate: %u Hz).\n"), baudrate, adapter_get_max_report_rate(baudrate));
               }
             }
           }
 
+          if (ret == E_GIMX_STATUS_SUCCESS && gimx_params.serial_frames && !adapter->proxy.is_proxy
+              && adapter->atype == E_ADAPTER_TYPE_DIY_USB && adapter->ctype != C_TYPE_PS2_PAD)
+          {
+            adapter->serial.frame.header.type = BYTE_FRAME;
+            adapter->serial.framed = (adapter_get_caps(i) & BYTE_CAP_FRAME) != 0;
+            if (adapter->serial.framed)
+            {
+              ginfo(_("Serial frames are enabled.\n"));
+            }
+            else
+            {
+              gwarn(_("Serial frames are not supported by the firmware.\n"));
+            }
+          }
+
           if(ret == E_GIMX_STATUS_SUCCESS && !adapter->proxy.is_proxy)
           {
             int usb_res = usb_init(i, adapter->ctype);
@@ -1140,6 +1742,12 @@ e_gimx_status adapter_detect()
     }
 #endif
   }
+
+  adapter_remote_get_versions();
+
+  gtime end = gtime_gettime();
+  ginfo(_("Adapter detection took %lu ms.\n"), (unsigned long) (GTIME_USEC(end - start) / 1000));
+
   return ret;
 }
 
@@ -1323,7 +1931,36 @@ int adapter_start()
       }
     }
 
-    if(adapter->proxy.is_proxy)
+    if(is_proxy_relay(i))
+    {
+      // the proxy socket is used to reach the downstream GIMX
+      adapter->proxy.relay_socket = gudp_open(GUDP_MODE_SERVER, adapter->proxy.local);
+      if(adapter->proxy.relay_socket == NULL)
+      {
+        gerror(_("failed to open proxy source: %s:%d.\n"), gudp_ip_str(adapter->proxy.local.ip), adapter->proxy.local.port);
+        ret = -1;
+      }
+      else
+      {
+        GUDP_CALLBACKS callbacks = {
+                .fp_read = proxy_relay_src_read_callback,
+                .fp_close = adapter_close_callback,
+                .fp_register = gpoll_register_fd,
+                .fp_remove = gpoll_remove_fd,
+        };
+        if (gudp_register(adapter->proxy.relay_socket, (void *)(intptr_t) i, &callbacks) < 0)
+        {
+          gerror(_("failed to register event source.\n"));
+          ret = -1;
+        }
+        else
+        {
+          ginfo(_("Relaying %s:%d to %s:%d.\n"), gudp_ip_str(adapter->proxy.local.ip), adapter->proxy.local.port,
+              gudp_ip_str(adapter->proxy.remote.ip), adapter->proxy.remote.port);
+        }
+      }
+    }
+    else if(adapter->proxy.is_proxy)
     {
       adapter->proxy.socket = gudp_open(GUDP_MODE_SERVER, adapter->proxy.local);
       if(adapter->proxy.socket == NULL)
@@ -1350,7 +1987,7 @@ int adapter_start()
     if(adapter->proxy.is_client)
     {
       GUDP_CALLBACKS callbacks = {
-                .fp_read = proxy_dst_read_callback,
+                .fp_read = is_proxy_relay(i) ? proxy_relay_dst_read_callback : proxy_dst_read_callback,
                 .fp_close = adapter_close_callback,
                 .fp_register = gpoll_register_fd,
                 .fp_remove = gpoll_remove_fd,
@@ -1370,6 +2007,33 @@ int adapter_start()
   return ret;
 }
 
+/*
+ * Get the adapter that sends the batched reports for a remote GIMX adapter,
+ * i.e. the first adapter targeting the same remote process.
+ */
+static s_adapter * adapter_remote_get_leader(int adapter)
+{
+  s_adapter * target = adapters + adapter;
+  int i;
+  for (i = 0; i < adapter; ++i)
+  {
+    s_adapter * candidate = adapters + i;
+    if (candidate->atype == E_ADAPTER_TYPE_REMOTE_GIMX && candidate->remote.socket != NULL
+        && candidate->remote.version >= REMOTE_PROTOCOL_VERSION && candidate->remote.address.ip == target->remote.address.ip)
+    {
+      unsigned char j;
+      for (j = 0; j < candidate->remote.nb_ports; ++j)
+      {
+        if (candidate->remote.ports[j] == target->remote.address.port)
+        {
+          return candidate;
+        }
+      }
+    }
+  }
+  return target;
+}
+
 int adapter_send()
 {
   int ret = 0;
@@ -1408,7 +2072,22 @@ int adapter_send()
     {
       if(adapter->atype == E_ADAPTER_TYPE_REMOTE_GIMX)
       {
-        if(adapter->remote.socket != NULL)
+        if(adapter->remote.socket != NULL && adapter->remote.version >= REMOTE_PROTOCOL_VERSION)
+        {
+          // batched with the other controllers of the same remote process, and sent after the loop
+          s_adapter * leader = adapter_remote_get_leader(i);
+          if (leader->remote.batch.count == 0)
+          {
+            remote_batch_init(&leader->remote.batch, leader->remote.sequence++, GTIME_USEC(gtime_gettime()));
+          }
+          // send all axes if --event argument is used
+          // otherwise only send changes
+          remote_batch_add(&leader->remote.batch, adapter->remote.address.port, adapter->axis, adapter->remote.last_axes,
+              adapter->event);
+          // backup so that we can send changes only
+          memcpy(adapter->remote.last_axes, adapter->axis, AXIS_MAX * sizeof(* adapter->axis));
+        }
+        else if(adapter->remote.socket != NULL)
         {
 
           s_network_packet_in_report * report = &adapter->remote.report;
@@ -1431,7 +2110,7 @@ int adapter_send()
           memcpy(adapter->remote.last_axes, adapter->axis, AXIS_MAX * sizeof(* adapter->axis));
         }
       }
-      else if(is_gimx_adapter(i))
+      else if(is_gimx_adapter(i) && !is_proxy_relay(i))
       {
         if (adapter->activation_button.index != 0)
         {
@@ -1448,28 +2127,28 @@ int adapter_send()
         switch(adapter->ctype)
         {
         case C_TYPE_SIXAXIS:
-          ret = adapter_write(i, report, HEADER_SIZE+report->length);
+          ret = adapter_queue(i, report, HEADER_SIZE+report->length);
           break;
         case C_TYPE_DS4:
           report->value.ds4.report_id = DS4_USB_HID_IN_REPORT_ID;
           report->length = DS4_USB_INTERRUPT_PACKET_SIZE;
-          ret = adapter_write(i, report, HEADER_SIZE+report->length);
+          ret = adapter_queue(i, report, HEADER_SIZE+report->length);
           break;
         case C_TYPE_T300RS_PS4:
         case C_TYPE_G29_PS4:
           report->length = DS4_USB_INTERRUPT_PACKET_SIZE;
-          ret = adapter_write(i, report, HEADER_SIZE+report->length);
+          ret = adapter_queue(i, report, HEADER_SIZE+report->length);
           break;
         case C_TYPE_XONE_PAD:
           if(adapter->status)
           {
-            ret = adapter_write(i, report, HEADER_SIZE+report->length);
+            ret = adapter_queue(i, report, HEADER_SIZE+report->length);
           }
           break;
         default:
           if(adapter->ctype != C_TYPE_PS2_PAD)
           {
-            ret = adapter_write(i, report, HEADER_SIZE+report->length);
+            ret = adapter_queue(i, report, HEADER_SIZE+report->length);
           }
           else
           {
@@ -1552,6 +2231,28 @@ int adapter_send()
     }
   }
 
+  // one datagram per remote process, and one serial write per framed adapter
+  for(i=0; i<MAX_CONTROLLERS; ++i)
+  {
+    adapter = adapter_get(i);
+
+    if(adapter->atype == E_ADAPTER_TYPE_REMOTE_GIMX && adapter->remote.batch.count > 0)
+    {
+      if (gudp_send(adapter->remote.socket, adapter->remote.batch.buf, adapter->remote.batch.size, adapter->remote.address) < 0)
+      {
+        ret = -1;
+      }
+      adapter->remote.batch.count = 0;
+    }
+    else if(adapter->serial.framed)
+    {
+      if (adapter_flush(i) < 0)
+      {
+        ret = -1;
+      }
+    }
+  }
+
   if (active == 0)
   {
     ret = -1;
@@ -1573,6 +2274,13 @@ e_gimx_status adapter_clean()
     stats_clean(adapter->cstats);
     stats_clean(adapter->mstats);
 
+    if (adapter->src_stats.received > 0)
+    {
+      ginfo(_("Network source %s:%d: %u batched reports, %u lost, %u reordered, jitter: %u us.\n"),
+          gudp_ip_str(adapter->src.ip), adapter->src.port, adapter->src_stats.received, adapter->src_stats.lost,
+          adapter->src_stats.reordered, adapter->src_stats.jitter);
+    }
+
     if(adapter->atype == E_ADAPTER_TYPE_REMOTE_GIMX)
     {
       if(adapter->remote.socket != NULL)
@@ -1627,6 +2335,8 @@ e_gimx_status adapter_clean()
     }
   }
 
+  bt_stats_clean();
+
   if (status == E_GIMX_STATUS_SUCCESS && active == 0) {
     status = E_GIMX_STATUS_INACTIVITY_TIMEOUT;
   }
@@ -1646,3 +2356,24 @@ void adapter_set_haptic_tweaks(int adapter, const s_haptic_core_tweaks * tweaks)
 {
   haptic_core_set_tweaks(adapters[adapter].ff_core, tweaks);
 }
+
+/*
+ * Feed the steering position of a haptic sink joystick to the haptic cores using it.
+ * Wheels report the steering position on their first axis.
+ */
+void adapter_set_haptic_position(int joystick, int axis, int value)
+{
+  if (axis != 0)
+  {
+    return;
+  }
+
+  int i;
+  for(i = 0; i < MAX_CONTROLLERS; ++i)
+  {
+    if (adapters[i].ff_core != NULL && adapters[i].haptic_sink_joystick == joystick)
+    {
+      haptic_core_set_position(adapters[i].ff_core, value);
+    }
+  }
+}
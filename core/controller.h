@@ -7,11 +7,13 @@
 #define CONTROLLER_H_
 
 #include <connectors/protocol.h>
+#include <connectors/remote_protocol.h>
 #include <gimx-network-protocol/protocol.h>
 #include <config.h>
 #include <gimxserial/include/gserial.h>
 #include <gimxcontroller/include/controller.h>
 #include <gimxudp/include/gudp.h>
+#include <gimxtime/include/gtime.h>
 #include "haptic/haptic_core.h"
 #include <gimx.h>
 
@@ -37,6 +39,17 @@ typedef struct {
         struct gserial_device * device;
         s_packet packet;
         unsigned int bread;
+        int framed; // the adapter accepts BYTE_FRAME packets
+        s_packet frame; // packets waiting to be sent in a single frame
+        unsigned char frame_count;
+        struct {
+            int pending;
+            int type; // -1 if the adapter did not answer
+            unsigned int queries;
+            gtime start;
+            gtime last; // time of the last query
+            gtime end;
+        } detect;
     } serial;
     struct {
         struct gudp_address address;
@@ -46,15 +59,23 @@ typedef struct {
             s_network_packet_in_report report;
         };
         int last_axes[AXIS_MAX];
+        int version; // protocol version of the remote GIMX
+        uint16_t ports[MAX_CONTROLLERS]; // the ports served by the remote GIMX process (version 2)
+        unsigned char nb_ports;
+        uint32_t sequence;
+        s_remote_batch batch;
     } remote;
     struct gudp_address src;
     struct gudp_socket * src_socket;
+    s_remote_stats src_stats;
     struct {
         int is_proxy;
         int is_client;
         struct gudp_address local;
         struct gudp_address remote;
         struct gudp_socket * socket;
+        struct gudp_address peer; // the upstream GIMX, when relaying
+        struct gudp_socket * relay_socket; // listening socket, when relaying
     } proxy;
     e_controller_type ctype;
   struct {
@@ -105,5 +126,6 @@ int adapter_forward_interrupt_in(int adapter, unsigned char* data, unsigned char
 
 void adapter_set_haptic_sink(int adapter, int joystick, int force);
 void adapter_set_haptic_tweaks(int adapter, const s_haptic_core_tweaks * tweaks);
+void adapter_set_haptic_position(int joystick, int axis, int value);
 
 #endif /* CONTROLLER_H_ */
@@ -0,0 +1,61 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include "crc32.h"
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+/*
+ * Slice-by-8 tables: crc32_tables[0] is the classic byte-wise table,
+ * crc32_tables[n][i] is the CRC of byte i followed by n null bytes.
+ */
+static uint32_t crc32_tables[8][256];
+
+void crc32_constructor(void) __attribute__((constructor));
+void crc32_constructor(void) {
+
+    unsigned int i;
+    for (i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        unsigned int j;
+        for (j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        crc32_tables[0][i] = crc;
+    }
+    for (i = 0; i < 256; ++i) {
+        unsigned int j;
+        for (j = 1; j < 8; ++j) {
+            uint32_t crc = crc32_tables[j - 1][i];
+            crc32_tables[j][i] = crc32_tables[0][crc & 0xFF] ^ (crc >> 8);
+        }
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void * data, size_t length) {
+
+    const uint8_t * bytes = data;
+
+    // process 8 bytes per iteration, with independent table lookups
+    while (length >= 8) {
+        uint32_t low = crc ^ (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24));
+        crc = crc32_tables[7][low & 0xFF]
+            ^ crc32_tables[6][(low >> 8) & 0xFF]
+            ^ crc32_tables[5][(low >> 16) & 0xFF]
+            ^ crc32_tables[4][low >> 24]
+            ^ crc32_tables[3][bytes[4]]
+            ^ crc32_tables[2][bytes[5]]
+            ^ crc32_tables[1][bytes[6]]
+            ^ crc32_tables[0][bytes[7]];
+        bytes += 8;
+        length -= 8;
+    }
+
+    while (length--) {
+        crc = crc32_tables[0][(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
@@ -0,0 +1,35 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC-32 as used by zlib, Ethernet and the DS4 Bluetooth reports (reflected polynomial 0xEDB88320).
+ *
+ * Usage: crc32_final(crc32_update(crc32_init(), data, length))
+ */
+
+/*
+ * The DS4 Bluetooth reports have a CRC computed over the HIDP header and the report.
+ * These are the CRC states after the HIDP header, i.e. crc32_update(crc32_init(), &header, 1).
+ */
+#define CRC32_SEED_HIDP_INPUT  0x8c2c830c // 0xA1 (DATA | INPUT)
+#define CRC32_SEED_HIDP_OUTPUT 0x1525d2b6 // 0xA2 (DATA | OUTPUT)
+
+static inline uint32_t crc32_init(void) {
+    return 0xFFFFFFFF;
+}
+
+uint32_t crc32_update(uint32_t crc, const void * data, size_t length);
+
+static inline uint32_t crc32_final(uint32_t crc) {
+    return ~crc;
+}
+
+#endif /* CRC32_H_ */
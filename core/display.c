@@ -18,6 +18,7 @@
 #include "gimx.h"
 #include <controller.h>
 #include <stats.h>
+#include <connectors/bluetooth/bt_stats.h>
 
 #define CROSS_CHAR '*'
 #define SHIFT_ESC _("Press Shift+Esc to exit.")
@@ -46,6 +47,8 @@
 #define CAL_Y_P LSTICK_Y_P + STICK_Y_L
 #define CAL_X_P 2
 
+#define BT_STATS_Y_P CAL_Y_P + 8
+
 static WINDOW *lstick = NULL, *rstick = NULL, *wbuttons = NULL, *wcal = NULL;
 
 static int cross[2][2] = { {STICK_X_L / 2, STICK_Y_L / 2}, {STICK_X_L / 2, STICK_Y_L / 2} };
@@ -344,6 +347,28 @@ void display_end()
   }
 }
 
+static void show_bt_stats()
+{
+  char line[COLS];
+
+  unsigned int i;
+  for(i = 0; i < bt_stats_count() && BT_STATS_Y_P + (int)i < LINES-1; ++i)
+  {
+    const s_bt_stats * peer = bt_stats_peer(i);
+    if(peer->sampled)
+    {
+      snprintf(line, sizeof(line), _("%s: RSSI %4d dB, link quality %3u, report rate %4uHz, send errors %u, ACL fragments %u  "),
+          peer->bdaddr, peer->rssi, peer->link_quality, peer->rate, peer->send_errors, peer->segments);
+    }
+    else
+    {
+      snprintf(line, sizeof(line), _("%s: report rate %4uHz, send errors %u, ACL fragments %u  "),
+          peer->bdaddr, peer->rate, peer->send_errors, peer->segments);
+    }
+    mvaddstr(BT_STATS_Y_P + i, CAL_X_P + 1, line);
+  }
+}
+
 static void show_stats(struct stats * s)
 {
   char rate[COLS];
@@ -354,6 +379,8 @@ static void show_stats(struct stats * s)
   {
     snprintf(rate, sizeof(rate), _("Refresh rate: %4dHz  "), freq);
     mvaddstr(LINES-1, 1, rate);
+
+    show_bt_stats();
   }
 }
 
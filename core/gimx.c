@@ -56,11 +56,19 @@ s_gimx_params gimx_params =
   .subpositions = 0,
   .window_events = 0,
   .btstack = 0,
+  .btstack_socket = NULL,
   .logfilename = NULL,
   .logfile = NULL,
   .skip_leds = 0,
   .ff_conv = 0,
   .inactivity_timeout = 0,
+  .haptic_period = 0,
+  .usb_queue_depth = 1,
+  .serial_frames = 0,
+  .bt_link_tuning = 0,
+  .hci_user = 0,
+  .gpp_keepalive = DEFAULT_GPP_KEEPALIVE,
+  .bt_report_rate = 0,
   .clock_source = CLOCK_TIMER,
 };
 
@@ -130,6 +138,10 @@ int process_event(GE_Event* event)
       cfg_process_rumble_event(event);
       break;
     default:
+      if (event->type == GE_JOYAXISMOTION)
+      {
+        adapter_set_haptic_position(ginput_get_device_id(event), event->jaxis.axis, event->jaxis.value);
+      }
       if (!cal_skip_event(event))
       {
         cfg_process_event(event);
@@ -281,6 +293,12 @@ int main(int argc, char *argv[])
   {
     bt_abs_value = E_BT_ABS_BTSTACK;
   }
+#ifndef WIN32
+  else if(gimx_params.hci_user)
+  {
+    bt_abs_value = E_BT_ABS_HCIUSER;
+  }
+#endif
 
   status = adapter_detect();
   if(status != E_GIMX_STATUS_SUCCESS)
@@ -294,6 +312,20 @@ int main(int argc, char *argv[])
      * TODO MLA: per controller refresh period?
      */
     gimx_params.refresh_period = controller_get_default_refresh_period(adapter_get(0)->ctype);
+    if(gimx_params.bt_report_rate && adapter_get(0)->atype == E_ADAPTER_TYPE_BLUETOOTH && adapter_get(0)->ctype == C_TYPE_DS4)
+    {
+      /*
+       * Run the main loop at the Bluetooth report rate.
+       */
+      int period = 1000000 / gimx_params.bt_report_rate;
+      int min_period = controller_get_min_refresh_period(adapter_get(0)->ctype);
+      if(period < min_period)
+      {
+        gwarn(_("Bluetooth report rate is limited to %d Hz\n"), 1000000 / min_period);
+        period = min_period;
+      }
+      gimx_params.refresh_period = period;
+    }
     gimx_params.postpone_count = 3 * DEFAULT_REFRESH_PERIOD / gimx_params.refresh_period;
     ginfo(_("using default refresh period: %.02fms\n"), (double)gimx_params.refresh_period/1000);
   }
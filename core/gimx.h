@@ -39,6 +39,9 @@ typedef enum {
 #define MAX_PROFILES 8
 #define MAX_DEVICES 256
 #define MAX_CONTROLS 256
+#define MAX_USB_QUEUE_DEPTH 8
+#define DEFAULT_GPP_KEEPALIVE 100000 //us
+#define MAX_GPP_KEEPALIVE 10000000 //us
 
 /*
  * Controllers are listening from TCP_PORT to TCP_PORT+MAX_CONTROLLERS-1
@@ -82,11 +85,19 @@ typedef struct
   int window_events;
   int network_input;
   int btstack;
+  char * btstack_socket; // unix socket of the btstack daemon, NULL means TCP
   char * logfilename;
   FILE * logfile;
   int skip_leds;
   int ff_conv;
   unsigned int inactivity_timeout; // minutes, 0 means not defined
+  unsigned int haptic_period; // us, 0 means sink default
+  unsigned int usb_queue_depth; // number of interrupt IN transfers in flight for pass-through devices
+  int serial_frames; // group the packets sent to DIY USB adapters into frames, if supported
+  int bt_link_tuning; // tune the Bluetooth links of interrupt channels for latency (Linux only)
+  int hci_user; // own the Bluetooth dongles through HCI user channels (Linux only)
+  unsigned int gpp_keepalive; // us, unchanged GPP outputs are only sent at this period, 0 means always sent
+  unsigned int bt_report_rate; // Hz, rate of the reports sent to the PS4 over Bluetooth, 0 means refresh rate
   int autograb;
   enum {
       CLOCK_TIMER,
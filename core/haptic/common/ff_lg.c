@@ -145,9 +145,9 @@ unsigned short ff_lg_get_wheel_range(unsigned short pid) {
     return 0;
 }
 
-uint8_t ff_lg_get_caps(uint16_t pid) {
+uint16_t ff_lg_get_caps(uint16_t pid) {
 
-    uint8_t caps = 0;
+    uint16_t caps = 0;
 
     switch(pid) {
     case USB_PRODUCT_ID_LOGITECH_FORMULA_FORCE_GP:
@@ -186,6 +186,24 @@ uint8_t ff_lg_get_caps(uint16_t pid) {
         break;
     }
 
+    switch(pid) {
+    case USB_PRODUCT_ID_LOGITECH_FORMULA_FORCE_GP:
+    case USB_PRODUCT_ID_LOGITECH_DRIVING_FORCE:
+    case USB_PRODUCT_ID_LOGITECH_MOMO_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_DFP_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_G25_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_DFGT_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_G27_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_MOMO_WHEEL2:
+    case USB_PRODUCT_ID_LOGITECH_G29_PC_WHEEL:
+    case USB_PRODUCT_ID_LOGITECH_G29_PS4_WHEEL:
+        // classic protocol
+        caps |= FF_LG_CAPS_SPRING | FF_LG_CAPS_DAMPER;
+        break;
+    default:
+        break;
+    }
+
     switch(pid) {
     case USB_PRODUCT_ID_LOGITECH_G27_WHEEL:
     case USB_PRODUCT_ID_LOGITECH_G29_PS4_WHEEL:
@@ -219,7 +237,7 @@ typedef struct {
  *
  * \return the force coefficient
  */
-static s_coef ff_lg_get_force_coefficient(uint8_t caps, unsigned char k) {
+static s_coef ff_lg_get_force_coefficient(uint16_t caps, unsigned char k) {
 
     s_coef coef;
 
@@ -238,14 +256,14 @@ static s_coef ff_lg_get_force_coefficient(uint8_t caps, unsigned char k) {
     return coef;
 }
 
-static int16_t ff_lg_get_condition_coef(uint8_t caps, unsigned char k, unsigned char s) {
+static int16_t ff_lg_get_condition_coef(uint16_t caps, unsigned char k, unsigned char s) {
 
     s_coef coef = ff_lg_get_force_coefficient(caps, k);
     int value = (s ? -SHRT_MAX : SHRT_MAX) * coef.num / coef.den;
     return value;
 }
 
-static uint16_t ff_lg_get_spring_deadband(uint8_t caps, unsigned char d, unsigned char dL) {
+static uint16_t ff_lg_get_spring_deadband(uint16_t caps, unsigned char d, unsigned char dL) {
 
     uint16_t deadband;
     if (caps & FF_LG_CAPS_HIGH_RES_DEADBAND) {
@@ -256,7 +274,7 @@ static uint16_t ff_lg_get_spring_deadband(uint8_t caps, unsigned char d, unsigne
     return deadband;
 }
 
-static uint16_t ff_lg_get_damper_clip(uint8_t caps, unsigned char c) {
+static uint16_t ff_lg_get_damper_clip(uint16_t caps, unsigned char c) {
 
     uint16_t clip;
     if (caps & FF_LG_CAPS_DAMPER_CLIP) {
@@ -375,7 +393,7 @@ void ff_lg_decode_command(const unsigned char data[FF_LG_OUTPUT_REPORT_SIZE]) {
     dprintf("\n");
 }
 
-int ff_lg_convert_force(uint8_t caps, uint8_t slot_index, const s_ff_lg_command * force, uint8_t playing, s_haptic_core_data * to) {
+int ff_lg_convert_force(uint16_t caps, uint8_t slot_index, const s_ff_lg_command * force, uint8_t playing, s_haptic_core_data * to) {
 
     int ret = 0;
 
@@ -539,7 +557,7 @@ static inline unsigned char convert_coef_lr2lr(unsigned char k) {
 
 #define CLAMP(MIN,VALUE,MAX) (((VALUE) < MIN) ? (MIN) : (((VALUE) > MAX) ? (MAX) : (VALUE)))
 
-void ff_lg_convert_slot(const s_haptic_core_data * from, int slot, s_ff_lg_report * to, uint8_t caps) {
+void ff_lg_convert_slot(const s_haptic_core_data * from, int slot, s_ff_lg_report * to, uint16_t caps) {
 
     memset(to, 0x00, sizeof(*to));
 
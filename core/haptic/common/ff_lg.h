@@ -145,6 +145,8 @@
 #define FF_LG_CAPS_LEDS              (1 << 4)
 #define FF_LG_CAPS_RANGE_200_900     (1 << 5)
 #define FF_LG_CAPS_RANGE             (1 << 6)
+#define FF_LG_CAPS_SPRING            (1 << 7)
+#define FF_LG_CAPS_DAMPER            (1 << 8)
 
 typedef struct PACKED {
     union {
@@ -166,11 +168,11 @@ unsigned short ff_lg_get_wheel_range(unsigned short pid);
 void ff_lg_decode_extended(const unsigned char data[FF_LG_OUTPUT_REPORT_SIZE]);
 void ff_lg_decode_command(const unsigned char data[FF_LG_OUTPUT_REPORT_SIZE]);
 
-uint8_t ff_lg_get_caps(uint16_t pid);
+uint16_t ff_lg_get_caps(uint16_t pid);
 
-int ff_lg_convert_force(uint8_t caps, uint8_t slot_index, const s_ff_lg_command * force, uint8_t playing, s_haptic_core_data * to);
+int ff_lg_convert_force(uint16_t caps, uint8_t slot_index, const s_ff_lg_command * force, uint8_t playing, s_haptic_core_data * to);
 int ff_lg_convert_extended(const s_ff_lg_command * cmd, s_haptic_core_data * to);
-void ff_lg_convert_slot(const s_haptic_core_data * from, int slot, s_ff_lg_report * to, uint8_t caps);
+void ff_lg_convert_slot(const s_haptic_core_data * from, int slot, s_ff_lg_report * to, uint16_t caps);
 
 /*
  * Convert a Logitech wheel position to a signed 16-bit value.
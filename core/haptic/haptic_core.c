@@ -13,6 +13,7 @@
 #include <haptic/haptic_sink.h>
 #include <haptic/haptic_source.h>
 #include <haptic/haptic_tweaks.h>
+#include <haptic/haptic_emulation.h>
 
 struct haptic_core {
     struct {
@@ -24,6 +25,8 @@ struct haptic_core {
         struct haptic_sink_state * state;
     } sink;
     s_haptic_core_tweaks tweaks;
+    s_haptic_tweak_table tweak_table;
+    s_haptic_emulation emulation;
     GLIST_LINK(struct haptic_core);
 };
 
@@ -59,11 +62,25 @@ struct haptic_core * haptic_core_init(s_haptic_core_ids source_ids, int sink_joy
     core->source.state = core->source.ptr->init(source_ids);
     core->sink.state = core->sink.ptr->init(sink_joystick);
 
+    // negotiate the capabilities of the opened device, and emulate the missing ones
+    e_haptic_sink_caps caps = core->sink.ptr->caps;
+    uint16_t range = 0;
+    if (core->sink.state != NULL) {
+        if (core->sink.ptr->get_caps != NULL) {
+            caps = core->sink.ptr->get_caps(core->sink.state);
+        }
+        if (core->sink.ptr->get_range != NULL) {
+            range = core->sink.ptr->get_range(core->sink.state);
+        }
+    }
+    haptic_emulation_init(&core->emulation, caps, range);
+
     core->tweaks.invert = 0;
     core->tweaks.gain.rumble = 100;
     core->tweaks.gain.constant = 100;
     core->tweaks.gain.spring = 100;
     core->tweaks.gain.damper = 100;
+    haptic_tweak_compile(&core->tweaks, &core->tweak_table);
 
     GLIST_ADD(ff_cores, core);
 
@@ -105,13 +122,28 @@ void haptic_core_update(struct haptic_core * core) {
 
     s_haptic_core_data data;
     while (core->source.ptr->get(core->source.state, &data)) {
-        haptic_tweak_apply(&core->tweaks, &data);
+        haptic_tweak_apply_table(&core->tweak_table, &data);
+        if (haptic_emulation_process(&core->emulation, &data) == 0) {
+            core->sink.ptr->process(core->sink.state, &data);
+        }
+    }
+
+    if (haptic_emulation_get(&core->emulation, &data)) {
         core->sink.ptr->process(core->sink.state, &data);
     }
 
     core->sink.ptr->update(core->sink.state);
 }
 
+void haptic_core_set_position(struct haptic_core * core, int16_t position) {
+
+    if (core == NULL) {
+        return;
+    }
+
+    haptic_emulation_set_position(&core->emulation, position);
+}
+
 void haptic_core_set_tweaks(struct haptic_core * core, const s_haptic_core_tweaks * tweaks) {
 
     if (core == NULL) {
@@ -141,4 +173,5 @@ void haptic_core_set_tweaks(struct haptic_core * core, const s_haptic_core_tweak
     }
 
     core->tweaks = *tweaks;
+    haptic_tweak_compile(&core->tweaks, &core->tweak_table);
 }
@@ -41,6 +41,7 @@ typedef enum {
     E_DATA_TYPE_DAMPER,
     E_DATA_TYPE_LEDS,
     E_DATA_TYPE_RANGE,
+    E_DATA_TYPE_LIGHTBAR,
 } e_haptic_core_data_type;
 
 typedef struct {
@@ -51,6 +52,14 @@ typedef struct {
     uint16_t value;
 } s_haptic_core_range;
 
+typedef struct {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t flash_on;
+    uint8_t flash_off;
+} s_haptic_core_lightbar;
+
 typedef struct {
     e_haptic_core_data_type type;
     uint8_t playing;
@@ -61,6 +70,7 @@ typedef struct {
         s_haptic_core_condition damper;
         s_haptic_core_leds leds;
         s_haptic_core_range range;
+        s_haptic_core_lightbar lightbar;
     };
 } s_haptic_core_data;
 
@@ -89,4 +99,6 @@ void haptic_core_set_tweaks(struct haptic_core * core, const s_haptic_core_tweak
 void haptic_core_process_report(struct haptic_core * core, size_t size, const unsigned char * data);
 void haptic_core_update(struct haptic_core * core);
 
+void haptic_core_set_position(struct haptic_core * core, int16_t position);
+
 #endif /* HAPTIC_CORE_H_ */
@@ -0,0 +1,187 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gimx.h>
+#include <haptic/haptic_common.h>
+#include <haptic/haptic_emulation.h>
+
+#define CLAMP(MIN,VALUE,MAX) (((VALUE) < MIN) ? (MIN) : (((VALUE) > MAX) ? (MAX) : (VALUE)))
+
+// the range the physical wheel is assumed to be set to, when the sink does not tell
+#define DEFAULT_PHYSICAL_RANGE 900 // degrees
+
+// force increase per position unit beyond the emulated range
+#define WALL_STIFFNESS 32
+
+// weight of the last sample in the velocity average (1/VELOCITY_FILTER)
+#define VELOCITY_FILTER 4
+
+void haptic_emulation_init(s_haptic_emulation * emulation, e_haptic_sink_caps caps, uint16_t physical_range) {
+
+    memset(emulation, 0x00, sizeof(*emulation));
+
+    emulation->physical_range = physical_range ? physical_range : DEFAULT_PHYSICAL_RANGE;
+
+    // all emulated features are rendered through the constant force
+    if (caps & E_HAPTIC_SINK_CAP_CONSTANT) {
+        emulation->emulated = ~caps & (E_HAPTIC_SINK_CAP_SPRING | E_HAPTIC_SINK_CAP_DAMPER | E_HAPTIC_SINK_CAP_RANGE);
+    }
+
+    if (gimx_params.debug.haptic && emulation->emulated) {
+        dprintf("emulated features:%s%s%s\n",
+                (emulation->emulated & E_HAPTIC_SINK_CAP_SPRING) ? " spring" : "",
+                (emulation->emulated & E_HAPTIC_SINK_CAP_DAMPER) ? " damper" : "",
+                (emulation->emulated & E_HAPTIC_SINK_CAP_RANGE) ? " range" : "");
+    }
+}
+
+/*
+ * Intercept the data that has to be emulated.
+ * Returns 1 if the data should not be forwarded to the sink, 0 otherwise.
+ */
+int haptic_emulation_process(s_haptic_emulation * emulation, const s_haptic_core_data * data) {
+
+    if (emulation->emulated == E_HAPTIC_SINK_CAP_NONE) {
+        return 0;
+    }
+
+    switch (data->type) {
+    case E_DATA_TYPE_CONSTANT:
+        // mixed with the emulated forces
+        emulation->constant = *data;
+        return 1;
+    case E_DATA_TYPE_SPRING:
+        if (emulation->emulated & E_HAPTIC_SINK_CAP_SPRING) {
+            emulation->spring = *data;
+            return 1;
+        }
+        break;
+    case E_DATA_TYPE_DAMPER:
+        if (emulation->emulated & E_HAPTIC_SINK_CAP_DAMPER) {
+            emulation->damper = *data;
+            return 1;
+        }
+        break;
+    case E_DATA_TYPE_RANGE:
+        if (emulation->emulated & E_HAPTIC_SINK_CAP_RANGE) {
+            emulation->range = (data->range.value < emulation->physical_range) ? data->range.value : 0;
+            if (gimx_params.debug.haptic) {
+                dprintf("emulated range: %u degrees\n", data->range.value);
+            }
+            return 1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+void haptic_emulation_set_position(s_haptic_emulation * emulation, int16_t value) {
+
+    if (emulation->emulated == E_HAPTIC_SINK_CAP_NONE) {
+        return;
+    }
+
+    gtime now = gtime_gettime();
+
+    if (emulation->position.valid) {
+        int64_t elapsed = GTIME_USEC(now - emulation->position.time);
+        if (elapsed > 0) {
+            int64_t velocity = ((int64_t) value - emulation->position.value) * 1000000 / elapsed / 2;
+            velocity = CLAMP(SHRT_MIN, velocity, SHRT_MAX);
+            emulation->position.velocity += (velocity - emulation->position.velocity) / VELOCITY_FILTER;
+        }
+    }
+
+    emulation->position.valid = 1;
+    emulation->position.value = value;
+    emulation->position.time = now;
+}
+
+/*
+ * Compute the force of a condition effect, for a given displacement.
+ */
+static int32_t get_condition_force(const s_haptic_core_condition * condition, int32_t displacement) {
+
+    int32_t offset = displacement - condition->center;
+    int32_t half_deadband = condition->deadband / 2;
+    int32_t force = 0;
+
+    if (offset > half_deadband) {
+        force = -(offset - half_deadband) * condition->coefficient.right / SHRT_MAX;
+        int32_t saturation = condition->saturation.right / 2;
+        force = CLAMP(-saturation, force, saturation);
+    } else if (offset < -half_deadband) {
+        force = -(offset + half_deadband) * condition->coefficient.left / SHRT_MAX;
+        int32_t saturation = condition->saturation.left / 2;
+        force = CLAMP(-saturation, force, saturation);
+    }
+
+    return force;
+}
+
+/*
+ * Mix the source constant force with the emulated forces.
+ * Returns 1 if a new constant force has to be sent to the sink, 0 otherwise.
+ */
+int haptic_emulation_get(s_haptic_emulation * emulation, s_haptic_core_data * data) {
+
+    if (emulation->emulated == E_HAPTIC_SINK_CAP_NONE) {
+        return 0;
+    }
+
+    int32_t level = 0;
+    uint8_t playing = 0;
+
+    if (emulation->constant.playing) {
+        level += emulation->constant.constant.level;
+        playing = 1;
+    }
+
+    if (emulation->position.valid) {
+
+        if (emulation->spring.playing) {
+            level += get_condition_force(&emulation->spring.spring, emulation->position.value);
+            playing = 1;
+        }
+
+        if (emulation->damper.playing) {
+            level += get_condition_force(&emulation->damper.damper, emulation->position.velocity);
+            playing = 1;
+        }
+
+        if (emulation->range != 0) {
+            int32_t limit = SHRT_MAX * emulation->range / emulation->physical_range;
+            int32_t position = emulation->position.value;
+            if (position > limit) {
+                level -= (position - limit) * WALL_STIFFNESS;
+                playing = 1;
+            } else if (position < -limit) {
+                level += (-limit - position) * WALL_STIFFNESS;
+                playing = 1;
+            }
+        }
+    }
+
+    level = CLAMP(-SHRT_MAX, level, SHRT_MAX);
+
+    if (playing == emulation->last.playing && level == emulation->last.level) {
+        return 0;
+    }
+
+    emulation->last.playing = playing;
+    emulation->last.level = level;
+
+    data->type = E_DATA_TYPE_CONSTANT;
+    data->playing = playing;
+    data->constant.level = level;
+
+    return 1;
+}
@@ -0,0 +1,43 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#ifndef HAPTIC_EMULATION_H_
+#define HAPTIC_EMULATION_H_
+
+#include <haptic/haptic_core.h>
+#include <haptic/haptic_sink.h>
+#include <gimxtime/include/gtime.h>
+
+/*
+ * Software emulation of the features a sink does not support, using its constant force.
+ *
+ * Positions are in the joystick axis range ([-32768, 32767]), and a positive constant level
+ * pushes the wheel towards positive positions (use the invert tweak if the wheel does the opposite).
+ */
+typedef struct {
+    e_haptic_sink_caps emulated; // the features emulated for the sink
+    struct {
+        int valid;
+        int16_t value;
+        int32_t velocity; // full scale is 2 ranges per second
+        gtime time;
+    } position;
+    s_haptic_core_data constant; // from the source
+    s_haptic_core_data spring;
+    s_haptic_core_data damper;
+    uint16_t physical_range; // degrees
+    uint16_t range; // degrees, 0 means not emulated
+    struct {
+        uint8_t playing;
+        int16_t level;
+    } last; // last constant force sent to the sink
+} s_haptic_emulation;
+
+void haptic_emulation_init(s_haptic_emulation * emulation, e_haptic_sink_caps caps, uint16_t physical_range);
+int haptic_emulation_process(s_haptic_emulation * emulation, const s_haptic_core_data * data);
+void haptic_emulation_set_position(s_haptic_emulation * emulation, int16_t value);
+int haptic_emulation_get(s_haptic_emulation * emulation, s_haptic_core_data * data);
+
+#endif /* HAPTIC_EMULATION_H_ */
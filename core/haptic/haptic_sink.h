@@ -21,6 +21,7 @@ typedef enum {
     E_HAPTIC_SINK_CAP_CONSTANT = (1 << 1),
     E_HAPTIC_SINK_CAP_SPRING = (1 << 2),
     E_HAPTIC_SINK_CAP_DAMPER = (1 << 3),
+    E_HAPTIC_SINK_CAP_RANGE = (1 << 4),
 } e_haptic_sink_caps;
 
 typedef struct {
@@ -31,6 +32,8 @@ typedef struct {
     void (* clean)(struct haptic_sink_state * state);
     void (* process)(struct haptic_sink_state * state, const s_haptic_core_data * data);
     void (* update)(struct haptic_sink_state * state);
+    e_haptic_sink_caps (* get_caps)(struct haptic_sink_state * state); // optional, caps of the opened device
+    uint16_t (* get_range)(struct haptic_sink_state * state); // optional, fixed range of the opened device (degrees)
 } s_haptic_sink;
 
 void haptic_sink_register(s_haptic_sink * sink);
@@ -5,68 +5,97 @@
 
 #include <limits.h>
 #include <haptic/haptic_core.h>
-
-#define SWAP(TYPE, V1, V2) \
-        TYPE tmp = V1; \
-        V1 = V2; \
-        V2 = tmp;
+#include <haptic/haptic_tweaks.h>
 
 #define CLAMP(MIN,VALUE,MAX) (((VALUE) < MIN) ? (MIN) : (((VALUE) > MAX) ? (MAX) : (VALUE)))
 
-#define APPLY_GAIN(VALUE, GAIN, MIN, MAX) \
-        { \
-            int64_t tmp = VALUE * GAIN / 100; \
-            VALUE = CLAMP(MIN, tmp, MAX); \
-        }
+/*
+ * Select V1 or V2 according to SWAP, without branching.
+ */
+#define SELECT(TYPE, SWAP, V1, V2) \
+        ((TYPE) (((V1) & ((SWAP) - 1)) | ((V2) & -(SWAP))))
 
-void haptic_tweak_apply(const s_haptic_core_tweaks * tweaks, s_haptic_core_data * data) {
+static inline int32_t apply_scale(const s_haptic_tweak_scale * scale, int32_t value) {
+
+    int64_t tmp = (int64_t) value * scale->gain / 100;
+    return CLAMP(scale->min, tmp, scale->max);
+}
+
+static void compile_scale(int gain, int32_t min, int32_t max, int32_t type_min, int32_t type_max,
+        s_haptic_tweak_scale * scale) {
+
+    scale->gain = gain;
+    if (gain != 100) {
+        scale->min = min;
+        scale->max = max;
+    } else {
+        scale->min = type_min;
+        scale->max = type_max;
+    }
+}
+
+void haptic_tweak_compile(const s_haptic_core_tweaks * tweaks, s_haptic_tweak_table * table) {
+
+    table->sign = tweaks->invert ? -1 : 1;
+    table->swap = tweaks->invert ? 1 : 0;
+
+    compile_scale(tweaks->gain.rumble, 0, USHRT_MAX, 0, USHRT_MAX, &table->scale.rumble);
+    compile_scale(tweaks->gain.constant, -SHRT_MAX, SHRT_MAX, SHRT_MIN, SHRT_MAX, &table->scale.constant);
+    compile_scale(tweaks->gain.spring, 0, USHRT_MAX, 0, USHRT_MAX, &table->scale.spring_saturation);
+    compile_scale(tweaks->gain.spring, -SHRT_MAX, SHRT_MAX, SHRT_MIN, SHRT_MAX, &table->scale.spring_coefficient);
+    compile_scale(tweaks->gain.damper, 0, USHRT_MAX, 0, USHRT_MAX, &table->scale.damper_saturation);
+    compile_scale(tweaks->gain.damper, -SHRT_MAX, SHRT_MAX, SHRT_MIN, SHRT_MAX, &table->scale.damper_coefficient);
+}
+
+static inline void apply_condition(const s_haptic_tweak_table * table, const s_haptic_tweak_scale * saturation,
+        const s_haptic_tweak_scale * coefficient, int32_t sign, s_haptic_core_condition * condition) {
+
+    int32_t left = apply_scale(coefficient, condition->coefficient.left);
+    int32_t right = apply_scale(coefficient, condition->coefficient.right);
+
+    condition->saturation.left = apply_scale(saturation, condition->saturation.left);
+    condition->saturation.right = apply_scale(saturation, condition->saturation.right);
+    condition->coefficient.left = SELECT(int16_t, table->swap, left, right);
+    condition->coefficient.right = SELECT(int16_t, table->swap, right, left);
+    condition->center = condition->center * sign;
+}
+
+void haptic_tweak_apply_table(const s_haptic_tweak_table * table, s_haptic_core_data * data) {
+
+    int32_t weak, strong;
 
     switch (data->type) {
     case E_DATA_TYPE_RUMBLE:
-        if (tweaks->gain.rumble != 100) {
-            APPLY_GAIN(data->rumble.weak, tweaks->gain.rumble, 0, USHRT_MAX)
-            APPLY_GAIN(data->rumble.strong, tweaks->gain.rumble, 0, USHRT_MAX)
-        }
-        if (tweaks->invert) {
-            SWAP(uint16_t, data->rumble.weak, data->rumble.strong)
-        }
+        weak = apply_scale(&table->scale.rumble, data->rumble.weak);
+        strong = apply_scale(&table->scale.rumble, data->rumble.strong);
+        data->rumble.weak = SELECT(uint16_t, table->swap, weak, strong);
+        data->rumble.strong = SELECT(uint16_t, table->swap, strong, weak);
         break;
     case E_DATA_TYPE_CONSTANT:
-        if (tweaks->gain.constant != 100) {
-            APPLY_GAIN(data->constant.level, tweaks->gain.constant, -SHRT_MAX, SHRT_MAX)
-        }
-        if (tweaks->invert) {
-            data->constant.level = -data->constant.level;
-        }
+        data->constant.level = apply_scale(&table->scale.constant, data->constant.level) * table->sign;
         break;
     case E_DATA_TYPE_SPRING:
-        if (tweaks->gain.spring != 100) {
-            APPLY_GAIN(data->spring.saturation.left, tweaks->gain.spring, 0, USHRT_MAX)
-            APPLY_GAIN(data->spring.saturation.right, tweaks->gain.spring, 0, USHRT_MAX)
-            APPLY_GAIN(data->spring.coefficient.left, tweaks->gain.spring, -SHRT_MAX, SHRT_MAX)
-            APPLY_GAIN(data->spring.coefficient.right, tweaks->gain.spring, -SHRT_MAX, SHRT_MAX)
-        }
-        if (tweaks->invert) {
-            SWAP(int16_t, data->spring.coefficient.left, data->spring.coefficient.right)
-            data->spring.center = -data->spring.center;
-        }
+        apply_condition(table, &table->scale.spring_saturation, &table->scale.spring_coefficient, table->sign,
+                &data->spring);
         break;
     case E_DATA_TYPE_DAMPER:
-        if (tweaks->gain.damper != 100) {
-            APPLY_GAIN(data->damper.saturation.left, tweaks->gain.damper, 0, USHRT_MAX)
-            APPLY_GAIN(data->damper.saturation.right, tweaks->gain.damper, 0, USHRT_MAX)
-            APPLY_GAIN(data->damper.coefficient.left, tweaks->gain.damper, -SHRT_MAX, SHRT_MAX)
-            APPLY_GAIN(data->damper.coefficient.right, tweaks->gain.damper, -SHRT_MAX, SHRT_MAX)
-        }
-        if (tweaks->invert) {
-            SWAP(int16_t, data->spring.coefficient.left, data->spring.coefficient.right)
-        }
+        // the center of a damper is not inverted
+        apply_condition(table, &table->scale.damper_saturation, &table->scale.damper_coefficient, 1, &data->damper);
         break;
     case E_DATA_TYPE_LEDS:
         break;
     case E_DATA_TYPE_RANGE:
         break;
+    case E_DATA_TYPE_LIGHTBAR:
+        break;
     case E_DATA_TYPE_NONE:
         break;
     }
 }
+
+void haptic_tweak_apply(const s_haptic_core_tweaks * tweaks, s_haptic_core_data * data) {
+
+    s_haptic_tweak_table table;
+    haptic_tweak_compile(tweaks, &table);
+    haptic_tweak_apply_table(&table, data);
+}
@@ -8,6 +8,36 @@
 
 #include <haptic/haptic_core.h>
 
+/*
+ * Scale and bounds applied to the values of a given effect type.
+ * When the gain is 100 the bounds are the full range of the field type,
+ * so that values are left untouched.
+ */
+typedef struct {
+    int32_t gain;
+    int32_t min;
+    int32_t max;
+} s_haptic_tweak_scale;
+
+/*
+ * Tweaks precompiled into a transform table, to be applied without branching on tweak values.
+ */
+typedef struct {
+    int32_t sign; // -1 if inverted, 1 otherwise
+    uint32_t swap; // 1 if inverted, 0 otherwise
+    struct {
+        s_haptic_tweak_scale rumble;
+        s_haptic_tweak_scale constant;
+        s_haptic_tweak_scale spring_saturation;
+        s_haptic_tweak_scale spring_coefficient;
+        s_haptic_tweak_scale damper_saturation;
+        s_haptic_tweak_scale damper_coefficient;
+    } scale;
+} s_haptic_tweak_table;
+
+void haptic_tweak_compile(const s_haptic_core_tweaks * tweaks, s_haptic_tweak_table * table);
+void haptic_tweak_apply_table(const s_haptic_tweak_table * table, s_haptic_core_data * data);
+
 void haptic_tweak_apply(const s_haptic_core_tweaks * tweaks, s_haptic_core_data * data);
 
 #endif /* HAPTIC_TWEAKS_H_ */
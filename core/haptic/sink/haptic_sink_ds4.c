@@ -9,8 +9,10 @@
 #include <stdlib.h>
 
 #include <gimxhid/include/ghid.h>
+#include <gimxtime/include/gtime.h>
 #include <controller.h>
 #include <gimx.h>
+#include <crc32.h>
 #include <limits.h>
 #include <haptic/haptic_common.h>
 #include <haptic/haptic_sink.h>
@@ -18,18 +20,131 @@
 #define DS4_VENDOR 0x054c
 #define DS4_PRODUCT 0x05c4
 #define DS4_PRODUCT_2 0x09cc
-#define DS4_OUTPUT_REPORT_SIZE 32
+
+#define DS4_USB_OUTPUT_REPORT_ID 0x05
+#define DS4_USB_OUTPUT_REPORT_SIZE 32
+#define DS4_USB_OUTPUT_OFFSET 4 // offset of the rumble and lightbar data
+
+#define DS4_BT_OUTPUT_REPORT_ID 0x11
+#define DS4_BT_OUTPUT_REPORT_SIZE 78
+#define DS4_BT_OUTPUT_OFFSET 6 // offset of the rumble and lightbar data
+#define DS4_BT_HID_CRC 0xC0 // the report is a HID report, and has a CRC
+#define DS4_BT_POLL_INTERVAL 0x04 // ms
+
+#define DS4_FLAGS_RUMBLE   0x01
+#define DS4_FLAGS_LIGHTBAR 0x02
+#define DS4_FLAGS_FLASH    0x04
+
+#define DS4_DEFAULT_PERIOD 8000 // us
 
 struct haptic_sink_state {
     struct ghid_device *hid;
     int write_pending;
     int updated;
-    uint8_t report[DS4_OUTPUT_REPORT_SIZE];
+    int bluetooth;
+    unsigned int period; // us
+    gtime last_send;
+    uint8_t weak;
+    uint8_t strong;
+    s_haptic_core_lightbar lightbar;
+    uint8_t report[DS4_BT_OUTPUT_REPORT_SIZE];
 };
 
+/*
+ * Check if a HID report descriptor declares an output report with a given id.
+ */
+static int has_output_report(const s_hid_info * info, uint8_t id) {
+
+    if (info == NULL || info->reportDescriptor == NULL) {
+        return 0;
+    }
+
+    const unsigned char * desc = info->reportDescriptor;
+    unsigned int length = info->reportDescriptorLength;
+    unsigned int i = 0;
+    uint8_t current = 0;
+
+    while (i < length) {
+        uint8_t prefix = desc[i];
+        if (prefix == 0xFE) {
+            // long item
+            if (i + 1 >= length) {
+                break;
+            }
+            i += 3 + desc[i + 1];
+            continue;
+        }
+        unsigned int size = prefix & 0x03;
+        if (size == 3) {
+            size = 4;
+        }
+        if (i + size >= length) {
+            break;
+        }
+        switch (prefix & 0xFC) {
+        case 0x84: // Report ID
+            current = desc[i + 1];
+            break;
+        case 0x90: // Output
+            if (current == id) {
+                return 1;
+            }
+            break;
+        }
+        i += 1 + size;
+    }
+
+    return 0;
+}
+
+/*
+ * Build the output report, merging the last rumble and lightbar states.
+ */
+static unsigned int build_report(struct haptic_sink_state *state) {
+
+    uint8_t * report = state->report;
+    unsigned int size;
+    unsigned int offset;
+
+    memset(report, 0x00, sizeof(state->report));
+
+    if (state->bluetooth) {
+        report[0] = DS4_BT_OUTPUT_REPORT_ID;
+        report[1] = DS4_BT_HID_CRC | DS4_BT_POLL_INTERVAL;
+        report[3] = DS4_FLAGS_RUMBLE | DS4_FLAGS_LIGHTBAR | DS4_FLAGS_FLASH;
+        offset = DS4_BT_OUTPUT_OFFSET;
+        size = DS4_BT_OUTPUT_REPORT_SIZE;
+    } else {
+        report[0] = DS4_USB_OUTPUT_REPORT_ID;
+        report[1] = DS4_FLAGS_RUMBLE | DS4_FLAGS_LIGHTBAR | DS4_FLAGS_FLASH;
+        offset = DS4_USB_OUTPUT_OFFSET;
+        size = DS4_USB_OUTPUT_REPORT_SIZE;
+    }
+
+    report[offset++] = state->weak;
+    report[offset++] = state->strong;
+    report[offset++] = state->lightbar.red;
+    report[offset++] = state->lightbar.green;
+    report[offset++] = state->lightbar.blue;
+    report[offset++] = state->lightbar.flash_on;
+    report[offset++] = state->lightbar.flash_off;
+
+    if (state->bluetooth) {
+        uint32_t crc = crc32_final(crc32_update(CRC32_SEED_HIDP_OUTPUT, report, size - sizeof(crc)));
+        report[size - 4] = crc & 0xFF;
+        report[size - 3] = (crc >> 8) & 0xFF;
+        report[size - 2] = (crc >> 16) & 0xFF;
+        report[size - 1] = crc >> 24;
+    }
+
+    return size;
+}
+
 static inline void send_report(struct haptic_sink_state *state) {
 
-    int res = ghid_write(state->hid, state->report, sizeof(state->report));
+    unsigned int size = build_report(state);
+
+    int res = ghid_write(state->hid, state->report, size);
     if (res == 0) {
         state->write_pending = 1;
     } else if (res > 0) {
@@ -40,14 +155,19 @@ static inline void send_report(struct haptic_sink_state *state) {
 
 void haptic_sink_ds4_update(struct haptic_sink_state *state) {
 
-    if (state->write_pending != 0) {
+    if (state->write_pending != 0 || state->updated == 0) {
         return;
     }
 
-    if (state->updated) {
-        send_report(state);
-        state->updated = 0;
+    // send at most one report per period, merging all updates received in the meantime
+    gtime now = gtime_gettime();
+    if (state->last_send != 0 && GTIME_USEC(now - state->last_send) < state->period) {
+        return;
     }
+
+    send_report(state);
+    state->updated = 0;
+    state->last_send = now;
 }
 
 static int hid_write_cb(void *user, int status) {
@@ -117,19 +237,27 @@ static struct haptic_sink_state* haptic_sink_ds4_init(int joystick) {
         return NULL;
     }
 
-    state->report[0] = 0x05;
-    state->report[1] = 0x07;
+    // a DS4 connected over Bluetooth only accepts the Bluetooth output report
+    const s_hid_info * info = ghid_get_hid_info(hid);
+    state->bluetooth = !has_output_report(info, DS4_USB_OUTPUT_REPORT_ID) && has_output_report(info, DS4_BT_OUTPUT_REPORT_ID);
+
+    state->period = gimx_params.haptic_period ? gimx_params.haptic_period : DS4_DEFAULT_PERIOD;
+
+    if (gimx_params.debug.haptic) {
+        dprintf("DS4 sink: %s output reports, period: %uus\n", state->bluetooth ? "Bluetooth" : "USB", state->period);
+    }
 
     return state;
 }
 
 static void haptic_sink_ds4_clean(struct haptic_sink_state *state) {
 
-    if (state->report[4] || state->report[5]) {
+    if (state->weak || state->strong) {
         // stop rumble
-        state->report[4] = 0;
-        state->report[5] = 0;
-        ghid_write_timeout(state->hid, state->report, sizeof(state->report), 1000);
+        state->weak = 0;
+        state->strong = 0;
+        unsigned int size = build_report(state);
+        ghid_write_timeout(state->hid, state->report, size, 1000);
     }
 
     ghid_close(state->hid);
@@ -142,12 +270,18 @@ static void haptic_sink_ds4_process(struct haptic_sink_state *state, const s_hap
     if (data->type == E_DATA_TYPE_RUMBLE) {
         uint8_t weak = data->rumble.weak * UCHAR_MAX / USHRT_MAX;
         uint8_t strong = data->rumble.strong * UCHAR_MAX / USHRT_MAX;
-        if (state->report[4] != weak || state->report[5] != strong) {
-            state->report[4] = weak;
-            state->report[5] = strong;
+        if (state->weak != weak || state->strong != strong) {
+            state->weak = weak;
+            state->strong = strong;
             state->updated = 1;
             dprintf("< RUMBLE, weak=%hu, strong=%hu\n", weak, strong);
         }
+    } else if (data->type == E_DATA_TYPE_LIGHTBAR) {
+        if (memcmp(&state->lightbar, &data->lightbar, sizeof(state->lightbar))) {
+            state->lightbar = data->lightbar;
+            state->updated = 1;
+            dprintf("< LIGHTBAR, red=%hu, green=%hu, blue=%hu\n", data->lightbar.red, data->lightbar.green, data->lightbar.blue);
+        }
     }
 }
 
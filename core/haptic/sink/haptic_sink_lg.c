@@ -20,7 +20,7 @@ struct haptic_sink_state {
     struct ghid_device * hid;
     int write_pending;
     unsigned short pid;
-    uint8_t caps;
+    uint16_t caps;
     struct {
         s_haptic_core_data data;
         int updated; // checked before removing the slot from the fifo
@@ -323,6 +323,8 @@ static void haptic_sink_lg_process(struct haptic_sink_state * state, const s_hap
         break;
     case E_DATA_TYPE_RUMBLE:
         break;
+    case E_DATA_TYPE_LIGHTBAR:
+        break;
     case E_DATA_TYPE_CONSTANT:
         slot = slot_constant;
         break;
@@ -363,6 +365,27 @@ static void haptic_sink_lg_process(struct haptic_sink_state * state, const s_hap
     }
 }
 
+static e_haptic_sink_caps haptic_sink_lg_get_caps(struct haptic_sink_state * state) {
+
+    e_haptic_sink_caps caps = E_HAPTIC_SINK_CAP_CONSTANT;
+
+    if (state->caps & FF_LG_CAPS_SPRING) {
+        caps |= E_HAPTIC_SINK_CAP_SPRING;
+    }
+    if (state->caps & FF_LG_CAPS_DAMPER) {
+        caps |= E_HAPTIC_SINK_CAP_DAMPER;
+    }
+    if (state->caps & FF_LG_CAPS_RANGE) {
+        caps |= E_HAPTIC_SINK_CAP_RANGE;
+    }
+
+    return caps;
+}
+
+static uint16_t haptic_sink_lg_get_range(struct haptic_sink_state * state) {
+
+    return ff_lg_get_wheel_range(state->pid);
+}
 
 static s_haptic_core_ids haptic_sink_lg_ids[] = {
         { .vid = USB_VENDOR_ID_LOGITECH,  .pid = USB_PRODUCT_ID_LOGITECH_FORMULA_FORCE_GP  },
@@ -383,7 +406,9 @@ static s_haptic_sink sink_lg = {
         .init = haptic_sink_lg_init,
         .clean = haptic_sink_lg_clean,
         .process = haptic_sink_lg_process,
-        .update = haptic_sink_lg_update
+        .update = haptic_sink_lg_update,
+        .get_caps = haptic_sink_lg_get_caps,
+        .get_range = haptic_sink_lg_get_range,
 };
 
 void haptic_sink_lg_constructor(void) __attribute__((constructor));
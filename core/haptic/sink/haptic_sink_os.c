@@ -10,6 +10,7 @@
 
 struct haptic_sink_state {
     int joystick;
+    int haptic;
 };
 
 static void dump_event(const GE_Event * event) {
@@ -47,6 +48,7 @@ static struct haptic_sink_state * haptic_sink_os_init(int joystick) {
             if (ptr != NULL) {
                 struct haptic_sink_state * state = (struct haptic_sink_state *) ptr;
                 state->joystick = joystick;
+                state->haptic = haptic;
                 return state;
             } else {
                 PRINT_ERROR_ALLOC_FAILED("calloc");
@@ -105,6 +107,7 @@ static void haptic_sink_os_process(struct haptic_sink_state * state, const s_hap
     case E_DATA_TYPE_NONE:
     case E_DATA_TYPE_RUMBLE:
     case E_DATA_TYPE_LEDS:
+    case E_DATA_TYPE_LIGHTBAR:
         break;
     }
 
@@ -134,6 +137,26 @@ static void haptic_sink_os_update(struct haptic_sink_state * state __attribute__
     // nothing to do here
 }
 
+static e_haptic_sink_caps haptic_sink_os_get_caps(struct haptic_sink_state * state) {
+
+    e_haptic_sink_caps caps = E_HAPTIC_SINK_CAP_NONE;
+
+    if (state->haptic & GE_HAPTIC_RUMBLE) {
+        caps |= E_HAPTIC_SINK_CAP_RUMBLE;
+    }
+    if (state->haptic & GE_HAPTIC_CONSTANT) {
+        caps |= E_HAPTIC_SINK_CAP_CONSTANT;
+    }
+    if (state->haptic & GE_HAPTIC_SPRING) {
+        caps |= E_HAPTIC_SINK_CAP_SPRING;
+    }
+    if (state->haptic & GE_HAPTIC_DAMPER) {
+        caps |= E_HAPTIC_SINK_CAP_DAMPER;
+    }
+
+    return caps;
+}
+
 static s_haptic_core_ids haptic_sink_os_ids[] = {
         /* This is a generic source, don't add anything here */
         { .vid = 0x0000,      .pid = 0x0000       }, // end of table
@@ -146,7 +169,8 @@ static s_haptic_sink sink_os = {
         .init = haptic_sink_os_init,
         .clean = haptic_sink_os_clean,
         .process = haptic_sink_os_process,
-        .update = haptic_sink_os_update
+        .update = haptic_sink_os_update,
+        .get_caps = haptic_sink_os_get_caps,
 };
 
 void haptic_sink_os_constructor(void) __attribute__((constructor));
@@ -26,7 +26,7 @@ typedef struct {
 } s_ext_cmd;
 
 struct haptic_source_state {
-    uint8_t caps;
+    uint16_t caps;
     uint8_t cmd_offset;
     uint16_t range; // the current wheel range (0 means unknown)
     s_force forces[FF_LG_FSLOTS_NB];
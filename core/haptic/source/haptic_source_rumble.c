@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gimxcontroller/include/controller.h>
 #include <haptic/haptic_source.h>
 #include <limits.h>
@@ -23,8 +24,12 @@ static struct {
         unsigned char offset;
         unsigned char max;
     } strong;
+    struct {
+        unsigned char offset; // red, green, blue, flash on, flash off (0 means no lightbar)
+    } lightbar;
 } props[] = {
-        { .ids = { .vid = DS4_VENDOR,  .pid = DS4_PRODUCT    }, .reportId = 0x00, .weak = { 4, 0xff }, .strong = { 5, 0xff } },
+        { .ids = { .vid = DS4_VENDOR,  .pid = DS4_PRODUCT    }, .reportId = 0x00, .weak = { 4, 0xff }, .strong = { 5, 0xff }, .lightbar = { 6 } },
+        { .ids = { .vid = DS4_VENDOR,  .pid = DS4_PRODUCT_2  }, .reportId = 0x00, .weak = { 4, 0xff }, .strong = { 5, 0xff }, .lightbar = { 6 } },
         { .ids = { .vid = X360_VENDOR, .pid = X360_PRODUCT   }, .reportId = 0x00, .weak = { 4, 0xff }, .strong = { 3, 0xff } },
         { .ids = { .vid = DS3_VENDOR,  .pid = DS3_PRODUCT    }, .reportId = 0x00, .weak = { 3, 0x01 }, .strong = { 5, 0xff } },
         { .ids = { .vid = XONE_VENDOR, .pid = XONE_PRODUCT   }, .reportId = 0x09, .weak = { 9, 0xff }, .strong = { 8, 0xff } },
@@ -40,6 +45,8 @@ struct haptic_source_state
     int updated;
     uint16_t weak;
     uint16_t strong;
+    int lightbar_updated;
+    s_haptic_core_lightbar lightbar;
 };
 
 static struct haptic_source_state * haptic_source_rumble_init(s_haptic_core_ids ids) {
@@ -66,7 +73,7 @@ static void haptic_source_rumble_clean(struct haptic_source_state * state) {
     free(state);
 }
 
-static void haptic_source_rumble_process(struct haptic_source_state * state, size_t size __attribute((unused)), const unsigned char * data) {
+static void haptic_source_rumble_process(struct haptic_source_state * state, size_t size, const unsigned char * data) {
 
     uint8_t reportId = props[state->props_index].reportId;
 
@@ -83,6 +90,24 @@ static void haptic_source_rumble_process(struct haptic_source_state * state, siz
         state->strong = strong;
         dprintf("> RUMBLE, weak=%hu, strong=%hu\n", weak, strong);
     }
+
+    unsigned char offset = props[state->props_index].lightbar.offset;
+
+    if (offset != 0 && offset + sizeof(state->lightbar) <= size) {
+        s_haptic_core_lightbar lightbar = {
+                .red = data[offset],
+                .green = data[offset + 1],
+                .blue = data[offset + 2],
+                .flash_on = data[offset + 3],
+                .flash_off = data[offset + 4],
+        };
+        if (memcmp(&lightbar, &state->lightbar, sizeof(lightbar))) {
+            state->lightbar_updated = 1;
+            state->lightbar = lightbar;
+            dprintf("> LIGHTBAR, red=%hu, green=%hu, blue=%hu, flash on=%hu, flash off=%hu\n",
+                    lightbar.red, lightbar.green, lightbar.blue, lightbar.flash_on, lightbar.flash_off);
+        }
+    }
 }
 
 static int haptic_source_rumble_get(struct haptic_source_state * state, s_haptic_core_data * data) {
@@ -95,6 +120,11 @@ static int haptic_source_rumble_get(struct haptic_source_state * state, s_haptic
         data->rumble.strong = state->strong;
         state->updated = 0;
         ret = 1;
+    } else if (state->lightbar_updated) {
+        data->type = E_DATA_TYPE_LIGHTBAR;
+        data->lightbar = state->lightbar;
+        state->lightbar_updated = 0;
+        ret = 1;
     }
 
     return ret;
@@ -102,6 +132,7 @@ static int haptic_source_rumble_get(struct haptic_source_state * state, s_haptic
 
 static s_haptic_core_ids haptic_source_rumble_ids[] = {
         { .vid = DS4_VENDOR,  .pid = DS4_PRODUCT    },
+        { .vid = DS4_VENDOR,  .pid = DS4_PRODUCT_2  },
         { .vid = X360_VENDOR, .pid = X360_PRODUCT   },
         { .vid = DS3_VENDOR,  .pid = DS3_PRODUCT    },
         { .vid = XONE_VENDOR, .pid = XONE_PRODUCT   },
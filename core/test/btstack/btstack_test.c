@@ -0,0 +1,214 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Exchange framed packets with a mock btstack daemon that echoes them back,
+ * over TCP loopback, a unix stream socket and a unix seqpacket socket,
+ * and measure the per-packet round trip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <connectors/bluetooth/btstack/btstack_transport.h>
+
+#define PACKETS 10000
+#define PAYLOAD 50 // a sixaxis input report
+
+#define TCP_PORT 13334
+
+static unsigned long long now_ns() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int listen_unix(const char * path, int type) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, type, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        perror("listen_unix");
+        exit(-1);
+    }
+    return fd;
+}
+
+static int listen_tcp() {
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TCP_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        perror("listen_tcp");
+        exit(-1);
+    }
+    return fd;
+}
+
+static int connect_tcp() {
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TCP_PORT), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect_tcp");
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/*
+ * Receive a complete packet.
+ */
+static int recv_packet(int fd, int seqpacket, unsigned char * buffer, unsigned int size) {
+
+    uint16_t read = 0, remaining = 0;
+    int ret;
+    while ((ret = btstack_transport_recv(fd, seqpacket, buffer, size, &read, &remaining)) == 0)
+        ;
+    return ret;
+}
+
+/*
+ * The mock daemon: echo each packet, until the connection is closed.
+ */
+static void daemon_serve(int listen_fd, int seqpacket) {
+
+    unsigned char buffer[BTSTACK_HEADER_SIZE + 1024];
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        perror("accept");
+        exit(-1);
+    }
+    if (!seqpacket) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    while (recv_packet(fd, seqpacket, buffer, sizeof(buffer)) == 1) {
+        uint16_t type = buffer[0] | buffer[1] << 8;
+        uint16_t channel = buffer[2] | buffer[3] << 8;
+        uint16_t len = buffer[4] | buffer[5] << 8;
+        if (btstack_transport_send(fd, type, channel, buffer + BTSTACK_HEADER_SIZE, len) < 0) {
+            break;
+        }
+    }
+
+    close(fd);
+}
+
+static int run(const char * name, int fd, int seqpacket) {
+
+    unsigned char payload[PAYLOAD];
+    unsigned char buffer[BTSTACK_HEADER_SIZE + 1024];
+    unsigned long long min = -1ULL, max = 0, total = 0;
+
+    unsigned int i;
+    for (i = 0; i < PACKETS; ++i) {
+
+        memset(payload, i, sizeof(payload));
+
+        unsigned long long start = now_ns();
+
+        if (btstack_transport_send(fd, 0x06, i & 0xFFFF, payload, sizeof(payload)) != sizeof(payload)) {
+            fprintf(stderr, "%s: send failed\n", name);
+            return -1;
+        }
+        if (recv_packet(fd, seqpacket, buffer, sizeof(buffer)) != 1) {
+            fprintf(stderr, "%s: recv failed\n", name);
+            return -1;
+        }
+
+        unsigned long long rtt = now_ns() - start;
+
+        if ((unsigned int) (buffer[2] | buffer[3] << 8) != (i & 0xFFFF) || (buffer[4] | buffer[5] << 8) != PAYLOAD
+                || memcmp(buffer + BTSTACK_HEADER_SIZE, payload, sizeof(payload))) {
+            fprintf(stderr, "%s: bad echo for packet %u\n", name, i);
+            return -1;
+        }
+
+        total += rtt;
+        if (rtt < min) min = rtt;
+        if (rtt > max) max = rtt;
+    }
+
+    printf("%-16s round trip: min %6.2f us, avg %6.2f us, max %8.2f us\n", name, min / 1000.0,
+            total / 1000.0 / PACKETS, max / 1000.0);
+
+    return 0;
+}
+
+int main() {
+
+    char stream_path[] = "/tmp/gimx_btstack_stream";
+    char seqpacket_path[] = "/tmp/gimx_btstack_seqpacket";
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fds[] = { listen_tcp(), listen_unix(stream_path, SOCK_STREAM), listen_unix(seqpacket_path, SOCK_SEQPACKET) };
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        daemon_serve(listen_fds[0], 0);
+        daemon_serve(listen_fds[1], 0);
+        daemon_serve(listen_fds[2], 1);
+        exit(0);
+    }
+
+    int status = 0;
+    int seqpacket;
+
+    int fd = connect_tcp();
+    if (fd < 0 || run("tcp", fd, 0) < 0) {
+        status = -1;
+    }
+    close(fd);
+
+    fd = btstack_transport_connect_unix(stream_path, &seqpacket);
+    if (fd < 0 || seqpacket) {
+        fprintf(stderr, "expected a unix stream socket\n");
+        status = -1;
+    } else if (run("unix stream", fd, 0) < 0) {
+        status = -1;
+    }
+    close(fd);
+
+    fd = btstack_transport_connect_unix(seqpacket_path, &seqpacket);
+    if (fd < 0 || !seqpacket) {
+        fprintf(stderr, "expected a unix seqpacket socket\n");
+        status = -1;
+    } else if (run("unix seqpacket", fd, 1) < 0) {
+        status = -1;
+    }
+    close(fd);
+
+    waitpid(pid, NULL, 0);
+
+    unlink(stream_path);
+    unlink(seqpacket_path);
+
+    printf("%s\n", status ? "FAILED" : "OK");
+
+    return status ? 1 : 0;
+}
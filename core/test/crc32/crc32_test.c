@@ -0,0 +1,199 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <crc32.h>
+#ifndef WIN32
+#include <mhash.h>
+#endif
+
+#define DS4_BT_REPORT_SIZE 75 // HIDP header + report, without the CRC
+
+static unsigned char ds4_rumble[DS4_BT_REPORT_SIZE] = {
+    0xa2, 0x11, 0xc0, 0x20, 0xf3, 0x04, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x43, 0x43,
+    0x00, 0x4d, 0x85,
+};
+
+static unsigned char ds4_rumble_on[DS4_BT_REPORT_SIZE] = {
+    0xa2, 0x11, 0xc0, 0x20, 0xf3, 0x04, 0x00, 0x80,
+    0xff, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x43, 0x43,
+    0x00, 0x4d, 0x85,
+};
+
+static struct {
+    const char * name;
+    const void * data;
+    size_t length;
+    uint32_t crc;
+} tests[] = {
+    { "empty",       "",                                            0,                      0x00000000 },
+    { "a",           "a",                                           1,                      0xe8b7be43 },
+    { "check value", "123456789",                                   9,                      0xcbf43926 },
+    { "fox",         "The quick brown fox jumps over the lazy dog", 43,                     0x414fa339 },
+    { "ds4 rumble",  ds4_rumble,                                    sizeof(ds4_rumble),     0x7c833116 },
+    { "ds4 rumble on", ds4_rumble_on,                               sizeof(ds4_rumble_on),  0xcf6b0638 },
+};
+
+#ifndef WIN32
+static uint32_t mhash_crc32(const void * data, size_t length) {
+
+    MHASH td = mhash_init(MHASH_CRC32B);
+    if (td == MHASH_FAILED) {
+        perror("mhash_init");
+        exit(-1);
+    }
+    mhash(td, data, length);
+    uint32_t digest = 0;
+    mhash_deinit(td, &digest);
+    return digest;
+}
+#endif
+
+static double now() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int known_answers() {
+
+    int ret = 0;
+
+    unsigned int i;
+    for (i = 0; i < sizeof(tests) / sizeof(*tests); ++i) {
+        uint32_t crc = crc32_final(crc32_update(crc32_init(), tests[i].data, tests[i].length));
+        if (crc != tests[i].crc) {
+            fprintf(stderr, "test failed: %s (crc=%08x, expected=%08x)\n", tests[i].name, crc, tests[i].crc);
+            ret = -1;
+        }
+    }
+
+    // the precomputed HIDP header seeds
+    uint8_t header = 0xa1;
+    if (crc32_update(crc32_init(), &header, 1) != CRC32_SEED_HIDP_INPUT) {
+        fprintf(stderr, "test failed: input seed\n");
+        ret = -1;
+    }
+    header = 0xa2;
+    if (crc32_update(crc32_init(), &header, 1) != CRC32_SEED_HIDP_OUTPUT) {
+        fprintf(stderr, "test failed: output seed\n");
+        ret = -1;
+    }
+    uint32_t crc = crc32_final(crc32_update(CRC32_SEED_HIDP_OUTPUT, ds4_rumble + 1, sizeof(ds4_rumble) - 1));
+    if (crc != 0x7c833116) {
+        fprintf(stderr, "test failed: ds4 rumble from seed (crc=%08x)\n", crc);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+#ifndef WIN32
+static int compare_mhash(unsigned int count) {
+
+    int ret = 0;
+
+    unsigned char data[256];
+
+    unsigned int i;
+    for (i = 0; i < count; ++i) {
+        size_t length = rand() % (sizeof(data) + 1);
+        size_t offset = rand() % (sizeof(data) - length + 1); // unaligned buffers
+        size_t j;
+        for (j = 0; j < length; ++j) {
+            data[offset + j] = rand();
+        }
+        uint32_t expected = mhash_crc32(data + offset, length);
+        uint32_t crc = crc32_final(crc32_update(crc32_init(), data + offset, length));
+        if (crc != expected) {
+            fprintf(stderr, "test failed: random buffer of %zu bytes (crc=%08x, mhash=%08x)\n", length, crc, expected);
+            ret = -1;
+            break;
+        }
+    }
+
+    return ret;
+}
+#endif
+
+static void benchmark(unsigned int count) {
+
+    volatile uint32_t sink = 0;
+    unsigned int i;
+
+    double start = now();
+    for (i = 0; i < count; ++i) {
+        ds4_rumble[7] = i;
+        sink ^= crc32_final(crc32_update(CRC32_SEED_HIDP_OUTPUT, ds4_rumble + 1, sizeof(ds4_rumble) - 1));
+    }
+    double elapsed = now() - start;
+    printf("crc32: %u reports in %.3fs, %.0f ns/report\n", count, elapsed, elapsed * 1e9 / count);
+
+#ifndef WIN32
+    start = now();
+    for (i = 0; i < count; ++i) {
+        ds4_rumble[7] = i;
+        sink ^= mhash_crc32(ds4_rumble, sizeof(ds4_rumble));
+    }
+    elapsed = now() - start;
+    printf("mhash: %u reports in %.3fs, %.0f ns/report\n", count, elapsed, elapsed * 1e9 / count);
+#endif
+
+    (void) sink;
+}
+
+static void usage(const char * name) {
+
+    fprintf(stderr, "usage: %s [-b] [-n count]\n", name);
+    fprintf(stderr, "  -b: run the benchmark\n");
+    fprintf(stderr, "  -n: number of random buffers or benchmark iterations\n");
+}
+
+int main(int argc, char * argv[]) {
+
+    int bench = 0;
+    unsigned int count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "bn:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bench = 1;
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    int ret = known_answers();
+
+#ifndef WIN32
+    if (ret == 0) {
+        ret = compare_mhash(count ? count : 100000);
+    }
+#endif
+
+    if (ret == 0) {
+        printf("all tests passed\n");
+    }
+
+    if (ret == 0 && bench) {
+        benchmark(count ? count : 1000000);
+    }
+
+    return ret;
+}
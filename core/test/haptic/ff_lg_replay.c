@@ -0,0 +1,544 @@
+/*
+ Copyright (c) 2017 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Replay or fuzz harness for the Logitech force feedback path.
+ *
+ * Force feedback commands (BYTE_OUT_REPORT payloads) are either read from a capture file
+ * or randomly generated, and go through haptic_source_lg -> tweaks -> haptic_sink_lg.
+ * The sink writes to an in-memory HID device, so that no wheel is required.
+ *
+ * Capture file format: one report per line, as hexadecimal bytes separated by spaces.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * The following invariants are checked after each drain of the sink:
+ * - no lost stop: a slot that was last updated with a stopped force is not playing on the wheel,
+ * - slot state consistency: a playing slot holds the last force sent to the sink for this slot.
+ */
+
+#define SDL_MAIN_HANDLED
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <haptic/common/ff_lg.h>
+#include <haptic/haptic_source.h>
+#include <haptic/haptic_sink.h>
+#include <haptic/haptic_tweaks.h>
+
+s_gimx_params gimx_params = { 0 };
+
+#define STUB_JOYSTICK 0
+
+#define DRAIN_WRITES (slot_nb * 4)
+
+#define DEFAULT_SRC_PID USB_PRODUCT_ID_LOGITECH_G27_WHEEL
+#define DEFAULT_DST_PID USB_PRODUCT_ID_LOGITECH_DFGT_WHEEL
+#define DEFAULT_COUNT 1000000
+#define DEFAULT_DRAIN_PERIOD 64
+
+/*
+ * In-memory HID device.
+ */
+static struct {
+    s_hid_info info;
+    void * user;
+    int (* write_cb)(void * user, int transfered);
+    int (* close_cb)(void * user);
+    int write_pending;
+    unsigned char last_write[sizeof(((s_ff_lg_report *)NULL)->data)];
+    unsigned int writes;
+} hid_stub;
+
+#define HID_STUB_DEVICE ((struct ghid_device *) &hid_stub)
+
+/*
+ * Wheel state, as seen from the reports written to the in-memory HID device.
+ */
+static struct {
+    struct {
+        int playing;
+        unsigned char report[sizeof(((s_ff_lg_report *)NULL)->data)];
+    } slots[slot_nb];
+} wheel;
+
+/*
+ * Last data sent to the sink, for each sink slot.
+ */
+static struct {
+    int valid;
+    s_haptic_core_data data;
+} expected[slot_nb];
+
+static struct {
+    unsigned long long commands;
+    unsigned long long conversions;
+    unsigned long long drains;
+    unsigned long long errors;
+} counters;
+
+struct ghid_device * ginput_joystick_get_hid(int joystick __attribute__((unused))) {
+
+    return HID_STUB_DEVICE;
+}
+
+int ginput_joystick_get_usb_ids(int joystick __attribute__((unused)), unsigned short * vendor, unsigned short * product) {
+
+    *vendor = hid_stub.info.vendor_id;
+    *product = hid_stub.info.product_id;
+    return 0;
+}
+
+const char * ginput_joystick_name(int joystick __attribute__((unused))) {
+
+    return "in-memory HID device";
+}
+
+int ginput_joystick_set_hid_callbacks(struct ghid_device * dev __attribute__((unused)), void * user,
+        int (* hid_write_cb)(void * user, int transfered), int (* hid_close_cb)(void * user)) {
+
+    hid_stub.user = user;
+    hid_stub.write_cb = hid_write_cb;
+    hid_stub.close_cb = hid_close_cb;
+    return 0;
+}
+
+struct ghid_device * ghid_open_ids(unsigned short vendor __attribute__((unused)), unsigned short product __attribute__((unused))) {
+
+    return HID_STUB_DEVICE;
+}
+
+int ghid_register(struct ghid_device * device, void * user, const GHID_CALLBACKS * callbacks) {
+
+    return ginput_joystick_set_hid_callbacks(device, user, callbacks->fp_write, callbacks->fp_close);
+}
+
+const s_hid_info * ghid_get_hid_info(struct ghid_device * device __attribute__((unused))) {
+
+    return &hid_stub.info;
+}
+
+int ghid_close(struct ghid_device * device __attribute__((unused))) {
+
+    return 0;
+}
+
+static void wheel_apply(const unsigned char * report) {
+
+    const unsigned char * data = report + 1;
+
+    if (data[0] != FF_LG_CMD_EXTENDED_COMMAND) {
+        uint8_t slots = (data[0] & FF_LG_FSLOT_MASK) >> FF_LG_FSLOTS_OFFSET;
+        uint8_t cmd = data[0] & FF_LG_CMD_MASK;
+        e_slot slot;
+        for (slot = slot_constant; slot <= slot_damper; ++slot) {
+            if (slots & (1 << slot)) {
+                if (cmd == FF_LG_CMD_DOWNLOAD_AND_PLAY) {
+                    wheel.slots[slot].playing = 1;
+                } else if (cmd == FF_LG_CMD_STOP) {
+                    wheel.slots[slot].playing = 0;
+                }
+                memcpy(wheel.slots[slot].report, report, sizeof(wheel.slots[slot].report));
+            }
+        }
+    } else {
+        e_slot slot = slot_nb;
+        switch (data[1]) {
+        case FF_LG_EXT_CMD_WHEEL_RANGE_200_DEGREES:
+        case FF_LG_EXT_CMD_WHEEL_RANGE_900_DEGREES:
+        case FF_LG_EXT_CMD_CHANGE_WHEEL_RANGE:
+            slot = slot_range;
+            break;
+        case FF_LG_EXT_CMD_SET_RPM_LEDS:
+            slot = slot_leds;
+            break;
+        }
+        if (slot != slot_nb) {
+            memcpy(wheel.slots[slot].report, report, sizeof(wheel.slots[slot].report));
+        }
+    }
+}
+
+int ghid_write(struct ghid_device * device __attribute__((unused)), const void * buf, unsigned int count) {
+
+    if (hid_stub.write_pending) {
+        fprintf(stderr, "write while another write is pending\n");
+        ++counters.errors;
+        return -1;
+    }
+    if (count != sizeof(hid_stub.last_write)) {
+        fprintf(stderr, "unexpected write size: %u\n", count);
+        ++counters.errors;
+        return -1;
+    }
+    memcpy(hid_stub.last_write, buf, count);
+    hid_stub.write_pending = 1;
+    ++hid_stub.writes;
+    return 0;
+}
+
+int ghid_write_timeout(struct ghid_device * device __attribute__((unused)), const void * buf, unsigned int count,
+        unsigned int timeout __attribute__((unused))) {
+
+    if (count == sizeof(hid_stub.last_write)) {
+        wheel_apply(buf);
+    }
+    return count;
+}
+
+/*
+ * Complete the pending write, if any. The sink may issue a new write from the callback.
+ */
+static int hid_stub_complete() {
+
+    if (!hid_stub.write_pending) {
+        return 0;
+    }
+    hid_stub.write_pending = 0;
+    wheel_apply(hid_stub.last_write);
+    hid_stub.write_cb(hid_stub.user, sizeof(hid_stub.last_write));
+    return 1;
+}
+
+static e_slot get_slot(e_haptic_core_data_type type) {
+
+    switch (type) {
+    case E_DATA_TYPE_CONSTANT:
+        return slot_constant;
+    case E_DATA_TYPE_SPRING:
+        return slot_spring;
+    case E_DATA_TYPE_DAMPER:
+        return slot_damper;
+    case E_DATA_TYPE_LEDS:
+        return slot_leds;
+    case E_DATA_TYPE_RANGE:
+        return slot_range;
+    default:
+        return slot_nb;
+    }
+}
+
+static struct {
+    const s_haptic_source * source;
+    struct haptic_source_state * source_state;
+    const s_haptic_sink * sink;
+    struct haptic_sink_state * sink_state;
+    s_haptic_tweak_table tweaks;
+    uint16_t dst_caps;
+    unsigned char cmd_offset;
+} pipeline;
+
+static void pipeline_process(const unsigned char * report, size_t size) {
+
+    if (report != NULL) {
+        pipeline.source->process(pipeline.source_state, size, report);
+        ++counters.commands;
+    }
+
+    s_haptic_core_data data;
+    while (pipeline.source->get(pipeline.source_state, &data)) {
+        haptic_tweak_apply_table(&pipeline.tweaks, &data);
+        pipeline.sink->process(pipeline.sink_state, &data);
+        ++counters.conversions;
+        e_slot slot = get_slot(data.type);
+        if (slot == slot_leds && !(pipeline.dst_caps & FF_LG_CAPS_LEDS)) {
+            continue;
+        }
+        if (slot == slot_range && !(pipeline.dst_caps & FF_LG_CAPS_RANGE)) {
+            continue;
+        }
+        if (slot != slot_nb) {
+            expected[slot].valid = 1;
+            expected[slot].data = data;
+        }
+    }
+
+    pipeline.sink->update(pipeline.sink_state);
+}
+
+static int check_invariants() {
+
+    int ret = 0;
+
+    e_slot slot;
+    for (slot = slot_constant; slot < slot_nb; ++slot) {
+        if (!expected[slot].valid) {
+            continue;
+        }
+        const s_haptic_core_data * data = &expected[slot].data;
+        if (slot <= slot_damper) {
+            if (!data->playing && wheel.slots[slot].playing) {
+                fprintf(stderr, "lost stop for slot %d\n", slot);
+                ret = -1;
+                continue;
+            }
+            if (data->playing && !wheel.slots[slot].playing) {
+                fprintf(stderr, "lost play for slot %d\n", slot);
+                ret = -1;
+                continue;
+            }
+            if (!data->playing) {
+                continue;
+            }
+        }
+        s_ff_lg_report report;
+        ff_lg_convert_slot(data, slot, &report, pipeline.dst_caps);
+        if (memcmp(report.data, wheel.slots[slot].report, sizeof(report.data))) {
+            fprintf(stderr, "inconsistent state for slot %d\n", slot);
+            ret = -1;
+        }
+    }
+
+    if (ret < 0) {
+        ++counters.errors;
+    }
+
+    return ret;
+}
+
+static int drain() {
+
+    unsigned int i;
+    for (i = 0; i < DRAIN_WRITES && hid_stub_complete(); ++i) ;
+    ++counters.drains;
+    return check_invariants();
+}
+
+/*
+ * Generate a random but valid force feedback command.
+ */
+static void random_command(unsigned char data[FF_LG_OUTPUT_REPORT_SIZE]) {
+
+    static const unsigned char cmds[] = {
+            FF_LG_CMD_DOWNLOAD,
+            FF_LG_CMD_DOWNLOAD_AND_PLAY,
+            FF_LG_CMD_DOWNLOAD_AND_PLAY,
+            FF_LG_CMD_DOWNLOAD_AND_PLAY,
+            FF_LG_CMD_PLAY,
+            FF_LG_CMD_STOP,
+            FF_LG_CMD_STOP,
+            FF_LG_CMD_REFRESH_FORCE,
+    };
+    static const unsigned char ftypes[] = {
+            FF_LG_FTYPE_CONSTANT,
+            FF_LG_FTYPE_VARIABLE,
+            FF_LG_FTYPE_SPRING,
+            FF_LG_FTYPE_DAMPER,
+            FF_LG_FTYPE_HIGH_RESOLUTION_SPRING,
+            FF_LG_FTYPE_HIGH_RESOLUTION_DAMPER,
+    };
+
+    memset(data, 0x00, FF_LG_OUTPUT_REPORT_SIZE);
+
+    unsigned int i;
+
+    if (rand() % 32 == 0) {
+        data[0] = FF_LG_CMD_EXTENDED_COMMAND;
+        if (rand() % 2) {
+            unsigned short range = 200 + rand() % 701;
+            data[1] = FF_LG_EXT_CMD_CHANGE_WHEEL_RANGE;
+            data[2] = range & 0xFF;
+            data[3] = range >> 8;
+        } else {
+            data[1] = FF_LG_EXT_CMD_SET_RPM_LEDS;
+            data[2] = rand() & 0x1F;
+        }
+        return;
+    }
+
+    unsigned char cmd = cmds[rand() % sizeof(cmds)];
+    // mostly single slot commands, sometimes multiple slots
+    unsigned char slots = (rand() % 8) ? (FF_LG_FSLOT_1 << (rand() % FF_LG_FSLOTS_NB)) : ((1 + rand() % 15) << 4);
+
+    data[0] = slots | cmd;
+    data[1] = ftypes[rand() % sizeof(ftypes)];
+    for (i = 2; i < FF_LG_OUTPUT_REPORT_SIZE; ++i) {
+        data[i] = rand();
+    }
+    if (data[1] == FF_LG_FTYPE_VARIABLE) {
+        // no stepping, so that the force can be converted
+        data[4] = 0x00;
+        data[5] = 0x00;
+    }
+}
+
+static int parse_line(const char * line, unsigned char * data, size_t * size) {
+
+    *size = 0;
+    while (*line != '\0' && *line != '\n' && *line != '#') {
+        char * end;
+        unsigned long value = strtoul(line, &end, 16);
+        if (end == line) {
+            return -1;
+        }
+        if (value > UCHAR_MAX || *size >= MAX_DATA_SIZE) {
+            return -1;
+        }
+        data[(*size)++] = value;
+        line = end;
+        while (*line == ' ' || *line == '\t' || *line == '\r') {
+            ++line;
+        }
+    }
+    return 0;
+}
+
+static double now() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char * name) {
+
+    fprintf(stderr, "usage: %s [-f capture] [-n count] [-s seed] [-d drain period] [-p source pid] [-P sink pid] [-i] [-g gain]\n", name);
+}
+
+int main(int argc, char * argv[]) {
+
+    const char * capture = NULL;
+    unsigned long count = DEFAULT_COUNT;
+    unsigned int seed = time(NULL);
+    unsigned int drain_period = DEFAULT_DRAIN_PERIOD;
+    unsigned short src_pid = DEFAULT_SRC_PID;
+    unsigned short dst_pid = DEFAULT_DST_PID;
+    s_haptic_core_tweaks tweaks = { .invert = 0, .gain = { 100, 100, 100, 100 } };
+
+    // silence ginfo() and gwarn(), as output would be flooded by conversion messages
+    gimx_params.curses_status = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:s:d:p:P:ig:")) != -1) {
+        switch (opt) {
+        case 'f':
+            capture = optarg;
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            drain_period = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            src_pid = strtoul(optarg, NULL, 16);
+            break;
+        case 'P':
+            dst_pid = strtoul(optarg, NULL, 16);
+            break;
+        case 'i':
+            tweaks.invert = 1;
+            break;
+        case 'g':
+            tweaks.gain.constant = tweaks.gain.spring = tweaks.gain.damper = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    hid_stub.info.vendor_id = USB_VENDOR_ID_LOGITECH;
+    hid_stub.info.product_id = dst_pid;
+
+    s_haptic_core_ids source_ids = { .vid = USB_VENDOR_ID_LOGITECH, .pid = src_pid };
+
+    pipeline.source = haptic_source_get(source_ids);
+    if (pipeline.source == NULL) {
+        fprintf(stderr, "no haptic source for %04x:%04x\n", source_ids.vid, source_ids.pid);
+        return 1;
+    }
+    pipeline.sink = haptic_sink_get(STUB_JOYSTICK);
+    if (pipeline.sink == NULL) {
+        fprintf(stderr, "no haptic sink for %04x:%04x\n", hid_stub.info.vendor_id, hid_stub.info.product_id);
+        return 1;
+    }
+
+    pipeline.source_state = pipeline.source->init(source_ids);
+    pipeline.sink_state = pipeline.sink->init(STUB_JOYSTICK);
+    if (pipeline.source_state == NULL || pipeline.sink_state == NULL) {
+        fprintf(stderr, "failed to initialize the pipeline\n");
+        return 1;
+    }
+    pipeline.dst_caps = ff_lg_get_caps(dst_pid);
+    pipeline.cmd_offset = (src_pid == USB_PRODUCT_ID_LOGITECH_G29_PS4_WHEEL) ? 1 : 0;
+    haptic_tweak_compile(&tweaks, &pipeline.tweaks);
+
+    // the source queues the initial wheel range
+    pipeline_process(NULL, 0);
+    drain();
+
+    unsigned char report[MAX_DATA_SIZE];
+    unsigned long i = 0;
+
+    double start = now();
+
+    if (capture != NULL) {
+        FILE * file = fopen(capture, "r");
+        if (file == NULL) {
+            perror(capture);
+            return 1;
+        }
+        char line[LINE_MAX];
+        unsigned int line_nb = 0;
+        while (fgets(line, sizeof(line), file) != NULL) {
+            ++line_nb;
+            size_t size;
+            memset(report, 0x00, sizeof(report));
+            if (parse_line(line, report, &size) < 0) {
+                fprintf(stderr, "%s:%u: invalid report\n", capture, line_nb);
+                continue;
+            }
+            if (size < (size_t) pipeline.cmd_offset + 1) {
+                continue;
+            }
+            pipeline_process(report, size);
+            // complete writes at a lower rate than commands arrive
+            if (++i % 2 == 0) {
+                hid_stub_complete();
+            }
+            if (drain_period != 0 && i % drain_period == 0 && drain() < 0) {
+                fprintf(stderr, "%s:%u: invariant violated\n", capture, line_nb);
+            }
+        }
+        fclose(file);
+    } else {
+        srand(seed);
+        for (i = 0; i < count; ++i) {
+            memset(report, 0x00, sizeof(report));
+            random_command(report + pipeline.cmd_offset);
+            pipeline_process(report, pipeline.cmd_offset + FF_LG_OUTPUT_REPORT_SIZE);
+            // complete writes at a random rate, to exercise the sink queue
+            if (rand() % 3 == 0) {
+                hid_stub_complete();
+            }
+            if (drain_period != 0 && (i + 1) % drain_period == 0 && drain() < 0) {
+                fprintf(stderr, "command %lu: invariant violated (seed=%u)\n", i, seed);
+            }
+        }
+    }
+
+    drain();
+
+    double elapsed = now() - start;
+
+    pipeline.source->clean(pipeline.source_state);
+    pipeline.sink->clean(pipeline.sink_state);
+
+    printf("commands: %llu, conversions: %llu, writes: %u, drains: %llu\n", counters.commands, counters.conversions,
+            hid_stub.writes, counters.drains);
+    if (elapsed > 0) {
+        printf("elapsed: %.3fs, commands/s: %.0f, conversions/s: %.0f\n", elapsed, counters.commands / elapsed,
+                counters.conversions / elapsed);
+    }
+    printf("errors: %llu\n", counters.errors);
+
+    return counters.errors ? 1 : 0;
+}
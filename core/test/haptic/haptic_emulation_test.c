@@ -0,0 +1,106 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#define SDL_MAIN_HANDLED
+
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <haptic/haptic_emulation.h>
+
+s_gimx_params gimx_params = { 0 };
+
+static gtime clock_value = 0;
+
+gtime gtime_gettime(void) {
+    return clock_value;
+}
+
+#define SPRING(COEF, SAT) \
+    { .type = E_DATA_TYPE_SPRING, .playing = 1, .spring = { \
+        .saturation = { SAT, SAT }, .coefficient = { COEF, COEF }, .center = 0, .deadband = 0 } }
+
+#define DAMPER(COEF, SAT) \
+    { .type = E_DATA_TYPE_DAMPER, .playing = 1, .damper = { \
+        .saturation = { SAT, SAT }, .coefficient = { COEF, COEF }, .center = 0, .deadband = 0 } }
+
+#define CONSTANT(LEVEL) \
+    { .type = E_DATA_TYPE_CONSTANT, .playing = 1, .constant = { LEVEL } }
+
+#define RANGE(VALUE) \
+    { .type = E_DATA_TYPE_RANGE, .range = { VALUE } }
+
+static struct {
+    const char * name;
+    e_haptic_sink_caps caps;
+    s_haptic_core_data in;
+    int consumed;
+    int16_t start; // the first position sample, 1ms before the second one
+    int16_t position;
+    int expect; // 1 if a constant force is expected
+    int16_t level;
+} tests[] = {
+    { "spring, native",   E_HAPTIC_SINK_CAP_CONSTANT | E_HAPTIC_SINK_CAP_SPRING, SPRING(SHRT_MAX, USHRT_MAX),     0,      0,      0, 0,      0 },
+    { "spring, centered", E_HAPTIC_SINK_CAP_CONSTANT,                            SPRING(SHRT_MAX, USHRT_MAX),     1,      0,      0, 1,      0 },
+    { "spring, right",    E_HAPTIC_SINK_CAP_CONSTANT,                            SPRING(SHRT_MAX, USHRT_MAX),     1,  16384,  16384, 1, -16384 },
+    { "spring, left",     E_HAPTIC_SINK_CAP_CONSTANT,                            SPRING(SHRT_MAX / 2, USHRT_MAX), 1, -16384, -16384, 1,   8191 },
+    { "spring, sat",      E_HAPTIC_SINK_CAP_CONSTANT,                            SPRING(SHRT_MAX, 8192),          1,  16384,  16384, 1,  -4096 },
+    { "spring, no ffb",   E_HAPTIC_SINK_CAP_RUMBLE,                              SPRING(SHRT_MAX, USHRT_MAX),     0,  16384,  16384, 0,      0 },
+    { "damper, still",    E_HAPTIC_SINK_CAP_CONSTANT,                            DAMPER(SHRT_MAX, USHRT_MAX),     1,   1000,   1000, 1,      0 },
+    // velocity: 20 units in 1ms, scaled to 20 * 1000 / 2 = 10000, and filtered to 10000 / 4 = 2500
+    { "damper, right",    E_HAPTIC_SINK_CAP_CONSTANT,                            DAMPER(SHRT_MAX, USHRT_MAX),     1,      0,     20, 1,  -2500 },
+    { "damper, left",     E_HAPTIC_SINK_CAP_CONSTANT,                            DAMPER(SHRT_MAX / 2, USHRT_MAX), 1,      0,    -20, 1,   1249 },
+    { "damper, sat",      E_HAPTIC_SINK_CAP_CONSTANT,                            DAMPER(SHRT_MAX, 2000),          1,      0,     20, 1,  -1000 },
+    { "damper, native",   E_HAPTIC_SINK_CAP_CONSTANT | E_HAPTIC_SINK_CAP_DAMPER, DAMPER(SHRT_MAX, USHRT_MAX),     0,      0,     20, 0,      0 },
+    { "constant, mixed",  E_HAPTIC_SINK_CAP_CONSTANT | E_HAPTIC_SINK_CAP_RANGE,  CONSTANT(1000),                  1,      0,      0, 1,   1000 },
+    { "range, inside",    E_HAPTIC_SINK_CAP_CONSTANT,                            RANGE(450),                      1,  16000,  16000, 0,      0 },
+    { "range, outside",   E_HAPTIC_SINK_CAP_CONSTANT,                            RANGE(450),                      1,  16483,  16483, 1, -32 * 100 },
+    { "range, native",    E_HAPTIC_SINK_CAP_CONSTANT | E_HAPTIC_SINK_CAP_RANGE,  RANGE(450),                      0,  32000,  32000, 0,      0 },
+};
+
+int main(int argc __attribute__((unused)), char * argv[] __attribute__((unused))) {
+
+    int ret = 0;
+
+    unsigned int i;
+    for (i = 0; i < sizeof(tests) / sizeof(*tests); ++i) {
+
+        s_haptic_emulation emulation;
+        haptic_emulation_init(&emulation, tests[i].caps, 900);
+
+        int consumed = haptic_emulation_process(&emulation, &tests[i].in);
+
+        // two samples 1ms apart, the velocity is null if the position does not change
+        clock_value = 0;
+        haptic_emulation_set_position(&emulation, tests[i].start);
+        clock_value = 1000000;
+        haptic_emulation_set_position(&emulation, tests[i].position);
+
+        s_haptic_core_data out = { 0 };
+        int expect = haptic_emulation_get(&emulation, &out);
+
+        int failed = 0;
+        if (consumed != tests[i].consumed || expect != tests[i].expect) {
+            failed = 1;
+        } else if (expect && (out.type != E_DATA_TYPE_CONSTANT || out.constant.level != tests[i].level)) {
+            failed = 1;
+        } else if (expect && haptic_emulation_get(&emulation, &out)) {
+            // unchanged forces must not be sent again
+            failed = 1;
+        }
+
+        if (failed) {
+            fprintf(stderr, "test failed: %s (consumed=%d, expect=%d, level=%d)\n", tests[i].name, consumed, expect,
+                    out.constant.level);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        printf("all tests passed\n");
+    }
+
+    return ret;
+}
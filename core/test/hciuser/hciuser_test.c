@@ -0,0 +1,860 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Drive the HCI user channel layer against a controller emulated by a child process:
+ * - device initialization and connection tracking,
+ * - asynchronous commands,
+ * - l2cap fragmentation and reassembly,
+ * - ACL flow control,
+ * - per-frame round trip,
+ * - l2cap connection, configuration and disconnection (l2cap_hciuser.c),
+ * - commands that can't be sent.
+ *
+ * The controller is a virtual one (vhci) if possible, which requires the vhci module
+ * and the CAP_NET_ADMIN capability. Otherwise, the packets are exchanged through a socket pair.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/l2cap.h>
+#include <connectors/bluetooth/linux/hci_user.h>
+#include <connectors/bluetooth/l2cap_abs.h>
+#include <connectors/bluetooth/bt_abs.h>
+#include <connectors/bluetooth/bt_stats.h>
+#include <connectors/bluetooth/linux/bt_mgmt.h>
+#include <gimxpoll/include/gpoll.h>
+#include <gimx.h>
+
+#define ACL_MTU 27 // the minimum ACL payload size, to force fragmentation
+#define ACL_BUFFERS 2
+
+#define HANDLE 0x0042
+
+#define RSSI 0xf6 // -10 dB
+#define LINK_QUALITY 200
+#define CID 0x0040
+
+#define PACKETS 1000
+#define PAYLOAD 50 // a sixaxis input report
+
+#define HID_HANDLE 0x0043 // the link of the l2cap test
+#define HID_CID 0x0050 // the first cid of the emulated HID device
+#define HID_MTU 672
+#define HID_CHANNELS 2 // control and interrupt
+
+static const bdaddr_t controller = { { 0x66, 0x55, 0x44, 0x33, 0x22, 0x11 } };
+static const bdaddr_t peer = { { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 } };
+static const bdaddr_t hid = { { 0x11, 0x12, 0x13, 0x14, 0x15, 0x16 } };
+
+/*
+ * The dependencies of l2cap_hciuser.c: the test reads the device itself.
+ */
+
+s_gimx_params gimx_params = { 0 };
+
+static s_l2cap_abs * l2cap = NULL;
+
+void l2cap_abs_register(e_bt_abs index, s_l2cap_abs * value) {
+
+    if (index == E_BT_ABS_HCIUSER) {
+        l2cap = value;
+    }
+}
+
+int gpoll_register_fd(int fd __attribute__((unused)), void * user __attribute__((unused)),
+        const GPOLL_CALLBACKS * callbacks __attribute__((unused))) {
+    return 0;
+}
+
+int gpoll_remove_fd(int fd __attribute__((unused))) {
+    return 0;
+}
+
+s_bt_stats * bt_stats_get(int device_number __attribute__((unused)), const bdaddr_t * peer __attribute__((unused))) {
+    return NULL;
+}
+
+void bt_stats_sent(s_bt_stats * stats __attribute__((unused)), unsigned short psm __attribute__((unused)),
+        const unsigned char * buf __attribute__((unused)), int len __attribute__((unused))) {
+}
+
+int bt_mgmt_read_link_keys(uint16_t index __attribute__((unused)), uint16_t nb_keys __attribute__((unused)),
+        bdaddr_t bdaddrs[nb_keys] __attribute__((unused)), unsigned char keys[nb_keys][16] __attribute__((unused))) {
+    return -1;
+}
+
+static unsigned long long now_ns() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The controller side.
+ */
+
+static void vhci_write(int fd, const unsigned char * buf, size_t len) {
+
+    if (write(fd, buf, len) != (ssize_t) len) {
+        perror("vhci write");
+        exit(-1);
+    }
+}
+
+static void vhci_event(int fd, uint8_t evt, const unsigned char * params, uint8_t plen) {
+
+    unsigned char buf[3 + 255] = { HCI_EVENT_PKT, evt, plen };
+    memcpy(buf + 3, params, plen);
+    vhci_write(fd, buf, 3 + plen);
+}
+
+static void vhci_command(int fd, const unsigned char * buf) {
+
+    uint16_t opcode = bt_get_le16(buf);
+    const unsigned char * cparam = buf + HCI_COMMAND_HDR_SIZE;
+
+    // credits, opcode, return parameters
+    unsigned char cc[16] = { 1, opcode & 0xff, opcode >> 8, 0x00 };
+    uint8_t len = 4;
+
+    if (opcode == cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BD_ADDR)) {
+        memcpy(cc + len, &controller, sizeof(controller));
+        len += sizeof(controller);
+    } else if (opcode == cmd_opcode_pack(OGF_INFO_PARAM, OCF_READ_BUFFER_SIZE)) {
+        unsigned char rp[] = { ACL_MTU, 0x00, 0x00, ACL_BUFFERS, 0x00, 0x00, 0x00 };
+        memcpy(cc + len, rp, sizeof(rp));
+        len += sizeof(rp);
+    } else if (opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI)
+            || opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_LINK_QUALITY)) {
+        // handle, value
+        cc[len++] = cparam[0];
+        cc[len++] = cparam[1];
+        cc[len++] = (opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI)) ? RSSI : LINK_QUALITY;
+    } else if (opcode == cmd_opcode_pack(OGF_LINK_CTL, OCF_CREATE_CONN)) {
+        // status, credits, opcode
+        unsigned char cs[] = { 0x00, 1, opcode & 0xff, opcode >> 8 };
+        vhci_event(fd, EVT_CMD_STATUS, cs, sizeof(cs));
+        // status, handle, bdaddr, link type, encryption
+        uint16_t h = bacmp((const bdaddr_t *) cparam, &hid) ? HANDLE : HID_HANDLE;
+        unsigned char ccomp[11] = { 0x00, h & 0xff, h >> 8 };
+        memcpy(ccomp + 3, cparam, sizeof(bdaddr_t));
+        ccomp[9] = ACL_LINK;
+        vhci_event(fd, EVT_CONN_COMPLETE, ccomp, sizeof(ccomp));
+        return;
+    }
+
+    vhci_event(fd, EVT_CMD_COMPLETE, cc, len);
+}
+
+/*
+ * Send an l2cap frame, fragmented to the ACL MTU.
+ */
+static void vhci_send_frame(int fd, uint16_t handle, const unsigned char * frame, unsigned int len) {
+
+    unsigned int offset;
+    for (offset = 0; offset < len; offset += ACL_MTU) {
+        unsigned int size = len - offset > ACL_MTU ? ACL_MTU : len - offset;
+        unsigned char packet[1 + HCI_ACL_HDR_SIZE + ACL_MTU] = { HCI_ACLDATA_PKT };
+        // acl_handle_pack does not parenthesize its arguments
+        uint16_t flags = offset ? ACL_CONT : ACL_START;
+        bt_put_le16(acl_handle_pack(handle, flags), packet + 1);
+        bt_put_le16(size, packet + 3);
+        memcpy(packet + 1 + HCI_ACL_HDR_SIZE, frame + offset, size);
+        vhci_write(fd, packet, 1 + HCI_ACL_HDR_SIZE + size);
+    }
+}
+
+/*
+ * The emulated HID device: it accepts the channels, echoes the data it receives and then closes the channel,
+ * and drops the link once all its channels are closed.
+ */
+
+static uint16_t hid_channels[HID_CHANNELS]; // the cids of the host, 0 if the channel is closed
+static unsigned int hid_connected = 0;
+static uint8_t hid_ident = 0;
+
+static void hid_error(const char * what) {
+
+    fprintf(stderr, "controller: bad %s\n", what);
+    exit(-1);
+}
+
+static void hid_signal(int fd, uint8_t code, uint8_t ident, const unsigned char * data, uint16_t len) {
+
+    unsigned char frame[L2CAP_HDR_SIZE + L2CAP_CMD_HDR_SIZE + 16] = { 0 };
+    bt_put_le16(L2CAP_CMD_HDR_SIZE + len, frame);
+    bt_put_le16(0x0001, frame + 2);
+    frame[4] = code;
+    frame[5] = ident;
+    bt_put_le16(len, frame + 6);
+    memcpy(frame + L2CAP_HDR_SIZE + L2CAP_CMD_HDR_SIZE, data, len);
+    vhci_send_frame(fd, HID_HANDLE, frame, L2CAP_HDR_SIZE + L2CAP_CMD_HDR_SIZE + len);
+}
+
+/*
+ * Get a channel from the cid of the device.
+ */
+static unsigned int hid_channel(uint16_t cid) {
+
+    unsigned int i = cid - HID_CID;
+    if (cid < HID_CID || i >= HID_CHANNELS || !hid_channels[i]) {
+        hid_error("cid");
+    }
+    return i;
+}
+
+static void hid_closed(int fd, unsigned int i) {
+
+    hid_channels[i] = 0;
+
+    if (--hid_connected == 0) {
+        // status, handle, reason
+        unsigned char dc[] = { 0x00, HID_HANDLE & 0xff, HID_HANDLE >> 8, HCI_OE_USER_ENDED_CONNECTION };
+        vhci_event(fd, EVT_DISCONN_COMPLETE, dc, sizeof(dc));
+    }
+}
+
+static void hid_l2cap(int fd, unsigned char * frame, unsigned int len) {
+
+    uint16_t cid = bt_get_le16(frame + 2);
+    const unsigned char * buf = frame + L2CAP_HDR_SIZE;
+    len -= L2CAP_HDR_SIZE;
+
+    if (cid != 0x0001) {
+        unsigned int i = hid_channel(cid);
+        bt_put_le16(hid_channels[i], frame + 2);
+        vhci_send_frame(fd, HID_HANDLE, frame, L2CAP_HDR_SIZE + len);
+        // dcid, scid
+        unsigned char req[4];
+        bt_put_le16(hid_channels[i], req);
+        bt_put_le16(HID_CID + i, req + 2);
+        hid_signal(fd, L2CAP_DISCONN_REQ, ++hid_ident, req, sizeof(req));
+        return;
+    }
+
+    if (len < L2CAP_CMD_HDR_SIZE || len != (unsigned int) L2CAP_CMD_HDR_SIZE + bt_get_le16(buf + 2)) {
+        hid_error("signaling frame");
+    }
+
+    uint8_t code = buf[0];
+    uint8_t ident = buf[1];
+    const unsigned char * data = buf + L2CAP_CMD_HDR_SIZE;
+    uint16_t dlen = len - L2CAP_CMD_HDR_SIZE;
+
+    unsigned char rsp[8] = { 0 };
+    unsigned int i;
+
+    switch (code) {
+    case L2CAP_CONN_REQ:
+        // psm, scid
+        for (i = 0; i < HID_CHANNELS && hid_channels[i]; ++i) ;
+        if (dlen != 4 || i == HID_CHANNELS) {
+            hid_error("connection request");
+        }
+        hid_channels[i] = bt_get_le16(data + 2);
+        ++hid_connected;
+        // dcid, scid, result, status
+        bt_put_le16(HID_CID + i, rsp);
+        memcpy(rsp + 2, data + 2, 2);
+        hid_signal(fd, L2CAP_CONN_RSP, ident, rsp, 8);
+        // dcid, flags, mtu option
+        bt_put_le16(hid_channels[i], rsp);
+        bt_put_le16(0x0000, rsp + 2);
+        rsp[4] = L2CAP_CONF_MTU;
+        rsp[5] = 2;
+        bt_put_le16(HID_MTU, rsp + 6);
+        hid_signal(fd, L2CAP_CONF_REQ, ++hid_ident, rsp, 8);
+        break;
+    case L2CAP_CONF_REQ:
+        // dcid, flags, mtu option
+        if (dlen != 8 || data[4] != L2CAP_CONF_MTU || bt_get_le16(data + 6) != HCI_USER_L2CAP_MTU) {
+            hid_error("configuration request");
+        }
+        i = hid_channel(bt_get_le16(data));
+        // scid, flags, result
+        bt_put_le16(hid_channels[i], rsp);
+        memcpy(rsp + 2, data + 2, 2);
+        hid_signal(fd, L2CAP_CONF_RSP, ident, rsp, 6);
+        break;
+    case L2CAP_CONF_RSP:
+        // scid, flags, result
+        if (dlen < 6 || bt_get_le16(data + 4) != L2CAP_CONF_SUCCESS) {
+            hid_error("configuration response");
+        }
+        hid_channel(bt_get_le16(data));
+        break;
+    case L2CAP_DISCONN_REQ:
+        // dcid, scid
+        if (dlen != 4) {
+            hid_error("disconnection request");
+        }
+        i = hid_channel(bt_get_le16(data));
+        if (bt_get_le16(data + 2) != hid_channels[i]) {
+            hid_error("disconnection request");
+        }
+        hid_signal(fd, L2CAP_DISCONN_RSP, ident, data, 4);
+        hid_closed(fd, i);
+        break;
+    case L2CAP_DISCONN_RSP:
+        // dcid, scid, as in the request
+        if (dlen != 4) {
+            hid_error("disconnection response");
+        }
+        i = hid_channel(bt_get_le16(data + 2));
+        if (bt_get_le16(data) != hid_channels[i] || ident != hid_ident) {
+            hid_error("disconnection response");
+        }
+        hid_closed(fd, i);
+        break;
+    default:
+        hid_error("signaling command");
+        break;
+    }
+}
+
+/*
+ * Reassemble the l2cap frames, complete their ACL packets, and echo them back.
+ */
+static void vhci_acl(int fd, const unsigned char * buf) {
+
+    static unsigned char frame[L2CAP_HDR_SIZE + HCI_USER_L2CAP_MTU];
+    static unsigned int len = 0;
+    static unsigned int fragments = 0;
+
+    uint16_t handle = acl_handle(bt_get_le16(buf));
+    uint16_t dlen = bt_get_le16(buf + 2);
+
+    if ((handle != HANDLE && handle != HID_HANDLE) || len + dlen > sizeof(frame)
+            || (acl_flags(bt_get_le16(buf)) == ACL_CONT) != (len > 0) || dlen > ACL_MTU) {
+        fprintf(stderr, "controller: bad ACL packet\n");
+        exit(-1);
+    }
+
+    memcpy(frame + len, buf + HCI_ACL_HDR_SIZE, dlen);
+    len += dlen;
+    ++fragments;
+
+    if (len < L2CAP_HDR_SIZE || len < (unsigned int) L2CAP_HDR_SIZE + bt_get_le16(frame)) {
+        return;
+    }
+
+    // number of handles, handle, count
+    unsigned char nocp[] = { 1, handle & 0xff, handle >> 8, fragments & 0xff, fragments >> 8 };
+    vhci_event(fd, EVT_NUM_COMP_PKTS, nocp, sizeof(nocp));
+
+    if (handle == HID_HANDLE) {
+        hid_l2cap(fd, frame, len);
+    } else {
+        vhci_send_frame(fd, HANDLE, frame, len);
+    }
+
+    len = 0;
+    fragments = 0;
+}
+
+static int controller_fd = -1;
+static volatile sig_atomic_t deaf = 0;
+
+/*
+ * Stop receiving, but keep the connection open: the host can't send anymore, and does not see a hang up.
+ */
+static void controller_deafen(int sig __attribute__((unused))) {
+
+    shutdown(controller_fd, SHUT_RD);
+    deaf = 1;
+    unsigned char ack = 0xff; // a vendor packet, ignored by the host
+    if (write(controller_fd, &ack, sizeof(ack)) < 0) {
+        _exit(-1);
+    }
+}
+
+static void controller_run(int fd) {
+
+    unsigned char buf[HCI_MAX_FRAME_SIZE];
+
+    controller_fd = fd;
+    signal(SIGUSR1, controller_deafen);
+
+    while (1) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("vhci read");
+            exit(-1);
+        }
+        if (len == 0) {
+            while (deaf) {
+                pause();
+            }
+            // the host is gone
+            exit(0);
+        }
+        switch (buf[0]) {
+        case HCI_COMMAND_PKT:
+            vhci_command(fd, buf + 1);
+            break;
+        case HCI_ACLDATA_PKT:
+            vhci_acl(fd, buf + 1);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * The host side.
+ */
+
+static int connected = 0;
+static uint16_t handle = 0;
+
+static unsigned char received[L2CAP_HDR_SIZE + HCI_USER_L2CAP_MTU];
+static int received_len = 0;
+
+static unsigned int ready = 0;
+
+static void on_event(int device __attribute__((unused)), const unsigned char * buf, int len) {
+
+    if (buf[0] == EVT_CONN_COMPLETE && len >= HCI_EVENT_HDR_SIZE + 11 && buf[2] == 0x00) {
+        handle = acl_handle(bt_get_le16(buf + 3));
+        connected = 1;
+    }
+}
+
+static void on_acl(int device __attribute__((unused)), uint16_t h, const unsigned char * buf, int len) {
+
+    if (h == handle) {
+        memcpy(received, buf, len);
+        received_len = len;
+    }
+}
+
+static void on_acl_ready(int device __attribute__((unused))) {
+
+    ++ready;
+}
+
+/*
+ * Process packets until the condition is met.
+ */
+static int wait_for(int device, const int * condition, const char * what) {
+
+    struct pollfd pfd = { .fd = hci_user_get_fd(device), .events = POLLIN };
+
+    while (!*condition) {
+        int ret = poll(&pfd, 1, 1000);
+        if (ret <= 0) {
+            fprintf(stderr, "timeout waiting for %s\n", what);
+            return -1;
+        }
+        if (hci_user_read(device) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int check_echo(const unsigned char * payload, int len) {
+
+    if (received_len != L2CAP_HDR_SIZE + len || bt_get_le16(received) != len || bt_get_le16(received + 2) != CID
+            || memcmp(received + L2CAP_HDR_SIZE, payload, len)) {
+        fprintf(stderr, "bad echo (%d bytes)\n", received_len);
+        return -1;
+    }
+    received_len = 0;
+    return 0;
+}
+
+static int test_connection(int device) {
+
+    bdaddr_t ba;
+    if (hci_user_get_bdaddr(device, &ba) < 0 || bacmp(&ba, &controller)) {
+        fprintf(stderr, "bad controller address\n");
+        return -1;
+    }
+    if (hci_user_find(&controller) != device) {
+        fprintf(stderr, "controller not found\n");
+        return -1;
+    }
+
+    // bdaddr, packet types, page scan repetition mode, reserved, clock offset, role switch
+    unsigned char cp[13] = { 0 };
+    memcpy(cp, &peer, sizeof(peer));
+    if (hci_user_command_async(device, cmd_opcode_pack(OGF_LINK_CTL, OCF_CREATE_CONN), cp, sizeof(cp)) < 0) {
+        return -1;
+    }
+    if (wait_for(device, &connected, "the connection") < 0) {
+        return -1;
+    }
+
+    uint16_t h;
+    if (hci_user_get_handle(device, &peer, &h) < 0 || h != HANDLE) {
+        fprintf(stderr, "bad connection handle\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int completed = 0;
+static int all_completed = 0;
+static unsigned char rssi = 0;
+static unsigned char link_quality = 0;
+
+static void on_complete(void * user, const unsigned char * rparam, int rlen) {
+
+    // status, handle, value
+    if (rlen >= 4 && rparam[0] == 0x00 && bt_get_le16(rparam + 1) == handle) {
+        *(unsigned char *) user = rparam[3];
+    }
+    all_completed = (++completed == 2);
+}
+
+static int test_async_commands(int device) {
+
+    unsigned char cp[2] = { handle & 0xff, handle >> 8 };
+
+    // the second command is queued until the controller completes the first one
+    if (hci_user_command_cb(device, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI), cp, sizeof(cp), on_complete,
+            &rssi) < 0 || hci_user_command_cb(device, cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_LINK_QUALITY), cp,
+            sizeof(cp), on_complete, &link_quality) < 0) {
+        return -1;
+    }
+
+    if (wait_for(device, &all_completed, "the command completions") < 0) {
+        return -1;
+    }
+
+    if (rssi != RSSI || link_quality != LINK_QUALITY) {
+        fprintf(stderr, "bad command completion (rssi=0x%02x, link quality=%u)\n", rssi, link_quality);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int test_flow_control(int device) {
+
+    unsigned char payload[60];
+    memset(payload, 0xa5, sizeof(payload));
+
+    // 3 ACL packets are needed, the controller only has 2 buffers
+    if (hci_user_acl_send(device, handle, CID, payload, 60) != -1 || errno != EAGAIN) {
+        fprintf(stderr, "a frame larger than the free buffers was sent\n");
+        return -1;
+    }
+    // 2 ACL packets
+    if (hci_user_acl_send(device, handle, CID, payload, 40) != 40) {
+        fprintf(stderr, "failed to send a 2-packet frame\n");
+        return -1;
+    }
+    // no buffer left until the controller completes the packets
+    if (hci_user_acl_send(device, handle, CID, payload, 10) != -1 || errno != EAGAIN) {
+        fprintf(stderr, "a frame was sent without free buffers\n");
+        return -1;
+    }
+    if (wait_for(device, &received_len, "the echo") < 0 || check_echo(payload, 40) < 0) {
+        return -1;
+    }
+    if (!ready) {
+        fprintf(stderr, "buffers were not released\n");
+        return -1;
+    }
+    if (hci_user_acl_send(device, handle, CID, payload, 10) != 10) {
+        fprintf(stderr, "failed to send after the buffers were released\n");
+        return -1;
+    }
+    if (wait_for(device, &received_len, "the echo") < 0 || check_echo(payload, 10) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int test_round_trip(int device) {
+
+    unsigned char payload[PAYLOAD];
+    unsigned long long min = -1ULL, max = 0, total = 0;
+
+    unsigned int i;
+    for (i = 0; i < PACKETS; ++i) {
+
+        memset(payload, i, sizeof(payload));
+
+        unsigned long long start = now_ns();
+
+        int ret;
+        while ((ret = hci_user_acl_send(device, handle, CID, payload, sizeof(payload))) < 0 && errno == EAGAIN) {
+            if (hci_user_read(device) < 0) {
+                return -1;
+            }
+        }
+        if (ret != sizeof(payload)) {
+            fprintf(stderr, "send failed\n");
+            return -1;
+        }
+        if (wait_for(device, &received_len, "the echo") < 0 || check_echo(payload, sizeof(payload)) < 0) {
+            return -1;
+        }
+
+        unsigned long long rtt = now_ns() - start;
+
+        total += rtt;
+        if (rtt < min) min = rtt;
+        if (rtt > max) max = rtt;
+    }
+
+    printf("hci user channel round trip: min %6.2f us, avg %6.2f us, max %8.2f us\n", min / 1000.0,
+            total / 1000.0 / PACKETS, max / 1000.0);
+
+    return 0;
+}
+
+static int l2cap_opened = 0; // a bit per channel
+static int l2cap_closed = 0; // a bit per channel
+static int l2cap_all_opened = 0;
+static int l2cap_received = 0;
+
+static int on_l2cap_connect(void * user) {
+
+    l2cap_opened |= 1 << (intptr_t) user;
+    l2cap_all_opened = (l2cap_opened == 0x03);
+    return 0;
+}
+
+static int on_l2cap_close(void * user) {
+
+    l2cap_closed |= 1 << (intptr_t) user;
+    return 0;
+}
+
+static int on_l2cap_read(void * user __attribute__((unused))) {
+
+    ++l2cap_received;
+    return 0;
+}
+
+/*
+ * Open the control and interrupt channels of a HID device, exchange a frame,
+ * and close the channels: the interrupt one from the device side, the control one from the host side.
+ */
+static int test_l2cap(int device) {
+
+    char src[18], dst[18];
+    ba2str(&controller, src);
+    ba2str(&hid, dst);
+
+    int control = l2cap->connect(src, dst, PSM_HID_CONTROL, L2CAP_ABS_LM_MASTER, (void *)(intptr_t) 0, on_l2cap_connect,
+            on_l2cap_close);
+    int interrupt = l2cap->connect(src, dst, PSM_HID_INTERRUPT, L2CAP_ABS_LM_MASTER, (void *)(intptr_t) 1, on_l2cap_connect,
+            on_l2cap_close);
+    if (control < 0 || interrupt < 0) {
+        fprintf(stderr, "l2cap connect failed\n");
+        return -1;
+    }
+
+    if (wait_for(device, &l2cap_all_opened, "the l2cap channels") < 0) {
+        return -1;
+    }
+
+    l2cap->add_source(interrupt, (void *)(intptr_t) 1, on_l2cap_read, NULL, on_l2cap_close);
+
+    unsigned char payload[PAYLOAD];
+    memset(payload, 0x5a, sizeof(payload));
+    payload[0] = 0xa1; // an input report
+
+    if (l2cap->send(interrupt, payload, sizeof(payload), 0) != sizeof(payload)) {
+        fprintf(stderr, "l2cap send failed\n");
+        return -1;
+    }
+
+    // the device echoes the frame, then closes the channel
+    struct pollfd pfd = { .fd = hci_user_get_fd(device), .events = POLLIN };
+    while (!(l2cap_closed & 0x02)) {
+        if (poll(&pfd, 1, 1000) <= 0 || hci_user_read(device) < 0) {
+            fprintf(stderr, "timeout waiting for the l2cap disconnection\n");
+            return -1;
+        }
+    }
+
+    unsigned char buf[L2CAP_DEFAULT_MTU];
+    if (l2cap_received != 1 || l2cap->recv(interrupt, buf, sizeof(buf)) != sizeof(payload)
+            || memcmp(buf, payload, sizeof(payload))) {
+        fprintf(stderr, "bad l2cap echo\n");
+        return -1;
+    }
+
+    l2cap->close(interrupt);
+    l2cap->close(control);
+
+    // the device drops the link once the control channel is closed
+    uint16_t h;
+    while (hci_user_get_handle(device, &hid, &h) == 0) {
+        if (poll(&pfd, 1, 1000) <= 0 || hci_user_read(device) < 0) {
+            fprintf(stderr, "timeout waiting for the link disconnection\n");
+            return -1;
+        }
+    }
+
+    if (l2cap_closed != 0x02) {
+        fprintf(stderr, "bad l2cap close callbacks: 0x%02x\n", l2cap_closed);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * A command fails as soon as it can't be sent, instead of timing out.
+ */
+static int test_send_failure(int device, pid_t pid) {
+
+    kill(pid, SIGUSR1);
+
+    // wait for the acknowledgement of the controller
+    struct pollfd pfd = { .fd = hci_user_get_fd(device), .events = POLLIN };
+    if (poll(&pfd, 1, 1000) <= 0 || hci_user_read(device) < 0) {
+        fprintf(stderr, "test failed: the controller did not stop receiving\n");
+        return -1;
+    }
+
+    unsigned long long start = now_ns();
+
+    int ret = hci_user_command(device, cmd_opcode_pack(OGF_HOST_CTL, OCF_RESET), NULL, 0, NULL, 0);
+
+    unsigned long long elapsed = now_ns() - start;
+
+    if (ret != -1 || elapsed > 100000000ULL) {
+        fprintf(stderr, "test failed: send failure (ret=%d, time=%lluus)\n", ret, elapsed / 1000);
+        return -1;
+    }
+
+    printf("send failure: reported after %lluus\n", elapsed / 1000);
+
+    return 0;
+}
+
+/*
+ * The device is briefly busy while the kernel registers it.
+ */
+static int open_device(int device, const s_hci_user_callbacks * callbacks) {
+
+    int i;
+    for (i = 0; i < 10; ++i) {
+        if (hci_user_open(device, callbacks) == 0) {
+            return 0;
+        }
+        usleep(200000);
+    }
+    return -1;
+}
+
+/*
+ * Create a raw (unconfigured) primary virtual controller.
+ */
+static int create_vhci(int * device) {
+
+    int fd = open("/dev/vhci", O_RDWR);
+    if (fd < 0) {
+        perror("/dev/vhci");
+        return -1;
+    }
+
+    unsigned char create[] = { 0xff, 0x80 };
+    if (write(fd, create, sizeof(create)) != sizeof(create)) {
+        perror("vhci write");
+        close(fd);
+        return -1;
+    }
+
+    // vendor packet, opcode, index
+    unsigned char rsp[4];
+    if (read(fd, rsp, sizeof(rsp)) != sizeof(rsp) || rsp[0] != 0xff) {
+        fprintf(stderr, "failed to create the virtual controller\n");
+        close(fd);
+        return -1;
+    }
+    *device = rsp[2] | rsp[3] << 8;
+
+    return fd;
+}
+
+int main() {
+
+    int device = 0;
+    int host_fd = -1;
+    const char * transport = "vhci";
+
+    int fd = create_vhci(&device);
+    if (fd < 0) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+            perror("socketpair");
+            return -1;
+        }
+        fd = sv[0];
+        host_fd = sv[1];
+        transport = "socket pair";
+    }
+
+    printf("controller transport: %s\n", transport);
+    fflush(stdout);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (host_fd >= 0) {
+            close(host_fd);
+        }
+        controller_run(fd);
+        exit(0);
+    }
+    close(fd);
+
+    s_hci_user_callbacks callbacks = { .event = on_event, .acl = on_acl, .acl_ready = on_acl_ready };
+
+    int status = 0;
+
+    int ret = (host_fd >= 0) ? hci_user_open_fd(device, host_fd, &callbacks) : open_device(device, &callbacks);
+    if (ret < 0) {
+        status = -1;
+    } else {
+        if (test_connection(device) < 0 || test_async_commands(device) < 0 || test_flow_control(device) < 0
+                || test_round_trip(device) < 0 || test_l2cap(device) < 0) {
+            status = -1;
+        }
+        // a vhci device can't refuse packets
+        if (status == 0 && host_fd >= 0 && test_send_failure(device, pid) < 0) {
+            status = -1;
+        }
+        hci_user_close(device);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    if (status == 0) {
+        printf("hci user channel test passed\n");
+    }
+
+    return status;
+}
@@ -0,0 +1,196 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <connectors/remote_protocol.h>
+
+#define PORT_1 51914
+#define PORT_2 51915
+
+/*
+ * A stand-in for a remote GIMX process serving two controllers, receiving batched reports on a loopback socket.
+ */
+static struct {
+    int sock;
+    int axis[2][AXIS_MAX];
+    unsigned int blocks;
+    s_remote_stats stats;
+} receiver;
+
+static int sender = -1;
+static struct sockaddr_in receiver_address;
+
+static void store_block(void * user __attribute__((unused)), uint16_t port, unsigned char nbAxes,
+        const s_remote_axis * axes) {
+
+    int controller = (port == PORT_1) ? 0 : 1;
+    unsigned char i;
+    for (i = 0; i < nbAxes; ++i) {
+        receiver.axis[controller][axes[i].axis] = axes[i].value;
+    }
+    ++receiver.blocks;
+}
+
+static int receive(uint32_t arrival) {
+
+    unsigned char buf[REMOTE_BATCH_MAX_SIZE];
+    ssize_t res = recv(receiver.sock, buf, sizeof(buf), 0);
+    if (res <= 0) {
+        perror("recv");
+        return -1;
+    }
+    uint32_t sequence;
+    uint32_t timestamp;
+    if (remote_batch_parse(buf, res, &sequence, &timestamp, store_block, NULL) < 0) {
+        return -1;
+    }
+    remote_stats_update(&receiver.stats, sequence, timestamp, arrival);
+    return 0;
+}
+
+static int send_batch(uint32_t sequence, uint32_t timestamp, int axis[2][AXIS_MAX], int last_axes[2][AXIS_MAX]) {
+
+    s_remote_batch batch;
+    remote_batch_init(&batch, sequence, timestamp);
+    remote_batch_add(&batch, PORT_1, axis[0], last_axes[0], 0);
+    remote_batch_add(&batch, PORT_2, axis[1], last_axes[1], 0);
+    ssize_t res = sendto(sender, batch.buf, batch.size, 0, (struct sockaddr *) &receiver_address,
+            sizeof(receiver_address));
+    return (res == (ssize_t) batch.size) ? 0 : -1;
+}
+
+static int open_sockets(void) {
+
+    receiver.sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sender = socket(AF_INET, SOCK_DGRAM, 0);
+    if (receiver.sock < 0 || sender < 0) {
+        perror("socket");
+        return -1;
+    }
+    receiver_address.sin_family = AF_INET;
+    receiver_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    receiver_address.sin_port = 0;
+    if (bind(receiver.sock, (struct sockaddr *) &receiver_address, sizeof(receiver_address)) < 0) {
+        perror("bind");
+        return -1;
+    }
+    socklen_t len = sizeof(receiver_address);
+    if (getsockname(receiver.sock, (struct sockaddr *) &receiver_address, &len) < 0) {
+        perror("getsockname");
+        return -1;
+    }
+    return 0;
+}
+
+static int test_version(void) {
+
+    uint16_t ports[] = { PORT_1, PORT_2 };
+    unsigned char buf[REMOTE_VERSION_MAX_SIZE];
+    int size = remote_version_build(buf, ports, 2);
+
+    uint16_t parsed[MAX_CONTROLLERS];
+    unsigned char count = 0;
+    if (remote_version_parse(buf, size, parsed, &count) != REMOTE_PROTOCOL_VERSION || count != 2
+            || parsed[0] != PORT_1 || parsed[1] != PORT_2) {
+        fprintf(stderr, "test failed: version answer\n");
+        return -1;
+    }
+    if (remote_version_parse(buf, size - 1, parsed, &count) != -1) {
+        fprintf(stderr, "test failed: truncated version answer\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int test_batches(void) {
+
+    int axis[2][AXIS_MAX] = { { 0 } };
+    int last_axes[2][AXIS_MAX] = { { 0 } };
+
+    // packets 0 to 7, with packet 3 lost and packets 5 and 6 swapped, and a 100us jitter on packet 7
+    static const uint32_t sequences[] = { 0, 1, 2, 4, 6, 5, 7 };
+    static const uint32_t delays[] = { 500, 500, 500, 500, 500, 500, 600 };
+
+    unsigned int i;
+    for (i = 0; i < sizeof(sequences) / sizeof(*sequences); ++i) {
+        axis[0][rel_axis_0] = -1000 * (int) sequences[i];
+        axis[1][abs_axis_0] = sequences[i];
+        uint32_t timestamp = 1000000 + sequences[i] * 4000;
+        if (send_batch(sequences[i], timestamp, axis, last_axes) < 0) {
+            fprintf(stderr, "test failed: send batch %u\n", sequences[i]);
+            return -1;
+        }
+        memcpy(last_axes, axis, sizeof(axis));
+        if (receive(timestamp + delays[i]) < 0) {
+            fprintf(stderr, "test failed: receive batch %u\n", sequences[i]);
+            return -1;
+        }
+        if (receiver.axis[0][rel_axis_0] != axis[0][rel_axis_0] || receiver.axis[1][abs_axis_0] != axis[1][abs_axis_0]) {
+            fprintf(stderr, "test failed: axes of batch %u\n", sequences[i]);
+            return -1;
+        }
+    }
+
+    if (receiver.blocks != 2 * i || receiver.stats.received != i || receiver.stats.lost != 1
+            || receiver.stats.reordered != 1 || receiver.stats.jitter != 100 / 16) {
+        fprintf(stderr, "test failed: stats (blocks=%u, received=%u, lost=%u, reordered=%u, jitter=%u)\n",
+                receiver.blocks, receiver.stats.received, receiver.stats.lost, receiver.stats.reordered,
+                receiver.stats.jitter);
+        return -1;
+    }
+
+    // unchanged axes are not sent
+    s_remote_batch batch;
+    remote_batch_init(&batch, 8, 0);
+    remote_batch_add(&batch, PORT_1, axis[0], last_axes[0], 0);
+    if (batch.size != REMOTE_BATCH_HEADER_SIZE + REMOTE_BATCH_BLOCK_SIZE(0)) {
+        fprintf(stderr, "test failed: empty block size\n");
+        return -1;
+    }
+
+    // truncated packets are rejected
+    remote_batch_add(&batch, PORT_2, axis[1], last_axes[1], 1);
+    uint32_t sequence;
+    uint32_t timestamp;
+    unsigned int blocks = receiver.blocks;
+    if (remote_batch_parse(batch.buf, batch.size - 1, &sequence, &timestamp, store_block, NULL) != -1
+            || receiver.blocks != blocks) {
+        fprintf(stderr, "test failed: truncated batch\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc __attribute__((unused)), char * argv[] __attribute__((unused))) {
+
+    int ret = 0;
+
+    if (open_sockets() < 0) {
+        return -1;
+    }
+
+    if (test_version() < 0) {
+        ret = -1;
+    }
+
+    if (test_batches() < 0) {
+        ret = -1;
+    }
+
+    close(receiver.sock);
+    close(sender);
+
+    if (ret == 0) {
+        printf("all tests passed\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,170 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Benchmark of the report2event functions over a sequence of reports that looks like a capture
+ * of a controller polled at 250Hz: most reports only differ by their counters and motion data,
+ * sticks move from time to time, buttons and triggers rarely change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <controller.h>
+#include <connectors/report2event/report2event.h>
+
+#define DEFAULT_COUNT 10000000
+#define SEQUENCE_SIZE 4096
+
+static s_adapter adapter;
+
+s_adapter* adapter_get(unsigned char index __attribute__((unused))) {
+
+    return &adapter;
+}
+
+static unsigned int events = 0;
+
+static int count_event(GE_Event* event __attribute__((unused))) {
+
+    ++events;
+    return 0;
+}
+
+static s_report reports[SEQUENCE_SIZE];
+
+static unsigned int seed = 1;
+
+static unsigned int next(unsigned int max) {
+
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % max;
+}
+
+static void make_sequence(e_controller_type type) {
+
+    memset(reports, 0x00, sizeof(reports));
+
+    s_report report = { .ds4 = { 0 } };
+
+    switch (type) {
+    case C_TYPE_DS4:
+        report.ds4.report_id = DS4_USB_HID_IN_REPORT_ID;
+        report.ds4.X = report.ds4.Y = report.ds4.Z = report.ds4.Rz = CENTER_AXIS_VALUE_8BITS;
+        report.ds4.HatAndButtons = 0x08;
+        report.ds4.packet1.finger1.id = report.ds4.packet1.finger2.id = 0x80;
+        break;
+    case C_TYPE_XONE_PAD:
+        report.xone.input.type = XONE_USB_HID_IN_REPORT_ID;
+        break;
+    default:
+        break;
+    }
+
+    unsigned int i;
+    for (i = 0; i < SEQUENCE_SIZE; ++i) {
+        unsigned int stick = next(100) < 30;
+        unsigned int button = next(100) < 2;
+        unsigned int trigger = next(100) < 10;
+        switch (type) {
+        case C_TYPE_DS4:
+            report.ds4.ButtonsAndCounter += 0x0400; // the counter is incremented in each report
+            report.ds4._time += 188;
+            report.ds4.motion_gyro.roll = next(16);
+            if (stick) {
+                report.ds4.X = CENTER_AXIS_VALUE_8BITS + next(64) - 32;
+            }
+            if (button) {
+                report.ds4.HatAndButtons ^= DS4_CROSS_MASK;
+            }
+            if (trigger) {
+                report.ds4.Rx = next(256);
+            }
+            break;
+        case C_TYPE_360_PAD:
+            if (stick) {
+                report.x360.xaxis = next(16384) - 8192;
+            }
+            if (button) {
+                report.x360.buttons ^= X360_A_MASK;
+            }
+            if (trigger) {
+                report.x360.ltrigger = next(256);
+            }
+            break;
+        case C_TYPE_XONE_PAD:
+            report.xone.input.counter++;
+            if (stick) {
+                report.xone.input.xaxis = next(16384) - 8192;
+            }
+            if (button) {
+                report.xone.input.buttons ^= XONE_A_MASK;
+            }
+            if (trigger) {
+                report.xone.input.ltrigger = next(1024);
+            }
+            break;
+        default:
+            break;
+        }
+        reports[i] = report;
+    }
+}
+
+static double now(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(e_controller_type type, unsigned int count) {
+
+    make_sequence(type);
+
+    adapter.ctype = type;
+    events = 0;
+
+    double start = now();
+
+    unsigned int i;
+    for (i = 0; i < count; ++i) {
+        unsigned int index = i % SEQUENCE_SIZE;
+        s_report* previous = &reports[index ? index - 1 : SEQUENCE_SIZE - 1];
+        report2event(type, 0, &reports[index], previous, 0);
+    }
+
+    double elapsed = now() - start;
+
+    printf("%-16s %u reports in %.3fs: %.1f Mreports/s, %u events (%.1f Mevents/s)\n", controller_get_name(type),
+            count, elapsed, count / elapsed / 1e6, events, events / elapsed / 1e6);
+}
+
+int main(int argc, char * argv[]) {
+
+    unsigned int count = DEFAULT_COUNT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: r2e_bench [-n count]\n");
+            return -1;
+        }
+    }
+
+    report2event_set_callback(count_event);
+
+    run(C_TYPE_DS4, count);
+    run(C_TYPE_360_PAD, count);
+    run(C_TYPE_XONE_PAD, count);
+
+    return 0;
+}
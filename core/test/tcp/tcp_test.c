@@ -0,0 +1,436 @@
+/*
+ Copyright (c) 2020 Mathieu Laurendeau <mat.lau@laposte.net>
+ License: GPLv3
+ */
+
+/*
+ * Check the reconnect timing of tcp_connect_async against a loopback server that starts listening late,
+ * against a server that never listens, and against a server that never answers.
+ *
+ * The poll loop and the timers are minimal stand-ins for gimxpoll and gimxtimer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <connectors/tcp_con.h>
+#include <gimxtimer/include/gtimer.h>
+#include <gimx.h>
+
+s_gimx_params gimx_params = { 0 };
+
+#define MAX_FDS 8
+
+#define SERVER_DELAY 250000 // us
+
+static struct {
+    int fd;
+    void * user;
+    GPOLL_CALLBACKS callbacks;
+} fds[MAX_FDS];
+
+static unsigned int nb_fds = 0;
+
+int gpoll_register_fd(int fd, void * user, const GPOLL_CALLBACKS * callbacks) {
+
+    if (nb_fds == MAX_FDS) {
+        return -1;
+    }
+    fds[nb_fds].fd = fd;
+    fds[nb_fds].user = user;
+    fds[nb_fds].callbacks = *callbacks;
+    ++nb_fds;
+    return 0;
+}
+
+int gpoll_remove_fd(int fd) {
+
+    unsigned int i;
+    for (i = 0; i < nb_fds; ++i) {
+        if (fds[i].fd == fd) {
+            memmove(fds + i, fds + i + 1, (nb_fds - i - 1) * sizeof(*fds));
+            --nb_fds;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Run until a callback returns a non-zero value.
+ * A single event is processed per poll call, as callbacks may remove and reuse file descriptors.
+ */
+static int loop(void) {
+
+    while (1) {
+        struct pollfd pfds[MAX_FDS];
+        unsigned int i;
+        for (i = 0; i < nb_fds; ++i) {
+            pfds[i].fd = fds[i].fd;
+            pfds[i].events = (fds[i].callbacks.fp_read ? POLLIN : 0) | (fds[i].callbacks.fp_write ? POLLOUT : 0);
+        }
+        if (poll(pfds, nb_fds, 5000) <= 0) {
+            fprintf(stderr, "poll timeout\n");
+            return -1;
+        }
+        for (i = 0; i < nb_fds; ++i) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            int ret;
+            if ((pfds[i].revents & POLLOUT) && fds[i].callbacks.fp_write) {
+                ret = fds[i].callbacks.fp_write(fds[i].user);
+            } else if ((pfds[i].revents & POLLIN) && fds[i].callbacks.fp_read) {
+                ret = fds[i].callbacks.fp_read(fds[i].user);
+            } else {
+                ret = fds[i].callbacks.fp_close(fds[i].user);
+            }
+            if (ret) {
+                return ret;
+            }
+            break;
+        }
+    }
+}
+
+struct gtimer {
+    int fd;
+    void * user;
+    GTIMER_CALLBACKS callbacks;
+};
+
+static int timer_read(void * user) {
+
+    struct gtimer * timer = (struct gtimer *) user;
+    uint64_t expirations;
+    if (read(timer->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return timer->callbacks.fp_close(timer->user);
+    }
+    // the callback may close the timer
+    return timer->callbacks.fp_read(timer->user);
+}
+
+static int timer_close(void * user) {
+
+    struct gtimer * timer = (struct gtimer *) user;
+    return timer->callbacks.fp_close(timer->user);
+}
+
+struct gtimer * gtimer_start(void * user, unsigned int usec, const GTIMER_CALLBACKS * callbacks) {
+
+    struct gtimer * timer = calloc(1, sizeof(*timer));
+    if (timer == NULL) {
+        return NULL;
+    }
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer->fd < 0) {
+        free(timer);
+        return NULL;
+    }
+    struct timespec period = { .tv_sec = usec / 1000000, .tv_nsec = (usec % 1000000) * 1000 };
+    struct itimerspec its = { .it_interval = period, .it_value = period };
+    timer->user = user;
+    timer->callbacks = *callbacks;
+    GPOLL_CALLBACKS poll_callbacks = { .fp_read = timer_read, .fp_write = NULL, .fp_close = timer_close };
+    if (timerfd_settime(timer->fd, 0, &its, NULL) < 0
+            || callbacks->fp_register(timer->fd, timer, &poll_callbacks) < 0) {
+        close(timer->fd);
+        free(timer);
+        return NULL;
+    }
+    return timer;
+}
+
+int gtimer_close(struct gtimer * timer) {
+
+    timer->callbacks.fp_remove(timer->fd);
+    close(timer->fd);
+    free(timer);
+    return 0;
+}
+
+static unsigned int elapsed(const struct timespec * start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static struct {
+    int fd;
+    int called;
+    unsigned int time; // us
+    struct timespec start;
+} result;
+
+static int connect_cb(void * user __attribute__((unused)), int fd) {
+
+    result.fd = fd;
+    result.called = 1;
+    result.time = elapsed(&result.start);
+    return 1;
+}
+
+static const TCP_CALLBACKS callbacks = {
+        .fp_connect = connect_cb,
+        .fp_register = gpoll_register_fd,
+        .fp_remove = gpoll_remove_fd,
+};
+
+/*
+ * Get a loopback port nobody is listening on.
+ */
+static int reserve_port(unsigned short * port) {
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(sa);
+    if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 || getsockname(fd, (struct sockaddr *) &sa, &len) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(sa.sin_port);
+    close(fd);
+    return 0;
+}
+
+static struct {
+    unsigned short port;
+    int fd;
+    struct gtimer * timer;
+} server = { 0, -1, NULL };
+
+static int server_start(void * user __attribute__((unused))) {
+
+    gtimer_close(server.timer);
+    server.timer = NULL;
+
+    server.fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(server.fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(server.port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(server.fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 || listen(server.fd, 1) < 0) {
+        perror("listen");
+        return -1;
+    }
+    return 0;
+}
+
+static int server_timer_close(void * user __attribute__((unused))) {
+
+    return -1;
+}
+
+static int check_options(int fd) {
+
+    int nodelay = 0;
+    int size = 0;
+    socklen_t len = sizeof(nodelay);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, &len) < 0 || !nodelay) {
+        return -1;
+    }
+    len = sizeof(size);
+    // the kernel doubles the requested size
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &len) < 0 || size > 4 * TCP_SEND_BUFFER_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+static int test_late_server(void) {
+
+    if (reserve_port(&server.port) < 0) {
+        return -1;
+    }
+
+    GTIMER_CALLBACKS timer_callbacks = {
+            .fp_read = server_start,
+            .fp_close = server_timer_close,
+            .fp_register = gpoll_register_fd,
+            .fp_remove = gpoll_remove_fd,
+    };
+    server.timer = gtimer_start(NULL, SERVER_DELAY, &timer_callbacks);
+    if (server.timer == NULL) {
+        return -1;
+    }
+
+    memset(&result, 0x00, sizeof(result));
+    clock_gettime(CLOCK_MONOTONIC, &result.start);
+
+    if (tcp_connect_async(htonl(INADDR_LOOPBACK), server.port, NULL, &callbacks) < 0) {
+        return -1;
+    }
+    if (!result.called) {
+        loop();
+    }
+
+    int ret = 0;
+
+    // attempts at 0, 100 and 300ms: the third one succeeds
+    unsigned int expected = TCP_CONNECT_BACKOFF * 3;
+    if (!result.called || result.fd < 0 || result.time < expected || result.time > expected + 100000) {
+        fprintf(stderr, "test failed: late server (fd=%d, time=%uus, expected=%uus)\n", result.fd, result.time,
+                expected);
+        ret = -1;
+    } else if (check_options(result.fd) < 0) {
+        fprintf(stderr, "test failed: socket options\n");
+        ret = -1;
+    } else {
+        printf("late server: connected after %uus\n", result.time);
+    }
+
+    if (result.fd >= 0) {
+        tcp_close(result.fd);
+    }
+    if (server.fd >= 0) {
+        close(server.fd);
+        server.fd = -1;
+    }
+
+    return ret;
+}
+
+static int test_no_server(void) {
+
+    if (reserve_port(&server.port) < 0) {
+        return -1;
+    }
+
+    memset(&result, 0x00, sizeof(result));
+    clock_gettime(CLOCK_MONOTONIC, &result.start);
+
+    if (tcp_connect_async(htonl(INADDR_LOOPBACK), server.port, NULL, &callbacks) < 0) {
+        return -1;
+    }
+    if (!result.called) {
+        loop();
+    }
+
+    // sum of the backoff delays between the attempts
+    unsigned int expected = 0;
+    unsigned int backoff = TCP_CONNECT_BACKOFF;
+    unsigned int i;
+    for (i = 1; i < TCP_CONNECT_RETRIES; ++i) {
+        expected += backoff;
+        backoff = (backoff * 2 > TCP_CONNECT_BACKOFF_MAX) ? TCP_CONNECT_BACKOFF_MAX : backoff * 2;
+    }
+
+    if (!result.called || result.fd != -1 || result.time < expected || result.time > expected + 200000) {
+        fprintf(stderr, "test failed: no server (fd=%d, time=%uus, expected=%uus)\n", result.fd, result.time,
+                expected);
+        return -1;
+    }
+
+    if (nb_fds != 0) {
+        fprintf(stderr, "test failed: %u file descriptors left registered\n", nb_fds);
+        return -1;
+    }
+
+    printf("no server: gave up after %uus\n", result.time);
+
+    return 0;
+}
+
+/*
+ * A listening socket with a full accept queue: the kernel drops the connection requests.
+ */
+static int test_unresponsive_server(void) {
+
+    if (reserve_port(&server.port) < 0) {
+        return -1;
+    }
+
+    server.fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(server.port),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(server.fd, (struct sockaddr *) &sa, sizeof(sa)) < 0 || listen(server.fd, 0) < 0) {
+        perror("listen");
+        close(server.fd);
+        server.fd = -1;
+        return -1;
+    }
+
+    // fill the accept queue
+    int filler = socket(AF_INET, SOCK_STREAM, 0);
+    if (filler < 0 || connect(filler, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+        perror("connect");
+        close(server.fd);
+        server.fd = -1;
+        return -1;
+    }
+
+    memset(&result, 0x00, sizeof(result));
+    clock_gettime(CLOCK_MONOTONIC, &result.start);
+
+    if (tcp_connect_async(htonl(INADDR_LOOPBACK), server.port, NULL, &callbacks) < 0) {
+        return -1;
+    }
+    if (!result.called) {
+        loop();
+    }
+
+    close(filler);
+    close(server.fd);
+    server.fd = -1;
+
+    // each attempt times out, plus the backoff delays between the attempts
+    unsigned int expected = TCP_CONNECT_RETRIES * TCP_CONNECT_TIMEOUT;
+    unsigned int backoff = TCP_CONNECT_BACKOFF;
+    unsigned int i;
+    for (i = 1; i < TCP_CONNECT_RETRIES; ++i) {
+        expected += backoff;
+        backoff = (backoff * 2 > TCP_CONNECT_BACKOFF_MAX) ? TCP_CONNECT_BACKOFF_MAX : backoff * 2;
+    }
+
+    if (!result.called || result.fd != -1 || result.time < expected || result.time > expected + 200000) {
+        fprintf(stderr, "test failed: unresponsive server (fd=%d, time=%uus, expected=%uus)\n", result.fd,
+                result.time, expected);
+        return -1;
+    }
+
+    if (nb_fds != 0) {
+        fprintf(stderr, "test failed: %u file descriptors left registered\n", nb_fds);
+        return -1;
+    }
+
+    printf("unresponsive server: gave up after %uus\n", result.time);
+
+    return 0;
+}
+
+int main(int argc __attribute__((unused)), char * argv[] __attribute__((unused))) {
+
+    int ret = 0;
+
+    if (test_late_server() < 0) {
+        ret = -1;
+    }
+
+    if (test_no_server() < 0) {
+        ret = -1;
+    }
+
+    if (test_unresponsive_server() < 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        printf("all tests passed\n");
+    }
+
+    return ret;
+}
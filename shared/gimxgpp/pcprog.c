@@ -10,6 +10,7 @@
 #include <windows.h>
 #endif
 #include <gimxfile/include/gfile.h>
+#include <gimxtime/include/gtime.h>
 
 #define USB_IDS_FILE "gpp.txt"
 
@@ -116,6 +117,9 @@ typedef struct
   struct ghid_device * device;
   char * path;
   unsigned int pending;
+  gtime write_start;
+  uint64_t write_total; // us
+  GCAPI_WRITE_STATS write_stats;
   GHID_READ_CALLBACK fp_read;
   GHID_WRITE_CALLBACK fp_write;
   GHID_CLOSE_CALLBACK fp_close;
@@ -138,6 +142,21 @@ static inline int check_device(int device, const char * file, unsigned int line,
     return retValue; \
   }
 
+static void update_write_stats(s_gpp_device * device)
+{
+  gtime now = gtime_gettime();
+  unsigned int elapsed = GTIME_USEC(now - device->write_start);
+
+  device->write_total += elapsed;
+  ++device->write_stats.count;
+  device->write_stats.last = elapsed;
+  device->write_stats.average = device->write_total / device->write_stats.count;
+  if (elapsed > device->write_stats.max)
+  {
+    device->write_stats.max = elapsed;
+  }
+}
+
 static int8_t gpppcprog_send(int id, uint8_t type, uint8_t * data, uint16_t length)
 {
   CHECK_DEVICE(id, -1)
@@ -159,6 +178,8 @@ static int8_t gpppcprog_send(int id, uint8_t type, uint8_t * data, uint16_t leng
   uint16_t sndLen;
   uint16_t i = 0;
 
+  devices[id].write_start = gtime_gettime();
+
   do
   {
     if (length)
@@ -181,6 +202,10 @@ static int8_t gpppcprog_send(int id, uint8_t type, uint8_t * data, uint16_t leng
     report.header.first = 0;
   }
   while (i < length);
+  if(!devices[id].fp_write)
+  {
+    update_write_stats(devices + id);
+  }
   return 1;
 }
 
@@ -256,6 +281,9 @@ int8_t gppcprog_connect(int id, const char * path)
     return -1;
   }
 
+  devices[id].write_total = 0;
+  memset(&devices[id].write_stats, 0x00, sizeof(devices[id].write_stats));
+
   // Enter Capture Mode
   r = gpppcprog_send(id, GPPKG_ENTER_CAPTURE, NULL, 0);
   if (r <= 0)
@@ -340,6 +368,10 @@ static int write_callback(void * user, int transfered)
   if (device->pending > 0)
   {
     --device->pending;
+    if (device->pending == 0)
+    {
+      update_write_stats(device);
+    }
   }
   if(device->fp_write)
   {
@@ -384,6 +416,15 @@ int8_t gpppcprog_start_async(int id, const GHID_CALLBACKS * callbacks)
   return 0;
 }
 
+int8_t gpppcprog_get_write_stats(int id, GCAPI_WRITE_STATS * stats)
+{
+  CHECK_DEVICE(id, -1)
+
+  *stats = devices[id].write_stats;
+
+  return 0;
+}
+
 int8_t gpppcprog_output(int id, int8_t output[GCAPI_OUTPUT_TOTAL])
 {
   CHECK_DEVICE(id, -1)
@@ -263,6 +263,18 @@ typedef struct
   const char * name;
 } GCAPI_USB_IDS;
 
+/* Write Statistics
+ *  Completion times of the output reports, from the write request
+ *  to the write acknowledgement, in microseconds.
+ */
+typedef struct
+{
+  unsigned int count;
+  unsigned int last;
+  unsigned int average;
+  unsigned int max;
+} GCAPI_WRITE_STATS;
+
 /* -------------------------------------------------------------------------- */
 /*   FUNCTIONS PROTOTYPES                                                     */
 /* -------------------------------------------------------------------------- */
@@ -279,5 +291,6 @@ void gppcprog_disconnect(int id);
 int8_t gpppcprog_input(int id, GCAPI_REPORT * report, int timeout);
 int8_t gpppcprog_output(int id, int8_t output[GCAPI_OUTPUT_TOTAL]);
 int8_t gpppcprog_start_async(int id, const GHID_CALLBACKS * callbacks);
+int8_t gpppcprog_get_write_stats(int id, GCAPI_WRITE_STATS * stats);
 
 #endif